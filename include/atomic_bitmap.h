@@ -0,0 +1,34 @@
+#ifndef _ATOMIC_BITMAP_H_
+#define _ATOMIC_BITMAP_H_
+
+#include <cstdint>
+
+/******************************************************************************
+* SECTION: 无锁位图
+* 在已有的位图内存上按 64 位字原子操作: fetch_or 认领空闲位, 被其他线程抢先时按
+* 返回的新值继续找; 释放用 fetch_and. 小端下字内第 i 位即第 i / 8 字节的第 i % 8 位,
+* 与磁盘上按字节排列的位图一致. 位图须 8 字节对齐, 长度按字向上取整后仍在缓冲区内
+*******************************************************************************/
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "bitmap words assume little endian");
+
+class AtomicBitmap {
+public:
+    typedef uint64_t __attribute__((may_alias)) Word;
+
+    AtomicBitmap(uint8_t* map, uint32_t nbits) : words((Word*)map), nbits(nbits) {}
+
+    // 从 start 起向后 (到尾后回绕) 认领一个空闲位, 返回位号; 没有空闲位返回 -1
+    int64_t claim(uint32_t start);
+    bool release(uint32_t bit);                     // 返回该位原先是否已置位
+    void set_range(uint32_t start, uint32_t len);   // 调用者已独占这些位 (如空闲区间分配器切出的块)
+
+    bool test(uint32_t bit) const {
+        return (__atomic_load_n(&words[bit / 64], __ATOMIC_RELAXED) >> (bit % 64)) & 1;
+    }
+
+private:
+    Word* words;
+    uint32_t nbits;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef _BLOCK_DEVICE_H_
+#define _BLOCK_DEVICE_H_
+
+#include "types.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/******************************************************************************
+* SECTION: 块设备后端
+* FileSystem 只通过 driver_read/driver_write 访问设备, 二者再经由 BlockDevice.
+* 所有接口的偏移与长度均须按 io_unit() 对齐, 非对齐部分由 driver_* 负责 RMW.
+* 返回 MYFS_ERROR_NONE 或 -MYFS_ERROR_IO.
+*******************************************************************************/
+
+// 批量请求中的一项: 设备上连续、内存中可分散
+struct BlockIo {
+    off_t offset;
+    const struct iovec* iov;
+    int iovcnt;
+    bool write;
+};
+
+// 预分配的定长 IO 缓冲区池: 一段页对齐的匿名映射切成等长槽位, 线程安全.
+// 槽位数固定, 内存占用可预期; 供 O_DIRECT 反弹缓冲与 io_uring 固定缓冲区使用
+class BufferPool {
+public:
+    BufferPool(size_t buf_size, unsigned count);
+    ~BufferPool();
+
+    bool valid() const { return base != nullptr; }
+    void* get();            // 用尽时返回 nullptr
+    void* get_wait();       // 用尽时等待其他线程归还
+    void put(void* buf);
+
+    // p 起的 len 字节完全落在某个槽位内时返回槽位号, 否则返回 -1
+    int index_of(const void* p, size_t len) const;
+
+    uint8_t* data() const { return base; }
+    size_t buffer_size() const { return buf_size; }
+    unsigned count() const { return buf_count; }
+
+private:
+    uint8_t* base = nullptr;
+    size_t buf_size;
+    unsigned buf_count;
+    std::vector<unsigned> free_slots;
+    std::mutex lock;
+    std::condition_variable returned;
+};
+
+// 设备 IO 计数. 回收线程与 FUSE 工作线程同时下发 IO, 各计数为原子量, 读取时取一份快照
+struct IoCounters {
+    std::atomic<uint64_t> read_cnt{0};
+    std::atomic<uint64_t> write_cnt{0};
+    std::atomic<uint64_t> seek_cnt{0};
+
+    void add_read(uint64_t n = 1) { read_cnt.fetch_add(n, std::memory_order_relaxed); }
+    void add_write(uint64_t n = 1) { write_cnt.fetch_add(n, std::memory_order_relaxed); }
+    void add_seek() { seek_cnt.fetch_add(1, std::memory_order_relaxed); }
+    myfs_io_stats snapshot() const {
+        return { read_cnt.load(std::memory_order_relaxed), write_cnt.load(std::memory_order_relaxed),
+                 seek_cnt.load(std::memory_order_relaxed) };
+    }
+};
+
+class BlockDevice {
+public:
+    virtual ~BlockDevice() = default;
+
+    virtual int open(const char* path) = 0;
+    virtual void close() = 0;
+
+    virtual int read(off_t offset, void* buf, size_t size) = 0;
+    virtual int write(off_t offset, const void* buf, size_t size) = 0;
+
+    // 一次传输设备上连续、内存中分散的多个缓冲区; 默认逐段调用 read/write
+    virtual int readv(off_t offset, const struct iovec* iov, int iovcnt);
+    virtual int writev(off_t offset, const struct iovec* iov, int iovcnt);
+
+    // 批量提交并等待全部完成. 各项互不重叠, 可并发执行且完成顺序不定;
+    // 默认逐项同步执行. 任一项失败返回 -MYFS_ERROR_IO (其余项仍会完成)
+    virtual int submit(const BlockIo* ios, int count);
+
+    // 设备提供的 IO 缓冲区 (io_uring 固定缓冲区 / O_DIRECT 对齐缓冲区), 不支持或用尽时返回 nullptr
+    virtual void* get_io_buffer(size_t size) { return nullptr; }
+    virtual void put_io_buffer(void* buf) {}
+
+    virtual int sync() { return MYFS_ERROR_NONE; }
+
+    // 文件偏移即设备偏移、可供 libfuse 直接 splice 的描述符; 不支持时返回 -1
+    virtual int splice_fd() const { return -1; }
+    // 经 splice_fd 旁路完成的传输也计入 IO 统计
+    void account_external(uint64_t reads, uint64_t writes) {
+        io_stats.add_read(reads);
+        io_stats.add_write(writes);
+    }
+
+    // 整个设备映射到内存时返回映射基址, 调用者可就地读写; 否则返回 nullptr
+    virtual uint8_t* mapped() const { return nullptr; }
+
+    virtual uint64_t size() const = 0;       // 设备容量 (字节)
+    virtual int io_unit() const = 0;         // 单次 IO 最小单位 (字节)
+
+    myfs_io_stats stats() const { return io_stats.snapshot(); }
+    // 设备自身维护的 IO 计数 (ddriver 的 IOC_REQ_DEVICE_STATE), 不支持时返回 false
+    virtual bool device_state(myfs_io_stats* out) { return false; }
+
+protected:
+    IoCounters io_stats;
+};
+
+// ddriver 后端: 每个 io_unit 一次 ddriver_read/ddriver_write, 每段连续传输只 seek 一次
+class DdriverDevice : public BlockDevice {
+public:
+    int open(const char* path) override;
+    void close() override;
+    int read(off_t offset, void* buf, size_t size) override;
+    int write(off_t offset, const void* buf, size_t size) override;
+    int readv(off_t offset, const struct iovec* iov, int iovcnt) override;
+    int writev(off_t offset, const struct iovec* iov, int iovcnt) override;
+    int sync() override;
+    uint64_t size() const override { return dev_size; }
+    int io_unit() const override { return unit; }
+    bool device_state(myfs_io_stats* out) override;
+
+private:
+    int fd = -1;
+    int unit = 512;
+    uint64_t dev_size = 0;
+    std::mutex head_lock;   // seek 与随后的读写须成对执行, 回收线程可能与前台同时访问
+};
+
+// 镜像文件 / 块设备后端: pread/pwrite/preadv/pwritev, 无 seek
+class ImageDevice : public BlockDevice {
+public:
+    ImageDevice();
+
+    int open(const char* path) override;
+    void close() override;
+    int read(off_t offset, void* buf, size_t size) override;
+    int write(off_t offset, const void* buf, size_t size) override;
+    int readv(off_t offset, const struct iovec* iov, int iovcnt) override;
+    int writev(off_t offset, const struct iovec* iov, int iovcnt) override;
+    int sync() override;
+    int splice_fd() const override { return fd; }
+    uint64_t size() const override { return dev_size; }
+    int io_unit() const override { return 512; }
+
+protected:
+    int fd = -1;
+    int open_flags;         // 子类可追加 O_DIRECT 等标志
+    uint64_t dev_size = 0;
+};
+
+// O_DIRECT 镜像后端: 绕过宿主页缓存, 所有传输按设备扇区对齐 (statx DIOALIGN, 缺省 4KB).
+// 未对齐的调用者缓冲区经缓冲池反弹; get_io_buffer 直接分配池中对齐的缓冲区
+class DirectDevice : public ImageDevice {
+public:
+    explicit DirectDevice(unsigned pool_buffers);
+
+    int open(const char* path) override;
+    void close() override;
+    int read(off_t offset, void* buf, size_t size) override;
+    int write(off_t offset, const void* buf, size_t size) override;
+    int readv(off_t offset, const struct iovec* iov, int iovcnt) override;
+    int writev(off_t offset, const struct iovec* iov, int iovcnt) override;
+    void* get_io_buffer(size_t size) override;
+    void put_io_buffer(void* buf) override;
+    int splice_fd() const override { return -1; }   // O_DIRECT 的对齐要求不适合任意偏移的 splice
+    int io_unit() const override { return unit; }
+
+private:
+    bool aligned(const struct iovec* iov, int iovcnt) const;
+    int bounce(off_t offset, const struct iovec* iov, int iovcnt, bool is_write);
+
+    unsigned pool_buffers;
+    int unit = 4096;
+    size_t mem_align = 4096;
+    std::unique_ptr<BufferPool> pool;
+};
+
+// mmap 后端: 整个镜像 MAP_SHARED 映射, 读写即 memcpy, 按字节寻址无需 RMW;
+// 持久化依赖 sync() 中的 msync. 适合能完整放入内存的小镜像
+class MmapDevice : public BlockDevice {
+public:
+    ~MmapDevice() override;
+
+    int open(const char* path) override;
+    void close() override;
+    int read(off_t offset, void* buf, size_t size) override;
+    int write(off_t offset, const void* buf, size_t size) override;
+    int sync() override;
+    uint8_t* mapped() const override { return base; }
+    int splice_fd() const override { return fd; }   // MAP_SHARED 与页缓存一致
+    uint64_t size() const override { return dev_size; }
+    int io_unit() const override { return 1; }
+
+private:
+    int fd = -1;
+    uint8_t* base = nullptr;
+    uint64_t dev_size = 0;
+};
+
+#ifdef MYFS_HAVE_IO_URING
+// io_uring 后端 (镜像文件 / 块设备): 单次 IO 仍走 pread/pwrite, 批量请求同时在途,
+// 队列深度由 --queue-depth 指定; 预注册一组固定缓冲区供 get_io_buffer 分配
+class UringDevice : public ImageDevice {
+public:
+    explicit UringDevice(unsigned queue_depth);
+    ~UringDevice() override;
+
+    int open(const char* path) override;
+    void close() override;
+    int submit(const BlockIo* ios, int count) override;
+    void* get_io_buffer(size_t size) override;
+    void put_io_buffer(void* buf) override;
+
+private:
+    struct Ring;
+    std::unique_ptr<Ring> ring;
+    unsigned depth;
+};
+#endif
+
+// 按名称创建后端: "ddriver" (默认)、"image"、"direct"、"mmap" 或 "uring"; 未知名称返回 nullptr
+std::unique_ptr<BlockDevice> make_block_device(const CustomOptions& opts);
+
+#endif /* _BLOCK_DEVICE_H_ */
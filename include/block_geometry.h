@@ -0,0 +1,104 @@
+#ifndef _BLOCK_GEOMETRY_H_
+#define _BLOCK_GEOMETRY_H_
+
+#include "types.h"
+
+/******************************************************************************
+* SECTION: 块几何策略
+* 块大小在格式化时选定并记入超级块. 每种块大小一个策略类, 热路径按策略实例化,
+* 块号/偏移换算编译为移位与掩码, 每块 inode / 目录项数为编译期常量
+*******************************************************************************/
+template <uint32_t BlkSize>
+struct BlockGeometry {
+    static_assert((BlkSize & (BlkSize - 1)) == 0, "block size must be a power of two");
+    static_assert(BlkSize >= MYFS_SUPER_SIZE && BlkSize <= MYFS_MAX_BLK_SIZE, "unsupported block size");
+
+    static constexpr uint32_t size = BlkSize;
+    static constexpr uint32_t bits = __builtin_ctz(BlkSize);
+    static constexpr uint32_t inodes_per_block = BlkSize / MYFS_INODE_DISK_SIZE;
+    static constexpr uint32_t dentries_per_block = BlkSize / sizeof(struct myfs_dentry_d);
+    static constexpr uint32_t max_file_size = MYFS_DIRECT_BLOCKS * BlkSize;
+
+    static constexpr off_t offset(uint32_t blk) { return (off_t)blk << bits; }       // 块号 -> 设备偏移
+    static constexpr uint32_t index(off_t ofs) { return (uint32_t)(ofs >> bits); }  // 偏移 -> 块序号
+    static constexpr uint32_t within(off_t ofs) { return (uint32_t)(ofs & (BlkSize - 1)); }
+};
+
+using Geometry1K = BlockGeometry<1024>;
+using Geometry4K = BlockGeometry<4096>;
+using Geometry16K = BlockGeometry<16384>;
+
+inline bool myfs_valid_block_size(uint32_t block_size) {
+    return block_size == Geometry1K::size || block_size == Geometry4K::size || block_size == Geometry16K::size;
+}
+
+// 按运行时块大小分派到对应策略; 调用前块大小须已通过 myfs_valid_block_size
+template <typename Fn>
+inline decltype(auto) with_geometry(uint32_t block_size, Fn&& fn) {
+    switch (block_size) {
+    case Geometry1K::size: return fn(Geometry1K{});
+    case Geometry4K::size: return fn(Geometry4K{});
+    default:               return fn(Geometry16K{});
+    }
+}
+
+// 覆盖 data_blks 个数据块所需的去重表块数
+inline uint32_t myfs_dedup_blks(uint32_t block_size, uint64_t data_blks) {
+    return (uint32_t)((data_blks * sizeof(myfs_dedup_entry) + block_size - 1) / block_size);
+}
+
+// 第 g 组的位置由超级块推出; 组描述符表中的位置须与之一致. 格式化、挂载与 myfs-fsck 共用
+inline myfs_group_d myfs_group_layout(const struct myfs_super_d& sb, uint32_t g) {
+    myfs_group_d gd = {};
+    uint32_t first = sb.group_start + g * sb.blocks_per_group;
+    uint32_t end = sb.total_blocks - first < sb.blocks_per_group ? sb.total_blocks : first + sb.blocks_per_group;
+    gd.ibmap_blk = first;
+    gd.dbmap_blk = first + 1;
+    gd.inode_start = first + 2;
+    gd.data_start = gd.inode_start + sb.inode_blks_per_group + sb.dedup_blks_per_group;
+    gd.data_blks = end > gd.data_start ? end - gd.data_start : 0;
+    return gd;
+}
+
+// 校验磁盘超级块的布局是否自洽, 返回 nullptr 或错误原因; 挂载与 myfs-fsck 共用
+inline const char* myfs_check_super(const struct myfs_super_d& sb, uint64_t dev_size) {
+    if (!myfs_valid_block_size(sb.block_size)) return "unsupported block size";
+    const uint64_t bs = sb.block_size;
+    const uint64_t bits_per_blk = bs * 8;
+
+    if (sb.inode_per_block != bs / MYFS_INODE_DISK_SIZE) return "inode_per_block does not match block size";
+    if ((uint64_t)sb.total_blocks * bs > dev_size) return "filesystem is larger than the device";
+    if (sb.group_count == 0 || sb.blocks_per_group == 0 || sb.blocks_per_group > bits_per_blk ||
+        sb.inode_blks_per_group == 0 ||
+        2 + (uint64_t)sb.inode_blks_per_group + sb.dedup_blks_per_group >= sb.blocks_per_group) {
+        return "bad block group geometry";
+    }
+    if (sb.features & ~MYFS_FEATURES_KNOWN) return "unsupported features";
+    uint64_t meta_blks = 2 + (uint64_t)sb.inode_blks_per_group + sb.dedup_blks_per_group;
+    if ((sb.features & MYFS_FEATURE_DEDUP) ?
+        sb.dedup_blks_per_group < myfs_dedup_blks(sb.block_size, myfs_group_layout(sb, 0).data_blks) :
+        sb.dedup_blks_per_group != 0) return "dedup table does not cover the group";
+    if (sb.gdt_start < 1 || (uint64_t)sb.gdt_blks * bs < (uint64_t)sb.group_count * sizeof(myfs_group_d) ||
+        sb.group_start != (uint64_t)sb.gdt_start + sb.gdt_blks) return "bad group descriptor table";
+    if ((uint64_t)sb.group_start + (uint64_t)(sb.group_count - 1) * sb.blocks_per_group +
+        meta_blks >= sb.total_blocks) return "regions overlap or exceed the device";
+    if (sb.inodes_per_group != (uint64_t)sb.inode_blks_per_group * sb.inode_per_block ||
+        sb.inodes_per_group > bits_per_blk ||
+        sb.inode_count != (uint64_t)sb.inodes_per_group * sb.group_count) return "inode count does not match groups";
+
+    uint64_t data_blks = 0;
+    for (uint32_t g = 0; g < sb.group_count; g++) data_blks += myfs_group_layout(sb, g).data_blks;
+    if (data_blks != sb.data_blks) return "data block count does not match groups";
+    if (sb.root_ino >= sb.inode_count) return "root inode out of range";
+    return nullptr;
+}
+
+// 校验组描述符记录的位置, 返回 nullptr 或错误原因. 计数只作放置参考, 不在此校验
+inline const char* myfs_check_group(const struct myfs_super_d& sb, const myfs_group_d& gd, uint32_t g) {
+    myfs_group_d want = myfs_group_layout(sb, g);
+    if (gd.ibmap_blk != want.ibmap_blk || gd.dbmap_blk != want.dbmap_blk || gd.inode_start != want.inode_start ||
+        gd.data_start != want.data_start || gd.data_blks != want.data_blks) return "location does not match the superblock";
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+/******************************************************************************
+* SECTION: LZ 压缩
+* LZ4 块格式的简化实现, 无外部依赖: 每个序列为 token (高 4 位字面量长度, 低 4 位匹配长度 - 4),
+* 长度为 15 时后跟 255 进位的扩展字节, 然后是字面量与 2 字节小端的回溯距离; 最后一个序列只有
+* 字面量. 匹配用 4 字节哈希表查找, 窗口 64KB, 足以覆盖最大的簇 (3 × 16KB)
+*******************************************************************************/
+
+// 压缩 src 到 dst, 返回压缩后的字节数; 超过 cap (即压缩后不够小) 时返回 0
+size_t lz_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap);
+
+// 解压到 dst, 返回解压后的字节数; 数据损坏或超过 cap 时返回 -1
+long lz_decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap);
+
+/******************************************************************************
+* SECTION: 簇缓存
+* 按 (ino, 簇号) 缓存簇解压后的内容, LRU 淘汰. 读命中时不读盘也不解压, 写簇时先取回旧内容
+* 再整簇重写, 命中时省去读改写中的读
+*******************************************************************************/
+class ClusterCache {
+public:
+    void reset(size_t capacity);        // 清空并设定容量 (簇数)
+
+    const std::vector<uint8_t>* find(uint32_t ino, uint32_t idx);
+    void put(uint32_t ino, uint32_t idx, const uint8_t* data, size_t len);
+    void erase(uint32_t ino, uint32_t idx);
+
+private:
+    struct Entry {
+        uint64_t key;
+        std::vector<uint8_t> data;
+    };
+    static uint64_t key_of(uint32_t ino, uint32_t idx) { return (uint64_t)ino << 32 | idx; }
+
+    std::list<Entry> lru;               // 表头为最近使用
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    size_t capacity = 0;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef _EXTENT_ALLOC_H_
+#define _EXTENT_ALLOC_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <utility>
+
+/******************************************************************************
+* SECTION: 空闲区间分配器
+* 由数据位图建立空闲区间索引: 按起点排序的树用于就近查找与合并相邻区间,
+* 按 (长度, 起点) 排序的树用于最佳适配. 块号为设备上的绝对块号, 各组的数据位图
+* 分别加入; 组间隔着元数据块, 区间因此不会跨组. 位图本身仍由调用者维护
+*******************************************************************************/
+class ExtentAllocator {
+public:
+    void add_map(const uint8_t* map, uint32_t nbits, uint32_t base);   // 第 i 位对应块 base + i, 1 表示已占用
+    void clear();
+
+    // 分配至多 want 块的连续区间, 返回起点并由 *got 给出实际块数, 无空间返回 -1.
+    // 依次尝试: goal 所在的空闲区间 (从 goal 起), goal 之后最近的不短于 want 的区间,
+    // 不短于 want 的最短区间, 最长的区间
+    int64_t alloc(uint32_t goal, uint32_t want, uint32_t* got);
+    void free(uint32_t start, uint32_t len);
+
+    uint64_t free_blocks() const { return free_total; }
+    size_t extent_count() const { return by_start.size(); }
+    uint32_t largest() const { return by_size.empty() ? 0 : by_size.rbegin()->first; }
+
+private:
+    using Iter = std::map<uint32_t, uint32_t>::iterator;
+
+    void insert(uint32_t start, uint32_t len);
+    void erase(Iter it);
+    int64_t carve(Iter it, uint32_t start, uint32_t len);   // 从区间 it 中切出 [start, start + len)
+
+    std::map<uint32_t, uint32_t> by_start;              // 起点 -> 长度
+    std::set<std::pair<uint32_t, uint32_t>> by_size;    // (长度, 起点)
+    uint64_t free_total = 0;
+};
+
+#endif
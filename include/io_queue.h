@@ -0,0 +1,31 @@
+#ifndef _IO_QUEUE_H_
+#define _IO_QUEUE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+#include <sys/types.h>
+
+/******************************************************************************
+* SECTION: 写请求队列
+* 批量写回期间 (FileSystem::IoPlug) 各次写入先拷入队列, 按设备偏移排序保存: 与已有区间重叠时
+* 新内容覆盖旧内容, 首尾相接的区间合并为一段. 下发时按偏移升序逐段取出, 一次扫过设备
+*******************************************************************************/
+class IoQueue {
+public:
+    using Extents = std::map<off_t, std::vector<uint8_t>>;     // 起点 -> 内容, 互不重叠也不相接
+
+    void add(off_t offset, const void* buf, size_t size);
+    void clear();
+
+    bool empty() const { return extents.empty(); }
+    size_t bytes() const { return total; }
+    const Extents& pending() const { return extents; }
+
+private:
+    Extents extents;
+    size_t total = 0;
+};
+
+#endif
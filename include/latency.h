@@ -0,0 +1,199 @@
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h>
+#include <sys/stat.h>
+#include "types.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/******************************************************************************
+* SECTION: FUSE 回调延迟统计
+* 每个 myfs_* 回调按操作类型计入对数线性 (HDR 风格) 直方图. 每次回调都计时, 尾部延迟不遗漏;
+* 热路径只读两次时钟 (TSC), 其余都是线程私有的内联读写
+*******************************************************************************/
+
+enum class FuseOp : uint8_t {
+    GETATTR,
+    READDIR,
+    MKDIR,
+    MKNOD,
+    WRITE,
+    READ,
+    UTIMENS,
+    ACCESS,
+    OPEN,
+    OPENDIR,
+    TRUNCATE,
+    UNLINK,
+    RMDIR,
+    RENAME,
+    FSYNC,
+    COPY_RANGE,
+    OP_COUNT
+};
+
+const char* fuse_op_name(FuseOp op);
+
+// 计时热路径上的函数在未优化构建中也内联, 计时开销不随优化级别放大
+#define LATENCY_INLINE      inline __attribute__((always_inline))
+
+// 单调时钟 (vDSO, 不陷入内核)
+static inline uint64_t latency_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// 计时热路径使用的时钟: x86 上为 TSC (需 constant_tsc), 否则退化为 latency_now_ns
+// 刻度与纳秒的换算系数在首次使用时校准
+bool latency_use_tsc();
+double latency_ns_per_tick();
+
+static LATENCY_INLINE uint64_t latency_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (latency_use_tsc()) return __rdtsc();
+#endif
+    return latency_now_ns();
+}
+
+// 对数线性直方图: 每个 2 的幂区间再等分为 16 个子桶, 相对误差 < 6.25%
+class LatencyHistogram {
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int BUCKET_COUNT = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    void record(uint64_t ns);          // 多线程安全
+    void record_local(uint64_t ns);    // 仅限单写者 (线程私有分片), 无锁前缀
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_ns.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_ns.load(std::memory_order_relaxed); }
+    uint64_t percentile(double q) const;   // q ∈ [0, 1], 返回桶上界 (ns)
+
+    static int bucket_of(uint64_t ns);
+    static uint64_t bucket_upper(int idx);
+
+private:
+    std::atomic<uint64_t> buckets[BUCKET_COUNT] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum_ns{0};
+    std::atomic<uint64_t> max_ns{0};
+};
+
+// 报告末尾的核心计数. 目录缓存与调度队列不是线程安全的, 须在核心锁内取一份快照
+struct CoreStatsSnapshot {
+    myfs_io_stats io;
+    bool has_device_state;
+    myfs_io_stats device_state;
+    myfs_sched_stats sched;
+    myfs_cache_stats cache;
+};
+
+// 直接读取核心计数; 调用方持有前端的核心锁, 或独占文件系统 (基准测试 / 重放)
+void core_stats_snapshot(CoreStatsSnapshot* out);
+
+class OpStats {
+public:
+    static LATENCY_INLINE OpStats& Instance() {
+        static OpStats instance;
+        return instance;
+    }
+
+    void set_slow_threshold_us(unsigned us);
+    // 前端注册在核心锁内取快照的函数; 须在 start_dump_thread 之前调用
+    void set_core_snapshot(void (*fn)(CoreStatsSnapshot*)) { core_snapshot = fn; }
+    LATENCY_INLINE bool slow_log_on() const { return slow_threshold_ticks != 0; }
+
+    // 记录一次回调 (计时刻度); dev_io 为该回调期间产生的设备 IO 次数
+    LATENCY_INLINE void record_ticks(FuseOp op, const char* path, uint64_t ticks, uint64_t dev_io);
+
+    // 生成文本报告 (SIGUSR1 与虚拟文件共用)
+    std::string report() const;
+    void reset();
+
+    // SIGUSR1 -> 自管道 -> 后台线程输出到 stderr
+    void start_dump_thread();
+    void stop_dump_thread();
+
+private:
+    OpStats();
+
+    OpStats(const OpStats&) = delete;
+    OpStats& operator=(const OpStats&) = delete;
+
+    // 每个线程一份直方图, 热路径无共享写; 报告时合并
+    struct Shard {
+        LatencyHistogram hist[(int)FuseOp::OP_COUNT];
+    };
+    static inline thread_local Shard* tls_shard = nullptr;     // 常量初始化, 访问不经 TLS 包装函数
+    Shard* new_shard();
+    void slow_op(FuseOp op, const char* path, uint64_t ns, uint64_t dev_io);
+
+    mutable std::mutex shards_lock;
+    std::vector<Shard*> shards;
+
+    void (*core_snapshot)(CoreStatsSnapshot*) = core_stats_snapshot;
+
+    std::atomic<uint64_t> slow_count{0};
+    uint64_t slow_threshold_ticks = 0;         // 0 表示关闭慢操作日志
+    double ns_per_tick = 1.0;
+
+    int dump_pipe[2] = {-1, -1};
+    std::thread dump_thread;
+};
+
+LATENCY_INLINE void OpStats::record_ticks(FuseOp op, const char* path, uint64_t ticks, uint64_t dev_io) {
+    uint64_t ns = (uint64_t)(ticks * ns_per_tick);
+    Shard* shard = tls_shard ? tls_shard : new_shard();
+    shard->hist[(int)op].record_local(ns);
+    if (slow_threshold_ticks != 0 && ticks >= slow_threshold_ticks) {
+        slow_op(op, path, ns, dev_io);
+    }
+}
+
+// 挂载中设备的累计 IO 次数, 供慢操作日志使用
+uint64_t latency_device_io();
+
+// RAII 计时器, 包裹在 myfs_* 回调内. 设备 IO 次数只在慢操作日志开启时读取
+class OpTimer {
+public:
+    LATENCY_INLINE OpTimer(FuseOp op, const char* path)
+        : op(op), path(path), stats(OpStats::Instance()),
+          start_io(stats.slow_log_on() ? latency_device_io() : 0), start_ticks(latency_ticks()) {
+    }
+
+    LATENCY_INLINE ~OpTimer() {
+        uint64_t ticks = latency_ticks() - start_ticks;
+        stats.record_ticks(op, path, ticks, stats.slow_log_on() ? latency_device_io() - start_io : 0);
+    }
+
+private:
+    FuseOp op;
+    const char* path;
+    OpStats& stats;
+    uint64_t start_io;
+    uint64_t start_ticks;
+};
+
+/******************************************************************************
+* SECTION: 虚拟统计文件
+* 读取时生成直方图报告, 不落盘; 两个 FUSE 入口 (myfs / myfs3) 共用
+*******************************************************************************/
+#define MYFS_STATS_PATH      "/.myfs_stats"
+
+bool stats_file_match(const char* path);
+int  stats_file_getattr(struct stat* st);
+int  stats_file_read(char* buf, size_t size, off_t offset);
+
+#endif /* _LATENCY_H_ */
@@ -32,6 +32,11 @@ int   			   myfs_write(const char *, const char *, size_t, off_t,
 					                  struct fuse_file_info *);
 int   			   myfs_read(const char *, char *, size_t, off_t,
 					                 struct fuse_file_info *);
+int   			   myfs_read_buf(const char *, struct fuse_bufvec **, size_t, off_t,
+					                     struct fuse_file_info *);
+int   			   myfs_write_buf(const char *, struct fuse_bufvec *, off_t,
+					                      struct fuse_file_info *);
+int   			   myfs_fsync(const char *, int, struct fuse_file_info *);
 int   			   myfs_access(const char *, int);
 int   			   myfs_unlink(const char *);
 int   			   myfs_rmdir(const char *);
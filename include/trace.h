@@ -0,0 +1,123 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "latency.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+/******************************************************************************
+* SECTION: 操作 trace
+* 挂载时加 --trace=FILE, 每个 myfs_* 回调 (统计文件除外) 结束时追加一条定长记录, 其后紧跟路径.
+* 文件为主机字节序: myfs_trace_head, 然后是 myfs_trace_rec + 路径 的序列. myfs-replay 据此
+* 在本地镜像上重放 (tests/replay)
+*******************************************************************************/
+#define MYFS_TRACE_MAGIC     "MYFSTRC1"
+#define MYFS_TRACE_VERSION   1
+
+struct myfs_trace_head {
+    char magic[8];
+    uint32_t version;
+    uint32_t rec_size;          // sizeof(myfs_trace_rec), 读取时校验
+    uint64_t start_unix_ns;     // 开始记录时的墙上时间
+};
+
+// 各操作的字段:
+//   read / write / copy_file_range: offset、size 为请求的偏移与长度, result 为字节数或 -errno;
+//     copy_file_range 的 path 为 "源\0目标", aux 为目标偏移
+//   readdir: offset 为续读偏移, size 为本次返回的项数
+//   mkdir / mknod: aux 为 mode;  access: aux 为 mask;  fsync: aux 为 datasync
+//   truncate: offset 为新长度;  rename: path 为 "源\0目标", aux 为 flags
+struct myfs_trace_rec {
+    uint64_t start_ns;          // 相对开始记录的时刻
+    uint64_t offset;
+    uint64_t aux;
+    uint32_t size;
+    int32_t result;
+    uint32_t dur_ns;            // 超过 ~4.3s 时截为 UINT32_MAX
+    uint8_t op;                 // FuseOp
+    uint8_t reserved;
+    uint16_t path_len;          // 其后的路径字节数, 不含结尾的 '\0'
+};
+static_assert(sizeof(myfs_trace_rec) == 40, "trace record layout");
+
+// 全局记录器. 各线程的记录由一把锁串行写入带缓冲的文件, 关闭时刷出
+class TraceLog {
+public:
+    static TraceLog& Instance();
+
+    int open(const char* path);     // 成功返回 0, 否则 -errno
+    void close();
+    static bool on() { return active.load(std::memory_order_relaxed); }
+
+    void record(FuseOp op, const char* path, const char* path2, uint64_t start_ns, uint64_t end_ns,
+                uint64_t offset, uint64_t size, uint64_t aux, int64_t result);
+
+private:
+    TraceLog() = default;
+    TraceLog(const TraceLog&) = delete;
+    TraceLog& operator=(const TraceLog&) = delete;
+
+    static std::atomic<bool> active;
+    std::mutex lock;
+    FILE* file = nullptr;
+    uint64_t origin_ns = 0;
+};
+
+// 包裹在 myfs_* 回调内: 构造时取开始时刻, done() 记下结果并原样返回. 未开启 trace 时只有一次判断
+class OpTrace {
+public:
+    OpTrace(FuseOp op, const char* path, uint64_t offset = 0, uint64_t size = 0, uint64_t aux = 0,
+            const char* path2 = nullptr)
+        : op(op), path(path), path2(path2), offset(offset), size(size), aux(aux),
+          start_ns(TraceLog::on() ? latency_now_ns() : 0) {}
+
+    void set_size(uint64_t n) { size = n; }
+
+    template <class T>
+    T done(T result) {
+        if (start_ns) {
+            TraceLog::Instance().record(op, path, path2, start_ns, latency_now_ns(), offset, size, aux,
+                                        (int64_t)result);
+        }
+        return result;
+    }
+
+private:
+    FuseOp op;
+    const char* path;
+    const char* path2;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t aux;
+    uint64_t start_ns;
+};
+
+// 顺序读取 trace 文件
+struct TraceEvent {
+    FuseOp op;
+    uint64_t start_ns;
+    uint32_t dur_ns;
+    int32_t result;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t aux;
+    std::string path;
+    std::string path2;
+};
+
+class TraceReader {
+public:
+    ~TraceReader();
+    bool open(const char* path, std::string* err);
+    bool next(TraceEvent& ev);      // 读到文件尾或截断的记录时返回 false
+    const myfs_trace_head& head() const { return hdr; }
+
+private:
+    FILE* file = nullptr;
+    myfs_trace_head hdr = {};
+};
+
+#endif /* _TRACE_H_ */
@@ -7,6 +7,7 @@
 #include <cerrno>
 #include <sys/stat.h>
 #include <string> // 引入 string
+#include <unordered_map>
 #include <type_traits> // 用于 static_assert 检查结构体大小
 
 /******************************************************************************
@@ -28,6 +29,9 @@ const int MYFS_ROOT_INO = 0;                // 根目录的 Inode 号
 #define MYFS_ERROR_NOTFOUND    ENOENT       // 文件未找到
 #define MYFS_ERROR_IO          EIO          // IO错误
 #define MYFS_ERROR_INVAL       EINVAL       // 参数无效
+#define MYFS_ERROR_NOMEM       ENOMEM       // 内存不足
+#define MYFS_ERROR_NOTDIR      ENOTDIR      // 不是目录
+#define MYFS_ERROR_NOTEMPTY    ENOTEMPTY    // 目录非空
 
 const int MYFS_MAX_FILE_NAME = 128;         // 最大文件名长度
 const int MYFS_DEFAULT_PERM = 0777;         // 默认权限
@@ -35,10 +39,11 @@ const int MYFS_DEFAULT_PERM = 0777;         // 默认权限
 /******************************************************************************
 * SECTION: EXT2 Lite Parameters (核心参数)
 *******************************************************************************/
-const int MYFS_BLK_SIZE = 1024;             // 块大小 1KB
-const int MYFS_DIRECT_BLOCKS = 6;           // 直接索引块数量 (6KB文件上限)
+const int MYFS_SUPER_SIZE = 1024;           // 磁盘超级块大小, 与块大小无关, 位于第 0 块开头
+const int MYFS_DEF_BLK_SIZE = 1024;         // 默认块大小 1KB; 格式化时可选 4KB / 16KB (见 block_geometry.h)
+const int MYFS_MAX_BLK_SIZE = 16384;
+const int MYFS_DIRECT_BLOCKS = 6;           // 直接索引块数量 (文件上限为 6 块)
 const int MYFS_INODE_DISK_SIZE = 128;       // 磁盘上每个 Inode 的大小
-const int MYFS_INODE_PER_BLOCK = (MYFS_BLK_SIZE / MYFS_INODE_DISK_SIZE); // 每块存8个Inode
 
 // 宏：判断 Inode 模式
 #define MYFS_IS_DIR(pinode)            (S_ISDIR(pinode->mode))
@@ -65,7 +70,40 @@ struct myfs_inode;
 // 命令行参数结构
 struct CustomOptions {
     const char* device;
+    const char* backend;     // 块设备后端: ddriver (默认) / image / direct / mmap / uring
     bool show_help;
+    unsigned slow_op_us;     // 慢操作阈值 (微秒), 0 表示关闭
+    unsigned queue_depth;    // uring 后端队列深度, 0 表示默认值
+    unsigned pool_buffers;   // direct 后端缓冲池槽位数 (每个 64KB), 0 表示默认值
+    unsigned block_size;     // 格式化时的块大小, 0 表示默认值; 已格式化的设备以超级块为准
+    int compress;            // 非 0 时新写入的数据按簇压缩 (已压缩的簇在任何挂载下都可读写)
+    int dedup;               // 非 0 时格式化为带去重表的文件系统; 已格式化的设备以超级块为准
+    unsigned cache_kb;       // inode / dentry 缓存上限 (KB), 0 表示不限
+    const char* trace;       // 非空时把每个回调记入该文件, 供 myfs-replay 重放 (include/trace.h)
+};
+
+// 设备 IO 计数 (每次 ddriver 调用计一次)
+struct myfs_io_stats {
+    uint64_t read_cnt;
+    uint64_t write_cnt;
+    uint64_t seek_cnt;
+};
+
+// 电梯调度: 交给调度的 BlockIo 数与合并后实际下发的传输数, 以及批量写回时入队的写段数; 跨多次挂载累计
+struct myfs_sched_stats {
+    uint64_t requests;
+    uint64_t transfers;
+    uint64_t queued;
+};
+
+// inode / dentry 缓存: 当前载入的数量与估算大小, 回收与重新载入次数跨多次挂载累计
+struct myfs_cache_stats {
+    uint64_t inodes;
+    uint64_t dentries;
+    uint64_t bytes;
+    uint64_t budget;         // 上限 (字节), 0 表示不限
+    uint64_t evictions;
+    uint64_t reloads;
 };
 
 /******************************************************************************
@@ -73,8 +111,9 @@ struct CustomOptions {
 * 包含指针等运行时特有的信息，不直接写入磁盘
 *******************************************************************************/
 
-//内存中的 Inode
-struct myfs_inode {
+//内存中的 Inode. 由 FileSystem 的 inode 表按 ino 持有, 同一 ino 只有一份, 指向它的 dentry 共用.
+//对应磁盘的字段恰好 64 字节且排在最前, 按缓存行对齐后 getattr 只碰一个缓存行
+struct alignas(64) myfs_inode {
     // --- 对应磁盘的数据 ---
     uint32_t ino;
     uint32_t mode;
@@ -86,11 +125,22 @@ struct myfs_inode {
     uint16_t gid;
     uint16_t link_count;
     uint32_t block[MYFS_DIRECT_BLOCKS];
+    uint32_t flags;                            // MYFS_INODE_* 标志
+    uint32_t dir_entries;                      // 目录: 目录项数
     
     // --- 内存特有运行时字段 (不会写盘) ---
-    struct myfs_dentry* dentry = nullptr;      // 反向指向 dentry
-    struct myfs_dentry* first_child = nullptr; 
+    struct myfs_dentry* dentry = nullptr;      // 反向指向 dentry (目录的唯一 dentry; 文件为首个载入它的 dentry)
+    uint32_t dentry_refs = 0;                  // 指向本 inode 的 dentry 数
+    struct myfs_dentry* first_child = nullptr; // 线性目录: 全部子项; 索引目录: 已查找过的子项缓存
+    std::unordered_map<std::string, struct myfs_dentry*> child_by_name;  // first_child 链表的按名索引
+    uint32_t next_cookie = 0;                  // 最近分配给子项的 cookie
+    struct myfs_dentry* rd_resume = nullptr;   // 线性目录 readdir 续读点: 上次因缓冲区满未返回的子项
+    uint32_t rd_resume_after = 0;              // 续读点之前最后返回的 cookie
+    uint32_t dx_cookie = 0;                    // 转为索引目录时最后分配的 cookie, 供此前的线性偏移续读
     uint8_t* data_buf = nullptr;               // 数据缓冲区
+    struct myfs_inode* lru_prev = nullptr;     // inode 缓存的 LRU 链表, 表头为最近用过的
+    struct myfs_inode* lru_next = nullptr;
+    bool rd_listing = false;                   // 线性目录正被分页列举 (上次 readdir 返回了子项)
 }; 
 
 //内存中的 Dentry (目录项)
@@ -98,6 +148,9 @@ struct myfs_dentry {
     std::string fname; 
     uint32_t ino;
     FileType ftype;
+    uint32_t cookie = 0;                       // 父目录内递增, 用作线性目录的 readdir 偏移
+    int32_t slot = -1;                         // 线性目录: 在目录块中的位置 (块序号 * 每块项数 + 块内序号), -1 为尚未写回
+    bool evicted = false;                      // inode 被缓存回收过, 再次载入时计一次重新载入
 
     // --- 目录树指针 ---
     struct myfs_dentry* parent = nullptr;
@@ -109,23 +162,29 @@ struct myfs_dentry {
 struct myfs_super {
     uint32_t magic_num;
     uint32_t block_size;  
+    uint32_t blk_bits;                         // log2(block_size)
     uint32_t total_blocks;
     
-    // 布局信息
-    uint32_t ibmap_start; 
-    uint32_t dbmap_start; 
-    uint32_t inode_start; 
-    uint32_t data_start;  
+    // 布局信息: 块组依次排列在组描述符表之后
+    uint32_t gdt_start;
+    uint32_t gdt_blks;
+    uint32_t group_start;                      // 第 0 组的起始块
+    uint32_t group_count;
+    uint32_t blocks_per_group;
+    uint32_t inodes_per_group;
 
     uint32_t inode_count; 
     uint32_t inode_per_block; 
+
+    uint32_t features;                         // MYFS_FEATURE_* 位
+    uint32_t dedup_blks_per_group;             // 每组去重表块数, 无去重时为 0
     
     // --- 运行时句柄 ---
-    int driver_fd;                             // 磁盘设备文件描述符
     bool is_mounted;
     
-    uint8_t* map_inode = nullptr;              // Inode位图缓存
-    uint8_t* map_data = nullptr;               // 数据块位图缓存
+    uint8_t* map_inode = nullptr;              // 各组 Inode 位图缓存, 每组一块首尾相接
+    uint8_t* map_data = nullptr;               // 各组数据块位图缓存, 同上
+    uint8_t* map_dedup = nullptr;              // 各组去重表缓存, 每组 dedup_blks_per_group 块首尾相接
     
     struct myfs_dentry* root_dentry = nullptr; // 根目录 dentry
 };
@@ -135,7 +194,7 @@ struct myfs_super {
 * 直接用于磁盘读写，大小和布局必须严格固定
 *******************************************************************************/
 
-// 磁盘超级块: 占用 1024 Bytes
+// 磁盘超级块: 占用 1024 Bytes, 不随块大小变化
 struct myfs_super_d {
     uint32_t magic_num;
     uint32_t block_size;
@@ -144,24 +203,46 @@ struct myfs_super_d {
     uint32_t inode_count;
     uint32_t inode_per_block;
 
-    // 区域起始位置和大小
-    uint32_t ibmap_start;
-    uint32_t ibmap_blks;
-    uint32_t dbmap_start;
-    uint32_t dbmap_blks;
-
-    uint32_t inode_start;
-    uint32_t inode_blks;
-    uint32_t data_start;
-    uint32_t data_blks;
+    // 组描述符表与块组. 除最后一组外每组 blocks_per_group 块, 各组 inode 数相同
+    uint32_t gdt_start;
+    uint32_t gdt_blks;
+    uint32_t group_start;
+    uint32_t group_count;
+    uint32_t blocks_per_group;
+    uint32_t inodes_per_group;
+    uint32_t inode_blks_per_group;
+    uint32_t data_blks;             // 各组数据块之和
 
     uint32_t root_ino;
+
+    // 格式化时选定的特性; 旧镜像此处为填充, 读出为 0
+    uint32_t features;
+    uint32_t dedup_blks_per_group;  // 每组去重表块数, 位于 inode 表与数据块之间
     
     // 填充至 1024 字节
-    uint8_t padding[MYFS_BLK_SIZE - (14 * sizeof(uint32_t))]; 
+    uint8_t padding[MYFS_SUPER_SIZE - (16 * sizeof(uint32_t))]; 
 };
 static_assert(sizeof(myfs_super_d) == 1024, "SuperBlock Size Mismatch");
 
+const uint32_t MYFS_FEATURE_DEDUP = 0x1;    // 块级去重: 每组带去重表 (见 myfs_dedup_entry)
+const uint32_t MYFS_FEATURES_KNOWN = MYFS_FEATURE_DEDUP;
+
+// 块组描述符: 占用 32 Bytes. 每组依次为 inode 位图 (1 块) | 数据位图 (1 块) | inode 表 | [去重表] | 数据块,
+// inode 位图第 i 位对应组内第 i 个 inode, 数据位图第 i 位对应 data_start + i
+struct myfs_group_d {
+    uint32_t ibmap_blk;
+    uint32_t dbmap_blk;
+    uint32_t inode_start;
+    uint32_t data_start;
+    uint32_t data_blks;
+
+    // 放置参考: 空闲计数挂载时由位图重新统计, 目录数在卸载时写回
+    uint32_t free_inodes;
+    uint32_t free_blocks;
+    uint32_t dirs;
+};
+static_assert(sizeof(myfs_group_d) == 32, "Group Descriptor Size Mismatch");
+
 // 磁盘 Inode: 占用 128 Bytes
 struct myfs_inode_d {
     uint32_t ino; 
@@ -177,9 +258,11 @@ struct myfs_inode_d {
     uint16_t link_count;
     
     uint32_t block[MYFS_DIRECT_BLOCKS]; 
+    uint32_t flags;
+    uint32_t dir_entries;
     
     // 填充至 128 字节
-    char padding[MYFS_INODE_DISK_SIZE - 56]; 
+    char padding[MYFS_INODE_DISK_SIZE - 64]; 
 }; 
 static_assert(sizeof(myfs_inode_d) == 128, "Inode Disk Size Mismatch");
 
@@ -192,4 +275,52 @@ struct myfs_dentry_d {
     char     fname[MYFS_MAX_FILE_NAME];
 }; 
 
+// 目录索引 (htree): 目录 inode 带 MYFS_INODE_DIR_INDEXED 时 block[0] 为根索引块,
+// 索引块内为按哈希升序的 (hash, blk) 项, 逐层指向下一层索引块或目录项块 (叶子).
+// 叶子与线性目录块格式相同; 同一哈希的目录项总在同一叶子中
+const uint32_t MYFS_INODE_DIR_INDEXED = 0x1;
+const uint32_t MYFS_DX_MAGIC = 0x4D594458;  // 索引块幻数
+const int MYFS_DX_MAX_LEVEL = 3;            // 根块 level 上限
+
+struct myfs_dx_head {
+    uint32_t magic;
+    uint16_t level;       // 0: 各项指向叶子; n: 各项指向第 n-1 层索引块
+    uint16_t count;       // 有效项数
+};
+
+struct myfs_dx_entry {
+    uint32_t hash;        // 子树中最小的哈希; 查找时首项兜底, 不比较
+    uint32_t blk;
+};
+
+// 目录项名字哈希 (FNV-1a), 决定目录项落在哪个叶子
+inline uint32_t myfs_dx_hash(const char* name, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// 压缩簇 (挂载选项 --compress): 普通文件每 MYFS_CLUSTER_BLOCKS 个逻辑块为一簇, 对应 block[] 中
+// 相邻的槽位. 簇压缩后至少能省下一块时, 前 k 个槽位依次为存放压缩数据的块, 其余槽位为
+// MYFS_BLK_COMPRESSED (故簇的末槽位即压缩标记); 否则各槽位照常指向原样存放的块.
+// 压缩数据以 myfs_cluster_head 开头, 解压后不足一簇的部分为零
+const int MYFS_CLUSTER_BLOCKS = 3;
+const uint32_t MYFS_BLK_COMPRESSED = 0xFFFFFFFF;
+static_assert(MYFS_DIRECT_BLOCKS % MYFS_CLUSTER_BLOCKS == 0, "clusters must tile the direct blocks");
+
+struct myfs_cluster_head {
+    uint32_t clen;        // 压缩数据字节数, 不含本头
+};
+
+// 去重表项: 去重表第 i 项对应组内第 i 个数据块. 整块写入的普通文件数据按内容哈希登记,
+// 内容相同的块由多个文件共用, shares 为第一个引用之外的引用数; 只有 shares 为 0 时释放才真正
+// 归还该块. hash 为 0 表示该块不在索引中 (目录块、压缩簇、部分写入的块等), 空闲块的项全为 0
+struct myfs_dedup_entry {
+    uint32_t hash;
+    uint32_t shares;
+};
+
 #endif
\ No newline at end of file
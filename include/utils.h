@@ -2,14 +2,35 @@
 #define _UTILS_H_
 
 #include "types.h"
+#include "block_device.h"
+#include "block_geometry.h"
+#include "extent_alloc.h"
+#include "compress.h"
+#include "io_queue.h"
 #include <fuse.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// FUSE 3 的 filler 多一个 flags 参数: 核心总是填好完整的 stat, 以 FUSE_FILL_DIR_PLUS 供 readdirplus 使用
+#ifdef MYFS_FUSE3
+#define MYFS_FILL(filler, buf, name, st, off)   filler(buf, name, st, off, FUSE_FILL_DIR_PLUS)
+#else
+#define MYFS_FILL(filler, buf, name, st, off)   filler(buf, name, st, off)
+#endif
 
 class FileSystem {
 public:
     static FileSystem& Instance(); 
 
-    void mount(const char* device);
+    int mount(const CustomOptions& opts);
     void umount();
     
     // FUSE 接口
@@ -22,6 +43,9 @@ public:
     // 选做功能的接口声明
     int fuse_write(const char* path, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi);
     int fuse_read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi);
+    int fuse_fsync(const char* path, int datasync, struct fuse_file_info* fi);
+    int fuse_read_buf(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset, struct fuse_file_info* fi);
+    int fuse_write_buf(const char* path, struct fuse_bufvec* buf, off_t offset, struct fuse_file_info* fi);
     int fuse_access(const char* path, int mask);
     int fuse_open(const char* path, struct fuse_file_info* fi);
     int fuse_opendir(const char* path, struct fuse_file_info* fi);
@@ -29,6 +53,21 @@ public:
     int fuse_unlink(const char* path);
     int fuse_rmdir(const char* path);
     int fuse_rename(const char* from, const char* to);
+    ssize_t fuse_copy_file_range(const char* from, off_t off_in, const char* to, off_t off_out, size_t size);
+
+    // 设备 IO 计数, 跨多次挂载累计
+    myfs_io_stats io_stats() const;
+    uint64_t io_count() const {     // 读 + 写次数, 供慢操作日志使用
+        uint64_t n = retired_stats.read_cnt + retired_stats.write_cnt;
+        if (device) {
+            const myfs_io_stats dev = device->stats();
+            n += dev.read_cnt + dev.write_cnt;
+        }
+        return n;
+    }
+    bool device_state(myfs_io_stats* out) const;    // 设备自身的计数, 见 BlockDevice::device_state
+    myfs_cache_stats cache_stats() const;   // inode / dentry 缓存
+    myfs_sched_stats sched_stats() const;   // 写请求队列与电梯调度
 
 private:
     FileSystem(); 
@@ -39,28 +78,265 @@ private:
 
     struct myfs_super super;
     struct CustomOptions options;
+    std::unique_ptr<BlockDevice> device;
+    struct myfs_io_stats retired_stats = {};    // 已卸载设备的 IO 计数
+    bool meta_in_place = false;     // mmap 后端: 位图、inode 表与目录块直接在映射中读写
+    std::vector<myfs_group_d> groups;   // 组描述符表, 卸载时写回; 计数经原子操作增减
+
+    // 每组的分配状态. 位图位经 AtomicBitmap 原子置位/清位; 空闲区间索引按组加锁,
+    // 不同组上的分配互不等待. 位图块的写回按组串行, 后写回的一次总带上此前置上的全部位
+    struct GroupAlloc {
+        ExtentAllocator data_free;  // 组内数据块空闲区间, 挂载时由数据位图建立
+        std::mutex lock;            // 保护 data_free
+        std::mutex flush_lock;
+    };
+    std::unique_ptr<GroupAlloc[]> group_alloc;
+    uint64_t mount_gen = 0;         // 每次挂载加一, 线程的 inode 扫描游标据此失效
+    uint32_t& ino_cursor(uint32_t g);
+
+    // 延迟释放: 操作中释放的数据块先记入 tx_frees, 操作的元数据写出后由 commit_frees 移入回收队列.
+    // 回收时先 sync 设备, 确认不再引用这些块的目录与 inode 已落盘, 再按组一次清位图、写回位图块并
+    // 归还空闲区间; 此前这些块在位图中仍为已占用, 不会被重新分配. 队列攒够一批时由回收线程处理,
+    // 分配时空间不足则当场回收
+    struct Reclaimer {
+        std::mutex lock;            // 保护 queue 与 stop
+        std::condition_variable wake;
+        std::vector<uint32_t> queue;
+        bool stop = false;
+        std::mutex apply_lock;      // 同一时刻只有一批在回收, 空间不足的分配者等在途的一批完成
+        std::thread worker;
+    };
+    std::vector<uint32_t> tx_frees;
+    Reclaimer reclaim;
+    void commit_frees();
+    void queue_frees(std::vector<uint32_t>& blks);     // 移入回收队列并清空 blks
+    bool reclaim_blocks();          // 回收队列中的全部块, 队列为空时返回 false
+    void reclaim_loop();
+    void apply_frees(std::vector<uint32_t>& blks);
+
+    // read_buf 以指向镜像偏移的 fd 缓冲区返回数据, libfuse 在回调返回、核心锁放开之后才 splice.
+    // 这些块在此之前被别的请求释放时先搁置, 不进回收队列, 以免回收后重新分配、写入新内容.
+    // libfuse 在同一线程取下一个请求之前已发出回复: 该线程下次进入核心 (或线程退出) 时解除引用
+    std::unordered_map<uint32_t, uint32_t> splice_pins;    // 块号 -> 引用数, 核心锁内访问
+    std::vector<uint32_t> splice_parked;                   // 引用期间释放的块
+    std::mutex splice_orphan_lock;                         // 保护 splice_orphans
+    std::vector<uint32_t> splice_orphans;                  // 已退出的线程留下的引用
+    std::atomic<bool> splice_orphaned{false};
+    void splice_pin(const std::vector<uint32_t>& blks);    // 记在本线程名下
+    void splice_release();                                 // 解除本线程与已退出线程的引用
+    void splice_unpin(const std::vector<uint32_t>& blks);
+    struct SpliceHeld;                                     // 线程私有的引用表, 析构 (线程退出) 时转为 orphans
+    SpliceHeld& splice_held();
+    void splice_orphan(uint64_t gen, const std::vector<uint32_t>& blks);
+
+    // 就地访问时返回设备偏移在映射中的地址, 否则返回 nullptr
+    uint8_t* in_place(off_t offset) const {
+        return meta_in_place ? device->mapped() + offset : nullptr;
+    }
+    // 第 g 组的 inode / 数据位图块; 就地访问时在映射中, 否则在 super.map_* 的第 g 块
+    uint8_t* ibmap(uint32_t g) const {
+        return meta_in_place ? in_place(blk_ofs(groups[g].ibmap_blk)) : super.map_inode + ((size_t)g << super.blk_bits);
+    }
+    uint8_t* dbmap(uint32_t g) const {
+        return meta_in_place ? in_place(blk_ofs(groups[g].dbmap_blk)) : super.map_data + ((size_t)g << super.blk_bits);
+    }
+    void flush_map(uint32_t g, const uint8_t* map, uint32_t blk);   // 写回第 g 组的一个位图块
+    // 第 g 组的去重表, 紧接在数据块之前; 就地访问时在映射中, 否则在 super.map_dedup 的第 g 段
+    myfs_dedup_entry* dedup_tab(uint32_t g) const {
+        uint32_t start = groups[g].data_start - super.dedup_blks_per_group;
+        return (myfs_dedup_entry*)(meta_in_place ? in_place(blk_ofs(start)) :
+               super.map_dedup + ((size_t)g * super.dedup_blks_per_group << super.blk_bits));
+    }
+
+    uint32_t ino_group(uint32_t ino) const { return ino / super.inodes_per_group; }
+    int data_group(uint32_t blk) const;                 // 数据块所在的组, 不是数据块时返回 -1
+    bool is_data_block(uint32_t blk) const { return data_group(blk) >= 0; }
+    uint32_t pick_group(const myfs_inode* parent, bool is_dir) const;
+
+    off_t blk_ofs(uint32_t blk) const { return (off_t)blk << super.blk_bits; }
+
+    // 一段任意对齐的设备区间; 同一批内各段互不重叠
+    struct IoSeg {
+        off_t offset;
+        void* buf;
+        size_t size;
+    };
 
-    int driver_read(int offset, void* out_content, int size);
-    int driver_write(int offset, void* in_content, int size);
+    int driver_read(off_t offset, void* out_content, size_t size);
+    int driver_write(off_t offset, const void* in_content, size_t size);
+    int driver_read_batch(const IoSeg* segs, int count);    // 各段一起提交, 同时在途
+    int driver_write_batch(const IoSeg* segs, int count);   // 本线程有 IoPlug 时只入队
+    int submit_writes(const IoSeg* segs, int count);        // 立即下发, 不经队列
+    int driver_write_round(const IoSeg* segs, int count);   // 各段互不共享 IO 单位
+
+    // 写请求队列与电梯调度 (io_queue.cpp). 每批 BlockIo 先按设备偏移排序, 方向相同且首尾相接的
+    // 合并为一次多段传输再交给设备. IoPlug 放在批量写回的入口 (sync_inode): 其间本线程的
+    // driver_write_batch 只把各段拷入队列, 最外层 IoPlug 结束时合并后一次下发; 本线程的读先下发
+    // 队列. 与回收线程共用的位图块不经队列 (flush_map), 队列也总在 commit_frees 之前下发完毕
+    struct IoPlug {
+        FileSystem& fs;
+        IoQueue queue;
+        bool outer;
+        explicit IoPlug(FileSystem& fs);
+        ~IoPlug();
+    };
+    struct SchedCounters {
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> transfers{0};
+        std::atomic<uint64_t> queued{0};
+    };
+    SchedCounters sched;
+    int dispatch(std::vector<BlockIo>& ios);
+    bool queue_writes(const IoSeg* segs, int count);        // 本线程有 IoPlug 时入队并返回 true
+    int unplug(IoQueue& queue);
+    void flush_plug();
+
+    void pack_super(struct myfs_super_d& super_d) const;
+    void group_meta_segs(std::vector<uint8_t>& gdt_buf, std::vector<IoSeg>& segs);
     
-    void clear_bit(uint8_t* map, int index);
     void free_data_block(int blk_no);
 
     void release_inode(myfs_inode* inode);
+    void drop_link(myfs_dentry* dentry);        // 删除目录项时去掉它对 inode 的引用与链接, 都为零时才释放
     int delete_dentry(myfs_inode* parent, myfs_dentry* child);
+    bool detach_child(myfs_inode* dir, myfs_dentry* child);
+    void replace_child(myfs_inode* dir, myfs_dentry* old_child, myfs_dentry* child);
+
+    // 文件内一段设备上物理连续的区间; dev_off < 0 表示空洞, req_off 为相对请求起点的偏移
+    struct FileRun {
+        off_t dev_off;
+        size_t req_off;
+        size_t len;
+    };
+    int map_file_range(myfs_inode* inode, off_t offset, size_t size, bool create, std::vector<FileRun>& runs);
+    template <class G>
+    int map_file_range(myfs_inode* inode, off_t offset, size_t size, bool create, std::vector<FileRun>& runs);
+    void finish_write(myfs_inode* inode, off_t offset, size_t size);
+
+    // 压缩簇 (cluster_io.cpp). clustered 的文件按整簇读写与截断, 其余文件仍走 map_file_range
+    ClusterCache cluster_cache;
+    static bool cluster_compressed(const myfs_inode* inode, int c) {
+        return inode->block[(c + 1) * MYFS_CLUSTER_BLOCKS - 1] == MYFS_BLK_COMPRESSED;
+    }
+    static bool has_compressed(const myfs_inode* inode);
+    bool clustered(const myfs_inode* inode) const;
+    int load_cluster(myfs_inode* inode, int c, uint8_t* out);
+    int store_cluster(myfs_inode* inode, int c, uint8_t* data, size_t valid);
+    int cluster_read(myfs_inode* inode, char* buf, size_t size, off_t offset);
+    int cluster_write(myfs_inode* inode, const char* buf, size_t size, off_t offset);
+    int cluster_truncate(myfs_inode* inode, off_t size);
+
+    // 块级去重 (dedup.cpp). 去重表常驻内存, 改动过的表块记入 dedup_dirty, 由 flush_dedup 一起写回;
+    // dedup_index 按内容哈希找候选块, 挂载时由去重表建立. 在索引中的块内容不再改写, 要改写先移出索引
+    std::unordered_multimap<uint32_t, uint32_t> dedup_index;
+    std::set<uint32_t> dedup_dirty;
+    bool dedup_on() const { return super.features & MYFS_FEATURE_DEDUP; }
+    myfs_dedup_entry& dedup_entry(uint32_t blk);
+    void dedup_touch(uint32_t blk);                     // blk 的表项所在的表块待写回
+    void dedup_build_index();
+    void flush_dedup();
+    bool dedup_shared(uint32_t blk);
+    bool dedup_release(uint32_t blk);                   // 去掉一个引用, 块仍被引用时返回 true
+    void dedup_forget(uint32_t blk);                    // 移出索引, 此后可原地改写
+    int64_t dedup_lookup(uint32_t hash, const uint8_t* data, uint32_t skip = 0);
+    int own_block(myfs_inode* inode, int idx);
+    int dedup_write(myfs_inode* inode, const char* buf, size_t size, off_t offset);
+    void dedup_clone(myfs_inode* src, int in, myfs_inode* dst, int out, int n);
 
-    int alloc_data_block();
+    int64_t take_extent(uint32_t goal, uint32_t want, uint32_t* got, uint32_t* group);
+    int alloc_data_blocks(uint32_t goal, uint32_t want, uint32_t* got, bool zero_fill = true);
+    int alloc_data_block(uint32_t goal = 0);
+    uint32_t data_goal(const myfs_inode* inode, int idx) const;
     int get_block(myfs_inode* inode, int logical_block_idx, bool create);
 
-    void sync_inode(myfs_inode* inode);
-    myfs_inode* read_inode(uint32_t ino);
-    myfs_inode* alloc_inode(myfs_dentry* dentry, bool is_dir);
+    // 格式化时按块大小规划布局; 目录块与目录项链表之间的转换
+    template <class G> int format_layout();
+    template <class G> void pack_dir_blocks(myfs_inode* inode, std::byte* scratch, std::vector<IoSeg>& segs);
+    template <class G> void load_dir_blocks(myfs_inode* inode);
+
+    void sync_inode(myfs_inode* inode);     // 连同已载入的子项递归写回
+    void write_inode(myfs_inode* inode);    // 只写回本 inode, 线性目录连同目录块
+    void write_dir_slots(myfs_inode* dir, const int* slots, int count);    // 线性目录只写回这些槽位所在的块
+    void pack_inode_record(const myfs_inode* inode, myfs_inode_d& buf, std::vector<IoSeg>& segs);
+    int dir_free_slot(const myfs_inode* dir) const;
+    myfs_inode* load_inode(myfs_dentry* dentry);     // 已在 inode 表中则共用, 否则读盘; 结果挂到 dentry
+    myfs_inode* build_inode(const myfs_inode_d& inode_d, myfs_dentry* dentry);
+    void prefetch_inodes(std::vector<myfs_dentry*>& children);
+    void fill_stat(const myfs_inode* inode, struct stat* st);
+    myfs_inode* alloc_inode(myfs_dentry* dentry, bool is_dir, const myfs_inode* parent);
     
     myfs_dentry* new_dentry(std::string fname, FileType ftype);
+    void link_child(myfs_inode* dir, myfs_dentry* child);
     int alloc_dentry(myfs_inode* parent, myfs_dentry* dentry);
     myfs_dentry* lookup(const std::string& path, bool* is_find, bool* is_root);
 
-    int get_inode_disk_offset(uint32_t ino);
+    // inode / dentry 缓存 (inode_cache.cpp). 载入的 inode 按使用先后串成 LRU 链表, 最外层操作结束时
+    // 估算的占用超过 --cache-kb 则自表尾回收: 不是根、没有已载入子项的 inode 连同其子项 dentry 释放,
+    // 之后经 ino 重新载入. 元数据随操作写穿, 操作之间内存中的 inode 总是干净的
+    struct InodeCache {
+        myfs_inode* head = nullptr;
+        myfs_inode* tail = nullptr;
+        uint64_t inodes = 0;
+        uint64_t dentries = 0;
+        uint64_t evictions = 0;
+        uint64_t reloads = 0;
+    };
+    InodeCache icache;
+    // 按 ino 索引的 inode 表: 每 MYFS_ITAB_CHUNK 个 ino 一段, 段在其中首个 inode 载入时分配,
+    // 段数在挂载时由 inode_count 确定. 载入的 inode 都在表中, 同一 ino 不会载入两份
+    std::vector<std::unique_ptr<myfs_inode*[]>> itab;
+    int op_depth = 0;
+    // 放在每个 fuse_* 入口: 操作中取得的 dentry / inode 指针在操作结束前一直有效
+    struct OpScope {
+        FileSystem& fs;
+        explicit OpScope(FileSystem& fs) : fs(fs) { if (fs.op_depth++ == 0) fs.splice_release(); }
+        ~OpScope() { if (--fs.op_depth == 0) fs.trim_cache(); }
+    };
+    uint64_t cache_bytes() const;
+    void itab_init();
+    myfs_inode* itab_get(uint32_t ino) const;
+    void cache_add(myfs_inode* inode);          // 放入 inode 表与 LRU 表头
+    void attach_inode(myfs_dentry* dentry, myfs_inode* inode);
+    void detach_inode(myfs_dentry* dentry);     // 去掉 dentry 对 inode 的引用, 不释放 inode
+    void cache_insert(myfs_inode* inode);
+    void cache_touch(myfs_inode* inode);
+    void cache_unlink(myfs_inode* inode);
+    // 移出 inode 表并释放, 主 dentry 的指针置空. 调用方保证已没有其他 dentry 指向它
+    void free_inode(myfs_inode* inode);
+    void free_dentry(myfs_dentry* dentry);
+    void free_tree(myfs_dentry* dentry);        // 卸载时释放整棵目录树
+    bool evictable(const myfs_inode* inode) const;
+    void evict(myfs_inode* inode);
+    void drop_bare_children(myfs_inode* dir);
+    void trim_cache();
+
+    off_t get_inode_disk_offset(uint32_t ino);
+    uint32_t inode_table_blk(uint32_t ino) const;       // ino 的记录所在的 inode 表块
+
+    // 单个元数据块的读写; 就地访问时直接使用映射 (dir_index.cpp)
+    uint8_t* meta_read(uint32_t blk, std::vector<uint8_t>& buf);
+    int meta_write(uint32_t blk, const uint8_t* data);
+
+    // 目录索引 (dir_index.cpp). path 为自根向下每层的 (索引块, 所选项)
+    struct DxStep {
+        uint32_t blk;
+        int idx;
+    };
+    static bool is_indexed(const myfs_inode* dir) { return dir->flags & MYFS_INODE_DIR_INDEXED; }
+    static void pack_dentry(myfs_dentry_d& d, const std::string& name, uint32_t ino, bool is_dir);
+    int dx_find_leaf(myfs_inode* dir, uint32_t hash, std::vector<DxStep>& path, uint32_t* leaf);
+    int dx_write_index(uint32_t blk, uint16_t level, const myfs_dx_entry* ents, size_t count);
+    int dx_insert_index(myfs_inode* dir, const std::vector<DxStep>& path, int depth, uint32_t hash, uint32_t blk);
+    bool dx_visit(uint32_t blk, int depth, uint32_t from, const std::function<bool(uint32_t, bool)>& fn);
+    myfs_dentry* dx_lookup(myfs_inode* dir, const std::string& name);
+    myfs_dentry* dx_attach(myfs_inode* dir, const myfs_dentry_d& d);
+    void dx_prefetch(myfs_inode* dir, uint32_t from);
+    int dx_insert(myfs_inode* dir, const std::string& name, uint32_t ino, bool is_dir);
+    int dx_remove(myfs_inode* dir, const std::string& name);
+    int dx_replace(myfs_inode* dir, const std::string& name, uint32_t ino, bool is_dir);
+    int dx_set_slot(myfs_inode* dir, const std::string& name, const myfs_dentry_d* d);
+    int dx_convert(myfs_inode* dir);
+    void dx_free(myfs_inode* dir);
 };
 
 #endif
\ No newline at end of file
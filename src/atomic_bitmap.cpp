@@ -0,0 +1,42 @@
+#include "atomic_bitmap.h"
+#include <algorithm>
+
+int64_t AtomicBitmap::claim(uint32_t start) {
+    const uint32_t nwords = (nbits + 63) / 64;
+    if (nwords == 0) return -1;
+    if (start >= nbits) start = 0;
+
+    // 多扫一轮回到起始字, 以便找回起始字中 start 之前的位
+    for (uint32_t k = 0; k <= nwords; k++) {
+        uint32_t w = (start / 64 + k) % nwords;
+        // 末字中超出 nbits 的位视为已占用; 第一轮的起始字只看 start 之后的位
+        uint64_t busy = 0;
+        if (w == nwords - 1 && nbits % 64) busy |= ~0ULL << (nbits % 64);
+        if (k == 0) busy |= (1ULL << (start % 64)) - 1;
+
+        uint64_t cur = __atomic_load_n(&words[w], __ATOMIC_RELAXED);
+        while ((cur | busy) != ~0ULL) {
+            uint64_t mask = 1ULL << __builtin_ctzll(~(cur | busy));
+            uint64_t old = __atomic_fetch_or(&words[w], mask, __ATOMIC_ACQ_REL);
+            if (!(old & mask)) return (int64_t)w * 64 + __builtin_ctzll(mask);
+            cur = old | mask;   // 被抢先: 按最新值在本字内继续找
+        }
+    }
+    return -1;
+}
+
+bool AtomicBitmap::release(uint32_t bit) {
+    uint64_t mask = 1ULL << (bit % 64);
+    return __atomic_fetch_and(&words[bit / 64], ~mask, __ATOMIC_ACQ_REL) & mask;
+}
+
+void AtomicBitmap::set_range(uint32_t start, uint32_t len) {
+    while (len > 0) {
+        uint32_t off = start % 64;
+        uint32_t n = std::min<uint32_t>(len, 64 - off);
+        uint64_t mask = (n == 64 ? ~0ULL : ((1ULL << n) - 1)) << off;
+        __atomic_fetch_or(&words[start / 64], mask, __ATOMIC_RELEASE);
+        start += n;
+        len -= n;
+    }
+}
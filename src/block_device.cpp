@@ -0,0 +1,706 @@
+#include "block_device.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#ifdef MYFS_HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+extern "C" {
+    #include "ddriver.h"
+}
+
+// =================================================================
+// BlockDevice 默认的向量化实现
+// =================================================================
+
+int BlockDevice::readv(off_t offset, const struct iovec* iov, int iovcnt) {
+    for (int i = 0; i < iovcnt; i++) {
+        int ret = read(offset, iov[i].iov_base, iov[i].iov_len);
+        if (ret != MYFS_ERROR_NONE) return ret;
+        offset += iov[i].iov_len;
+    }
+    return MYFS_ERROR_NONE;
+}
+
+int BlockDevice::writev(off_t offset, const struct iovec* iov, int iovcnt) {
+    for (int i = 0; i < iovcnt; i++) {
+        int ret = write(offset, iov[i].iov_base, iov[i].iov_len);
+        if (ret != MYFS_ERROR_NONE) return ret;
+        offset += iov[i].iov_len;
+    }
+    return MYFS_ERROR_NONE;
+}
+
+int BlockDevice::submit(const BlockIo* ios, int count) {
+    int err = MYFS_ERROR_NONE;
+    for (int i = 0; i < count; i++) {
+        const BlockIo& io = ios[i];
+        int ret;
+        if (io.iovcnt == 1) {
+            ret = io.write ? write(io.offset, io.iov[0].iov_base, io.iov[0].iov_len)
+                           : read(io.offset, io.iov[0].iov_base, io.iov[0].iov_len);
+        } else {
+            ret = io.write ? writev(io.offset, io.iov, io.iovcnt) : readv(io.offset, io.iov, io.iovcnt);
+        }
+        if (ret != MYFS_ERROR_NONE) err = ret;
+    }
+    return err;
+}
+
+// =================================================================
+// BufferPool
+// =================================================================
+
+BufferPool::BufferPool(size_t buf_size, unsigned count) : buf_size(buf_size), buf_count(count) {
+    void* p = mmap(nullptr, buf_size * count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return;
+    base = (uint8_t*)p;
+    for (unsigned i = count; i > 0; i--) free_slots.push_back(i - 1);
+}
+
+BufferPool::~BufferPool() {
+    if (base) munmap(base, buf_size * buf_count);
+}
+
+void* BufferPool::get() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (free_slots.empty()) return nullptr;
+    unsigned idx = free_slots.back();
+    free_slots.pop_back();
+    return base + (size_t)idx * buf_size;
+}
+
+void* BufferPool::get_wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    returned.wait(guard, [this] { return !free_slots.empty(); });
+    unsigned idx = free_slots.back();
+    free_slots.pop_back();
+    return base + (size_t)idx * buf_size;
+}
+
+void BufferPool::put(void* buf) {
+    int idx = index_of(buf, 1);
+    if (idx < 0) return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        free_slots.push_back((unsigned)idx);
+    }
+    returned.notify_one();
+}
+
+int BufferPool::index_of(const void* p, size_t len) const {
+    const uint8_t* b = (const uint8_t*)p;
+    if (!base || b < base || b >= base + buf_size * buf_count) return -1;
+    size_t idx = (size_t)(b - base) / buf_size;
+    if (b + len > base + (idx + 1) * buf_size) return -1;
+    return (int)idx;
+}
+
+#define MYFS_DEF_QUEUE_DEPTH    32
+#define MYFS_DEF_POOL_BUFFERS   64
+
+std::unique_ptr<BlockDevice> make_block_device(const CustomOptions& opts) {
+    std::string backend = opts.backend ? opts.backend : "";
+    if (backend.empty() || backend == "ddriver") return std::unique_ptr<BlockDevice>(new DdriverDevice());
+    if (backend == "image") return std::unique_ptr<BlockDevice>(new ImageDevice());
+    if (backend == "direct") {
+        unsigned n = opts.pool_buffers ? opts.pool_buffers : MYFS_DEF_POOL_BUFFERS;
+        return std::unique_ptr<BlockDevice>(new DirectDevice(n));
+    }
+    if (backend == "mmap") return std::unique_ptr<BlockDevice>(new MmapDevice());
+#ifdef MYFS_HAVE_IO_URING
+    if (backend == "uring") {
+        unsigned depth = opts.queue_depth ? opts.queue_depth : MYFS_DEF_QUEUE_DEPTH;
+        return std::unique_ptr<BlockDevice>(new UringDevice(depth));
+    }
+#endif
+    return nullptr;
+}
+
+// =================================================================
+// DdriverDevice
+// =================================================================
+
+int DdriverDevice::open(const char* path) {
+    fd = ddriver_open(const_cast<char*>(path));
+    if (fd < 0) return -MYFS_ERROR_IO;
+
+    int io_sz = 0;
+    if (ddriver_ioctl(fd, IOC_REQ_DEVICE_IO_SZ, &io_sz) == 0 && io_sz > 0) unit = io_sz;
+
+    int dev_sz = 0;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SIZE, &dev_sz);
+    dev_size = (uint64_t)dev_sz;
+    return MYFS_ERROR_NONE;
+}
+
+void DdriverDevice::close() {
+    if (fd < 0) return;
+    ddriver_close(fd);
+    fd = -1;
+}
+
+int DdriverDevice::read(off_t offset, void* buf, size_t size) {
+    struct iovec iov = { buf, size };
+    return readv(offset, &iov, 1);
+}
+
+int DdriverDevice::write(off_t offset, const void* buf, size_t size) {
+    struct iovec iov = { const_cast<void*>(buf), size };
+    return writev(offset, &iov, 1);
+}
+
+// 读写会推进磁盘头, 设备上连续的多段 (电梯调度合并后的一次传输) 只需一次 seek
+int DdriverDevice::readv(off_t offset, const struct iovec* iov, int iovcnt) {
+    std::lock_guard<std::mutex> guard(head_lock);
+    if (ddriver_seek(fd, offset, SEEK_SET) < 0) return -MYFS_ERROR_IO;
+    io_stats.add_seek();
+
+    for (int i = 0; i < iovcnt; i++) {
+        char* p = (char*)iov[i].iov_base;
+        for (size_t done = 0; done < iov[i].iov_len; done += unit) {
+            if (ddriver_read(fd, p + done, unit) < 0) return -MYFS_ERROR_IO;
+            io_stats.add_read();
+        }
+    }
+    return MYFS_ERROR_NONE;
+}
+
+int DdriverDevice::writev(off_t offset, const struct iovec* iov, int iovcnt) {
+    std::lock_guard<std::mutex> guard(head_lock);
+    if (ddriver_seek(fd, offset, SEEK_SET) < 0) return -MYFS_ERROR_IO;
+    io_stats.add_seek();
+
+    for (int i = 0; i < iovcnt; i++) {
+        char* p = (char*)iov[i].iov_base;
+        for (size_t done = 0; done < iov[i].iov_len; done += unit) {
+            if (ddriver_write(fd, p + done, unit) < 0) return -MYFS_ERROR_IO;
+            io_stats.add_write();
+        }
+    }
+    return MYFS_ERROR_NONE;
+}
+
+int DdriverDevice::sync() {
+    return fsync(fd) == 0 ? MYFS_ERROR_NONE : -MYFS_ERROR_IO;
+}
+
+bool DdriverDevice::device_state(myfs_io_stats* out) {
+    struct ddriver_state st = {};
+    std::lock_guard<std::mutex> guard(head_lock);
+    if (fd < 0 || ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE, &st) != 0) return false;
+    out->read_cnt = (uint64_t)st.read_cnt;
+    out->write_cnt = (uint64_t)st.write_cnt;
+    out->seek_cnt = (uint64_t)st.seek_cnt;
+    return true;
+}
+
+// =================================================================
+// ImageDevice
+// =================================================================
+
+ImageDevice::ImageDevice() : open_flags(O_RDWR | O_CLOEXEC) {
+}
+
+int ImageDevice::open(const char* path) {
+    fd = ::open(path, open_flags);
+    if (fd < 0) return -MYFS_ERROR_IO;
+
+    struct stat st;
+    uint64_t bytes = 0;
+    if (fstat(fd, &st) != 0 || (S_ISBLK(st.st_mode) && ioctl(fd, BLKGETSIZE64, &bytes) != 0)) {
+        ::close(fd);
+        fd = -1;
+        return -MYFS_ERROR_IO;
+    }
+    dev_size = S_ISBLK(st.st_mode) ? bytes : (uint64_t)st.st_size;
+    return MYFS_ERROR_NONE;
+}
+
+void ImageDevice::close() {
+    if (fd < 0) return;
+    ::close(fd);
+    fd = -1;
+}
+
+int ImageDevice::read(off_t offset, void* buf, size_t size) {
+    char* p = (char*)buf;
+    while (size > 0) {
+        ssize_t n = pread(fd, p, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -MYFS_ERROR_IO;
+        io_stats.add_read();
+        p += n;
+        offset += n;
+        size -= n;
+    }
+    return MYFS_ERROR_NONE;
+}
+
+int ImageDevice::write(off_t offset, const void* buf, size_t size) {
+    const char* p = (const char*)buf;
+    while (size > 0) {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -MYFS_ERROR_IO;
+        io_stats.add_write();
+        p += n;
+        offset += n;
+        size -= n;
+    }
+    return MYFS_ERROR_NONE;
+}
+
+int ImageDevice::readv(off_t offset, const struct iovec* iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+
+    ssize_t n;
+    do {
+        n = preadv(fd, iov, iovcnt, offset);
+    } while (n < 0 && errno == EINTR);
+    io_stats.add_read();
+
+    if (n == (ssize_t)total) return MYFS_ERROR_NONE;
+    if (n < 0) return -MYFS_ERROR_IO;
+    return BlockDevice::readv(offset, iov, iovcnt);   // 短读: 逐段补齐
+}
+
+int ImageDevice::writev(off_t offset, const struct iovec* iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+
+    ssize_t n;
+    do {
+        n = pwritev(fd, iov, iovcnt, offset);
+    } while (n < 0 && errno == EINTR);
+    io_stats.add_write();
+
+    if (n == (ssize_t)total) return MYFS_ERROR_NONE;
+    if (n < 0) return -MYFS_ERROR_IO;
+    return BlockDevice::writev(offset, iov, iovcnt);
+}
+
+int ImageDevice::sync() {
+    return fdatasync(fd) == 0 ? MYFS_ERROR_NONE : -MYFS_ERROR_IO;
+}
+
+// =================================================================
+// DirectDevice
+// =================================================================
+
+#define DIRECT_BUF_SIZE     (64 * 1024)     // 缓冲池每个槽位的大小
+
+DirectDevice::DirectDevice(unsigned pool_buffers) : pool_buffers(pool_buffers) {
+    open_flags |= O_DIRECT;
+}
+
+int DirectDevice::open(const char* path) {
+    int ret = ImageDevice::open(path);
+    if (ret != MYFS_ERROR_NONE) return ret;
+
+    // 优先使用内核报告的对齐要求, 否则按 4KB (覆盖 512e/4Kn 设备)
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN) &&
+        stx.stx_dio_offset_align != 0) {
+        unit = (int)stx.stx_dio_offset_align;
+        mem_align = stx.stx_dio_mem_align;
+    }
+#endif
+    if (dev_size % unit != 0 || DIRECT_BUF_SIZE % unit != 0) {
+        ImageDevice::close();
+        return -MYFS_ERROR_IO;
+    }
+
+    pool.reset(new BufferPool(DIRECT_BUF_SIZE, pool_buffers));
+    if (!pool->valid()) {
+        pool.reset();
+        ImageDevice::close();
+        return -MYFS_ERROR_IO;
+    }
+    return MYFS_ERROR_NONE;
+}
+
+void DirectDevice::close() {
+    ImageDevice::close();
+    pool.reset();
+}
+
+bool DirectDevice::aligned(const struct iovec* iov, int iovcnt) const {
+    for (int i = 0; i < iovcnt; i++) {
+        if ((uintptr_t)iov[i].iov_base % mem_align != 0 || iov[i].iov_len % unit != 0) return false;
+    }
+    return true;
+}
+
+// 调用者缓冲区未对齐: 逐个池缓冲区大小分片, 在池缓冲区与 iov 之间拷贝.
+// 调用者可能已持有池缓冲区作暂存 (get_io_buffer), 在池上等待会与自己或其他线程互等死锁:
+// 池用尽时改用堆上的对齐缓冲区
+int DirectDevice::bounce(off_t offset, const struct iovec* iov, int iovcnt, bool is_write) {
+    uint8_t* buf = (uint8_t*)pool->get();
+    bool pooled = buf != nullptr;
+    if (!pooled && posix_memalign((void**)&buf, mem_align, DIRECT_BUF_SIZE) != 0) return -MYFS_ERROR_IO;
+    int ret = MYFS_ERROR_NONE;
+    int vi = 0;
+    size_t vofs = 0;
+
+    auto copy = [&](size_t len) {
+        for (size_t done = 0; done < len; ) {
+            size_t n = std::min(len - done, iov[vi].iov_len - vofs);
+            uint8_t* user = (uint8_t*)iov[vi].iov_base + vofs;
+            if (is_write) std::memcpy(buf + done, user, n);
+            else std::memcpy(user, buf + done, n);
+            done += n;
+            vofs += n;
+            if (vofs == iov[vi].iov_len) {
+                vi++;
+                vofs = 0;
+            }
+        }
+    };
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+    for (size_t done = 0; done < total && ret == MYFS_ERROR_NONE; ) {
+        size_t len = std::min(total - done, (size_t)DIRECT_BUF_SIZE);
+        if (is_write) {
+            copy(len);
+            ret = ImageDevice::write(offset + done, buf, len);
+        } else {
+            ret = ImageDevice::read(offset + done, buf, len);
+            if (ret == MYFS_ERROR_NONE) copy(len);
+        }
+        done += len;
+    }
+    if (pooled) pool->put(buf);
+    else free(buf);
+    return ret;
+}
+
+int DirectDevice::read(off_t offset, void* buf, size_t size) {
+    struct iovec iov = { buf, size };
+    return readv(offset, &iov, 1);
+}
+
+int DirectDevice::write(off_t offset, const void* buf, size_t size) {
+    struct iovec iov = { const_cast<void*>(buf), size };
+    return writev(offset, &iov, 1);
+}
+
+int DirectDevice::readv(off_t offset, const struct iovec* iov, int iovcnt) {
+    if (!aligned(iov, iovcnt)) return bounce(offset, iov, iovcnt, false);
+    if (iovcnt == 1) return ImageDevice::read(offset, iov[0].iov_base, iov[0].iov_len);
+    return ImageDevice::readv(offset, iov, iovcnt);
+}
+
+int DirectDevice::writev(off_t offset, const struct iovec* iov, int iovcnt) {
+    if (!aligned(iov, iovcnt)) return bounce(offset, iov, iovcnt, true);
+    if (iovcnt == 1) return ImageDevice::write(offset, iov[0].iov_base, iov[0].iov_len);
+    return ImageDevice::writev(offset, iov, iovcnt);
+}
+
+void* DirectDevice::get_io_buffer(size_t size) {
+    if (!pool || size > pool->buffer_size()) return nullptr;
+    return pool->get();
+}
+
+void DirectDevice::put_io_buffer(void* buf) {
+    if (pool) pool->put(buf);
+}
+
+// =================================================================
+// MmapDevice
+// =================================================================
+
+MmapDevice::~MmapDevice() {
+    close();
+}
+
+int MmapDevice::open(const char* path) {
+    fd = ::open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) return -MYFS_ERROR_IO;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) return -MYFS_ERROR_IO;
+    if (S_ISBLK(st.st_mode)) {
+        uint64_t bytes = 0;
+        if (ioctl(fd, BLKGETSIZE64, &bytes) != 0) return -MYFS_ERROR_IO;
+        dev_size = bytes;
+    } else {
+        dev_size = (uint64_t)st.st_size;
+    }
+    if (dev_size == 0) return -MYFS_ERROR_IO;
+
+    // 小镜像一次性预读, 之后的访问不再缺页
+    void* p = mmap(nullptr, dev_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (p == MAP_FAILED) return -MYFS_ERROR_IO;
+    base = (uint8_t*)p;
+    return MYFS_ERROR_NONE;
+}
+
+void MmapDevice::close() {
+    if (base) {
+        munmap(base, dev_size);
+        base = nullptr;
+    }
+    if (fd < 0) return;
+    ::close(fd);
+    fd = -1;
+}
+
+int MmapDevice::read(off_t offset, void* buf, size_t size) {
+    if ((uint64_t)offset + size > dev_size) return -MYFS_ERROR_IO;
+    std::memcpy(buf, base + offset, size);
+    io_stats.add_read();
+    return MYFS_ERROR_NONE;
+}
+
+int MmapDevice::write(off_t offset, const void* buf, size_t size) {
+    if ((uint64_t)offset + size > dev_size) return -MYFS_ERROR_IO;
+    std::memmove(base + offset, buf, size);     // 就地访问时源与目的可能重叠
+    io_stats.add_write();
+    return MYFS_ERROR_NONE;
+}
+
+int MmapDevice::sync() {
+    return msync(base, dev_size, MS_SYNC) == 0 ? MYFS_ERROR_NONE : -MYFS_ERROR_IO;
+}
+
+#ifdef MYFS_HAVE_IO_URING
+// =================================================================
+// UringDevice: 直接使用 io_uring 系统调用, 不依赖 liburing
+// =================================================================
+
+#define URING_BUF_SIZE      (16 * 1024)     // 每个固定缓冲区的大小
+
+struct UringDevice::Ring {
+    int fd = -1;
+
+    void* sq_ptr = MAP_FAILED;
+    size_t sq_len = 0;
+    void* cq_ptr = MAP_FAILED;
+    size_t cq_len = 0;
+    struct io_uring_sqe* sqes = (struct io_uring_sqe*)MAP_FAILED;
+    size_t sqes_len = 0;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    // 固定缓冲区: 缓冲池的每个槽位注册为一个 buf_index
+    std::unique_ptr<BufferPool> bufs;
+
+    std::mutex submit_lock;     // 环本身不是线程安全的
+
+    ~Ring();
+    int setup(unsigned entries);
+    void register_buffers(unsigned count);
+    int buf_index(const void* p, size_t len) const { return bufs ? bufs->index_of(p, len) : -1; }
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+UringDevice::Ring::~Ring() {
+    if (sqes != MAP_FAILED) munmap(sqes, sqes_len);
+    if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_len);
+    if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_len);
+    if (fd >= 0) ::close(fd);
+}
+
+int UringDevice::Ring::setup(unsigned entries) {
+    struct io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0) return -MYFS_ERROR_IO;
+
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && cq_len > sq_len) sq_len = cq_len;
+
+    sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) return -MYFS_ERROR_IO;
+    if (single_mmap) {
+        cq_ptr = sq_ptr;
+    } else {
+        cq_ptr = mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) return -MYFS_ERROR_IO;
+    }
+    sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe*)mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                      fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return -MYFS_ERROR_IO;
+
+    uint8_t* sq = (uint8_t*)sq_ptr;
+    uint8_t* cq = (uint8_t*)cq_ptr;
+    sq_head = (unsigned*)(sq + p.sq_off.head);
+    sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    sq_array = (unsigned*)(sq + p.sq_off.array);
+    cq_head = (unsigned*)(cq + p.cq_off.head);
+    cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return MYFS_ERROR_NONE;
+}
+
+// 注册失败 (如 RLIMIT_MEMLOCK 不足) 不是错误, 只是不提供固定缓冲区
+void UringDevice::Ring::register_buffers(unsigned count) {
+    std::unique_ptr<BufferPool> pool(new BufferPool(URING_BUF_SIZE, count));
+    if (!pool->valid()) return;
+
+    std::vector<struct iovec> iov(count);
+    for (unsigned i = 0; i < count; i++) {
+        iov[i] = { pool->data() + (size_t)i * URING_BUF_SIZE, URING_BUF_SIZE };
+    }
+    if (sys_io_uring_register(fd, IORING_REGISTER_BUFFERS, iov.data(), count) != 0) return;
+    bufs = std::move(pool);
+}
+
+UringDevice::UringDevice(unsigned queue_depth) : depth(queue_depth) {
+}
+
+UringDevice::~UringDevice() {
+    close();
+}
+
+int UringDevice::open(const char* path) {
+    int ret = ImageDevice::open(path);
+    if (ret != MYFS_ERROR_NONE) return ret;
+
+    ring.reset(new Ring());
+    if (ring->setup(depth) != MYFS_ERROR_NONE) {
+        ring.reset();
+        ImageDevice::close();
+        return -MYFS_ERROR_IO;
+    }
+    ring->register_buffers(depth);
+    return MYFS_ERROR_NONE;
+}
+
+void UringDevice::close() {
+    ring.reset();
+    ImageDevice::close();
+}
+
+void* UringDevice::get_io_buffer(size_t size) {
+    if (!ring || !ring->bufs || size > URING_BUF_SIZE) return nullptr;
+    return ring->bufs->get();
+}
+
+void UringDevice::put_io_buffer(void* buf) {
+    if (ring && ring->bufs) ring->bufs->put(buf);
+}
+
+// 滑动窗口: 保持至多 depth 个请求在途, 每收割一批完成事件就补充提交
+int UringDevice::submit(const BlockIo* ios, int count) {
+    if (count == 1) return BlockDevice::submit(ios, count);
+
+    Ring& r = *ring;
+    std::lock_guard<std::mutex> guard(r.submit_lock);
+
+    int err = MYFS_ERROR_NONE;
+    int next = 0, inflight = 0, done = 0;
+    while (done < count) {
+        unsigned tail = *r.sq_tail;
+        while (next < count && inflight < (int)depth) {
+            const BlockIo& io = ios[next];
+            unsigned idx = tail & r.sq_mask;
+            struct io_uring_sqe* sqe = &r.sqes[idx];
+            std::memset(sqe, 0, sizeof(*sqe));
+            sqe->fd = fd;
+            sqe->off = (uint64_t)io.offset;
+            sqe->user_data = (uint64_t)next;
+
+            int bi = io.iovcnt == 1 ? r.buf_index(io.iov[0].iov_base, io.iov[0].iov_len) : -1;
+            if (bi >= 0) {
+                sqe->opcode = io.write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+                sqe->addr = (uint64_t)(uintptr_t)io.iov[0].iov_base;
+                sqe->len = (unsigned)io.iov[0].iov_len;
+                sqe->buf_index = (uint16_t)bi;
+            } else {
+                sqe->opcode = io.write ? IORING_OP_WRITEV : IORING_OP_READV;
+                sqe->addr = (uint64_t)(uintptr_t)io.iov;
+                sqe->len = (unsigned)io.iovcnt;
+            }
+            r.sq_array[idx] = idx;
+            tail++;
+            next++;
+            inflight++;
+        }
+        __atomic_store_n(r.sq_tail, tail, __ATOMIC_RELEASE);
+
+        // 提交尚未被内核消费的 SQE, 并至少等待一个完成事件
+        unsigned to_submit = tail - __atomic_load_n(r.sq_head, __ATOMIC_ACQUIRE);
+        int ret = sys_io_uring_enter(r.fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+        if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            // 环已不可用: 撤回未被消费的 SQE, 避免下次提交时误发. 已被内核取走的 SQE 仍引用调用者的
+            // iov 与缓冲区, 须等它们全部完成再返回, 否则内核会写入已释放的内存, 迟到的完成事件还会被
+            // 下一次提交按它的 ios 解读. 进入内核等待也失败时只能轮询完成队列
+            unsigned sq_head = __atomic_load_n(r.sq_head, __ATOMIC_ACQUIRE);
+            inflight -= (int)(tail - sq_head);
+            __atomic_store_n(r.sq_tail, sq_head, __ATOMIC_RELEASE);
+            while (inflight > 0) {
+                unsigned ctail = __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE);
+                inflight -= (int)(ctail - *r.cq_head);
+                __atomic_store_n(r.cq_head, ctail, __ATOMIC_RELEASE);
+                if (inflight > 0 && sys_io_uring_enter(r.fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) sched_yield();
+            }
+            return -MYFS_ERROR_IO;
+        }
+
+        unsigned head = *r.cq_head;
+        unsigned ctail = __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != ctail; head++) {
+            const struct io_uring_cqe* cqe = &r.cqes[head & r.cq_mask];
+            const BlockIo& io = ios[cqe->user_data];
+            size_t total = 0;
+            for (int i = 0; i < io.iovcnt; i++) total += io.iov[i].iov_len;
+
+            if (io.write) io_stats.add_write();
+            else io_stats.add_read();
+
+            // 短读写或被中断: 该项整体改为同步重做
+            if (cqe->res != (int)total) {
+                int sync_ret = cqe->res < 0 && cqe->res != -EINTR && cqe->res != -EAGAIN
+                             ? -MYFS_ERROR_IO
+                             : (io.write ? ImageDevice::writev(io.offset, io.iov, io.iovcnt)
+                                         : ImageDevice::readv(io.offset, io.iov, io.iovcnt));
+                if (sync_ret != MYFS_ERROR_NONE) err = sync_ret;
+            }
+            inflight--;
+            done++;
+        }
+        __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+    }
+    return err;
+}
+#endif
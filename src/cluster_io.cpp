@@ -0,0 +1,235 @@
+#include "utils.h"
+#include <algorithm>
+#include <cstring>
+
+// =================================================================
+// 压缩簇
+// 挂载时带 --compress 或文件已有压缩簇时, 普通文件按簇读写: 写入先取回整簇内容 (缓存命中时
+// 不读盘), 改动后整簇压缩重写; 读取时压缩簇经缓存解压, 原样存放的簇仍直接读设备.
+// 簇缓存中总是簇的当前内容: 凡改写簇的路径都同时更新或丢弃缓存项
+// =================================================================
+
+bool FileSystem::has_compressed(const myfs_inode* inode) {
+    for (int c = 0; c < MYFS_DIRECT_BLOCKS / MYFS_CLUSTER_BLOCKS; c++) {
+        if (cluster_compressed(inode, c)) return true;
+    }
+    return false;
+}
+
+bool FileSystem::clustered(const myfs_inode* inode) const {
+    return MYFS_IS_REG(inode) && (options.compress || has_compressed(inode));
+}
+
+// 取回第 c 簇的内容 (一整簇, 空洞与有效数据之后为零)
+int FileSystem::load_cluster(myfs_inode* inode, int c, uint8_t* out) {
+    const size_t bs = super.block_size;
+    const size_t cbytes = MYFS_CLUSTER_BLOCKS * bs;
+    if (const std::vector<uint8_t>* hit = cluster_cache.find(inode->ino, c)) {
+        std::memcpy(out, hit->data(), cbytes);
+        return MYFS_ERROR_NONE;
+    }
+
+    const uint32_t* slot = inode->block + c * MYFS_CLUSTER_BLOCKS;
+    bool packed = cluster_compressed(inode, c);
+    std::vector<uint8_t> raw;
+    uint8_t* dst = out;
+    if (packed) {
+        raw.resize(cbytes);
+        dst = raw.data();
+    } else {
+        std::memset(out, 0, cbytes);
+    }
+
+    // 物理连续的块合并为一段
+    std::vector<IoSeg> segs;
+    int stored = 0;
+    for (int i = 0; i < MYFS_CLUSTER_BLOCKS; i++) {
+        if (slot[i] == 0 || slot[i] == MYFS_BLK_COMPRESSED) continue;
+        off_t off = blk_ofs(slot[i]);
+        uint8_t* buf = dst + (size_t)i * bs;
+        IoSeg* last = segs.empty() ? nullptr : &segs.back();
+        if (last && last->offset + (off_t)last->size == off && (uint8_t*)last->buf + last->size == buf) {
+            last->size += bs;
+        } else {
+            segs.push_back({ off, buf, bs });
+        }
+        stored = i + 1;
+    }
+    if (driver_read_batch(segs.data(), (int)segs.size()) != MYFS_ERROR_NONE) return -MYFS_ERROR_IO;
+
+    if (packed) {
+        myfs_cluster_head head;
+        std::memcpy(&head, dst, sizeof(head));
+        if (stored == 0 || head.clen > stored * bs - sizeof(head)) return -MYFS_ERROR_IO;
+        long n = lz_decompress(dst + sizeof(head), head.clen, out, cbytes);
+        if (n < 0) return -MYFS_ERROR_IO;
+        std::memset(out + n, 0, cbytes - n);
+    }
+    if (packed || options.compress) cluster_cache.put(inode->ino, c, out, cbytes);
+    return MYFS_ERROR_NONE;
+}
+
+// 把整簇内容 (前 valid 字节有效) 写回第 c 簇: 压缩模式下能省下至少一块时压缩存放, 否则原样存放
+// valid 所覆盖的块. 沿用簇原有的块, 不够时在其后分配, 多余的释放; 只改内存中的 inode, 由调用者写回
+int FileSystem::store_cluster(myfs_inode* inode, int c, uint8_t* data, size_t valid) {
+    const size_t bs = super.block_size;
+    const size_t cbytes = MYFS_CLUSTER_BLOCKS * bs;
+    uint32_t* slot = inode->block + c * MYFS_CLUSTER_BLOCKS;
+    std::memset(data + valid, 0, cbytes - valid);
+
+    int need = (int)((valid + bs - 1) >> super.blk_bits);
+    const uint8_t* payload = data;
+    std::vector<uint8_t> packed;
+    if (options.compress && need > 1) {
+        // 压缩数据至多占 need - 1 块, 放不下时 lz_compress 返回 0
+        packed.assign((size_t)(need - 1) * bs, 0);
+        size_t clen = lz_compress(data, valid, packed.data() + sizeof(myfs_cluster_head),
+                                  packed.size() - sizeof(myfs_cluster_head));
+        if (clen > 0) {
+            myfs_cluster_head head = { (uint32_t)clen };
+            std::memcpy(packed.data(), &head, sizeof(head));
+            need = (int)((sizeof(head) + clen + bs - 1) >> super.blk_bits);
+            payload = packed.data();
+        } else {
+            packed.clear();
+        }
+    }
+    bool compressed = !packed.empty();
+
+    // 与其他文件共用的去重块不能改写, 写完后去掉本文件的引用; 沿用的独占块先移出去重索引
+    std::vector<uint32_t> old, shared;
+    for (int i = 0; i < MYFS_CLUSTER_BLOCKS; i++) {
+        if (slot[i] == 0 || slot[i] == MYFS_BLK_COMPRESSED) continue;
+        if (dedup_shared(slot[i])) {
+            shared.push_back(slot[i]);
+        } else {
+            dedup_forget(slot[i]);
+            old.push_back(slot[i]);
+        }
+    }
+
+    uint32_t blks[MYFS_CLUSTER_BLOCKS];
+    int keep = std::min(need, (int)old.size());
+    std::copy(old.begin(), old.begin() + keep, blks);
+    auto undo = [&](int allocated, int err) {
+        for (int j = keep; j < allocated; j++) free_data_block(blks[j]);
+        return err;
+    };
+    for (int i = keep; i < need; ) {
+        // 整块随后写满, 不必先清零
+        uint32_t got;
+        uint32_t goal = i > 0 ? blks[i - 1] + 1 : data_goal(inode, c * MYFS_CLUSTER_BLOCKS);
+        int blk = alloc_data_blocks(goal, need - i, &got, false);
+        if (blk == -1) return undo(i, -MYFS_ERROR_NOSPACE);
+        for (uint32_t k = 0; k < got; k++) blks[i + k] = blk + k;
+        i += got;
+    }
+
+    std::vector<IoSeg> segs;
+    for (int i = 0; i < need; i++) {
+        off_t off = blk_ofs(blks[i]);
+        if (!segs.empty() && segs.back().offset + (off_t)segs.back().size == off) {
+            segs.back().size += bs;
+        } else {
+            segs.push_back({ off, (void*)(payload + (size_t)i * bs), bs });
+        }
+    }
+    if (driver_write_batch(segs.data(), (int)segs.size()) != MYFS_ERROR_NONE) return undo(need, -MYFS_ERROR_IO);
+
+    for (size_t j = need; j < old.size(); j++) free_data_block(old[j]);
+    for (uint32_t b : shared) free_data_block(b);
+    for (int i = 0; i < MYFS_CLUSTER_BLOCKS; i++) {
+        slot[i] = i < need ? blks[i] : (compressed ? MYFS_BLK_COMPRESSED : 0);
+    }
+    if (compressed || options.compress) cluster_cache.put(inode->ino, c, data, cbytes);
+    else cluster_cache.erase(inode->ino, c);
+    return MYFS_ERROR_NONE;
+}
+
+// size 已按文件大小截断
+int FileSystem::cluster_read(myfs_inode* inode, char* buf, size_t size, off_t offset) {
+    const size_t cbytes = (size_t)MYFS_CLUSTER_BLOCKS << super.blk_bits;
+    std::vector<uint8_t> data;
+    std::vector<FileRun> runs;
+    std::vector<IoSeg> segs;
+
+    for (size_t done = 0; done < size; ) {
+        off_t pos = offset + (off_t)done;
+        int c = (int)(pos / cbytes);
+        size_t within = (size_t)(pos % cbytes);
+        size_t len = std::min(size - done, cbytes - within);
+        char* out = buf + done;
+
+        const std::vector<uint8_t>* hit = cluster_cache.find(inode->ino, c);
+        if (hit) {
+            std::memcpy(out, hit->data() + within, len);
+        } else if (cluster_compressed(inode, c)) {
+            data.resize(cbytes);
+            int ret = load_cluster(inode, c, data.data());
+            if (ret != MYFS_ERROR_NONE) return ret;
+            std::memcpy(out, data.data() + within, len);
+        } else {
+            // 原样存放的簇与普通文件相同, 各段一起提交
+            map_file_range(inode, pos, len, false, runs);
+            for (const FileRun& r : runs) {
+                if (r.dev_off < 0) std::memset(out + r.req_off, 0, r.len);
+                else if (uint8_t* src = in_place(r.dev_off)) std::memcpy(out + r.req_off, src, r.len);
+                else segs.push_back({ r.dev_off, out + r.req_off, r.len });
+            }
+        }
+        done += len;
+    }
+    if (driver_read_batch(segs.data(), (int)segs.size()) != MYFS_ERROR_NONE) return -MYFS_ERROR_IO;
+    return (int)size;
+}
+
+int FileSystem::cluster_write(myfs_inode* inode, const char* buf, size_t size, off_t offset) {
+    const size_t cbytes = (size_t)MYFS_CLUSTER_BLOCKS << super.blk_bits;
+    if (offset < 0 || (uint64_t)offset + size > ((uint64_t)MYFS_DIRECT_BLOCKS << super.blk_bits)) {
+        return -MYFS_ERROR_NOSPACE;
+    }
+    uint64_t new_size = std::max<uint64_t>(inode->size, (uint64_t)offset + size);
+
+    std::vector<uint8_t> data(cbytes);
+    for (size_t done = 0; done < size; ) {
+        off_t pos = offset + (off_t)done;
+        int c = (int)(pos / cbytes);
+        size_t within = (size_t)(pos % cbytes);
+        size_t len = std::min(size - done, cbytes - within);
+        size_t valid = (size_t)std::min<uint64_t>(cbytes, new_size - (uint64_t)c * cbytes);
+
+        // 簇的有效部分被整段覆盖时不必取回旧内容
+        if (within != 0 || len < valid) {
+            int ret = load_cluster(inode, c, data.data());
+            if (ret != MYFS_ERROR_NONE) return ret;
+        }
+        std::memcpy(data.data() + within, buf + done, len);
+        int ret = store_cluster(inode, c, data.data(), valid);
+        if (ret != MYFS_ERROR_NONE) return ret;
+        done += len;
+    }
+    return MYFS_ERROR_NONE;
+}
+
+// 新大小之后的整簇释放; 缩小时新大小落在簇中间, 则截去该簇的尾部后整簇重写
+int FileSystem::cluster_truncate(myfs_inode* inode, off_t size) {
+    const size_t cbytes = (size_t)MYFS_CLUSTER_BLOCKS << super.blk_bits;
+    for (int c = MYFS_DIRECT_BLOCKS / MYFS_CLUSTER_BLOCKS - 1; c >= 0; c--) {
+        off_t start = (off_t)c * cbytes;
+        uint32_t* slot = inode->block + c * MYFS_CLUSTER_BLOCKS;
+        if (start >= size) {
+            for (int i = 0; i < MYFS_CLUSTER_BLOCKS; i++) {
+                if (slot[i] != 0 && slot[i] != MYFS_BLK_COMPRESSED) free_data_block(slot[i]);
+                slot[i] = 0;
+            }
+            cluster_cache.erase(inode->ino, c);
+        } else if (size < start + (off_t)cbytes && size < inode->size &&
+                   std::any_of(slot, slot + MYFS_CLUSTER_BLOCKS, [](uint32_t b) { return b != 0; })) {
+            std::vector<uint8_t> data(cbytes);
+            int ret = load_cluster(inode, c, data.data());
+            if (ret == MYFS_ERROR_NONE) ret = store_cluster(inode, c, data.data(), (size_t)(size - start));
+            if (ret != MYFS_ERROR_NONE) return ret;
+        }
+    }
+    return MYFS_ERROR_NONE;
+}
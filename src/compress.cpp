@@ -0,0 +1,171 @@
+#include "compress.h"
+#include <cstring>
+#include <iterator>
+
+/******************************************************************************
+* SECTION: LZ 压缩
+*******************************************************************************/
+static const int LZ_MIN_MATCH = 4;
+static const int LZ_HASH_BITS = 12;
+static const size_t LZ_LAST_LITERALS = 5;   // 末尾这么多字节总作为字面量
+static const size_t LZ_MATCH_LIMIT = 12;    // 距末尾不足这么多字节时不再找匹配
+static const size_t LZ_MAX_DISTANCE = 0xFFFF;
+
+static inline uint32_t load32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// 写出长度中超过 token 所能表示的部分
+static bool put_length(uint8_t*& op, const uint8_t* oend, size_t n) {
+    for (; n >= 255; n -= 255) {
+        if (op >= oend) return false;
+        *op++ = 255;
+    }
+    if (op >= oend) return false;
+    *op++ = (uint8_t)n;
+    return true;
+}
+
+// 写出一个序列: 字面量 [lit, lit + nlit), 然后回溯 dist 字节复制 mlen 字节; mlen 为 0 表示最后一个序列
+static bool put_sequence(uint8_t*& op, const uint8_t* oend, const uint8_t* lit, size_t nlit,
+                         size_t dist, size_t mlen) {
+    if (op >= oend) return false;
+    uint8_t* token = op++;
+    *token = (uint8_t)((nlit < 15 ? nlit : 15) << 4);
+    if (nlit >= 15 && !put_length(op, oend, nlit - 15)) return false;
+    if ((size_t)(oend - op) < nlit) return false;
+    if (nlit) std::memcpy(op, lit, nlit);
+    op += nlit;
+    if (mlen == 0) return true;
+
+    if (oend - op < 2) return false;
+    *op++ = (uint8_t)dist;
+    *op++ = (uint8_t)(dist >> 8);
+    size_t m = mlen - LZ_MIN_MATCH;
+    *token |= (uint8_t)(m < 15 ? m : 15);
+    return m < 15 || put_length(op, oend, m - 15);
+}
+
+size_t lz_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap) {
+    uint32_t table[1 << LZ_HASH_BITS] = {};     // 哈希 -> 位置 + 1, 0 表示空
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* iend = src + len;
+    uint8_t* op = dst;
+    const uint8_t* oend = dst + cap;
+
+    if (len >= LZ_MATCH_LIMIT) {
+        const uint8_t* ilimit = iend - LZ_MATCH_LIMIT;
+        const uint8_t* mlimit = iend - LZ_LAST_LITERALS;
+        while (ip <= ilimit) {
+            uint32_t seq = load32(ip);
+            uint32_t& slot = table[lz_hash(seq)];
+            const uint8_t* ref = slot ? src + slot - 1 : nullptr;
+            slot = (uint32_t)(ip - src) + 1;
+            if (!ref || (size_t)(ip - ref) > LZ_MAX_DISTANCE || load32(ref) != seq) {
+                ip += 1 + ((ip - anchor) >> 6);     // 长时间找不到匹配时加大步长, 不可压缩的数据很快扫过
+                continue;
+            }
+
+            size_t mlen = LZ_MIN_MATCH;
+            while (ip + mlen < mlimit && ref[mlen] == ip[mlen]) mlen++;
+            if (!put_sequence(op, oend, anchor, ip - anchor, ip - ref, mlen)) return 0;
+            ip += mlen;
+            anchor = ip;
+        }
+    }
+    if (!put_sequence(op, oend, anchor, iend - anchor, 0, 0)) return 0;
+    return op - dst;
+}
+
+// 读取 token 之后的扩展长度
+static bool get_length(const uint8_t*& ip, const uint8_t* iend, size_t& n) {
+    uint8_t b;
+    do {
+        if (ip >= iend) return false;
+        b = *ip++;
+        n += b;
+    } while (b == 255);
+    return true;
+}
+
+long lz_decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + len;
+    uint8_t* op = dst;
+    const uint8_t* oend = dst + cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t nlit = token >> 4;
+        if (nlit == 15 && !get_length(ip, iend, nlit)) return -1;
+        if ((size_t)(iend - ip) < nlit || (size_t)(oend - op) < nlit) return -1;
+        std::memcpy(op, ip, nlit);
+        ip += nlit;
+        op += nlit;
+        if (ip == iend) break;      // 最后一个序列只有字面量
+
+        if (iend - ip < 2) return -1;
+        size_t dist = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (dist == 0 || dist > (size_t)(op - dst)) return -1;
+        size_t mlen = token & 15;
+        if (mlen == 15 && !get_length(ip, iend, mlen)) return -1;
+        mlen += LZ_MIN_MATCH;
+        if ((size_t)(oend - op) < mlen) return -1;
+
+        // 源与目标可能重叠 (dist < mlen 即重复模式), 逐字节复制
+        const uint8_t* ref = op - dist;
+        for (size_t i = 0; i < mlen; i++) op[i] = ref[i];
+        op += mlen;
+    }
+    return op - dst;
+}
+
+/******************************************************************************
+* SECTION: 簇缓存
+*******************************************************************************/
+void ClusterCache::reset(size_t cap) {
+    lru.clear();
+    index.clear();
+    capacity = cap;
+}
+
+const std::vector<uint8_t>* ClusterCache::find(uint32_t ino, uint32_t idx) {
+    auto it = index.find(key_of(ino, idx));
+    if (it == index.end()) return nullptr;
+    lru.splice(lru.begin(), lru, it->second);
+    return &it->second->data;
+}
+
+void ClusterCache::put(uint32_t ino, uint32_t idx, const uint8_t* data, size_t len) {
+    if (capacity == 0) return;
+    uint64_t key = key_of(ino, idx);
+    auto it = index.find(key);
+    if (it != index.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+    } else if (lru.size() >= capacity) {
+        // 淘汰最久未用的一项, 其缓冲区留给新项
+        index.erase(lru.back().key);
+        lru.splice(lru.begin(), lru, std::prev(lru.end()));
+        lru.front().key = key;
+        index[key] = lru.begin();
+    } else {
+        lru.push_front({ key, {} });
+        index[key] = lru.begin();
+    }
+    lru.front().data.assign(data, data + len);
+}
+
+void ClusterCache::erase(uint32_t ino, uint32_t idx) {
+    auto it = index.find(key_of(ino, idx));
+    if (it == index.end()) return;
+    lru.erase(it->second);
+    index.erase(it);
+}
@@ -0,0 +1,298 @@
+#include "utils.h"
+#include <algorithm>
+#include <cstring>
+
+// =================================================================
+// 块级去重
+// 带 --dedup 格式化的文件系统中, 普通文件整块写入的数据按内容哈希登记在去重表与内存索引中.
+// 写入整块时先按哈希找候选块, 逐字节比较相同才共用 (shares 加一), 不再写设备; 否则写入本文件
+// 独占的块并登记. 与其他文件共用的块不原地改写: 部分写入、截断清尾与簇重写都先另分配一块.
+// 释放时 shares 不为 0 只减一, 为 0 才进入延迟释放
+// =================================================================
+
+// 块内容哈希: 每 8 字节一轮乘法与移位混合, 块大小总是 8 的倍数. 0 留作 "不在索引中"
+static uint32_t block_hash(const uint8_t* p, size_t len) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ len;
+    for (size_t i = 0; i < len; i += 8) {
+        uint64_t v;
+        std::memcpy(&v, p + i, sizeof(v));
+        h = (h ^ v) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    uint32_t h32 = (uint32_t)h ^ (uint32_t)(h >> 32);
+    return h32 ? h32 : 1;
+}
+
+myfs_dedup_entry& FileSystem::dedup_entry(uint32_t blk) {
+    uint32_t g = (uint32_t)data_group(blk);
+    return dedup_tab(g)[blk - groups[g].data_start];
+}
+
+void FileSystem::dedup_touch(uint32_t blk) {
+    if (meta_in_place) return;
+    const myfs_group_d& gd = groups[data_group(blk)];
+    uint32_t per_blk = super.block_size / sizeof(myfs_dedup_entry);
+    dedup_dirty.insert(gd.data_start - super.dedup_blks_per_group + (blk - gd.data_start) / per_blk);
+}
+
+// 登记已占用且带哈希的块; 空闲块的表项应为全 0, 残留的哈希不予理会
+void FileSystem::dedup_build_index() {
+    dedup_index.clear();
+    dedup_dirty.clear();
+    if (!dedup_on()) return;
+    for (uint32_t g = 0; g < super.group_count; g++) {
+        const myfs_group_d& gd = groups[g];
+        const myfs_dedup_entry* tab = dedup_tab(g);
+        const uint8_t* map = dbmap(g);
+        for (uint32_t i = 0; i < gd.data_blks; i++) {
+            if (tab[i].hash && (map[i / 8] >> (i % 8) & 1)) dedup_index.emplace(tab[i].hash, gd.data_start + i);
+        }
+    }
+}
+
+// 改动过的表块一起写回, 相邻的合并为一段
+void FileSystem::flush_dedup() {
+    if (dedup_dirty.empty()) return;
+    std::vector<IoSeg> segs;
+    for (uint32_t blk : dedup_dirty) {
+        uint32_t g = (blk - super.group_start) / super.blocks_per_group;
+        uint32_t start = groups[g].data_start - super.dedup_blks_per_group;
+        uint8_t* buf = (uint8_t*)dedup_tab(g) + ((size_t)(blk - start) << super.blk_bits);
+        IoSeg* last = segs.empty() ? nullptr : &segs.back();
+        if (last && last->offset + (off_t)last->size == blk_ofs(blk) && (uint8_t*)last->buf + last->size == buf) {
+            last->size += super.block_size;
+        } else {
+            segs.push_back({ blk_ofs(blk), buf, super.block_size });
+        }
+    }
+    driver_write_batch(segs.data(), (int)segs.size());
+    dedup_dirty.clear();
+}
+
+bool FileSystem::dedup_shared(uint32_t blk) {
+    return dedup_on() && is_data_block(blk) && dedup_entry(blk).shares > 0;
+}
+
+bool FileSystem::dedup_release(uint32_t blk) {
+    myfs_dedup_entry& e = dedup_entry(blk);
+    if (e.shares > 0) {
+        e.shares--;
+        dedup_touch(blk);
+        return true;
+    }
+    dedup_forget(blk);
+    return false;
+}
+
+void FileSystem::dedup_forget(uint32_t blk) {
+    if (!dedup_on() || !is_data_block(blk)) return;
+    myfs_dedup_entry& e = dedup_entry(blk);
+    if (e.hash == 0) return;
+    auto range = dedup_index.equal_range(e.hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == blk) {
+            dedup_index.erase(it);
+            break;
+        }
+    }
+    e.hash = 0;
+    dedup_touch(blk);
+}
+
+// 按哈希找内容与 data 相同的块, 没有时返回 -1. 哈希相同的候选逐个读出比较, 已比较过的 skip 跳过
+int64_t FileSystem::dedup_lookup(uint32_t hash, const uint8_t* data, uint32_t skip) {
+    auto range = dedup_index.equal_range(hash);
+    if (range.first == range.second) return -1;
+    std::vector<uint8_t> buf(super.block_size);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == skip) continue;
+        if (driver_read(blk_ofs(it->second), buf.data(), buf.size()) != MYFS_ERROR_NONE) continue;
+        if (std::memcmp(buf.data(), data, buf.size()) == 0) return it->second;
+    }
+    return -1;
+}
+
+// 第 idx 个逻辑块随后要原地改写: 独占的块移出索引; 与其他文件共用时复制到新块, 原块去掉一个引用
+int FileSystem::own_block(myfs_inode* inode, int idx) {
+    uint32_t old = inode->block[idx];
+    if (!dedup_shared(old)) {
+        dedup_forget(old);
+        return MYFS_ERROR_NONE;
+    }
+    uint32_t got;
+    int blk = alloc_data_blocks(data_goal(inode, idx), 1, &got, false);
+    if (blk == -1) return -MYFS_ERROR_NOSPACE;
+    std::vector<uint8_t> buf(super.block_size);
+    if (driver_read(blk_ofs(old), buf.data(), buf.size()) != MYFS_ERROR_NONE ||
+        driver_write(blk_ofs(blk), buf.data(), buf.size()) != MYFS_ERROR_NONE) {
+        free_data_block(blk);
+        return -MYFS_ERROR_IO;
+    }
+    free_data_block(old);
+    inode->block[idx] = blk;
+    return MYFS_ERROR_NONE;
+}
+
+// 非簇方式的普通文件写入. 依次: 整块按内容找已有的相同块共用; 其余块中与其他文件共用的与空洞
+// 一起按逻辑块连续分配新块, 独占的旧块移出索引后原地改写; 同一次写入中内容相同的整块共用
+// 先写的那块. 数据写完后新写的整块才登记进索引, 共用的引用数在 inode 落盘前写回
+int FileSystem::dedup_write(myfs_inode* inode, const char* buf, size_t size, off_t offset) {
+    const size_t bs = super.block_size;
+    if (offset < 0 || (uint64_t)offset + size > ((uint64_t)MYFS_DIRECT_BLOCKS << super.blk_bits)) {
+        return -MYFS_ERROR_NOSPACE;
+    }
+
+    struct Piece {
+        int idx;                // 逻辑块号
+        size_t within, len;
+        const uint8_t* src;
+        uint32_t hash;          // 整块时的内容哈希, 否则为 0
+        int same;               // 本次写入中内容相同的前一块 (pieces 下标), 没有为 -1
+        uint32_t fresh;         // 新分配的块, 0 表示原地改写旧块
+    };
+    std::vector<Piece> pieces;
+    for (size_t done = 0; done < size; ) {
+        off_t pos = offset + (off_t)done;
+        Piece p = { (int)(pos >> super.blk_bits), (size_t)pos & (bs - 1), 0, (const uint8_t*)buf + done, 0, -1, 0 };
+        p.len = std::min(size - done, bs - p.within);
+        if (p.len == bs) p.hash = block_hash(p.src, bs);
+        pieces.push_back(p);
+        done += p.len;
+    }
+
+    // 各整块哈希的第一个候选一起读出; 同一哈希的其余候选很少, 由 dedup_lookup 逐个比较
+    std::vector<uint32_t> cand(pieces.size(), 0);
+    std::vector<uint8_t> cand_buf(pieces.size() * bs);
+    std::vector<IoSeg> reads;
+    for (size_t k = 0; k < pieces.size(); k++) {
+        auto it = pieces[k].hash ? dedup_index.find(pieces[k].hash) : dedup_index.end();
+        if (it == dedup_index.end()) continue;
+        cand[k] = it->second;
+        uint8_t* dst = cand_buf.data() + k * bs;
+        IoSeg* last = reads.empty() ? nullptr : &reads.back();
+        if (last && last->offset + (off_t)last->size == blk_ofs(cand[k]) && (uint8_t*)last->buf + last->size == dst) {
+            last->size += bs;     // 副本的候选多半是源文件连续的块
+        } else {
+            reads.push_back({ blk_ofs(cand[k]), dst, bs });
+        }
+    }
+    if (driver_read_batch(reads.data(), (int)reads.size()) != MYFS_ERROR_NONE) return -MYFS_ERROR_IO;
+
+    std::vector<Piece> kept;
+    for (size_t k = 0; k < pieces.size(); k++) {
+        Piece& p = pieces[k];
+        if (p.hash) {
+            int64_t dup = cand[k] && std::memcmp(cand_buf.data() + k * bs, p.src, bs) == 0 ? cand[k] :
+                          dedup_lookup(p.hash, p.src, cand[k]);
+            if (dup >= 0) {
+                // 内容已在设备上: 共用该块, 换下的旧块去掉一个引用
+                uint32_t old = inode->block[p.idx];
+                if ((uint32_t)dup != old) {
+                    dedup_entry((uint32_t)dup).shares++;
+                    dedup_touch((uint32_t)dup);
+                    if (old) free_data_block(old);
+                    inode->block[p.idx] = (uint32_t)dup;
+                }
+                continue;
+            }
+            for (size_t q = 0; q < kept.size() && p.same < 0; q++) {
+                if (kept[q].hash == p.hash && kept[q].same < 0 && std::memcmp(kept[q].src, p.src, bs) == 0) {
+                    p.same = (int)q;
+                }
+            }
+        }
+        kept.push_back(p);
+    }
+    pieces.swap(kept);
+
+    // 空洞与共用的块换成新块 (上面的共用可能刚让本文件的旧块变成共用); 相邻的一起分配,
+    // 部分块随后由 merged 补成整块, 不必先清零
+    auto needs_fresh = [&](const Piece& p) {
+        return p.same < 0 && (inode->block[p.idx] == 0 || dedup_shared(inode->block[p.idx]));
+    };
+    for (size_t k = 0; k < pieces.size(); ) {
+        if (!needs_fresh(pieces[k])) {
+            k++;
+            continue;
+        }
+        size_t run = 1;
+        while (k + run < pieces.size() && needs_fresh(pieces[k + run])) run++;
+        uint32_t goal = k > 0 && pieces[k - 1].fresh ? pieces[k - 1].fresh + 1 : data_goal(inode, pieces[k].idx);
+        uint32_t got;
+        int blk = alloc_data_blocks(goal, (uint32_t)run, &got, false);
+        if (blk == -1) {
+            for (size_t j = 0; j < k; j++) {
+                if (pieces[j].fresh) free_data_block(pieces[j].fresh);
+            }
+            return -MYFS_ERROR_NOSPACE;
+        }
+        for (uint32_t j = 0; j < got; j++) pieces[k + j].fresh = blk + j;
+        k += got;
+    }
+
+    std::vector<uint8_t> merged(2 * bs);    // 部分块至多首尾两个
+    int n_merged = 0;
+    std::vector<IoSeg> segs;
+    auto add_seg = [&](off_t off, const uint8_t* data, size_t len) {
+        IoSeg* last = segs.empty() ? nullptr : &segs.back();
+        if (last && last->offset + (off_t)last->size == off && (const uint8_t*)last->buf + last->size == data) {
+            last->size += len;
+        } else {
+            segs.push_back({ off, (void*)data, len });
+        }
+    };
+    for (Piece& p : pieces) {
+        uint32_t old = inode->block[p.idx];
+        if (p.same >= 0) {
+            // 先写的那块此时已换到位
+            uint32_t blk = inode->block[pieces[p.same].idx];
+            dedup_entry(blk).shares++;
+            dedup_touch(blk);
+            if (old) free_data_block(old);
+            inode->block[p.idx] = blk;
+        } else if (!p.fresh) {
+            dedup_forget(old);
+            add_seg(blk_ofs(old) + p.within, p.src, p.len);
+        } else {
+            const uint8_t* data = p.src;
+            if (p.len < bs) {
+                uint8_t* m = merged.data() + (size_t)n_merged++ * bs;
+                if (old == 0) std::memset(m, 0, bs);
+                else if (driver_read(blk_ofs(old), m, bs) != MYFS_ERROR_NONE) return -MYFS_ERROR_IO;
+                std::memcpy(m + p.within, p.src, p.len);
+                data = m;
+            }
+            add_seg(blk_ofs(p.fresh), data, bs);
+            if (old) free_data_block(old);
+            inode->block[p.idx] = p.fresh;
+        }
+    }
+    if (driver_write_batch(segs.data(), (int)segs.size()) != MYFS_ERROR_NONE) return -MYFS_ERROR_IO;
+
+    for (const Piece& p : pieces) {
+        if (p.hash && p.same < 0) {
+            uint32_t blk = inode->block[p.idx];
+            dedup_entry(blk).hash = p.hash;
+            dedup_touch(blk);
+            dedup_index.emplace(p.hash, blk);
+        }
+    }
+    flush_dedup();
+    return MYFS_ERROR_NONE;
+}
+
+// copy_file_range 的整块部分: 目标第 out 块起的 n 块改为共用源文件第 in 块起的块 (各加一个引用),
+// 目标原有的块随后释放; 源中的空洞在目标中也是空洞. 只改内存中的 inode, 由调用者写回
+void FileSystem::dedup_clone(myfs_inode* src, int in, myfs_inode* dst, int out, int n) {
+    for (int i = 0; i < n; i++) {
+        uint32_t blk = src->block[in + i];
+        uint32_t old = dst->block[out + i];
+        if (blk == old) continue;
+        if (blk) {
+            dedup_entry(blk).shares++;
+            dedup_touch(blk);
+        }
+        dst->block[out + i] = blk;
+        if (old) free_data_block(old);
+    }
+}
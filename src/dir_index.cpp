@@ -0,0 +1,342 @@
+#include "utils.h"
+#include <algorithm>
+#include <cstring>
+
+// =================================================================
+// 元数据块读写
+// =================================================================
+
+// 就地访问时返回映射中的地址, 否则读入 buf; 失败返回 nullptr
+uint8_t* FileSystem::meta_read(uint32_t blk, std::vector<uint8_t>& buf) {
+    if (uint8_t* p = in_place(blk_ofs(blk))) return p;
+    buf.resize(super.block_size);
+    if (driver_read(blk_ofs(blk), buf.data(), super.block_size) != MYFS_ERROR_NONE) return nullptr;
+    return buf.data();
+}
+
+int FileSystem::meta_write(uint32_t blk, const uint8_t* data) {
+    if (uint8_t* p = in_place(blk_ofs(blk))) {
+        if (p != data) std::memcpy(p, data, super.block_size);
+        return MYFS_ERROR_NONE;
+    }
+    return driver_write(blk_ofs(blk), data, super.block_size);
+}
+
+// =================================================================
+// 目录索引 (htree)
+// 线性目录写满 MYFS_DIRECT_BLOCKS 块后转为索引目录. 索引目录不整体载入内存,
+// first_child 只缓存查找过的子项; 增删目录项只读写根到叶子一条路径上的块
+// =================================================================
+
+static uint32_t dx_limit(uint32_t block_size) {
+    return (block_size - sizeof(struct myfs_dx_head)) / sizeof(struct myfs_dx_entry);
+}
+
+static bool dentry_matches(const struct myfs_dentry_d& d, const std::string& name) {
+    return d.fname[0] != '\0' && d.namelen == name.size() && std::memcmp(d.fname, name.data(), name.size()) == 0;
+}
+
+void FileSystem::pack_dentry(myfs_dentry_d& d, const std::string& name, uint32_t ino, bool is_dir) {
+    size_t name_len = name.length();
+    if (name_len >= MYFS_MAX_FILE_NAME) name_len = MYFS_MAX_FILE_NAME - 1;
+
+    std::memset(&d, 0, sizeof(d));
+    d.ino = ino;
+    d.reclen = sizeof(struct myfs_dentry_d);
+    d.namelen = name_len;
+    d.file_type = is_dir ? 1 : 0;
+    std::memcpy(d.fname, name.data(), name_len);
+}
+
+// 自根向下找到 hash 所在的叶子
+int FileSystem::dx_find_leaf(myfs_inode* dir, uint32_t hash, std::vector<DxStep>& path, uint32_t* leaf) {
+    std::vector<uint8_t> buf;
+    uint32_t blk = dir->block[0];
+    path.clear();
+
+    for (int depth = 0; depth <= MYFS_DX_MAX_LEVEL; depth++) {
+        if (!is_data_block(blk)) return -MYFS_ERROR_IO;
+        const uint8_t* data = meta_read(blk, buf);
+        if (!data) return -MYFS_ERROR_IO;
+
+        const struct myfs_dx_head* head = (const struct myfs_dx_head*)data;
+        const struct myfs_dx_entry* ents = (const struct myfs_dx_entry*)(head + 1);
+        if (head->magic != MYFS_DX_MAGIC || head->count == 0 || head->count > dx_limit(super.block_size)) {
+            return -MYFS_ERROR_IO;
+        }
+
+        // 最后一个 hash <= 目标的项; 首项兜底
+        const struct myfs_dx_entry* it = std::upper_bound(ents + 1, ents + head->count, hash,
+            [](uint32_t h, const struct myfs_dx_entry& e) { return h < e.hash; });
+        int idx = (int)(it - ents) - 1;
+        path.push_back({ blk, idx });
+        blk = ents[idx].blk;
+
+        if (head->level == 0) {
+            if (!is_data_block(blk)) return -MYFS_ERROR_IO;
+            *leaf = blk;
+            return MYFS_ERROR_NONE;
+        }
+    }
+    return -MYFS_ERROR_IO;
+}
+
+int FileSystem::dx_write_index(uint32_t blk, uint16_t level, const myfs_dx_entry* ents, size_t count) {
+    std::vector<uint8_t> buf(super.block_size, 0);
+    struct myfs_dx_head* head = (struct myfs_dx_head*)buf.data();
+    head->magic = MYFS_DX_MAGIC;
+    head->level = level;
+    head->count = (uint16_t)count;
+    std::memcpy(head + 1, ents, count * sizeof(struct myfs_dx_entry));
+    return meta_write(blk, buf.data());
+}
+
+// 子节点分裂后把 (hash, blk) 插入 path[depth] 所在的索引块, 紧跟所选项之后;
+// 索引块满时对半分裂并继续向上插入. 根块固定在 block[0], 满时两半移入新块, 根升高一层
+int FileSystem::dx_insert_index(myfs_inode* dir, const std::vector<DxStep>& path, int depth,
+                                uint32_t hash, uint32_t blk) {
+    std::vector<uint8_t> buf;
+    const uint8_t* data = meta_read(path[depth].blk, buf);
+    if (!data) return -MYFS_ERROR_IO;
+
+    const struct myfs_dx_head* head = (const struct myfs_dx_head*)data;
+    const struct myfs_dx_entry* ents = (const struct myfs_dx_entry*)(head + 1);
+    uint16_t level = head->level;
+    std::vector<struct myfs_dx_entry> all(ents, ents + head->count);
+    all.insert(all.begin() + path[depth].idx + 1, { hash, blk });
+
+    if (all.size() <= dx_limit(super.block_size)) {
+        return dx_write_index(path[depth].blk, level, all.data(), all.size());
+    }
+
+    size_t mid = all.size() / 2;
+    if (depth == 0) {
+        if (level >= MYFS_DX_MAX_LEVEL) return -MYFS_ERROR_NOSPACE;
+        int left = alloc_data_block(data_goal(dir, 1));
+        int right = left < 0 ? -1 : alloc_data_block(left + 1);
+        if (right < 0) {
+            if (left >= 0) free_data_block(left);
+            return -MYFS_ERROR_NOSPACE;
+        }
+        dir->size += 2 * super.block_size;
+
+        struct myfs_dx_entry root[] = { { 0, (uint32_t)left }, { all[mid].hash, (uint32_t)right } };
+        int ret = dx_write_index(left, level, all.data(), mid);
+        if (ret == MYFS_ERROR_NONE) ret = dx_write_index(right, level, all.data() + mid, all.size() - mid);
+        if (ret == MYFS_ERROR_NONE) ret = dx_write_index(path[0].blk, level + 1, root, 2);
+        return ret;
+    }
+
+    int right = alloc_data_block(path[depth].blk + 1);
+    if (right < 0) return -MYFS_ERROR_NOSPACE;
+    dir->size += super.block_size;
+
+    int ret = dx_write_index(path[depth].blk, level, all.data(), mid);
+    if (ret == MYFS_ERROR_NONE) ret = dx_write_index(right, level, all.data() + mid, all.size() - mid);
+    if (ret != MYFS_ERROR_NONE) return ret;
+    return dx_insert_index(dir, path, depth - 1, all[mid].hash, right);
+}
+
+// 深度优先、按哈希顺序访问索引树: 索引块 (leaf = false) 先于其子树; fn 返回 false 时停止.
+// 哈希区间整体小于 from 的子树不访问. 损坏的索引块连同子树跳过
+bool FileSystem::dx_visit(uint32_t blk, int depth, uint32_t from, const std::function<bool(uint32_t, bool)>& fn) {
+    if (depth > MYFS_DX_MAX_LEVEL || !is_data_block(blk)) return true;
+
+    std::vector<uint8_t> buf;
+    const uint8_t* data = meta_read(blk, buf);
+    if (!data) return true;
+    const struct myfs_dx_head* head = (const struct myfs_dx_head*)data;
+    if (head->magic != MYFS_DX_MAGIC || head->count > dx_limit(super.block_size)) return true;
+
+    uint16_t level = head->level;
+    const struct myfs_dx_entry* first = (const struct myfs_dx_entry*)(head + 1);
+    std::vector<struct myfs_dx_entry> ents(first, first + head->count);
+
+    if (!fn(blk, false)) return false;
+    for (size_t i = 0; i < ents.size(); i++) {
+        if (i + 1 < ents.size() && ents[i + 1].hash <= from) continue;
+        const struct myfs_dx_entry& e = ents[i];
+        if (level == 0) {
+            if (is_data_block(e.blk) && !fn(e.blk, true)) return false;
+        } else if (!dx_visit(e.blk, depth + 1, from, fn)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 在磁盘上查找 name, 找到则建立 dentry 并挂入目录的子项缓存
+myfs_dentry* FileSystem::dx_lookup(myfs_inode* dir, const std::string& name) {
+    std::vector<DxStep> path;
+    uint32_t leaf;
+    if (dx_find_leaf(dir, myfs_dx_hash(name.data(), name.size()), path, &leaf) != MYFS_ERROR_NONE) return nullptr;
+
+    std::vector<uint8_t> buf;
+    const struct myfs_dentry_d* ents = (const struct myfs_dentry_d*)meta_read(leaf, buf);
+    if (!ents) return nullptr;
+
+    const uint32_t per_block = super.block_size / sizeof(struct myfs_dentry_d);
+    for (uint32_t i = 0; i < per_block; i++) {
+        if (!dentry_matches(ents[i], name)) continue;
+
+        return dx_attach(dir, ents[i]);
+    }
+    return nullptr;
+}
+
+// 磁盘上的目录项对应的缓存子项, 不在缓存中时建立并挂入
+myfs_dentry* FileSystem::dx_attach(myfs_inode* dir, const struct myfs_dentry_d& d) {
+    std::string name(d.fname, d.namelen);
+    auto it = dir->child_by_name.find(name);
+    if (it != dir->child_by_name.end()) return it->second;
+
+    myfs_dentry* child = new_dentry(name, d.file_type == 1 ? FileType::DIR : FileType::REG_FILE);
+    child->ino = d.ino;
+    link_child(dir, child);
+    return child;
+}
+
+// readdir 预读: 自哈希 from 起按哈希顺序挂入子项, 直到凑齐 MYFS_DX_PREFETCH 个未载入 inode 的子项,
+// 再一次读入它们的 inode. 哈希顺序下 ino 是分散的, 成批读才能让同一 inode 表块只读一次
+static const size_t MYFS_DX_PREFETCH = 1024;
+
+void FileSystem::dx_prefetch(myfs_inode* dir, uint32_t from) {
+    std::vector<uint8_t> buf;
+    std::vector<myfs_dentry*> fetch;
+    const uint32_t per_block = super.block_size / sizeof(struct myfs_dentry_d);
+    dx_visit(dir->block[0], 0, from, [&](uint32_t blk, bool leaf) {
+        if (!leaf) return true;
+        const struct myfs_dentry_d* ents = (const struct myfs_dentry_d*)meta_read(blk, buf);
+        for (uint32_t i = 0; ents && i < per_block; i++) {
+            if (ents[i].fname[0] == '\0' || myfs_dx_hash(ents[i].fname, ents[i].namelen) < from) continue;
+            myfs_dentry* child = dx_attach(dir, ents[i]);
+            if (!child->inode) fetch.push_back(child);
+        }
+        return fetch.size() < MYFS_DX_PREFETCH;
+    });
+    prefetch_inodes(fetch);
+}
+
+// 写入叶子中的空槽; 叶子满时连同新项按哈希排序, 在中间附近 (不拆开相同哈希) 分成两个叶子
+int FileSystem::dx_insert(myfs_inode* dir, const std::string& name, uint32_t ino, bool is_dir) {
+    const uint32_t per_block = super.block_size / sizeof(struct myfs_dentry_d);
+    std::vector<DxStep> path;
+    uint32_t leaf;
+    int ret = dx_find_leaf(dir, myfs_dx_hash(name.data(), name.size()), path, &leaf);
+    if (ret != MYFS_ERROR_NONE) return ret;
+
+    std::vector<uint8_t> buf;
+    uint8_t* data = meta_read(leaf, buf);
+    if (!data) return -MYFS_ERROR_IO;
+    struct myfs_dentry_d* ents = (struct myfs_dentry_d*)data;
+
+    for (uint32_t i = 0; i < per_block; i++) {
+        if (ents[i].fname[0] != '\0') continue;
+        pack_dentry(ents[i], name, ino, is_dir);
+        return meta_write(leaf, data);
+    }
+
+    std::vector<std::pair<uint32_t, struct myfs_dentry_d>> all;
+    all.reserve(per_block + 1);
+    for (uint32_t i = 0; i < per_block; i++) {
+        all.push_back({ myfs_dx_hash(ents[i].fname, ents[i].namelen), ents[i] });
+    }
+    struct myfs_dentry_d added;
+    pack_dentry(added, name, ino, is_dir);
+    all.push_back({ myfs_dx_hash(added.fname, added.namelen), added });
+    std::sort(all.begin(), all.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    size_t mid = all.size() / 2;
+    while (mid < all.size() && all[mid].first == all[mid - 1].first) mid++;
+    if (mid == all.size()) {
+        mid = all.size() / 2;
+        while (mid > 0 && all[mid].first == all[mid - 1].first) mid--;
+        if (mid == 0) return -MYFS_ERROR_NOSPACE;    // 整个叶子同一哈希
+    }
+
+    int right = alloc_data_block(leaf + 1);
+    if (right < 0) return -MYFS_ERROR_NOSPACE;
+    dir->size += super.block_size;
+
+    std::vector<uint8_t> left_blk(super.block_size, 0), right_blk(super.block_size, 0);
+    for (size_t i = 0; i < all.size(); i++) {
+        if (i < mid) ((struct myfs_dentry_d*)left_blk.data())[i] = all[i].second;
+        else ((struct myfs_dentry_d*)right_blk.data())[i - mid] = all[i].second;
+    }
+    ret = meta_write(leaf, left_blk.data());
+    if (ret == MYFS_ERROR_NONE) ret = meta_write(right, right_blk.data());
+    if (ret != MYFS_ERROR_NONE) return ret;
+    return dx_insert_index(dir, path, (int)path.size() - 1, all[mid].first, right);
+}
+
+// 清空叶子中的槽位; 空叶子保留, 不合并
+int FileSystem::dx_remove(myfs_inode* dir, const std::string& name) {
+    return dx_set_slot(dir, name, nullptr);
+}
+
+// 原地改写目录项指向的 inode (rename 覆盖已有目标), 只写一个叶子
+int FileSystem::dx_replace(myfs_inode* dir, const std::string& name, uint32_t ino, bool is_dir) {
+    struct myfs_dentry_d d;
+    pack_dentry(d, name, ino, is_dir);
+    return dx_set_slot(dir, name, &d);
+}
+
+// 叶子中名为 name 的槽位改写为 d, d 为空时清空
+int FileSystem::dx_set_slot(myfs_inode* dir, const std::string& name, const myfs_dentry_d* d) {
+    std::vector<DxStep> path;
+    uint32_t leaf;
+    int ret = dx_find_leaf(dir, myfs_dx_hash(name.data(), name.size()), path, &leaf);
+    if (ret != MYFS_ERROR_NONE) return ret;
+
+    std::vector<uint8_t> buf;
+    uint8_t* data = meta_read(leaf, buf);
+    if (!data) return -MYFS_ERROR_IO;
+    struct myfs_dentry_d* ents = (struct myfs_dentry_d*)data;
+
+    const uint32_t per_block = super.block_size / sizeof(struct myfs_dentry_d);
+    for (uint32_t i = 0; i < per_block; i++) {
+        if (!dentry_matches(ents[i], name)) continue;
+        if (d) ents[i] = *d;
+        else std::memset(&ents[i], 0, sizeof(struct myfs_dentry_d));
+        return meta_write(leaf, data);
+    }
+    return -MYFS_ERROR_NOTFOUND;
+}
+
+// 线性目录 (已全部在内存中) 转为索引目录: 先分配根块与首个叶子, 再释放原目录块并逐项插入
+int FileSystem::dx_convert(myfs_inode* dir) {
+    uint32_t got;
+    int root = alloc_data_blocks(data_goal(dir, MYFS_DIRECT_BLOCKS), 2, &got);
+    int leaf = root < 0 ? -1 : (got == 2 ? root + 1 : alloc_data_block(root + 1));
+    if (leaf < 0) {
+        if (root >= 0) free_data_block(root);
+        return -MYFS_ERROR_NOSPACE;
+    }
+
+    for (int i = 0; i < MYFS_DIRECT_BLOCKS; i++) {
+        if (dir->block[i] != 0) free_data_block(dir->block[i]);
+        dir->block[i] = 0;
+    }
+    dir->block[0] = root;
+    dir->flags |= MYFS_INODE_DIR_INDEXED;
+    dir->size = 2 * super.block_size;
+    dir->dx_cookie = dir->next_cookie;
+
+    struct myfs_dx_entry first = { 0, (uint32_t)leaf };
+    int ret = dx_write_index(root, 0, &first, 1);
+    for (myfs_dentry* child = dir->first_child; child && ret == MYFS_ERROR_NONE; child = child->brother) {
+        bool is_dir = child->inode ? MYFS_IS_DIR(child->inode) : child->ftype == FileType::DIR;
+        ret = dx_insert(dir, child->fname, child->ino, is_dir);
+    }
+    return ret;
+}
+
+// 释放索引树的全部块 (含根块)
+void FileSystem::dx_free(myfs_inode* dir) {
+    dx_visit(dir->block[0], 0, 0, [&](uint32_t blk, bool) {
+        free_data_block(blk);
+        return true;
+    });
+    dir->block[0] = 0;
+    dir->size = 0;
+}
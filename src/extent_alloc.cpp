@@ -0,0 +1,113 @@
+#include "extent_alloc.h"
+#include <algorithm>
+#include <iterator>
+
+// goal 之后就近查找时最多检查的区间数, 超过后改用最佳适配
+static const int MYFS_EXTENT_SCAN = 32;
+
+void ExtentAllocator::add_map(const uint8_t* map, uint32_t nbits, uint32_t base) {
+    uint32_t run_start = 0;
+    bool in_run = false;
+    for (uint32_t i = 0; i < nbits; ) {
+        // 整字节已占用或整字节空闲时按字节跳过
+        if ((i & 7) == 0 && i + 8 <= nbits && (map[i / 8] == 0xFF || map[i / 8] == 0)) {
+            bool used = map[i / 8] == 0xFF;
+            if (used && in_run) {
+                insert(base + run_start, i - run_start);
+                in_run = false;
+            } else if (!used && !in_run) {
+                run_start = i;
+                in_run = true;
+            }
+            i += 8;
+            continue;
+        }
+        bool used = map[i / 8] & (1 << (i % 8));
+        if (used && in_run) {
+            insert(base + run_start, i - run_start);
+            in_run = false;
+        } else if (!used && !in_run) {
+            run_start = i;
+            in_run = true;
+        }
+        i++;
+    }
+    if (in_run) insert(base + run_start, nbits - run_start);
+}
+
+void ExtentAllocator::clear() {
+    by_start.clear();
+    by_size.clear();
+    free_total = 0;
+}
+
+void ExtentAllocator::insert(uint32_t start, uint32_t len) {
+    by_start[start] = len;
+    by_size.insert({ len, start });
+    free_total += len;
+}
+
+void ExtentAllocator::erase(Iter it) {
+    by_size.erase({ it->second, it->first });
+    free_total -= it->second;
+    by_start.erase(it);
+}
+
+int64_t ExtentAllocator::carve(Iter it, uint32_t start, uint32_t len) {
+    uint32_t ext_start = it->first;
+    uint32_t ext_end = it->first + it->second;
+    erase(it);
+    if (start > ext_start) insert(ext_start, start - ext_start);
+    if (start + len < ext_end) insert(start + len, ext_end - start - len);
+    return start;
+}
+
+int64_t ExtentAllocator::alloc(uint32_t goal, uint32_t want, uint32_t* got) {
+    if (by_start.empty()) return -1;
+    want = std::max(want, 1u);
+
+    // goal 本身空闲: 从 goal 起尽量多取, 保持与前一块相邻
+    Iter next = by_start.upper_bound(goal);
+    if (next != by_start.begin()) {
+        Iter prev = std::prev(next);
+        if (prev->first + prev->second > goal) {
+            *got = std::min(want, prev->first + prev->second - goal);
+            return carve(prev, goal, *got);
+        }
+    }
+
+    // goal 之后最近的足够长的区间
+    int scanned = 0;
+    for (Iter it = next; it != by_start.end() && scanned < MYFS_EXTENT_SCAN; ++it, ++scanned) {
+        if (it->second >= want) {
+            *got = want;
+            return carve(it, it->first, want);
+        }
+    }
+
+    // 最佳适配; 没有足够长的区间时取最长的, 由调用者继续申请余下部分
+    auto fit = by_size.lower_bound({ want, 0 });
+    if (fit == by_size.end()) fit = std::prev(by_size.end());
+    *got = std::min(want, fit->first);
+    return carve(by_start.find(fit->second), fit->second, *got);
+}
+
+void ExtentAllocator::free(uint32_t start, uint32_t len) {
+    if (len == 0) return;
+
+    // 与前后相邻的空闲区间合并
+    Iter next = by_start.lower_bound(start);
+    if (next != by_start.begin()) {
+        Iter prev = std::prev(next);
+        if (prev->first + prev->second == start) {
+            start = prev->first;
+            len += prev->second;
+            erase(prev);
+        }
+    }
+    if (next != by_start.end() && next->first == start + len) {
+        len += next->second;
+        erase(next);
+    }
+    insert(start, len);
+}
@@ -0,0 +1,189 @@
+#include "utils.h"
+#include <algorithm>
+
+// =================================================================
+// inode / dentry 缓存
+// 载入的 inode 挂在 LRU 链表上, lookup 经过的每一层都移到表头. 回收只在最外层操作结束时进行
+// (OpScope), 自表尾起找可回收的 inode: 根目录不回收; 目录要求其子项都没有载入 inode (子树已先
+// 回收), 且不在分页列举中途 (线性目录的续读点与 cookie 都在内存里, 重新载入后会重新编号).
+// 回收时目录的子项 dentry 一并释放, 本身的 dentry 留在父目录中, 之后经 ino 重新载入; 索引目录
+// 的子项缓存只为加速查找, 未载入 inode 的子项随时可丢, 之后由 dx_lookup 重新建立.
+// 载入的 inode 同时登记在按 ino 索引的分段表中, 再次载入同一 ino 时直接共用, 不再读盘
+// =================================================================
+
+static const uint32_t MYFS_ITAB_CHUNK = 256;
+
+// 估算值: 每个 dentry 另计父目录按名索引中的一个节点; 超出短字符串优化的长文件名不计
+static const uint64_t MYFS_DENTRY_BYTES =
+    sizeof(myfs_dentry) + sizeof(std::pair<const std::string, myfs_dentry*>) + 2 * sizeof(void*);
+
+uint64_t FileSystem::cache_bytes() const {
+    return icache.inodes * sizeof(myfs_inode) + icache.dentries * MYFS_DENTRY_BYTES;
+}
+
+myfs_cache_stats FileSystem::cache_stats() const {
+    myfs_cache_stats s;
+    s.inodes = icache.inodes;
+    s.dentries = icache.dentries;
+    s.bytes = cache_bytes();
+    s.budget = (uint64_t)options.cache_kb << 10;
+    s.evictions = icache.evictions;
+    s.reloads = icache.reloads;
+    return s;
+}
+
+void FileSystem::itab_init() {
+    itab.clear();
+    itab.resize((super.inode_count + MYFS_ITAB_CHUNK - 1) / MYFS_ITAB_CHUNK);
+}
+
+myfs_inode* FileSystem::itab_get(uint32_t ino) const {
+    if (ino >= super.inode_count) return nullptr;
+    const auto& chunk = itab[ino / MYFS_ITAB_CHUNK];
+    return chunk ? chunk[ino % MYFS_ITAB_CHUNK] : nullptr;
+}
+
+void FileSystem::cache_add(myfs_inode* inode) {
+    auto& chunk = itab[inode->ino / MYFS_ITAB_CHUNK];
+    if (!chunk) chunk.reset(new myfs_inode*[MYFS_ITAB_CHUNK]());
+    chunk[inode->ino % MYFS_ITAB_CHUNK] = inode;
+    cache_insert(inode);
+}
+
+// dentry 指向 inode 并计一次引用; 第一个指向它的 dentry 作为反向指针
+void FileSystem::attach_inode(myfs_dentry* dentry, myfs_inode* inode) {
+    dentry->inode = inode;
+    dentry->ino = inode->ino;
+    inode->dentry_refs++;
+    if (!inode->dentry) inode->dentry = dentry;
+}
+
+void FileSystem::cache_insert(myfs_inode* inode) {
+    inode->lru_prev = nullptr;
+    inode->lru_next = icache.head;
+    if (icache.head) icache.head->lru_prev = inode;
+    else icache.tail = inode;
+    icache.head = inode;
+    icache.inodes++;
+}
+
+void FileSystem::cache_unlink(myfs_inode* inode) {
+    if (inode->lru_prev) inode->lru_prev->lru_next = inode->lru_next;
+    else icache.head = inode->lru_next;
+    if (inode->lru_next) inode->lru_next->lru_prev = inode->lru_prev;
+    else icache.tail = inode->lru_prev;
+    inode->lru_prev = inode->lru_next = nullptr;
+    icache.inodes--;
+}
+
+void FileSystem::cache_touch(myfs_inode* inode) {
+    if (!inode || icache.head == inode) return;
+    cache_unlink(inode);
+    cache_insert(inode);
+}
+
+void FileSystem::free_inode(myfs_inode* inode) {
+    cache_unlink(inode);
+    itab[inode->ino / MYFS_ITAB_CHUNK][inode->ino % MYFS_ITAB_CHUNK] = nullptr;
+    if (inode->dentry && inode->dentry->inode == inode) inode->dentry->inode = nullptr;
+    delete inode;
+}
+
+void FileSystem::detach_inode(myfs_dentry* dentry) {
+    myfs_inode* inode = dentry->inode;
+    if (!inode) return;
+    inode->dentry_refs--;
+    if (inode->dentry == dentry) inode->dentry = nullptr;
+    dentry->inode = nullptr;
+}
+
+void FileSystem::free_dentry(myfs_dentry* dentry) {
+    detach_inode(dentry);
+    icache.dentries--;
+    delete dentry;
+}
+
+// inode 在最后一个指向它的 dentry 释放时连同子树释放
+void FileSystem::free_tree(myfs_dentry* dentry) {
+    myfs_inode* inode = dentry->inode;
+    detach_inode(dentry);
+    if (inode && inode->dentry_refs == 0) {
+        for (myfs_dentry* c = inode->first_child; c; ) {
+            myfs_dentry* next = c->brother;
+            free_tree(c);
+            c = next;
+        }
+        free_inode(inode);
+    }
+    free_dentry(dentry);
+}
+
+bool FileSystem::evictable(const myfs_inode* inode) const {
+    const myfs_dentry* d = inode->dentry;
+    if (!d || d == super.root_dentry || !d->parent) return false;
+    if (inode->dentry_refs > 1) return false;   // 其他 dentry 还指向它
+    if (!MYFS_IS_DIR(inode)) return true;
+    if (inode->rd_listing || inode->dx_cookie) return false;
+    for (const myfs_dentry* c = inode->first_child; c; c = c->brother) {
+        if (c->inode) return false;
+    }
+    return true;
+}
+
+void FileSystem::evict(myfs_inode* inode) {
+    myfs_dentry* d = inode->dentry;
+    for (myfs_dentry* c = inode->first_child; c; ) {
+        myfs_dentry* next = c->brother;
+        free_dentry(c);
+        c = next;
+    }
+    free_inode(inode);
+    d->evicted = true;
+    icache.evictions++;
+}
+
+// 摘下索引目录中未载入 inode 的子项. 转换前的子项 (cookie 不大于 dx_cookie) 留给线性偏移续读
+void FileSystem::drop_bare_children(myfs_inode* dir) {
+    myfs_dentry** link = &dir->first_child;
+    while (myfs_dentry* c = *link) {
+        if (c->inode || c->cookie <= dir->dx_cookie || c == dir->rd_resume) {
+            link = &c->brother;
+            continue;
+        }
+        *link = c->brother;
+        dir->child_by_name.erase(c->fname);
+        free_dentry(c);
+    }
+}
+
+// 回收到上限的 7/8, 不必每个操作都回收. 父目录总比其子项更早用过, 一轮中先遇到的目录因子项
+// 还在而跳过, 因此反复自表尾扫描, 直到降到目标以下或一轮中没有可回收的
+void FileSystem::trim_cache() {
+    uint64_t budget = (uint64_t)options.cache_kb << 10;
+    if (budget == 0 || cache_bytes() <= budget) return;
+    uint64_t target = budget - budget / 8;
+
+    std::vector<myfs_inode*> indexed;   // 本轮有子项被回收的索引目录
+    bool progress = true;
+    while (progress && cache_bytes() > target) {
+        progress = false;
+        indexed.clear();
+        for (myfs_inode* inode = icache.tail; inode && cache_bytes() > target; ) {
+            myfs_inode* prev = inode->lru_prev;
+            if (evictable(inode)) {
+                myfs_inode* parent = inode->dentry->parent->inode;
+                if (MYFS_IS_DIR(inode)) {
+                    indexed.erase(std::remove(indexed.begin(), indexed.end(), inode), indexed.end());
+                }
+                evict(inode);
+                if (parent && is_indexed(parent) &&
+                    std::find(indexed.begin(), indexed.end(), parent) == indexed.end()) {
+                    indexed.push_back(parent);
+                }
+                progress = true;
+            }
+            inode = prev;
+        }
+        for (myfs_inode* dir : indexed) drop_bare_children(dir);
+    }
+}
@@ -0,0 +1,135 @@
+#include "utils.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <iterator>
+
+// =================================================================
+// 写请求队列
+// =================================================================
+
+void IoQueue::add(off_t offset, const void* buf, size_t size) {
+    if (size == 0) return;
+    const off_t end = offset + (off_t)size;
+
+    // first: 第一个与 [offset, end) 重叠或相接的区间; last: 其后第一个不相接的区间
+    auto first = extents.upper_bound(offset);
+    if (first != extents.begin()) {
+        auto prev = std::prev(first);
+        if (prev->first + (off_t)prev->second.size() >= offset) first = prev;
+    }
+    auto last = first;
+    off_t lo = offset, hi = end;
+    while (last != extents.end() && last->first <= end) {
+        lo = std::min(lo, last->first);
+        hi = std::max(hi, last->first + (off_t)last->second.size());
+        total -= last->second.size();
+        ++last;
+    }
+
+    // 起点不晚于新区间的第一段原地扩展, 其余各段拷入后新内容最后覆盖
+    std::vector<uint8_t> data;
+    auto it = first;
+    if (it != last && it->first == lo) {
+        data = std::move(it->second);
+        ++it;
+    }
+    data.resize((size_t)(hi - lo));
+    for (; it != last; ++it) std::memcpy(data.data() + (it->first - lo), it->second.data(), it->second.size());
+    std::memcpy(data.data() + (offset - lo), buf, size);
+
+    extents.erase(first, last);
+    extents.emplace(lo, std::move(data));
+    total += (size_t)(hi - lo);
+}
+
+void IoQueue::clear() {
+    extents.clear();
+    total = 0;
+}
+
+// =================================================================
+// 电梯调度
+// =================================================================
+
+// 队列攒到这么多字节时先下发一轮, 整棵大目录树的写回不必全部留在内存里
+static const size_t MYFS_PLUG_BYTES = 4 << 20;
+
+// 当前线程最外层 IoPlug 的队列; 回收线程等其他线程的写不受影响
+static thread_local IoQueue* plug_queue = nullptr;
+
+myfs_sched_stats FileSystem::sched_stats() const {
+    myfs_sched_stats s;
+    s.requests = sched.requests.load(std::memory_order_relaxed);
+    s.transfers = sched.transfers.load(std::memory_order_relaxed);
+    s.queued = sched.queued.load(std::memory_order_relaxed);
+    return s;
+}
+
+// 一批内各项互不重叠, 排序不改变结果. 合并后的 iovec 至多 IOV_MAX 个
+int FileSystem::dispatch(std::vector<BlockIo>& ios) {
+    sched.requests.fetch_add(ios.size(), std::memory_order_relaxed);
+    if (ios.size() < 2) {
+        sched.transfers.fetch_add(ios.size(), std::memory_order_relaxed);
+        return ios.empty() ? MYFS_ERROR_NONE : device->submit(ios.data(), (int)ios.size());
+    }
+    std::stable_sort(ios.begin(), ios.end(), [](const BlockIo& a, const BlockIo& b) { return a.offset < b.offset; });
+
+    size_t iov_total = 0;
+    for (const BlockIo& io : ios) iov_total += io.iovcnt;
+    std::vector<struct iovec> iov;
+    iov.reserve(iov_total);     // 不再扩容, 已合并项的 iov 指针保持有效
+    std::vector<BlockIo> merged;
+    off_t merged_end = 0;
+    for (const BlockIo& io : ios) {
+        size_t len = 0;
+        for (int i = 0; i < io.iovcnt; i++) len += io.iov[i].iov_len;
+        BlockIo* back = merged.empty() ? nullptr : &merged.back();
+        if (!back || back->write != io.write || merged_end != io.offset || back->iovcnt + io.iovcnt > IOV_MAX) {
+            merged.push_back({ io.offset, iov.data() + iov.size(), 0, io.write });
+            back = &merged.back();
+        }
+        iov.insert(iov.end(), io.iov, io.iov + io.iovcnt);
+        back->iovcnt += io.iovcnt;
+        merged_end = io.offset + (off_t)len;
+    }
+    sched.transfers.fetch_add(merged.size(), std::memory_order_relaxed);
+    return device->submit(merged.data(), (int)merged.size());
+}
+
+FileSystem::IoPlug::IoPlug(FileSystem& fs) : fs(fs), outer(plug_queue == nullptr) {
+    if (outer) plug_queue = &queue;
+}
+
+FileSystem::IoPlug::~IoPlug() {
+    if (!outer) return;
+    plug_queue = nullptr;
+    fs.unplug(queue);
+}
+
+// 就地访问时元数据直接写在映射中, 入队的写 (如新目录块的清零) 下发时反而会盖掉其后的就地修改
+bool FileSystem::queue_writes(const IoSeg* segs, int count) {
+    IoQueue* queue = plug_queue;
+    if (!queue || meta_in_place) return false;
+    for (int i = 0; i < count; i++) queue->add(segs[i].offset, segs[i].buf, segs[i].size);
+    sched.queued.fetch_add(count, std::memory_order_relaxed);
+    if (queue->bytes() >= MYFS_PLUG_BYTES) unplug(*queue);
+    return true;
+}
+
+// 各区间已按偏移排好且互不相接; 共享 IO 单位的相邻区间由 submit_writes 分轮处理
+int FileSystem::unplug(IoQueue& queue) {
+    if (queue.empty()) return MYFS_ERROR_NONE;
+    std::vector<IoSeg> segs;
+    segs.reserve(queue.pending().size());
+    for (const auto& e : queue.pending()) {
+        segs.push_back({ e.first, const_cast<uint8_t*>(e.second.data()), e.second.size() });
+    }
+    int ret = submit_writes(segs.data(), (int)segs.size());
+    queue.clear();
+    return ret;
+}
+
+void FileSystem::flush_plug() {
+    if (plug_queue) unplug(*plug_queue);
+}
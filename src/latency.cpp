@@ -0,0 +1,316 @@
+#include "latency.h"
+#include "utils.h"
+#include <cstdio>
+#include <algorithm>
+#include <csignal>
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+
+static const char* op_names[(int)FuseOp::OP_COUNT] = {
+    "getattr", "readdir", "mkdir", "mknod", "write", "read", "utimens",
+    "access", "open", "opendir", "truncate", "unlink", "rmdir", "rename", "fsync", "copy_file_range",
+};
+
+const char* fuse_op_name(FuseOp op) {
+    return op < FuseOp::OP_COUNT ? op_names[(int)op] : "unknown";
+}
+
+// =================================================================
+// 计时时钟: TSC 仅在 constant_tsc + nonstop_tsc 时启用, 以单调时钟校准
+// =================================================================
+
+struct TickClock {
+    bool use_tsc = false;
+    double ns_per_tick = 1.0;
+
+    TickClock() {
+#if defined(__x86_64__) || defined(__i386__)
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        std::string line;
+        while (std::getline(cpuinfo, line)) {
+            if (line.compare(0, 5, "flags") != 0) continue;
+            use_tsc = line.find(" constant_tsc") != std::string::npos &&
+                      line.find(" nonstop_tsc") != std::string::npos;
+            break;
+        }
+        if (!use_tsc) return;
+
+        uint64_t ns0 = latency_now_ns();
+        uint64_t t0 = __rdtsc();
+        while (latency_now_ns() - ns0 < 5000000) {   // 校准 5ms
+        }
+        uint64_t ns1 = latency_now_ns();
+        uint64_t t1 = __rdtsc();
+        if (t1 <= t0) {
+            use_tsc = false;
+            return;
+        }
+        ns_per_tick = (double)(ns1 - ns0) / (double)(t1 - t0);
+#endif
+    }
+};
+
+static const TickClock tick_clock;
+
+bool latency_use_tsc() {
+    return tick_clock.use_tsc;
+}
+
+double latency_ns_per_tick() {
+    return tick_clock.ns_per_tick;
+}
+
+// =================================================================
+// LatencyHistogram
+// =================================================================
+
+int LatencyHistogram::bucket_of(uint64_t ns) {
+    if (ns < (uint64_t)SUB_COUNT) return (int)ns;
+    int e = 63 - __builtin_clzll(ns);                 // 最高位
+    int sub = (int)(ns >> (e - SUB_BITS)) - SUB_COUNT; // 次高 SUB_BITS 位
+    return (e - SUB_BITS + 1) * SUB_COUNT + sub;
+}
+
+uint64_t LatencyHistogram::bucket_upper(int idx) {
+    if (idx < SUB_COUNT) return (uint64_t)idx;
+    int e = idx / SUB_COUNT + SUB_BITS - 1;
+    uint64_t sub = (uint64_t)(idx % SUB_COUNT);
+    uint64_t width = 1ull << (e - SUB_BITS);
+    return ((SUB_COUNT + sub) << (e - SUB_BITS)) + width - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+    buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum_ns.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t cur = max_ns.load(std::memory_order_relaxed);
+    while (ns > cur && !max_ns.compare_exchange_weak(cur, ns, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::record_local(uint64_t ns) {
+    // 单写者: 读-改-写无需原子指令, 读者 (报告线程) 看到的是完整的 64 位值
+    std::atomic<uint64_t>& b = buckets[bucket_of(ns)];
+    b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    sum_ns.store(sum_ns.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    if (ns > max_ns.load(std::memory_order_relaxed)) max_ns.store(ns, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        uint64_t n = other.buckets[i].load(std::memory_order_relaxed);
+        if (n) buckets[i].fetch_add(n, std::memory_order_relaxed);
+    }
+    total.fetch_add(other.count(), std::memory_order_relaxed);
+    sum_ns.fetch_add(other.sum(), std::memory_order_relaxed);
+
+    uint64_t m = other.max();
+    uint64_t cur = max_ns.load(std::memory_order_relaxed);
+    while (m > cur && !max_ns.compare_exchange_weak(cur, m, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset() {
+    for (auto& b : buckets) b.store(0, std::memory_order_relaxed);
+    total.store(0, std::memory_order_relaxed);
+    sum_ns.store(0, std::memory_order_relaxed);
+    max_ns.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double q) const {
+    uint64_t n = count();
+    if (n == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (double)(n - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) return std::min(bucket_upper(i), max());
+    }
+    return max();
+}
+
+// =================================================================
+// OpStats
+// =================================================================
+
+OpStats::OpStats() : ns_per_tick(latency_ns_per_tick()) {
+}
+
+void OpStats::set_slow_threshold_us(unsigned us) {
+    slow_threshold_ticks = (uint64_t)(us * 1000.0 / ns_per_tick);
+}
+
+// 本线程第一次计时时分配
+OpStats::Shard* OpStats::new_shard() {
+    tls_shard = new Shard();   // 线程退出后保留, 其数据仍计入报告
+    std::lock_guard<std::mutex> guard(shards_lock);
+    shards.push_back(tls_shard);
+    return tls_shard;
+}
+
+void OpStats::slow_op(FuseOp op, const char* path, uint64_t ns, uint64_t dev_io) {
+    slow_count.fetch_add(1, std::memory_order_relaxed);
+    std::fprintf(stderr, "[myfs] slow op: %s path=%s dur=%.3fms dev_io=%llu\n",
+                 fuse_op_name(op), path ? path : "-", ns / 1e6,
+                 (unsigned long long)dev_io);
+}
+
+void core_stats_snapshot(CoreStatsSnapshot* out) {
+    FileSystem& fs = FileSystem::Instance();
+    out->io = fs.io_stats();
+    out->has_device_state = fs.device_state(&out->device_state);
+    out->sched = fs.sched_stats();
+    out->cache = fs.cache_stats();
+}
+
+std::string OpStats::report() const {
+    std::ostringstream os;
+    os << std::left << std::setw(10) << "op"
+       << std::right << std::setw(10) << "count"
+       << std::setw(12) << "avg_us" << std::setw(12) << "p50_us"
+       << std::setw(12) << "p90_us" << std::setw(12) << "p99_us"
+       << std::setw(12) << "max_us" << "\n";
+
+    os << std::fixed << std::setprecision(1);
+    for (int i = 0; i < (int)FuseOp::OP_COUNT; i++) {
+        LatencyHistogram h;
+        {
+            std::lock_guard<std::mutex> guard(shards_lock);
+            for (const Shard* shard : shards) h.merge(shard->hist[i]);
+        }
+        uint64_t n = h.count();
+        if (n == 0) continue;
+        os << std::left << std::setw(10) << op_names[i]
+           << std::right << std::setw(10) << n
+           << std::setw(12) << h.sum() / 1e3 / n
+           << std::setw(12) << h.percentile(0.50) / 1e3
+           << std::setw(12) << h.percentile(0.90) / 1e3
+           << std::setw(12) << h.percentile(0.99) / 1e3
+           << std::setw(12) << h.max() / 1e3 << "\n";
+    }
+
+    CoreStatsSnapshot core;
+    core_snapshot(&core);
+    const myfs_io_stats& io = core.io;
+    os << "slow_ops " << slow_count.load(std::memory_order_relaxed)
+       << " (threshold_us " << (uint64_t)(slow_threshold_ticks * ns_per_tick / 1000 + 0.5) << ")\n";
+    os << "device read " << io.read_cnt << " write " << io.write_cnt
+       << " seek " << io.seek_cnt << "\n";
+    if (core.has_device_state) {
+        const myfs_io_stats& dev = core.device_state;
+        os << "ddriver read " << dev.read_cnt << " write " << dev.write_cnt
+           << " seek " << dev.seek_cnt << "\n";
+    }
+    const myfs_sched_stats& sched = core.sched;
+    os << "sched requests " << sched.requests << " transfers " << sched.transfers
+       << " queued " << sched.queued << "\n";
+    const myfs_cache_stats& cache = core.cache;
+    os << "inode_cache inodes " << cache.inodes << " dentries " << cache.dentries
+       << " kb " << cache.bytes / 1024 << " budget_kb " << cache.budget / 1024
+       << " evictions " << cache.evictions << " reloads " << cache.reloads << "\n";
+    return os.str();
+}
+
+void OpStats::reset() {
+    std::lock_guard<std::mutex> guard(shards_lock);
+    for (Shard* shard : shards) {
+        for (auto& h : shard->hist) h.reset();
+    }
+    slow_count.store(0, std::memory_order_relaxed);
+}
+
+// =================================================================
+// SIGUSR1 转储: 信号处理函数只写自管道, 格式化在后台线程中进行
+// =================================================================
+
+static int dump_signal_fd = -1;
+
+static void on_sigusr1(int) {
+    if (dump_signal_fd >= 0) {
+        char c = 'd';
+        ssize_t r = write(dump_signal_fd, &c, 1);
+        (void)r;
+    }
+}
+
+void OpStats::start_dump_thread() {
+    if (dump_thread.joinable()) return;
+    if (pipe2(dump_pipe, O_CLOEXEC) != 0) return;
+
+    dump_signal_fd = dump_pipe[1];
+    dump_thread = std::thread([this]() {
+        char c;
+        while (read(dump_pipe[0], &c, 1) == 1 && c != 'q') {
+            std::string text = report();
+            std::fprintf(stderr, "%s", text.c_str());
+            std::fflush(stderr);
+        }
+    });
+
+    struct sigaction sa = {};
+    sa.sa_handler = on_sigusr1;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, nullptr);
+}
+
+void OpStats::stop_dump_thread() {
+    if (!dump_thread.joinable()) return;
+
+    signal(SIGUSR1, SIG_DFL);
+    dump_signal_fd = -1;
+
+    char c = 'q';
+    ssize_t r = write(dump_pipe[1], &c, 1);
+    (void)r;
+    dump_thread.join();
+
+    close(dump_pipe[0]);
+    close(dump_pipe[1]);
+    dump_pipe[0] = dump_pipe[1] = -1;
+}
+
+// =================================================================
+// OpTimer
+// =================================================================
+
+uint64_t latency_device_io() {
+    return FileSystem::Instance().io_count();
+}
+
+// =================================================================
+// 虚拟统计文件
+// =================================================================
+
+static std::mutex stats_file_lock;
+static std::string stats_file_text;
+
+bool stats_file_match(const char* path) {
+    return strcmp(path, MYFS_STATS_PATH) == 0;
+}
+
+int stats_file_getattr(struct stat* st) {
+    std::lock_guard<std::mutex> guard(stats_file_lock);
+    stats_file_text = OpStats::Instance().report();
+    memset(st, 0, sizeof(*st));
+    st->st_mode = S_IFREG | 0444;
+    st->st_nlink = 1;
+    st->st_size = stats_file_text.size();
+    return 0;
+}
+
+int stats_file_read(char* buf, size_t size, off_t offset) {
+    std::lock_guard<std::mutex> guard(stats_file_lock);
+    // 从头读时刷新快照, 续读沿用同一份快照
+    if (offset == 0) stats_file_text = OpStats::Instance().report();
+    if (offset >= (off_t)stats_file_text.size()) return 0;
+    size_t len = std::min(size, stats_file_text.size() - (size_t)offset);
+    memcpy(buf, stats_file_text.data() + offset, len);
+    return len;
+}
@@ -2,81 +2,222 @@
 
 #include "myfs.h"
 #include "utils.h"
+#include "latency.h"
+#include "trace.h"
 #include <cstddef>
+#include <cstdlib>
+#include <mutex>
+#include <string>
 
 #define OPTION(t, p)        { t, offsetof(struct CustomOptions, p), 1 }
 
 static const struct fuse_opt option_spec[] = {
 	OPTION("--device=%s", device),
+	OPTION("--backend=%s", backend),
+	OPTION("--slow-op-us=%u", slow_op_us),
+	OPTION("--queue-depth=%u", queue_depth),
+	OPTION("--pool-buffers=%u", pool_buffers),
+	OPTION("--block-size=%u", block_size),
+	OPTION("--compress", compress),
+	OPTION("--dedup", dedup),
+	OPTION("--cache-kb=%u", cache_kb),
+	OPTION("--trace=%s", trace),
 	FUSE_OPT_END
 };
 
 struct CustomOptions myfs_options;
 
+// 核心的目录缓存与 inode 不是线程安全的: fuse_main 默认多线程下发请求, 一个操作结束时的缓存回收
+// 可能释放另一个线程正在使用的 inode. 请求在此排队逐个进入核心; 计时包含排队时间
+static std::mutex core_lock;
+#define CORE_CALL()         std::lock_guard<std::mutex> core_guard(core_lock)
+
+// SIGUSR1 转储线程与统计虚拟文件经此在核心锁内读取核心计数
+static void locked_core_stats(CoreStatsSnapshot* out) {
+    CORE_CALL();
+    core_stats_snapshot(out);
+}
+
 // Wrappers (原有)
 void* myfs_init(struct fuse_conn_info * conn_info) {
-	FileSystem::Instance().mount(myfs_options.device);
+	if (FileSystem::Instance().mount(myfs_options) != 0) {
+		fuse_exit(fuse_get_context()->fuse);
+		return NULL;
+	}
+	OpStats::Instance().set_slow_threshold_us(myfs_options.slow_op_us);
+	OpStats::Instance().set_core_snapshot(locked_core_stats);
+	OpStats::Instance().start_dump_thread();
+	if (myfs_options.trace && *myfs_options.trace) {
+		int ret = TraceLog::Instance().open(myfs_options.trace);
+		if (ret != 0) fprintf(stderr, "[myfs] trace %s: %s\n", myfs_options.trace, strerror(-ret));
+	}
 	return NULL;
 }
 
 void myfs_destroy(void* p) {
+	TraceLog::Instance().close();
+	OpStats::Instance().stop_dump_thread();
 	FileSystem::Instance().umount();
 }
 
 int myfs_mkdir(const char* path, mode_t mode) {
-    return FileSystem::Instance().fuse_mkdir(path, mode);
+    OpTimer timer(FuseOp::MKDIR, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::MKDIR, path, 0, 0, mode);
+    return trace.done(FileSystem::Instance().fuse_mkdir(path, mode));
 }
 
 int myfs_mknod(const char* path, mode_t mode, dev_t dev) {
-    return FileSystem::Instance().fuse_mknod(path, mode, dev);
+    OpTimer timer(FuseOp::MKNOD, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::MKNOD, path, 0, 0, mode);
+    return trace.done(FileSystem::Instance().fuse_mknod(path, mode, dev));
 }
 
 int myfs_getattr(const char* path, struct stat * st) {
-    return FileSystem::Instance().fuse_getattr(path, st);
+    if (stats_file_match(path)) return stats_file_getattr(st);
+    OpTimer timer(FuseOp::GETATTR, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::GETATTR, path);
+    return trace.done(FileSystem::Instance().fuse_getattr(path, st));
+}
+
+// 记录 trace 时经此转交给内核的 filler, 数出本次返回的项数
+struct CountingFill {
+    void* buf;
+    fuse_fill_dir_t filler;
+    uint32_t entries;
+};
+
+static int counting_fill(void* p, const char* name, const struct stat* st, off_t off) {
+    CountingFill* fill = (CountingFill*)p;
+    int full = fill->filler(fill->buf, name, st, off);
+    if (!full) fill->entries++;
+    return full;
 }
 
 int myfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info * fi) {
-    return FileSystem::Instance().fuse_readdir(path, buf, filler, offset, fi);
+    OpTimer timer(FuseOp::READDIR, path);
+    CORE_CALL();
+    if (!TraceLog::on()) return FileSystem::Instance().fuse_readdir(path, buf, filler, offset, fi);
+    OpTrace trace(FuseOp::READDIR, path, offset);
+    CountingFill fill = { buf, filler, 0 };
+    int ret = FileSystem::Instance().fuse_readdir(path, &fill, counting_fill, offset, fi);
+    trace.set_size(fill.entries);
+    return trace.done(ret);
 }
 
 int myfs_write(const char* path, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi) { 
-    return FileSystem::Instance().fuse_write(path, buf, size, offset, fi);
+    OpTimer timer(FuseOp::WRITE, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::WRITE, path, offset, size);
+    return trace.done(FileSystem::Instance().fuse_write(path, buf, size, offset, fi));
 }
 
 int myfs_read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) { 
-    return FileSystem::Instance().fuse_read(path, buf, size, offset, fi);
+    if (stats_file_match(path)) return stats_file_read(buf, size, offset);
+    OpTimer timer(FuseOp::READ, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::READ, path, offset, size);
+    return trace.done(FileSystem::Instance().fuse_read(path, buf, size, offset, fi));
+}
+
+int myfs_read_buf(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset,
+                  struct fuse_file_info* fi) {
+    if (stats_file_match(path)) {
+        struct fuse_bufvec* bv = (struct fuse_bufvec*)calloc(1, sizeof(struct fuse_bufvec));
+        if (!bv) return -MYFS_ERROR_NOMEM;
+        bv->count = 1;
+        bv->buf[0].fd = -1;
+        bv->buf[0].mem = malloc(size ? size : 1);
+        if (!bv->buf[0].mem) {
+            free(bv);
+            return -MYFS_ERROR_NOMEM;
+        }
+        bv->buf[0].size = stats_file_read((char*)bv->buf[0].mem, size, offset);
+        *bufp = bv;
+        return 0;
+    }
+    OpTimer timer(FuseOp::READ, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::READ, path, offset, size);
+    return trace.done(FileSystem::Instance().fuse_read_buf(path, bufp, size, offset, fi));
+}
+
+int myfs_write_buf(const char* path, struct fuse_bufvec* buf, off_t offset, struct fuse_file_info* fi) {
+    OpTimer timer(FuseOp::WRITE, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::WRITE, path, offset, fuse_buf_size(buf));
+    return trace.done(FileSystem::Instance().fuse_write_buf(path, buf, offset, fi));
+}
+
+int myfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+    if (stats_file_match(path)) return 0;
+    OpTimer timer(FuseOp::FSYNC, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::FSYNC, path, 0, 0, datasync);
+    return trace.done(FileSystem::Instance().fuse_fsync(path, datasync, fi));
 }
 
 int myfs_utimens(const char* path, const struct timespec tv[2]) {
-    return FileSystem::Instance().fuse_utimens(path, tv);
+    OpTimer timer(FuseOp::UTIMENS, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::UTIMENS, path);
+    return trace.done(FileSystem::Instance().fuse_utimens(path, tv));
 }
 
 int myfs_access(const char* path, int mask) {
-    return FileSystem::Instance().fuse_access(path, mask);
+    if (stats_file_match(path)) return 0;
+    OpTimer timer(FuseOp::ACCESS, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::ACCESS, path, 0, 0, mask);
+    return trace.done(FileSystem::Instance().fuse_access(path, mask));
 }
 
 int myfs_open(const char* path, struct fuse_file_info* fi) {
-    return FileSystem::Instance().fuse_open(path, fi);
+    if (stats_file_match(path)) {
+        fi->direct_io = 1;  // 报告长度随时变化, 绕过内核页缓存
+        return 0;
+    }
+    OpTimer timer(FuseOp::OPEN, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::OPEN, path);
+    return trace.done(FileSystem::Instance().fuse_open(path, fi));
 }
 
 int myfs_opendir(const char* path, struct fuse_file_info* fi) {
-    return FileSystem::Instance().fuse_opendir(path, fi);
+    OpTimer timer(FuseOp::OPENDIR, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::OPENDIR, path);
+    return trace.done(FileSystem::Instance().fuse_opendir(path, fi));
 }
 
 int myfs_truncate(const char* path, off_t size) {
-    return FileSystem::Instance().fuse_truncate(path, size);
+    OpTimer timer(FuseOp::TRUNCATE, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::TRUNCATE, path, size);
+    return trace.done(FileSystem::Instance().fuse_truncate(path, size));
 }
 
 int myfs_unlink(const char* path) {
-    return FileSystem::Instance().fuse_unlink(path);
+    OpTimer timer(FuseOp::UNLINK, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::UNLINK, path);
+    return trace.done(FileSystem::Instance().fuse_unlink(path));
 }
 
 int myfs_rmdir(const char* path) {
-    return FileSystem::Instance().fuse_rmdir(path);
+    OpTimer timer(FuseOp::RMDIR, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::RMDIR, path);
+    return trace.done(FileSystem::Instance().fuse_rmdir(path));
 }
 
 int myfs_rename(const char* from, const char* to) {
-    return FileSystem::Instance().fuse_rename(from, to);
+    OpTimer timer(FuseOp::RENAME, from);
+    CORE_CALL();
+    OpTrace trace(FuseOp::RENAME, from, 0, 0, 0, to);
+    return trace.done(FileSystem::Instance().fuse_rename(from, to));
 }
 
 // Main
@@ -91,6 +232,9 @@ int main(int argc, char **argv)
     operations.mknod = myfs_mknod;   
     operations.write = myfs_write;
     operations.read = myfs_read;     
+    operations.fsync = myfs_fsync;
+    operations.read_buf = myfs_read_buf;     // 优先于 read/write, 可 splice
+    operations.write_buf = myfs_write_buf;
     operations.utimens = myfs_utimens; 
     operations.access = myfs_access;
     operations.open = myfs_open;
@@ -102,6 +246,7 @@ int main(int argc, char **argv)
 
     struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 	myfs_options.device = strdup(""); 
+	myfs_options.backend = strdup("ddriver");
 	
     if (fuse_opt_parse(&args, &myfs_options, option_spec, NULL) == -1) return -1;
 	
@@ -0,0 +1,309 @@
+#define _XOPEN_SOURCE 700
+
+// FUSE 3 入口 (-DMYFS_FUSE3=ON 时构建为 myfs3). FUSE_USE_VERSION 与 MYFS_FUSE3 由 CMake 定义,
+// 核心 (myfs_core3) 以同样的定义重新编译; 回调与 myfs.cpp 一一对应, 另有 copy_file_range
+#include "utils.h"
+#include "latency.h"
+#include "trace.h"
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE    (1 << 0)    /* <linux/fs.h>, _XOPEN_SOURCE 下不可见 */
+#endif
+
+#define OPTION(t, p)        { t, offsetof(struct CustomOptions, p), 1 }
+
+static const struct fuse_opt option_spec[] = {
+	OPTION("--device=%s", device),
+	OPTION("--backend=%s", backend),
+	OPTION("--slow-op-us=%u", slow_op_us),
+	OPTION("--queue-depth=%u", queue_depth),
+	OPTION("--pool-buffers=%u", pool_buffers),
+	OPTION("--block-size=%u", block_size),
+	OPTION("--compress", compress),
+	OPTION("--dedup", dedup),
+	OPTION("--cache-kb=%u", cache_kb),
+	OPTION("--trace=%s", trace),
+	FUSE_OPT_END
+};
+
+struct CustomOptions myfs_options;
+
+// 核心的目录缓存与 inode 不是线程安全的: 多线程下发的请求在此排队逐个进入核心; 计时包含排队时间.
+// 因此不协商 PARALLEL_DIROPS, 同一目录的 lookup / readdir / create 仍由内核按目录串行下发
+static std::mutex core_lock;
+#define CORE_CALL()         std::lock_guard<std::mutex> core_guard(core_lock)
+
+// SIGUSR1 转储线程与统计虚拟文件经此在核心锁内读取核心计数
+static void locked_core_stats(CoreStatsSnapshot* out) {
+    CORE_CALL();
+    core_stats_snapshot(out);
+}
+
+// 文件最多 6 块, 最大的 16KB 块时为 96KB: 一次请求即可读写整个文件
+static const unsigned MYFS_MAX_IO = MYFS_DIRECT_BLOCKS * MYFS_MAX_BLK_SIZE;
+
+static void want(struct fuse_conn_info* conn, unsigned cap) {
+    if (conn->capable & cap) conn->want |= cap;
+}
+
+static void* myfs_init(struct fuse_conn_info* conn, struct fuse_config* cfg) {
+	if (FileSystem::Instance().mount(myfs_options) != 0) {
+		fuse_exit(fuse_get_context()->fuse);
+		return NULL;
+	}
+	OpStats::Instance().set_slow_threshold_us(myfs_options.slow_op_us);
+	OpStats::Instance().set_core_snapshot(locked_core_stats);
+	OpStats::Instance().start_dump_thread();
+	if (myfs_options.trace && *myfs_options.trace) {
+		int ret = TraceLog::Instance().open(myfs_options.trace);
+		if (ret != 0) fprintf(stderr, "[myfs3] trace %s: %s\n", myfs_options.trace, strerror(-ret));
+	}
+
+    want(conn, FUSE_CAP_WRITEBACK_CACHE);   // 小写入在页缓存中合并, 按页成批下发
+    want(conn, FUSE_CAP_READDIRPLUS);       // 列举时一并返回属性, ls -l 不再逐项 getattr
+    want(conn, FUSE_CAP_READDIRPLUS_AUTO);
+    want(conn, FUSE_CAP_SPLICE_READ);       // 配合 read_buf / write_buf 返回与接收 fd 缓冲区
+    want(conn, FUSE_CAP_SPLICE_WRITE);
+    want(conn, FUSE_CAP_SPLICE_MOVE);
+    // max_read 只能由挂载选项设定, 默认不限, 实际大小由预读窗口决定
+    conn->max_write = MYFS_MAX_IO;
+    conn->max_readahead = MYFS_MAX_IO;
+
+    cfg->kernel_cache = 1;      // 只经本挂载修改, 重新打开时保留页缓存
+	return NULL;
+}
+
+static void myfs_destroy(void* p) {
+	TraceLog::Instance().close();
+	OpStats::Instance().stop_dump_thread();
+	FileSystem::Instance().umount();
+}
+
+static int myfs_mkdir(const char* path, mode_t mode) {
+    OpTimer timer(FuseOp::MKDIR, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::MKDIR, path, 0, 0, mode);
+    return trace.done(FileSystem::Instance().fuse_mkdir(path, mode));
+}
+
+static int myfs_mknod(const char* path, mode_t mode, dev_t dev) {
+    OpTimer timer(FuseOp::MKNOD, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::MKNOD, path, 0, 0, mode);
+    return trace.done(FileSystem::Instance().fuse_mknod(path, mode, dev));
+}
+
+static int myfs_getattr(const char* path, struct stat* st, struct fuse_file_info* fi) {
+    if (stats_file_match(path)) return stats_file_getattr(st);
+    OpTimer timer(FuseOp::GETATTR, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::GETATTR, path);
+    return trace.done(FileSystem::Instance().fuse_getattr(path, st));
+}
+
+// 记录 trace 时经此转交给内核的 filler, 数出本次返回的项数
+struct CountingFill {
+    void* buf;
+    fuse_fill_dir_t filler;
+    uint32_t entries;
+};
+
+static int counting_fill(void* p, const char* name, const struct stat* st, off_t off,
+                         enum fuse_fill_dir_flags flags) {
+    CountingFill* fill = (CountingFill*)p;
+    int full = fill->filler(fill->buf, name, st, off, flags);
+    if (!full) fill->entries++;
+    return full;
+}
+
+// 核心总是以 FUSE_FILL_DIR_PLUS 填入完整属性, 普通 readdir 与 readdirplus 共用
+static int myfs_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
+                        struct fuse_file_info* fi, enum fuse_readdir_flags flags) {
+    OpTimer timer(FuseOp::READDIR, path);
+    CORE_CALL();
+    if (!TraceLog::on()) return FileSystem::Instance().fuse_readdir(path, buf, filler, offset, fi);
+    OpTrace trace(FuseOp::READDIR, path, offset);
+    CountingFill fill = { buf, filler, 0 };
+    int ret = FileSystem::Instance().fuse_readdir(path, &fill, counting_fill, offset, fi);
+    trace.set_size(fill.entries);
+    return trace.done(ret);
+}
+
+static int myfs_write(const char* path, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+    OpTimer timer(FuseOp::WRITE, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::WRITE, path, offset, size);
+    return trace.done(FileSystem::Instance().fuse_write(path, buf, size, offset, fi));
+}
+
+static int myfs_read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+    if (stats_file_match(path)) return stats_file_read(buf, size, offset);
+    OpTimer timer(FuseOp::READ, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::READ, path, offset, size);
+    return trace.done(FileSystem::Instance().fuse_read(path, buf, size, offset, fi));
+}
+
+static int myfs_read_buf(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset,
+                         struct fuse_file_info* fi) {
+    if (stats_file_match(path)) {
+        struct fuse_bufvec* bv = (struct fuse_bufvec*)calloc(1, sizeof(struct fuse_bufvec));
+        if (!bv) return -MYFS_ERROR_NOMEM;
+        bv->count = 1;
+        bv->buf[0].fd = -1;
+        bv->buf[0].mem = malloc(size ? size : 1);
+        if (!bv->buf[0].mem) {
+            free(bv);
+            return -MYFS_ERROR_NOMEM;
+        }
+        bv->buf[0].size = stats_file_read((char*)bv->buf[0].mem, size, offset);
+        *bufp = bv;
+        return 0;
+    }
+    OpTimer timer(FuseOp::READ, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::READ, path, offset, size);
+    return trace.done(FileSystem::Instance().fuse_read_buf(path, bufp, size, offset, fi));
+}
+
+static int myfs_write_buf(const char* path, struct fuse_bufvec* buf, off_t offset, struct fuse_file_info* fi) {
+    OpTimer timer(FuseOp::WRITE, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::WRITE, path, offset, fuse_buf_size(buf));
+    return trace.done(FileSystem::Instance().fuse_write_buf(path, buf, offset, fi));
+}
+
+static int myfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+    if (stats_file_match(path)) return 0;
+    OpTimer timer(FuseOp::FSYNC, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::FSYNC, path, 0, 0, datasync);
+    return trace.done(FileSystem::Instance().fuse_fsync(path, datasync, fi));
+}
+
+static int myfs_utimens(const char* path, const struct timespec tv[2], struct fuse_file_info* fi) {
+    OpTimer timer(FuseOp::UTIMENS, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::UTIMENS, path);
+    return trace.done(FileSystem::Instance().fuse_utimens(path, tv));
+}
+
+static int myfs_access(const char* path, int mask) {
+    if (stats_file_match(path)) return 0;
+    OpTimer timer(FuseOp::ACCESS, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::ACCESS, path, 0, 0, mask);
+    return trace.done(FileSystem::Instance().fuse_access(path, mask));
+}
+
+static int myfs_open(const char* path, struct fuse_file_info* fi) {
+    if (stats_file_match(path)) {
+        fi->direct_io = 1;  // 报告长度随时变化, 绕过内核页缓存
+        return 0;
+    }
+    OpTimer timer(FuseOp::OPEN, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::OPEN, path);
+    return trace.done(FileSystem::Instance().fuse_open(path, fi));
+}
+
+static int myfs_opendir(const char* path, struct fuse_file_info* fi) {
+    OpTimer timer(FuseOp::OPENDIR, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::OPENDIR, path);
+    return trace.done(FileSystem::Instance().fuse_opendir(path, fi));
+}
+
+static int myfs_truncate(const char* path, off_t size, struct fuse_file_info* fi) {
+    OpTimer timer(FuseOp::TRUNCATE, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::TRUNCATE, path, size);
+    return trace.done(FileSystem::Instance().fuse_truncate(path, size));
+}
+
+static int myfs_unlink(const char* path) {
+    OpTimer timer(FuseOp::UNLINK, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::UNLINK, path);
+    return trace.done(FileSystem::Instance().fuse_unlink(path));
+}
+
+static int myfs_rmdir(const char* path) {
+    OpTimer timer(FuseOp::RMDIR, path);
+    CORE_CALL();
+    OpTrace trace(FuseOp::RMDIR, path);
+    return trace.done(FileSystem::Instance().fuse_rmdir(path));
+}
+
+// RENAME_NOREPLACE 先确认目标不存在; RENAME_EXCHANGE 不支持
+static int myfs_rename(const char* from, const char* to, unsigned int flags) {
+    OpTimer timer(FuseOp::RENAME, from);
+    CORE_CALL();
+    OpTrace trace(FuseOp::RENAME, from, 0, 0, flags, to);
+    if (flags & ~RENAME_NOREPLACE) return trace.done(-MYFS_ERROR_INVAL);
+    if (flags & RENAME_NOREPLACE) {
+        struct stat st;
+        if (FileSystem::Instance().fuse_getattr(to, &st) == 0) return trace.done(-MYFS_ERROR_EXISTS);
+    }
+    return trace.done(FileSystem::Instance().fuse_rename(from, to));
+}
+
+// 内核把拷贝整段交给守护进程, 数据不经用户态往返; 统计文件不支持, 内核退回普通拷贝
+static ssize_t myfs_copy_file_range(const char* path_in, struct fuse_file_info* fi_in, off_t off_in,
+                                    const char* path_out, struct fuse_file_info* fi_out, off_t off_out,
+                                    size_t size, int flags) {
+    if (stats_file_match(path_in) || stats_file_match(path_out)) return -EOPNOTSUPP;
+    if (flags != 0) return -MYFS_ERROR_INVAL;
+    OpTimer timer(FuseOp::COPY_RANGE, path_out);
+    CORE_CALL();
+    OpTrace trace(FuseOp::COPY_RANGE, path_in, off_in, size, off_out, path_out);
+    return trace.done(FileSystem::Instance().fuse_copy_file_range(path_in, off_in, path_out, off_out, size));
+}
+
+// 回调表; 定义 MYFS3_NO_MAIN 编译时不含 main, 供 tests/ops3 不经挂载直接调用
+const struct fuse_operations* myfs3_operations() {
+    static struct fuse_operations operations;
+    operations.init = myfs_init;
+    operations.destroy = myfs_destroy;
+    operations.mkdir = myfs_mkdir;
+    operations.getattr = myfs_getattr;
+    operations.readdir = myfs_readdir;
+    operations.mknod = myfs_mknod;
+    operations.write = myfs_write;
+    operations.read = myfs_read;
+    operations.fsync = myfs_fsync;
+    operations.read_buf = myfs_read_buf;     // 优先于 read/write, 可 splice
+    operations.write_buf = myfs_write_buf;
+    operations.utimens = myfs_utimens;
+    operations.access = myfs_access;
+    operations.open = myfs_open;
+    operations.opendir = myfs_opendir;
+    operations.truncate = myfs_truncate;
+    operations.unlink = myfs_unlink;
+    operations.rmdir = myfs_rmdir;
+    operations.rename = myfs_rename;
+    operations.copy_file_range = myfs_copy_file_range;
+    return &operations;
+}
+
+#ifndef MYFS3_NO_MAIN
+// Main
+int main(int argc, char **argv)
+{
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	myfs_options.device = strdup("");
+	myfs_options.backend = strdup("ddriver");
+
+    if (fuse_opt_parse(&args, &myfs_options, option_spec, NULL) == -1) return -1;
+
+    const struct fuse_operations* operations = myfs3_operations();
+    int ret = fuse_main(args.argc, args.argv, operations, NULL);
+	fuse_opt_free_args(&args);
+	return ret;
+}
+#endif
@@ -0,0 +1,116 @@
+#include "trace.h"
+#include <cerrno>
+#include <cstring>
+#include <time.h>
+
+// =================================================================
+// 记录
+// =================================================================
+
+std::atomic<bool> TraceLog::active{false};
+
+TraceLog& TraceLog::Instance() {
+    static TraceLog log;
+    return log;
+}
+
+int TraceLog::open(const char* path) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (file) return -EBUSY;
+    file = std::fopen(path, "wb");
+    if (!file) return -errno;
+    std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    myfs_trace_head head = {};
+    std::memcpy(head.magic, MYFS_TRACE_MAGIC, sizeof(head.magic));
+    head.version = MYFS_TRACE_VERSION;
+    head.rec_size = sizeof(myfs_trace_rec);
+    head.start_unix_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    std::fwrite(&head, sizeof(head), 1, file);
+
+    origin_ns = latency_now_ns();
+    active.store(true, std::memory_order_relaxed);
+    return 0;
+}
+
+void TraceLog::close() {
+    std::lock_guard<std::mutex> guard(lock);
+    active.store(false, std::memory_order_relaxed);
+    if (!file) return;
+    std::fclose(file);
+    file = nullptr;
+}
+
+void TraceLog::record(FuseOp op, const char* path, const char* path2, uint64_t start_ns, uint64_t end_ns,
+                      uint64_t offset, uint64_t size, uint64_t aux, int64_t result) {
+    size_t len = path ? std::strlen(path) : 0;
+    size_t len2 = path2 ? std::strlen(path2) + 1 : 0;   // 含分隔的 '\0'
+    if (len + len2 > UINT16_MAX) return;
+
+    myfs_trace_rec rec = {};
+    rec.offset = offset;
+    rec.aux = aux;
+    rec.size = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+    rec.result = (int32_t)result;
+    rec.dur_ns = end_ns - start_ns > UINT32_MAX ? UINT32_MAX : (uint32_t)(end_ns - start_ns);
+    rec.op = (uint8_t)op;
+    rec.path_len = (uint16_t)(len + len2);
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (!file) return;
+    rec.start_ns = start_ns > origin_ns ? start_ns - origin_ns : 0;
+    std::fwrite(&rec, sizeof(rec), 1, file);
+    if (len) std::fwrite(path, 1, len, file);
+    if (len2) {
+        std::fputc('\0', file);
+        std::fwrite(path2, 1, len2 - 1, file);
+    }
+}
+
+// =================================================================
+// 读取
+// =================================================================
+
+TraceReader::~TraceReader() {
+    if (file) std::fclose(file);
+}
+
+bool TraceReader::open(const char* path, std::string* err) {
+    file = std::fopen(path, "rb");
+    if (!file) {
+        *err = std::string(path) + ": " + std::strerror(errno);
+        return false;
+    }
+    if (std::fread(&hdr, sizeof(hdr), 1, file) != 1 ||
+        std::memcmp(hdr.magic, MYFS_TRACE_MAGIC, sizeof(hdr.magic)) != 0) {
+        *err = std::string(path) + ": not a myfs trace";
+        return false;
+    }
+    if (hdr.version != MYFS_TRACE_VERSION || hdr.rec_size != sizeof(myfs_trace_rec)) {
+        *err = std::string(path) + ": unsupported trace version " + std::to_string(hdr.version);
+        return false;
+    }
+    return true;
+}
+
+bool TraceReader::next(TraceEvent& ev) {
+    myfs_trace_rec rec;
+    if (!file || std::fread(&rec, sizeof(rec), 1, file) != 1) return false;
+    if (rec.op >= (uint8_t)FuseOp::OP_COUNT) return false;
+    std::string paths(rec.path_len, '\0');
+    if (rec.path_len && std::fread(&paths[0], 1, rec.path_len, file) != rec.path_len) return false;
+
+    ev.op = (FuseOp)rec.op;
+    ev.start_ns = rec.start_ns;
+    ev.dur_ns = rec.dur_ns;
+    ev.result = rec.result;
+    ev.offset = rec.offset;
+    ev.size = rec.size;
+    ev.aux = rec.aux;
+    size_t sep = paths.find('\0');
+    ev.path = paths.substr(0, sep);
+    ev.path2 = sep == std::string::npos ? "" : paths.substr(sep + 1);
+    return true;
+}
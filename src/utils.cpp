@@ -1,4 +1,6 @@
 #include "utils.h"
+#include "atomic_bitmap.h"
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <ctime>
@@ -7,12 +9,7 @@
 #include <algorithm>
 #include <cstddef>
 #include <sstream> 
-
-extern "C" {
-    #include "ddriver.h"
-}
-
-#define DRIVER_BLK_SIZE 512
+#include <atomic>
 
 FileSystem& FileSystem::Instance() {
     static FileSystem instance;
@@ -26,114 +23,415 @@ FileSystem::FileSystem() {
 FileSystem::~FileSystem() {
 }
 
-int FileSystem::driver_read(int offset, void* out_content, int size) {
-    int down = MYFS_ROUND_DOWN(offset, DRIVER_BLK_SIZE);
-    int up = MYFS_ROUND_UP(offset + size, DRIVER_BLK_SIZE);
-    int bias = offset - down;
-    
-    std::vector<std::byte> tempdata(up - down);
-    size_t block_count = tempdata.size() / DRIVER_BLK_SIZE;
-    
-    for (size_t i = 0; i < block_count; i++) {
-        int current_offset = down + i * DRIVER_BLK_SIZE;
-        ddriver_seek(super.driver_fd, current_offset, SEEK_SET);
-        ddriver_read(super.driver_fd, (char *)(tempdata.data() + i * DRIVER_BLK_SIZE), DRIVER_BLK_SIZE);
+myfs_io_stats FileSystem::io_stats() const {
+    myfs_io_stats total = retired_stats;
+    if (device) {
+        const myfs_io_stats dev = device->stats();
+        total.read_cnt += dev.read_cnt;
+        total.write_cnt += dev.write_cnt;
+        total.seek_cnt += dev.seek_cnt;
     }
-    
-    std::memcpy(out_content, tempdata.data() + bias, size);
-    
-    return MYFS_ERROR_NONE;
+    return total;
 }
 
-int FileSystem::driver_write(int offset, void* in_content, int size) {
-    int down = MYFS_ROUND_DOWN(offset, DRIVER_BLK_SIZE);
-    int up = MYFS_ROUND_UP(offset + size, DRIVER_BLK_SIZE);
-    int bias = offset - down;
-    
-    std::vector<std::byte> tempdata(up - down);
-    size_t block_count = tempdata.size() / DRIVER_BLK_SIZE;
-    
-    for (size_t i = 0; i < block_count; i++) {
-        int current_offset = down + i * DRIVER_BLK_SIZE; 
-        ddriver_seek(super.driver_fd, current_offset, SEEK_SET);
-        ddriver_read(super.driver_fd, (char *)(tempdata.data() + i * DRIVER_BLK_SIZE), DRIVER_BLK_SIZE);
+bool FileSystem::device_state(myfs_io_stats* out) const {
+    return device && device->device_state(out);
+}
+
+// 暂存区: 优先取设备提供的 IO 缓冲区 (如 uring 固定缓冲区), 否则用堆内存
+class IoScratch {
+public:
+    IoScratch(BlockDevice* dev, size_t size) : dev(dev) {
+        ptr = (std::byte*)dev->get_io_buffer(size);
+        if (!ptr) {
+            heap.resize(size);
+            ptr = heap.data();
+        } else {
+            pooled = true;
+        }
     }
+    ~IoScratch() {
+        if (pooled) dev->put_io_buffer(ptr);
+    }
+    std::byte* data() { return ptr; }
+
+private:
+    BlockDevice* dev;
+    std::byte* ptr;
+    bool pooled = false;
+    std::vector<std::byte> heap;
+};
+
+// 一段传输拆成: 暂存的首/尾 IO 单位 + 直接落在调用者缓冲区的中间部分
+struct SegPlan {
+    off_t down, up;             // 按 IO 单位扩展后的区间
+    off_t mid_start, mid_end;   // 直接传输的对齐部分
+    std::byte* head = nullptr;  // 非对齐首单位 (区间落在单个 IO 单位内时只用 head)
+    std::byte* tail = nullptr;
+};
+
+static void plan_segment(off_t offset, size_t size, off_t unit, std::byte* stage, SegPlan& p) {
+    p.down = MYFS_ROUND_DOWN(offset, unit);
+    p.up = MYFS_ROUND_UP(offset + (off_t)size, unit);
+    p.mid_start = offset;
+    p.mid_end = offset + size;
+    p.head = p.tail = nullptr;
+
+    if (p.down == offset && p.up == offset + (off_t)size) return;
+    if (p.up - p.down == unit) {
+        p.head = stage;
+        p.mid_start = p.mid_end = p.down;
+        return;
+    }
+    if (p.down != offset) {
+        p.head = stage;
+        p.mid_start = p.down + unit;
+    }
+    if (p.up != offset + (off_t)size) {
+        p.tail = stage + unit;
+        p.mid_end = p.up - unit;
+    }
+}
 
-    std::memcpy(tempdata.data() + bias, static_cast<const std::byte*>(in_content), size);
-    
-    for (size_t i = 0; i < block_count; ++i) {
-        int current_offset = down + i * DRIVER_BLK_SIZE;
-        ddriver_seek(super.driver_fd, current_offset, SEEK_SET);
-        ddriver_write(super.driver_fd, (char *)(tempdata.data() + i * DRIVER_BLK_SIZE), DRIVER_BLK_SIZE);
+static int plan_iov(const SegPlan& p, uint8_t* user, off_t offset, off_t unit, struct iovec* iov) {
+    int iovcnt = 0;
+    if (p.head) iov[iovcnt++] = { p.head, (size_t)unit };
+    if (p.mid_end > p.mid_start) {
+        iov[iovcnt++] = { user + (p.mid_start - offset), (size_t)(p.mid_end - p.mid_start) };
+    }
+    if (p.tail) iov[iovcnt++] = { p.tail, (size_t)unit };
+    return iovcnt;
+}
+
+int FileSystem::driver_read(off_t offset, void* out_content, size_t size) {
+    IoSeg seg = { offset, out_content, size };
+    return driver_read_batch(&seg, 1);
+}
+
+int FileSystem::driver_write(off_t offset, const void* in_content, size_t size) {
+    IoSeg seg = { offset, const_cast<void*>(in_content), size };
+    return driver_write_batch(&seg, 1);
+}
+
+// 每段一个 BlockIo, 非对齐的首/尾 IO 单位读入暂存区后再拷出. 本线程队列中的写先下发, 读到的总是最新内容
+int FileSystem::driver_read_batch(const IoSeg* segs, int count) {
+    flush_plug();
+    const off_t unit = device->io_unit();
+    IoScratch scratch(device.get(), (size_t)count * 2 * unit);
+    std::vector<SegPlan> plans(count);
+    std::vector<struct iovec> iov((size_t)count * 3);
+    std::vector<BlockIo> ios;
+    ios.reserve(count);
+
+    for (int i = 0; i < count; i++) {
+        if (segs[i].size == 0) continue;
+        SegPlan& p = plans[i];
+        plan_segment(segs[i].offset, segs[i].size, unit, scratch.data() + (size_t)i * 2 * unit, p);
+        int iovcnt = plan_iov(p, (uint8_t*)segs[i].buf, segs[i].offset, unit, &iov[(size_t)i * 3]);
+        ios.push_back({ p.down, &iov[(size_t)i * 3], iovcnt, false });
+    }
+    if (ios.empty()) return MYFS_ERROR_NONE;
+
+    int ret = dispatch(ios);
+    if (ret != MYFS_ERROR_NONE) return ret;
+
+    for (int i = 0; i < count; i++) {
+        const SegPlan& p = plans[i];
+        uint8_t* out = (uint8_t*)segs[i].buf;
+        off_t offset = segs[i].offset;
+        size_t size = segs[i].size;
+        if (size == 0) continue;
+
+        if (p.head && p.up - p.down == unit) {
+            std::memcpy(out, p.head + (offset - p.down), size);
+            continue;
+        }
+        if (p.head) std::memcpy(out, p.head + (offset - p.down), p.mid_start - offset);
+        if (p.tail) std::memcpy(out + (p.mid_end - offset), p.tail, offset + size - p.mid_end);
     }
     return MYFS_ERROR_NONE;
 }
 
-int FileSystem::get_inode_disk_offset(uint32_t ino) {
-    return (super.inode_start * MYFS_BLK_SIZE) + 
-           ((ino) / MYFS_INODE_PER_BLOCK * MYFS_BLK_SIZE) + 
-           ((ino) % MYFS_INODE_PER_BLOCK * MYFS_INODE_DISK_SIZE);
+int FileSystem::driver_write_batch(const IoSeg* segs, int count) {
+    if (queue_writes(segs, count)) return MYFS_ERROR_NONE;
+    return submit_writes(segs, count);
 }
 
-int FileSystem::alloc_data_block() {
-    int data_blocks_count = super.total_blocks - super.data_start;
-  
-    //遍历查找空闲位 (LSB First)
-    for (int i = 0; i < data_blocks_count; i++) {
-        int byte_idx = i / 8;
-        int bit_idx = i % 8;
-        
-        // 检查位是否为0
-        if (!(super.map_data[byte_idx] & (1 << bit_idx))) {
-            // 找到空闲位，立即标记
-            super.map_data[byte_idx] |= (1 << bit_idx);
-            
-            //写回 Bitmap
-            driver_write(super.dbmap_start * MYFS_BLK_SIZE, super.map_data, MYFS_BLK_SIZE);
-            
-            int abs_blk_id = super.data_start + i;
+// 两段落在同一个 IO 单位上时 (IO 单位大于块, 如 O_DIRECT 的 4KB) 若在同一轮内
+// 各自 RMW 会互相覆盖: 按偏移排序后分轮提交, 每轮内各段互不共享 IO 单位
+int FileSystem::submit_writes(const IoSeg* segs, int count) {
+    const off_t unit = device->io_unit();
+    bool disjoint = true;
+    for (int i = 1; i < count && disjoint; i++) {
+        disjoint = MYFS_ROUND_DOWN(segs[i].offset, unit) >=
+                   MYFS_ROUND_UP(segs[i - 1].offset + (off_t)segs[i - 1].size, unit);
+    }
+    if (disjoint) return driver_write_round(segs, count);
+
+    std::vector<IoSeg> pending(segs, segs + count), round, deferred;
+    std::sort(pending.begin(), pending.end(), [](const IoSeg& a, const IoSeg& b) { return a.offset < b.offset; });
+
+    int err = MYFS_ERROR_NONE;
+    while (!pending.empty()) {
+        off_t last_up = -1;
+        for (const IoSeg& seg : pending) {
+            if (seg.size == 0) continue;
+            if (MYFS_ROUND_DOWN(seg.offset, unit) < last_up) {
+                deferred.push_back(seg);
+                continue;
+            }
+            round.push_back(seg);
+            last_up = MYFS_ROUND_UP(seg.offset + (off_t)seg.size, unit);
+        }
+        int ret = driver_write_round(round.data(), (int)round.size());
+        if (ret != MYFS_ERROR_NONE) err = ret;
+        round.clear();
+        pending.swap(deferred);
+        deferred.clear();
+    }
+    return err;
+}
 
-            //清零新分配的数据块
-            std::vector<uint8_t> empty_block(MYFS_BLK_SIZE, 0);
-            driver_write(abs_blk_id * MYFS_BLK_SIZE, empty_block.data(), MYFS_BLK_SIZE);
+// 只有非对齐的首/尾 IO 单位需要先读后写 (RMW); 所有段的 RMW 读合为一批, 写再合为一批
+int FileSystem::driver_write_round(const IoSeg* segs, int count) {
+    const off_t unit = device->io_unit();
+    IoScratch scratch(device.get(), (size_t)count * 2 * unit);
+    std::vector<SegPlan> plans(count);
+    std::vector<struct iovec> iov((size_t)count * 3);
+    std::vector<BlockIo> ios;
+    ios.reserve((size_t)count * 2);
+
+    for (int i = 0; i < count; i++) {
+        if (segs[i].size == 0) continue;
+        SegPlan& p = plans[i];
+        plan_segment(segs[i].offset, segs[i].size, unit, scratch.data() + (size_t)i * 2 * unit, p);
+        if (p.head) {
+            iov[(size_t)i * 3] = { p.head, (size_t)unit };
+            ios.push_back({ p.down, &iov[(size_t)i * 3], 1, false });
+        }
+        if (p.tail) {
+            iov[(size_t)i * 3 + 1] = { p.tail, (size_t)unit };
+            ios.push_back({ p.mid_end, &iov[(size_t)i * 3 + 1], 1, false });
+        }
+    }
+    if (!ios.empty()) {
+        int ret = dispatch(ios);
+        if (ret != MYFS_ERROR_NONE) return ret;
+        ios.clear();
+    }
+
+    for (int i = 0; i < count; i++) {
+        const SegPlan& p = plans[i];
+        const uint8_t* in = (const uint8_t*)segs[i].buf;
+        off_t offset = segs[i].offset;
+        size_t size = segs[i].size;
+        if (size == 0) continue;
 
-            //返回数据块号
-            return abs_blk_id;
+        if (p.head && p.up - p.down == unit) {
+            std::memcpy(p.head + (offset - p.down), in, size);
+        } else {
+            if (p.head) std::memcpy(p.head + (offset - p.down), in, p.mid_start - offset);
+            if (p.tail) std::memcpy(p.tail, in + (p.mid_end - offset), offset + size - p.mid_end);
         }
+        int iovcnt = plan_iov(p, const_cast<uint8_t*>(in), offset, unit, &iov[(size_t)i * 3]);
+        ios.push_back({ p.down, &iov[(size_t)i * 3], iovcnt, true });
     }
-    
-    return -1; // 无空间
+    if (ios.empty()) return MYFS_ERROR_NONE;
+    return dispatch(ios);
 }
 
-myfs_inode* FileSystem::alloc_inode(myfs_dentry *dentry, bool is_dir) {
-    // 直接遍历查找空闲位
-    int ino = -1;
-    for (int i = 0; i < super.inode_count; i++) {
-        int byte_idx = i / 8;
-        int bit_idx = i % 8;
-        
-        if (!(super.map_inode[byte_idx] & (1 << bit_idx))) {
-            super.map_inode[byte_idx] |= (1 << bit_idx);
-            ino = i;
-            break;
+// 位图块写回; 就地访问时位图本身就在映射中, 无需拷贝.
+// 同组的写回串行进行: 置位总在写回前完成, 最后一次写回的内容包含此前所有线程置上的位.
+// 因此不经写请求队列, 否则队列中较早的副本下发时会盖掉回收线程此后写回的位图
+void FileSystem::flush_map(uint32_t g, const uint8_t* map, uint32_t blk) {
+    if (meta_in_place) return;
+    std::lock_guard<std::mutex> guard(group_alloc[g].flush_lock);
+    IoSeg seg = { blk_ofs(blk), const_cast<uint8_t*>(map), super.block_size };
+    submit_writes(&seg, 1);
+}
+
+int FileSystem::data_group(uint32_t blk) const {
+    if (blk < super.group_start) return -1;
+    uint32_t g = (blk - super.group_start) / super.blocks_per_group;
+    if (g >= super.group_count) return -1;
+    const myfs_group_d& gd = groups[g];
+    return blk >= gd.data_start && blk - gd.data_start < gd.data_blks ? (int)g : -1;
+}
+
+// 各组的 inode 表连续存放, 每块恰好放满整数个 inode
+uint32_t FileSystem::inode_table_blk(uint32_t ino) const {
+    return groups[ino_group(ino)].inode_start + (ino % super.inodes_per_group) / super.inode_per_block;
+}
+
+off_t FileSystem::get_inode_disk_offset(uint32_t ino) {
+    return blk_ofs(groups[ino_group(ino)].inode_start) + (off_t)(ino % super.inodes_per_group) * MYFS_INODE_DISK_SIZE;
+}
+
+// 从空闲区间索引中切出至多 want 块 (优先从 goal 开始), 由 *group 给出所在组, 无空间返回 -1.
+// 先在 goal 所在组找, 该组没有整段空间时顺次找下一个有整段空间的组, 都没有时取最长区间所在的组.
+// 每次只持有一个组的锁
+int64_t FileSystem::take_extent(uint32_t goal, uint32_t want, uint32_t* got, uint32_t* group) {
+    const uint32_t n = super.group_count;
+    uint32_t home = goal < super.group_start ? 0 : (goal - super.group_start) / super.blocks_per_group;
+    if (home >= n) home = n - 1;
+
+    int64_t start = -1;
+    uint32_t g = home, best = UINT32_MAX, best_len = 0;
+    for (uint32_t k = 0; k < n && start < 0; k++) {
+        g = (home + k) % n;
+        std::lock_guard<std::mutex> guard(group_alloc[g].lock);
+        ExtentAllocator& free = group_alloc[g].data_free;
+        uint32_t len = free.largest();
+        if (len >= want) {
+            start = free.alloc(k == 0 ? goal : groups[g].data_start, want, got);
+        } else if (len > best_len) {
+            best = g;
+            best_len = len;
         }
     }
-    
-    if (ino == -1) return nullptr;
+    if (start < 0) {
+        if (best == UINT32_MAX) return -1;
+        g = best;
+        std::lock_guard<std::mutex> guard(group_alloc[g].lock);
+        start = group_alloc[g].data_free.alloc(groups[g].data_start, want, got);
+    }
+    *group = g;
+    return start;
+}
+
+// 分配一段连续数据块, 返回起始块号, 无空间返回 -1. 空闲区间不跨组, 整段落在同一个位图块中,
+// 只写回一次; zero_fill 时新块整段清零
+int FileSystem::alloc_data_blocks(uint32_t goal, uint32_t want, uint32_t* got, bool zero_fill) {
+    uint32_t g;
+    int64_t start = take_extent(goal, want, got, &g);
+    // 没有空间时先回收已删除、尚未归还的块再试一次
+    if (start < 0 && reclaim_blocks()) start = take_extent(goal, want, got, &g);
+    if (start < 0) return -1;
+
+    myfs_group_d& gd = groups[g];
+    uint8_t* map = dbmap(g);
+    AtomicBitmap(map, gd.data_blks).set_range((uint32_t)start - gd.data_start, *got);
+    __atomic_fetch_sub(&gd.free_blocks, *got, __ATOMIC_RELAXED);
+    flush_map(g, map, gd.dbmap_blk);
+    if (!zero_fill) return (int)start;
+
+    size_t bytes = (size_t)*got << super.blk_bits;
+    IoScratch zero(device.get(), bytes);
+    std::memset(zero.data(), 0, bytes);
+    driver_write(blk_ofs((uint32_t)start), zero.data(), bytes);
+    return (int)start;
+}
+
+int FileSystem::alloc_data_block(uint32_t goal) {
+    uint32_t got;
+    return alloc_data_blocks(goal, 1, &got);
+}
+
+// 第 idx 个逻辑块的目标物理块: 紧接前面最近的已分配块; 文件还没有块时取 inode 在本组
+// 数据块中的默认位置. 格式化时按每个 inode 配 MYFS_DIRECT_BLOCKS 个数据块规划各组, 故取组内序号对应的那一段
+uint32_t FileSystem::data_goal(const myfs_inode* inode, int idx) const {
+    for (int j = idx - 1; j >= 0; j--) {
+        if (inode->block[j] != 0 && inode->block[j] != MYFS_BLK_COMPRESSED) return inode->block[j] + (idx - j);
+    }
+    const myfs_group_d& gd = groups[ino_group(inode->ino)];
+    uint64_t slot = inode->ino % super.inodes_per_group;
+    return gd.data_start + (uint32_t)((slot * MYFS_DIRECT_BLOCKS + idx) % gd.data_blks);
+}
+
+// 新 inode 所在的组: 文件跟随父目录, 与目录块、兄弟文件相邻; 目录分散到各组, 在空闲 inode
+// 与空闲块都不低于平均值的组中取目录数最少的, 自父目录所在组起找, 相同时取先找到的.
+// 没有父目录 (根目录) 时取第 0 组. 各组都没有空闲 inode 时返回 UINT32_MAX
+uint32_t FileSystem::pick_group(const myfs_inode* parent, bool is_dir) const {
+    const uint32_t n = super.group_count;
+    const uint32_t home = parent ? ino_group(parent->ino) : 0;
+    if (!parent || !is_dir) {
+        for (uint32_t k = 0; k < n; k++) {
+            uint32_t g = (home + k) % n;
+            if (__atomic_load_n(&groups[g].free_inodes, __ATOMIC_RELAXED) > 0) return g;
+        }
+        return UINT32_MAX;
+    }
+
+    // 计数可能正被其他线程增减, 只读一次快照, 放置策略不要求精确
+    std::vector<myfs_group_d> snap(n);
+    uint64_t free_inodes = 0, free_blocks = 0;
+    for (uint32_t g = 0; g < n; g++) {
+        snap[g].free_inodes = __atomic_load_n(&groups[g].free_inodes, __ATOMIC_RELAXED);
+        snap[g].free_blocks = __atomic_load_n(&groups[g].free_blocks, __ATOMIC_RELAXED);
+        snap[g].dirs = __atomic_load_n(&groups[g].dirs, __ATOMIC_RELAXED);
+        free_inodes += snap[g].free_inodes;
+        free_blocks += snap[g].free_blocks;
+    }
+    uint32_t best = UINT32_MAX;
+    bool best_roomy = false;
+    for (uint32_t k = 0; k < n; k++) {
+        uint32_t g = (home + k) % n;
+        const myfs_group_d& gd = snap[g];
+        if (gd.free_inodes == 0) continue;
+        bool roomy = (uint64_t)gd.free_inodes * n >= free_inodes && (uint64_t)gd.free_blocks * n >= free_blocks;
+        if (best == UINT32_MAX || (roomy && !best_roomy) ||
+            (roomy == best_roomy && gd.dirs < snap[best].dirs)) {
+            best = g;
+            best_roomy = roomy;
+        }
+    }
+    return best;
+}
+
+// 线程在第 g 组中下一次开始找空闲 inode 的位置. 线程第一次分配时按序领取槽位,
+// 各槽位的起点在组内相隔 MYFS_CURSOR_SPREAD 个 inode, 并发创建的线程各自从不同的字开始认领
+static const uint32_t MYFS_CURSOR_SPREAD = 512;
+
+uint32_t& FileSystem::ino_cursor(uint32_t g) {
+    struct Cursors {
+        uint32_t slot;
+        uint64_t gen;
+        std::vector<uint32_t> next;
+    };
+    static std::atomic<uint32_t> next_slot{0};
+    thread_local Cursors cur = { next_slot++, 0, {} };
+    if (cur.gen != mount_gen) {
+        cur.gen = mount_gen;
+        cur.next.assign(super.group_count, UINT32_MAX);
+    }
+    if (cur.next[g] == UINT32_MAX) {
+        cur.next[g] = (uint32_t)((uint64_t)cur.slot * MYFS_CURSOR_SPREAD % super.inodes_per_group) & ~63u;
+    }
+    return cur.next[g];
+}
+
+myfs_inode* FileSystem::alloc_inode(myfs_dentry *dentry, bool is_dir, const myfs_inode* parent) {
+    uint32_t g = pick_group(parent, is_dir);
+    if (g == UINT32_MAX) return nullptr;
+
+    // 从本线程的游标起原子认领空闲位; 选中的组恰被其他线程占满时顺延到下一组.
+    // 根目录从第 0 组的第 0 位开始, 保证其 ino 为 MYFS_ROOT_INO
+    int64_t bit = -1;
+    for (uint32_t k = 0; k < super.group_count && bit < 0; k++) {
+        uint32_t gg = (g + k) % super.group_count;
+        uint32_t& cursor = ino_cursor(gg);
+        bit = AtomicBitmap(ibmap(gg), super.inodes_per_group).claim(parent ? cursor : 0);
+        if (bit >= 0) {
+            g = gg;
+            cursor = (uint32_t)bit + 1;
+        }
+    }
+    if (bit < 0) return nullptr;
+    int ino = (int)(g * super.inodes_per_group + bit);
+    __atomic_fetch_sub(&groups[g].free_inodes, 1, __ATOMIC_RELAXED);
+    if (is_dir) __atomic_fetch_add(&groups[g].dirs, 1, __ATOMIC_RELAXED);
     
     // 写回 Bitmap
-    driver_write(super.ibmap_start * MYFS_BLK_SIZE, super.map_inode, MYFS_BLK_SIZE);
+    flush_map(g, ibmap(g), groups[g].ibmap_blk);
     
     myfs_inode *inode = new myfs_inode();
     *inode = {};
     inode->ino = ino;
     inode->mode = is_dir ? (S_IFDIR | 0755) : (S_IFREG | 0644);
-    inode->link_count = 1;
-    inode->dentry = dentry;
+    inode->link_count = is_dir ? 2 : 1;     // 目录另计自身的 "."; 子目录的 ".." 由 mkdir 计入
     inode->atime = inode->mtime = inode->ctime = time(NULL);
-    
-    dentry->inode = inode;
-    dentry->ino = ino;
+    cache_add(inode);
+    attach_inode(dentry, inode);
     return inode;
 }
 
@@ -147,18 +445,43 @@ myfs_dentry* FileSystem::new_dentry(std::string fname, FileType ftype) {
     
     dentry->ftype = ftype;
     dentry->ino = -1;
+    icache.dentries++;
     return dentry; 
 }
 
+// 挂到子项链表头部. cookie 在目录内递增, 因此链表自头向尾 cookie 递减
+void FileSystem::link_child(myfs_inode* dir, myfs_dentry* child) {
+    child->parent = dir->dentry;
+    child->brother = dir->first_child;
+    child->cookie = ++dir->next_cookie;
+    dir->first_child = child;
+    dir->child_by_name[child->fname] = child;
+}
+
+// 挂入父目录; 索引目录立即写入磁盘, 线性目录由 sync_inode 整体写回, 写满时转为索引目录.
+// 失败时 dentry 不挂入父目录
 int FileSystem::alloc_dentry(myfs_inode *parent, myfs_dentry *dentry) {
     if (!parent) return -1;
-    dentry->parent = parent->dentry;
-    dentry->brother = parent->first_child;
-    parent->first_child = dentry;
-    
-    // 更新父目录大小
-    parent->size += sizeof(struct myfs_dentry_d);
-    return 0;
+    link_child(parent, dentry);
+    parent->dir_entries++;
+
+    int ret = MYFS_ERROR_NONE;
+    if (is_indexed(parent)) {
+        bool is_dir = dentry->inode ? MYFS_IS_DIR(dentry->inode) : dentry->ftype == FileType::DIR;
+        ret = dx_insert(parent, dentry->fname, dentry->ino, is_dir);
+    } else if (parent->dir_entries > MYFS_DIRECT_BLOCKS * (super.block_size / sizeof(struct myfs_dentry_d))) {
+        ret = dx_convert(parent);
+    } else {
+        // 更新父目录大小
+        parent->size += sizeof(struct myfs_dentry_d);
+    }
+
+    if (ret != MYFS_ERROR_NONE) {
+        parent->first_child = dentry->brother;
+        parent->child_by_name.erase(dentry->fname);
+        parent->dir_entries--;
+    }
+    return ret;
 }
 
 myfs_dentry* FileSystem::lookup(const std::string& path, bool *is_find, bool *is_root) {
@@ -179,22 +502,22 @@ myfs_dentry* FileSystem::lookup(const std::string& path, bool *is_find, bool *is
 
         found = false;
         
-        if (current->inode == nullptr) {
-            current->inode = read_inode(current->ino);
-            if (current->inode) {
-                current->inode->dentry = current;
-            }
-        }
+        if (current->inode == nullptr) load_inode(current);
+        cache_touch(current->inode);
         
         if (current->inode && MYFS_IS_DIR(current->inode)) {
-            struct myfs_dentry *child = current->inode->first_child;
-            while (child) {
-                if (child->fname == token) {
+            auto it = current->inode->child_by_name.find(token);
+            if (it != current->inode->child_by_name.end()) {
+                current = it->second;
+                found = true;
+            }
+            // 索引目录只缓存了部分子项, 未命中时按哈希到磁盘上查找
+            if (!found && is_indexed(current->inode)) {
+                struct myfs_dentry *child = dx_lookup(current->inode, token);
+                if (child) {
                     current = child;
                     found = true;
-                    break;
                 }
-                child = child->brother;
             }
         }
         
@@ -204,6 +527,10 @@ myfs_dentry* FileSystem::lookup(const std::string& path, bool *is_find, bool *is
             return nullptr;
         }
     }
+
+    // 末端的 inode 可能已被缓存回收, 调用者都要用到, 一并载入
+    if (current->inode == nullptr) load_inode(current);
+    cache_touch(current->inode);
     
     *is_find = found;
     *is_root = false;
@@ -214,71 +541,138 @@ myfs_dentry* FileSystem::lookup(const std::string& path, bool *is_find, bool *is
 // Inode 同步与读取
 // =================================================================
 
+// 目录项链表按顺序打包进目录块, 缺少的块随写随分配; 块缓冲区加入 segs 由调用者提交
+template <class G>
+void FileSystem::pack_dir_blocks(myfs_inode* inode, std::byte* scratch, std::vector<IoSeg>& segs) {
+    struct myfs_dentry *child = inode->first_child;
+    int blk_cnt = 0;
+
+    // 遍历所有子目录项
+    while (child && blk_cnt < MYFS_DIRECT_BLOCKS) {
+        // 确保当前数据块已分配
+        if (inode->block[blk_cnt] == 0) {
+            int new_blk = alloc_data_block(data_goal(inode, blk_cnt));
+            if (new_blk == -1) break; // 没有空间
+            inode->block[blk_cnt] = new_blk;
+        }
+
+        // 准备当前数据块的缓冲区 (就地访问时直接写映射)
+        off_t blk_ofs = G::offset(inode->block[blk_cnt]);
+        std::byte* buf = (std::byte*)in_place(blk_ofs);
+        if (!buf) {
+            buf = scratch + blk_cnt * G::size;
+            segs.push_back({ blk_ofs, buf, G::size });
+        }
+        std::memset(buf, 0, G::size);
+        struct myfs_dentry_d *dentry_ptr = (struct myfs_dentry_d *)buf;
+
+        // 填充当前数据块
+        for (uint32_t entries_in_block = 0; child && entries_in_block < G::dentries_per_block; entries_in_block++) {
+            // 确定文件类型
+            bool is_dir = child->inode ? MYFS_IS_DIR(child->inode) : child->ftype == FileType::DIR;
+            pack_dentry(dentry_ptr[entries_in_block], child->fname, child->ino, is_dir);
+            child->slot = blk_cnt * G::dentries_per_block + entries_in_block;
+            child = child->brother;
+        }
+
+        blk_cnt++;
+    }
+
+    // 目录缩小后多出的块释放掉, 否则重新载入时会读到其中残留的目录项
+    for (int i = blk_cnt; i < MYFS_DIRECT_BLOCKS; i++) {
+        if (inode->block[i] == 0) continue;
+        free_data_block(inode->block[i]);
+        inode->block[i] = 0;
+    }
+
+    // 更新目录大小
+    inode->size = blk_cnt * G::size;
+}
+
+// 所有目录块一次批量读入 (就地访问时直接解析映射), 反向构建目录项链表
+template <class G>
+void FileSystem::load_dir_blocks(myfs_inode* inode) {
+    IoScratch bufs(device.get(), meta_in_place ? 0 : MYFS_DIRECT_BLOCKS * G::size);
+    const std::byte* blocks[MYFS_DIRECT_BLOCKS] = {};
+    std::vector<IoSeg> segs;
+    for (int blk_cnt = 0; blk_cnt < MYFS_DIRECT_BLOCKS; blk_cnt++) {
+        if (inode->block[blk_cnt] == 0) continue;
+        off_t blk_ofs = G::offset(inode->block[blk_cnt]);
+        blocks[blk_cnt] = (const std::byte*)in_place(blk_ofs);
+        if (!blocks[blk_cnt]) {
+            blocks[blk_cnt] = bufs.data() + blk_cnt * G::size;
+            segs.push_back({ blk_ofs, bufs.data() + blk_cnt * G::size, G::size });
+        }
+    }
+    driver_read_batch(segs.data(), (int)segs.size());
+
+    //从所有数据块读取目录项
+    uint32_t entries = 0;
+    for (int blk_cnt = 0; blk_cnt < MYFS_DIRECT_BLOCKS; blk_cnt++) {
+        if (inode->block[blk_cnt] == 0) continue;
+
+        const struct myfs_dentry_d *dentry_ptr = (const struct myfs_dentry_d *)blocks[blk_cnt];
+
+        //反向构建链表
+        for (int i = G::dentries_per_block - 1; i >= 0; i--) {
+            if (dentry_ptr[i].fname[0] == '\0') continue;
+
+            FileType type = (dentry_ptr[i].file_type == 1) ? FileType::DIR : FileType::REG_FILE;
+            //构造 string 对象传递给 new_dentry
+            std::string fname_str(dentry_ptr[i].fname);
+            struct myfs_dentry *child = new_dentry(fname_str, type);
+            child->ino = dentry_ptr[i].ino;
+            child->slot = blk_cnt * G::dentries_per_block + i;
+            link_child(inode, child);
+            entries++;
+        }
+    }
+    inode->dir_entries = entries;
+}
+
+// 整棵子树的目录块与 inode 记录先入队, 返回前按偏移排序合并后一次下发
 void FileSystem::sync_inode(myfs_inode *inode) {
     if (!inode) return;
+    IoPlug plug(*this);
 
     if (MYFS_IS_DIR(inode)) {
-        // 处理目录项写入数据块
-        struct myfs_dentry *child = inode->first_child;
-        int blk_cnt = 0;
-        int entries_in_block = 0;
-        int max_entries_per_block = MYFS_BLK_SIZE / sizeof(struct myfs_dentry_d);
-        
-        // 遍历所有子目录项
-        while (child && blk_cnt < MYFS_DIRECT_BLOCKS) {
-            // 确保当前数据块已分配
-            if (inode->block[blk_cnt] == 0) {
-                int new_blk = alloc_data_block();
-                if (new_blk == -1) break; // 没有空间
-                inode->block[blk_cnt] = new_blk;
-            }
-            
-            // 准备当前数据块的缓冲区
-            std::vector<std::byte> buf(MYFS_BLK_SIZE);
-            struct myfs_dentry_d *dentry_ptr = (struct myfs_dentry_d *)buf.data();
-            entries_in_block = 0;
-            
-            // 填充当前数据块
-            while (child && entries_in_block < max_entries_per_block) {
-                dentry_ptr[entries_in_block].ino = child->ino;
-                dentry_ptr[entries_in_block].reclen = sizeof(struct myfs_dentry_d);
-                
-                size_t name_len = child->fname.length();
-                if (name_len >= MYFS_MAX_FILE_NAME) name_len = MYFS_MAX_FILE_NAME - 1;
-                dentry_ptr[entries_in_block].namelen = name_len;
-                
-                // 确定文件类型
-                if (child->inode) {
-                    dentry_ptr[entries_in_block].file_type = MYFS_IS_DIR(child->inode) ? 1 : 0;
-                } else {
-                    dentry_ptr[entries_in_block].file_type = (child->ftype == FileType::DIR) ? 1 : 0;
-                }
-                
-                std::memset(dentry_ptr[entries_in_block].fname, 0, MYFS_MAX_FILE_NAME);
-                std::strncpy(dentry_ptr[entries_in_block].fname, child->fname.c_str(), name_len);
-                
-                entries_in_block++;
-                child = child->brother;
-            }
-            
-            // 写入当前数据块
-            driver_write(inode->block[blk_cnt] * MYFS_BLK_SIZE, buf.data(), MYFS_BLK_SIZE);
-            blk_cnt++;
-        }
-        
-        // 更新目录大小
-        inode->size = blk_cnt * MYFS_BLK_SIZE;
-        
         // 递归同步子节点
-        child = inode->first_child;
+        struct myfs_dentry *child = inode->first_child;
         while (child) {
             if (child->inode) sync_inode(child->inode);
             child = child->brother;
         }
     }
+    write_inode(inode);
+}
+
+void FileSystem::write_inode(myfs_inode *inode) {
+    if (!inode) return;
+
+    // 目录数据块与 inode 记录一起提交
+    std::vector<IoSeg> segs;
+    IoScratch dir_bufs(device.get(), MYFS_IS_DIR(inode) && !is_indexed(inode) && !meta_in_place ?
+                                     MYFS_DIRECT_BLOCKS * super.block_size : 0);
+
+    if (MYFS_IS_DIR(inode) && !is_indexed(inode)) {
+        // 处理目录项写入数据块 (索引目录的目录项已在增删时写入)
+        with_geometry(super.block_size, [&](auto geo) {
+            pack_dir_blocks<decltype(geo)>(inode, dir_bufs.data(), segs);
+        });
+    }
 
     // 同步inode元数据
-    struct myfs_inode_d inode_d = {};
+    struct myfs_inode_d inode_buf;
+    pack_inode_record(inode, inode_buf, segs);
+    driver_write_batch(segs.data(), (int)segs.size());
+}
+
+// inode 记录就地访问时直接写在映射中, 否则写入 buf 并加入 segs
+void FileSystem::pack_inode_record(const myfs_inode* inode, myfs_inode_d& buf, std::vector<IoSeg>& segs) {
+    off_t offset = get_inode_disk_offset(inode->ino);
+    struct myfs_inode_d* inode_ptr = (struct myfs_inode_d*)in_place(offset);
+    struct myfs_inode_d& inode_d = inode_ptr ? *inode_ptr : buf;
+    inode_d = {};
     inode_d.ino = inode->ino;
     inode_d.mode = inode->mode;
     inode_d.size = inode->size;
@@ -289,20 +683,107 @@ void FileSystem::sync_inode(myfs_inode *inode) {
     inode_d.mtime = inode->mtime;
     inode_d.ctime = inode->ctime;
     std::memcpy(inode_d.block, inode->block, sizeof(inode->block));
+    inode_d.flags = inode->flags;
+    inode_d.dir_entries = inode->dir_entries;
 
-    int offset = get_inode_disk_offset(inode->ino);
-    driver_write(offset, (uint8_t *)&inode_d, sizeof(struct myfs_inode_d));
+    if (!inode_ptr) segs.push_back({ offset, &inode_d, sizeof(struct myfs_inode_d) });
 }
 
-myfs_inode* FileSystem::read_inode(uint32_t ino) {
+// 线性目录中没有子项占用的最小槽位; 有子项槽位未知或已满时返回 -1
+int FileSystem::dir_free_slot(const myfs_inode* dir) const {
+    std::vector<bool> used(MYFS_DIRECT_BLOCKS * (super.block_size / sizeof(struct myfs_dentry_d)));
+    for (const myfs_dentry* c = dir->first_child; c; c = c->brother) {
+        if (c->slot < 0 || (size_t)c->slot >= used.size()) return -1;
+        used[c->slot] = true;
+    }
+    for (size_t i = 0; i < used.size(); i++) {
+        if (!used[i]) return (int)i;
+    }
+    return -1;
+}
+
+// 线性目录中只有 slots 处的目录项有变动时, 按内存中各子项的槽位重新生成这些槽位所在的块, 连同
+// inode 记录一起提交, 其余目录块不动. 索引目录只写 inode 记录; 有槽位未知时退回 write_inode 整体重写
+void FileSystem::write_dir_slots(myfs_inode* dir, const int* slots, int count) {
+    if (is_indexed(dir)) {
+        write_inode(dir);
+        return;
+    }
+    const int per_block = (int)(super.block_size / sizeof(struct myfs_dentry_d));
+    bool dirty[MYFS_DIRECT_BLOCKS] = {};
+    for (int i = 0; i < count; i++) {
+        if (slots[i] < 0 || slots[i] >= MYFS_DIRECT_BLOCKS * per_block) {
+            write_inode(dir);
+            return;
+        }
+        dirty[slots[i] / per_block] = true;
+    }
+    for (const myfs_dentry* c = dir->first_child; c; c = c->brother) {
+        if (c->slot < 0) {
+            write_inode(dir);
+            return;
+        }
+    }
+
+    std::vector<IoSeg> segs;
+    IoScratch dir_bufs(device.get(), meta_in_place ? 0 : count * super.block_size);
+    int used = 0;
+    for (int b = 0; b < MYFS_DIRECT_BLOCKS; b++) {
+        if (!dirty[b]) continue;
+        if (dir->block[b] == 0) {
+            int new_blk = alloc_data_block(data_goal(dir, b));
+            if (new_blk == -1) {
+                write_inode(dir);
+                return;
+            }
+            dir->block[b] = new_blk;
+        }
+        off_t ofs = blk_ofs(dir->block[b]);
+        std::byte* buf = (std::byte*)in_place(ofs);
+        if (!buf) {
+            buf = dir_bufs.data() + (used++) * super.block_size;
+            segs.push_back({ ofs, buf, super.block_size });
+        }
+        std::memset(buf, 0, super.block_size);
+        struct myfs_dentry_d* ents = (struct myfs_dentry_d*)buf;
+        for (const myfs_dentry* c = dir->first_child; c; c = c->brother) {
+            if (c->slot / per_block != b) continue;
+            bool is_dir = c->inode ? MYFS_IS_DIR(c->inode) : c->ftype == FileType::DIR;
+            pack_dentry(ents[c->slot % per_block], c->fname, c->ino, is_dir);
+        }
+    }
+
+    // 目录大小按已分配的目录块计, 与整体重写一致; 变空的块留到下次整体重写时释放
+    uint32_t blks = 0;
+    while (blks < MYFS_DIRECT_BLOCKS && dir->block[blks] != 0) blks++;
+    dir->size = blks * super.block_size;
+
+    struct myfs_inode_d inode_buf;
+    pack_inode_record(dir, inode_buf, segs);
+    driver_write_batch(segs.data(), (int)segs.size());
+}
+
+myfs_inode* FileSystem::load_inode(myfs_dentry* dentry) {
+    uint32_t ino = dentry->ino;
     if (ino >= super.inode_count) return nullptr;
+    if (myfs_inode* inode = itab_get(ino)) {
+        attach_inode(dentry, inode);
+        return inode;
+    }
     
+    off_t offset = get_inode_disk_offset(ino);
+    struct myfs_inode_d inode_buf;
+    const struct myfs_inode_d* inode_ptr = (const struct myfs_inode_d*)in_place(offset);
+    if (!inode_ptr) {
+        driver_read(offset, (uint8_t *)&inode_buf, sizeof(struct myfs_inode_d));
+        inode_ptr = &inode_buf;
+    }
+    return build_inode(*inode_ptr, dentry);
+}
+
+// 由磁盘记录构造内存 inode, 放入 inode 表并挂到 dentry. 调用者已确认表中没有这个 ino
+myfs_inode* FileSystem::build_inode(const myfs_inode_d& inode_d, myfs_dentry* dentry) {
     myfs_inode *inode = new myfs_inode();
-    *inode = {};
-    
-    struct myfs_inode_d inode_d;
-    int offset = get_inode_disk_offset(ino);
-    driver_read(offset, (uint8_t *)&inode_d, sizeof(struct myfs_inode_d));
     
     inode->ino = inode_d.ino;
     inode->mode = inode_d.mode;
@@ -314,151 +795,358 @@ myfs_inode* FileSystem::read_inode(uint32_t ino) {
     inode->mtime = inode_d.mtime;
     inode->ctime = inode_d.ctime;
     std::memcpy(inode->block, inode_d.block, sizeof(inode->block));
+    inode->flags = inode_d.flags;
+    inode->dir_entries = inode_d.dir_entries;
+    cache_add(inode);
+    attach_inode(dentry, inode);
+    if (dentry->evicted) {
+        icache.reloads++;
+        dentry->evicted = false;
+    }
     
-    if (MYFS_IS_DIR(inode)) {
-        //从所有数据块读取目录项
-        for (int blk_cnt = 0; blk_cnt < MYFS_DIRECT_BLOCKS; blk_cnt++) {
-            if (inode->block[blk_cnt] == 0) continue;
-            
-            std::vector<std::byte> buf(MYFS_BLK_SIZE);
-            driver_read(inode->block[blk_cnt] * MYFS_BLK_SIZE, buf.data(), MYFS_BLK_SIZE);
-            
-            struct myfs_dentry_d *dentry_ptr = (struct myfs_dentry_d *)buf.data();
-            int max_entries = MYFS_BLK_SIZE / sizeof(struct myfs_dentry_d);
-            
-            //反向构建链表
-            for (int i = max_entries - 1; i >= 0; i--) {
-                if (dentry_ptr[i].fname[0] == '\0') continue;
-                
-                FileType type = (dentry_ptr[i].file_type == 1) ? FileType::DIR : FileType::REG_FILE;
-                //构造 string 对象传递给 new_dentry
-                std::string fname_str(dentry_ptr[i].fname);
-                struct myfs_dentry *child = new_dentry(fname_str, type);
-                child->ino = dentry_ptr[i].ino;
-                child->brother = inode->first_child;
-                inode->first_child = child;
-            }
+    // 线性目录整体载入; 索引目录按需查找
+    if (MYFS_IS_DIR(inode) && !is_indexed(inode)) {
+        with_geometry(super.block_size, [&](auto geo) { load_dir_blocks<decltype(geo)>(inode); });
+    }
+    // 旧镜像中目录的 link_count 恒为 1: 线性目录按子目录数补正, 索引目录只补到 2 (由 myfs-fsck --repair
+    // 修正), 随下次写回落盘
+    if (MYFS_IS_DIR(inode) && inode->link_count < 2) {
+        inode->link_count = 2;
+        for (myfs_dentry* c = inode->first_child; c && !is_indexed(inode); c = c->brother) {
+            if (c->ftype == FileType::DIR) inode->link_count++;
         }
     }
     return inode;
 }
 
+// 子目录移出或删除时父目录的 link_count 减一; 不低于 2, 以免补正前的旧计数减到 0
+static void drop_dir_link(myfs_inode* dir) {
+    if (dir->link_count > 2) dir->link_count--;
+}
+
+// 为一批尚未载入 inode 的子项一次读入 inode 记录: 按 ino 排序即按 inode 表块排序,
+// 每个用到的表块只读一次, 相邻的表块合并为一段, 各段一起提交. 已在 inode 表中的直接共用
+void FileSystem::prefetch_inodes(std::vector<myfs_dentry*>& children) {
+    children.erase(std::remove_if(children.begin(), children.end(), [&](myfs_dentry* d) {
+        if (!d->inode && d->ino < super.inode_count) {
+            if (myfs_inode* inode = itab_get(d->ino)) attach_inode(d, inode);
+        }
+        return d->inode || d->ino >= super.inode_count;
+    }), children.end());
+    if (children.empty()) return;
+    std::sort(children.begin(), children.end(),
+              [](const myfs_dentry* a, const myfs_dentry* b) { return a->ino < b->ino; });
+
+    // 各组的表按组号依次排列, ino 升序时表块号也升序
+    std::vector<uint32_t> blks;     // 用到的表块
+    for (myfs_dentry* d : children) {
+        uint32_t b = inode_table_blk(d->ino);
+        if (blks.empty() || blks.back() != b) blks.push_back(b);
+    }
+
+    IoScratch bufs(device.get(), meta_in_place ? 0 : blks.size() * super.block_size);
+    std::vector<const std::byte*> blk_data(blks.size());
+    std::vector<IoSeg> segs;
+    for (size_t i = 0; i < blks.size(); i++) {
+        if (meta_in_place) {
+            blk_data[i] = (const std::byte*)in_place(blk_ofs(blks[i]));
+            continue;
+        }
+        blk_data[i] = bufs.data() + (i << super.blk_bits);
+        if (i > 0 && blks[i] == blks[i - 1] + 1) segs.back().size += super.block_size;
+        else segs.push_back({ blk_ofs(blks[i]), bufs.data() + (i << super.blk_bits), super.block_size });
+    }
+    if (driver_read_batch(segs.data(), (int)segs.size()) != MYFS_ERROR_NONE) return;
+
+    const uint32_t per_block = super.inode_per_block;
+    size_t k = 0;
+    for (myfs_dentry* d : children) {
+        while (blks[k] != inode_table_blk(d->ino)) k++;
+        const struct myfs_inode_d* recs = (const struct myfs_inode_d*)blk_data[k];
+        build_inode(recs[d->ino % per_block], d);
+    }
+}
+
 // =================================================================
 // 挂载/格式化
 // =================================================================
 
-void FileSystem::mount(const char* device) {
-    super.driver_fd = ddriver_open(const_cast<char*>(device));
+// 布局: 超级块 | 组描述符表 | 块组 0 | 块组 1 | ...; 每组为 inode 位图 | 数据位图 | inode 表 | 数据块,
+// 至多 8 × 块大小 个块 (一个位图块的位数); 带 --dedup 格式化时 inode 表之后另有去重表.
+// 每个 inode 块配 inodes_per_block × MYFS_DIRECT_BLOCKS 个数据块 (1KB 块时为 1 : 48), 各组 inode 数相同;
+// 末尾放不下一组的块不用
+template <class G>
+int FileSystem::format_layout() {
+    super.block_size = G::size;
+    super.blk_bits = G::bits;
+    super.inode_per_block = G::inodes_per_block;
+
+    const uint32_t dev_blocks = device->size() >> G::bits;
+    const uint32_t bpg = G::size * 8;
+    const uint32_t ratio = 1 + MYFS_DIRECT_BLOCKS * G::inodes_per_block;
+    if (dev_blocks < 6) return -MYFS_ERROR_NOSPACE;
+
+    // 描述符表按不扣除自身时的组数估算, 至多多出一项
+    uint32_t gdt_blks = (uint32_t)((((uint64_t)dev_blocks + bpg - 2) / bpg * sizeof(myfs_group_d) + G::size - 1) / G::size);
+    uint32_t avail = dev_blocks - 1 - gdt_blks;
+    uint32_t group_count = (avail + bpg - 1) / bpg;
+
+    // 每组 inode 块数按整组 (只有一组时按实际大小) 计算; 最后一组放不下 inode 表与至少一个数据块时舍去
+    uint32_t inode_blks = std::max(1u, (std::min(avail, bpg) - 2) / ratio);
+    uint32_t dedup_blks = 0;
+    if (options.dedup && std::min(avail, bpg) > 2 + inode_blks) {
+        dedup_blks = myfs_dedup_blks(G::size, std::min(avail, bpg) - 2 - inode_blks);
+    }
+    uint32_t last = avail - (group_count - 1) * bpg;
+    if (last < 2 + inode_blks + dedup_blks + 1) {
+        if (group_count == 1) return -MYFS_ERROR_NOSPACE;
+        group_count--;
+        last = bpg;
+    }
 
-    struct myfs_super_d super_d_disk;
-    driver_read(MYFS_SUPER_OFS, (uint8_t *)&super_d_disk, sizeof(struct myfs_super_d));
+    super.gdt_start = 1;
+    super.gdt_blks = gdt_blks;
+    super.group_start = 1 + gdt_blks;
+    super.group_count = group_count;
+    super.blocks_per_group = bpg;
+    super.inodes_per_group = inode_blks * G::inodes_per_block;
+    super.total_blocks = super.group_start + (group_count - 1) * bpg + last;
+    super.inode_count = super.inodes_per_group * group_count;
+    super.features = options.dedup ? MYFS_FEATURE_DEDUP : 0;
+    super.dedup_blks_per_group = dedup_blks;
+    return MYFS_ERROR_NONE;
+}
 
-    myfs_dentry* root_dentry = new_dentry("/",FileType::DIR);
-    myfs_inode* root_inode;
+void FileSystem::pack_super(struct myfs_super_d& super_d) const {
+    super_d = {};
+    super_d.magic_num = MYFS_MAGIC_NUM;
+    super_d.block_size = super.block_size;
+    super_d.total_blocks = super.total_blocks;
+    super_d.inode_count = super.inode_count;
+    super_d.inode_per_block = super.inode_per_block;
 
-    if (super_d_disk.magic_num != MYFS_MAGIC_NUM) {
-        
-        // ==================== 格式化分支 (Format Path) ====================
-        super.magic_num = MYFS_MAGIC_NUM;
-        super.block_size = MYFS_BLK_SIZE;
+    super_d.gdt_start = super.gdt_start;
+    super_d.gdt_blks = super.gdt_blks;
+    super_d.group_start = super.group_start;
+    super_d.group_count = super.group_count;
+    super_d.blocks_per_group = super.blocks_per_group;
+    super_d.inodes_per_group = super.inodes_per_group;
+    super_d.inode_blks_per_group = super.inodes_per_group / super.inode_per_block;
+    for (const myfs_group_d& gd : groups) super_d.data_blks += gd.data_blks;
 
-        int dev_size = 0;
-        ddriver_ioctl(super.driver_fd, IOC_REQ_DEVICE_SIZE, &dev_size);
-        //计算总块数
-        super.total_blocks = dev_size / MYFS_BLK_SIZE;
+    super_d.root_ino = MYFS_ROOT_INO;
+    super_d.features = super.features;
+    super_d.dedup_blks_per_group = super.dedup_blks_per_group;
+}
 
-        //布局规划 目前最大支持8MB
-        int reserved_reserved = 1; // Superblock
-        int ibmap_blks = 1;
-        int dbmap_blks = 1;
-        
-        int fixed_overhead = reserved_reserved + ibmap_blks + dbmap_blks;
-        int available_blocks = super.total_blocks - fixed_overhead;
+// 组描述符表 (表尾不足一块的部分清零) 与各组位图加入 segs, 由调用者与超级块一起提交.
+// 就地访问时描述符表直接写入映射, 位图本就在映射中
+void FileSystem::group_meta_segs(std::vector<uint8_t>& gdt_buf, std::vector<IoSeg>& segs) {
+    size_t size = (size_t)super.gdt_blks << super.blk_bits;
+    uint8_t* table = in_place(blk_ofs(super.gdt_start));
+    if (!table) {
+        gdt_buf.resize(size);
+        table = gdt_buf.data();
+    }
+    std::memset(table, 0, size);
+    std::memcpy(table, groups.data(), groups.size() * sizeof(myfs_group_d));
+    if (meta_in_place) return;
+
+    segs.push_back({ blk_ofs(super.gdt_start), table, size });
+    for (uint32_t g = 0; g < super.group_count; g++) {
+        segs.push_back({ blk_ofs(groups[g].ibmap_blk), ibmap(g), super.block_size });
+        segs.push_back({ blk_ofs(groups[g].dbmap_blk), dbmap(g), super.block_size });
+    }
+}
 
-        //一个索引块存储8个索引节点，每个节点指向6个块，一共49块
-        int inode_blks = available_blocks / 49;
+static uint32_t count_free_bits(const uint8_t* map, uint32_t nbits) {
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < nbits; i++) used += (map[i / 8] >> (i % 8)) & 1;
+    return nbits - used;
+}
+
+// 簇缓存的内存上限, 挂载时按块大小折算为簇数
+static const size_t MYFS_CLUSTER_CACHE_BYTES = 4 << 20;
+
+int FileSystem::mount(const CustomOptions& opts) {
+    options = opts;
+    mount_gen++;
+
+    device = make_block_device(opts);
+    if (!device) {
+        std::cerr << "myfs: unknown backend '" << opts.backend << "'" << std::endl;
+        return -MYFS_ERROR_INVAL;
+    }
+    if (device->open(opts.device) != MYFS_ERROR_NONE) {
+        std::cerr << "myfs: cannot open device '" << opts.device << "'" << std::endl;
+        device.reset();
+        return -MYFS_ERROR_IO;
+    }
+
+    meta_in_place = device->mapped() != nullptr;
+
+    // 超级块固定 1KB 位于设备起始, 读取时无需知道块大小
+    struct myfs_super_d super_buf;
+    const struct myfs_super_d* super_ptr = (const struct myfs_super_d*)in_place(MYFS_SUPER_OFS);
+    if (!super_ptr) {
+        driver_read(MYFS_SUPER_OFS, (uint8_t *)&super_buf, sizeof(struct myfs_super_d));
+        super_ptr = &super_buf;
+    }
+    const struct myfs_super_d& super_d_disk = *super_ptr;
+
+    auto fail = [&](int err) {
+        device->close();
+        device.reset();
+        groups.clear();
+        group_alloc.reset();
+        meta_in_place = false;
+        return err;
+    };
+
+    if (super_d_disk.magic_num != MYFS_MAGIC_NUM) {
         
-        // 设置起始位置
-        super.ibmap_start = 1;
-        super.dbmap_start = 1 + ibmap_blks;
-        super.inode_start = 1 + ibmap_blks + dbmap_blks; 
-        super.data_start  = super.inode_start + inode_blks;
+        // ==================== 格式化分支 (Format Path) ====================
+        uint32_t block_size = opts.block_size ? opts.block_size : MYFS_DEF_BLK_SIZE;
+        if (!myfs_valid_block_size(block_size)) {
+            std::cerr << "myfs: unsupported block size " << block_size << " (1024, 4096 or 16384)" << std::endl;
+            return fail(-MYFS_ERROR_INVAL);
+        }
+        super.magic_num = MYFS_MAGIC_NUM;
+        int ret = with_geometry(block_size, [&](auto geo) { return format_layout<decltype(geo)>(); });
+        if (ret != MYFS_ERROR_NONE) {
+            std::cerr << "myfs: device too small for block size " << block_size << std::endl;
+            return fail(ret);
+        }
 
-        // 填写统计信息
-        super.inode_count = inode_blks * MYFS_INODE_PER_BLOCK;
-        super.inode_per_block = MYFS_INODE_PER_BLOCK;
+        // 各组描述符由布局推出, 计数从全空开始
+        struct myfs_super_d new_super_d;
+        pack_super(new_super_d);
+        groups.resize(super.group_count);
+        group_alloc.reset(new GroupAlloc[super.group_count]);
+        for (uint32_t g = 0; g < super.group_count; g++) {
+            groups[g] = myfs_group_layout(new_super_d, g);
+            groups[g].free_inodes = super.inodes_per_group;
+            groups[g].free_blocks = groups[g].data_blks;
+        }
+        pack_super(new_super_d);
 
         //分配并清零位图
-        super.map_inode = new uint8_t[MYFS_BLK_SIZE * ibmap_blks](); 
-        super.map_data = new uint8_t[MYFS_BLK_SIZE * dbmap_blks]();
+        size_t map_size = (size_t)super.group_count << super.blk_bits;
+        if (!meta_in_place) {
+            super.map_inode = new uint8_t[map_size]();
+            super.map_data = new uint8_t[map_size]();
+        }
+        for (uint32_t g = 0; g < super.group_count; g++) {
+            std::memset(ibmap(g), 0, super.block_size);
+            std::memset(dbmap(g), 0, super.block_size);
+            group_alloc[g].data_free.add_map(dbmap(g), groups[g].data_blks, groups[g].data_start);
+        }
+        size_t dedup_size = (size_t)super.dedup_blks_per_group << super.blk_bits;
+        if (dedup_size && !meta_in_place) super.map_dedup = new uint8_t[dedup_size * super.group_count]();
+        for (uint32_t g = 0; dedup_size && g < super.group_count; g++) std::memset(dedup_tab(g), 0, dedup_size);
+        dedup_build_index();
 
-        root_inode = alloc_inode(root_dentry,MYFS_ISDIR);
+        // 根目录取第 0 组的第 0 个 inode, 即 MYFS_ROOT_INO
+        itab_init();
+        super.root_dentry = new_dentry("/", FileType::DIR);
+        myfs_inode* root_inode = alloc_inode(super.root_dentry, MYFS_ISDIR, nullptr);
         sync_inode(root_inode);
 
-        //建立内存中的 Dentry 联系
-        super.root_dentry = new_dentry("/", FileType::DIR);
-        super.root_dentry->ino = MYFS_ROOT_INO;
-        super.root_dentry->inode = root_inode;
-        root_inode->dentry = super.root_dentry;
-
-        driver_write(super.ibmap_start * MYFS_BLK_SIZE, super.map_inode, MYFS_BLK_SIZE * ibmap_blks);
-        driver_write(super.dbmap_start * MYFS_BLK_SIZE, super.map_data, MYFS_BLK_SIZE * dbmap_blks);
-
-        struct myfs_super_d new_super_d = {};
-        new_super_d.magic_num = super.magic_num;
-        new_super_d.block_size = super.block_size;
-        new_super_d.total_blocks = super.total_blocks;
-        new_super_d.inode_count = super.inode_count;
-        new_super_d.inode_per_block = super.inode_per_block;
-        
-        new_super_d.ibmap_start = super.ibmap_start;
-        new_super_d.ibmap_blks = ibmap_blks;
-        new_super_d.dbmap_start = super.dbmap_start;
-        new_super_d.dbmap_blks = dbmap_blks;
-        
-        new_super_d.inode_start = super.inode_start;
-        new_super_d.inode_blks = inode_blks;
-        
-        new_super_d.data_start = super.data_start;
-        new_super_d.data_blks = super.total_blocks - super.data_start;
-        
-        new_super_d.root_ino = MYFS_ROOT_INO;
-        
-        driver_write(MYFS_SUPER_OFS, (uint8_t *)&new_super_d, sizeof(struct myfs_super_d));
+        std::vector<uint8_t> gdt_buf;
+        std::vector<IoSeg> segs = { { MYFS_SUPER_OFS, &new_super_d, sizeof(struct myfs_super_d) } };
+        group_meta_segs(gdt_buf, segs);
+        for (uint32_t g = 0; dedup_size && !meta_in_place && g < super.group_count; g++) {
+            segs.push_back({ blk_ofs(groups[g].data_start - super.dedup_blks_per_group), dedup_tab(g), dedup_size });
+        }
+        driver_write_batch(segs.data(), (int)segs.size());
 
     } else {
         // ==================== 加载分支 (Load Path) ====================
+        if (const char* why = myfs_check_super(super_d_disk, device->size())) {
+            std::cerr << "myfs: bad superblock: " << why << std::endl;
+            return fail(-MYFS_ERROR_INVAL);
+        }
+        if (opts.block_size && opts.block_size != super_d_disk.block_size) {
+            std::cerr << "myfs: device already formatted with block size " << super_d_disk.block_size
+                      << ", ignoring --block-size" << std::endl;
+        }
+        if (opts.dedup && !(super_d_disk.features & MYFS_FEATURE_DEDUP)) {
+            std::cerr << "myfs: device already formatted without dedup, ignoring --dedup" << std::endl;
+        }
+
         super.magic_num = super_d_disk.magic_num;
         super.block_size = super_d_disk.block_size;
+        super.blk_bits = __builtin_ctz(super_d_disk.block_size);
         super.total_blocks = super_d_disk.total_blocks;
         super.inode_count = super_d_disk.inode_count;
         super.inode_per_block = super_d_disk.inode_per_block;
         
-        super.ibmap_start = super_d_disk.ibmap_start;
-        super.dbmap_start = super_d_disk.dbmap_start;
-        super.inode_start = super_d_disk.inode_start;
-        super.data_start = super_d_disk.data_start;
+        super.gdt_start = super_d_disk.gdt_start;
+        super.gdt_blks = super_d_disk.gdt_blks;
+        super.group_start = super_d_disk.group_start;
+        super.group_count = super_d_disk.group_count;
+        super.blocks_per_group = super_d_disk.blocks_per_group;
+        super.inodes_per_group = super_d_disk.inodes_per_group;
+        super.features = super_d_disk.features;
+        super.dedup_blks_per_group = super_d_disk.dedup_blks_per_group;
+
+        // 组描述符表
+        groups.resize(super.group_count);
+        group_alloc.reset(new GroupAlloc[super.group_count]);
+        const myfs_group_d* table = (const myfs_group_d*)in_place(blk_ofs(super.gdt_start));
+        if (!table) {
+            std::vector<uint8_t> buf((size_t)super.gdt_blks << super.blk_bits);
+            driver_read(blk_ofs(super.gdt_start), buf.data(), buf.size());
+            std::memcpy(groups.data(), buf.data(), groups.size() * sizeof(myfs_group_d));
+        } else {
+            std::memcpy(groups.data(), table, groups.size() * sizeof(myfs_group_d));
+        }
+        for (uint32_t g = 0; g < super.group_count; g++) {
+            if (const char* why = myfs_check_group(super_d_disk, groups[g], g)) {
+                std::cerr << "myfs: bad group descriptor " << g << ": " << why << std::endl;
+                return fail(-MYFS_ERROR_INVAL);
+            }
+        }
         
         // 动态分配位图大小
-        int ibmap_size = super_d_disk.ibmap_blks * MYFS_BLK_SIZE;
-        int dbmap_size = super_d_disk.dbmap_blks * MYFS_BLK_SIZE;
+        if (!meta_in_place) {
+            size_t map_size = (size_t)super.group_count << super.blk_bits;
+            super.map_inode = new uint8_t[map_size];
+            super.map_data = new uint8_t[map_size];
+
+            size_t dedup_size = (size_t)super.dedup_blks_per_group << super.blk_bits;
+            if (dedup_size) super.map_dedup = new uint8_t[dedup_size * super.group_count];
+
+            std::vector<IoSeg> maps;
+            for (uint32_t g = 0; g < super.group_count; g++) {
+                maps.push_back({ blk_ofs(groups[g].ibmap_blk), ibmap(g), super.block_size });
+                maps.push_back({ blk_ofs(groups[g].dbmap_blk), dbmap(g), super.block_size });
+                if (dedup_size) maps.push_back({ blk_ofs(groups[g].data_start - super.dedup_blks_per_group), dedup_tab(g), dedup_size });
+            }
+            driver_read_batch(maps.data(), (int)maps.size());
+        }
 
-        super.map_inode = new uint8_t[ibmap_size];
-        super.map_data = new uint8_t[dbmap_size];
-        
-        driver_read(super.ibmap_start * MYFS_BLK_SIZE, super.map_inode, ibmap_size);
-        driver_read(super.dbmap_start * MYFS_BLK_SIZE, super.map_data, dbmap_size);
+        // 位图随分配立即落盘, 描述符表只在卸载时写回: 空闲计数以位图为准重新统计
+        for (uint32_t g = 0; g < super.group_count; g++) {
+            myfs_group_d& gd = groups[g];
+            gd.free_inodes = count_free_bits(ibmap(g), super.inodes_per_group);
+            gd.free_blocks = count_free_bits(dbmap(g), gd.data_blks);
+            group_alloc[g].data_free.add_map(dbmap(g), gd.data_blks, gd.data_start);
+        }
+        dedup_build_index();
         
+        itab_init();
         super.root_dentry = new_dentry("/", FileType::DIR);
         super.root_dentry->ino = super_d_disk.root_ino;
-        super.root_dentry->inode = read_inode(super_d_disk.root_ino);
-        
-        if (super.root_dentry->inode) {
-            super.root_dentry->inode->dentry = super.root_dentry;
-        }
+        load_inode(super.root_dentry);
     }
 
+    cluster_cache.reset(MYFS_CLUSTER_CACHE_BYTES / ((size_t)MYFS_CLUSTER_BLOCKS << super.blk_bits));
+    reclaim.stop = false;
+    reclaim.worker = std::thread(&FileSystem::reclaim_loop, this);
+
     super.is_mounted = true;
+    return MYFS_ERROR_NONE;
 }
 
 void FileSystem::umount() {
@@ -466,104 +1154,303 @@ void FileSystem::umount() {
     if (super.root_dentry && super.root_dentry->inode) {
         sync_inode(super.root_dentry->inode);
     }
+    if (super.root_dentry) free_tree(super.root_dentry);
+    super.root_dentry = nullptr;
+    itab.clear();
+
+    // 回复都已发出, 搁置的块一并回收
+    tx_frees.insert(tx_frees.end(), splice_parked.begin(), splice_parked.end());
+    splice_parked.clear();
+    splice_pins.clear();
+    {
+        std::lock_guard<std::mutex> guard(splice_orphan_lock);
+        splice_orphans.clear();
+        splice_orphaned.store(false, std::memory_order_relaxed);
+    }
 
-    struct myfs_super_d super_d = {};
-    super_d.magic_num = MYFS_MAGIC_NUM;
-    super_d.block_size = MYFS_BLK_SIZE;
-    super_d.total_blocks = super.total_blocks;
-    super_d.inode_count = super.inode_count;
-    super_d.inode_per_block = super.inode_per_block;
-    super_d.ibmap_start = super.ibmap_start;
-    super_d.ibmap_blks = 1;
-    super_d.dbmap_start = super.dbmap_start;
-    super_d.dbmap_blks = 1;
-    super_d.inode_start = super.inode_start;
-    super_d.inode_blks = (super.inode_count + MYFS_INODE_PER_BLOCK - 1) / MYFS_INODE_PER_BLOCK;
-    super_d.data_start = super.data_start;
-    super_d.data_blks = super.total_blocks - super.data_start;
-    super_d.root_ino = MYFS_ROOT_INO;
-    
-    driver_write(MYFS_SUPER_OFS, (uint8_t *)&super_d, sizeof(struct myfs_super_d));
-    driver_write(super.ibmap_start * MYFS_BLK_SIZE, super.map_inode, MYFS_BLK_SIZE);
-    driver_write(super.dbmap_start * MYFS_BLK_SIZE, super.map_data, MYFS_BLK_SIZE);
-
-    fsync(super.driver_fd);
-    ddriver_close(super.driver_fd);
+    // 停下回收线程, 余下的待回收块当场归还, 位图与组计数随后一起写回
+    commit_frees();
+    {
+        std::lock_guard<std::mutex> guard(reclaim.lock);
+        reclaim.stop = true;
+    }
+    reclaim.wake.notify_one();
+    if (reclaim.worker.joinable()) reclaim.worker.join();
+    reclaim_blocks();
+
+    struct myfs_super_d super_buf;
+    struct myfs_super_d* super_ptr = (struct myfs_super_d*)in_place(MYFS_SUPER_OFS);
+    struct myfs_super_d& super_d = super_ptr ? *super_ptr : super_buf;
+    pack_super(super_d);
+    
+    std::vector<uint8_t> gdt_buf;
+    std::vector<IoSeg> segs;
+    if (!meta_in_place) segs.push_back({ MYFS_SUPER_OFS, &super_d, sizeof(struct myfs_super_d) });
+    group_meta_segs(gdt_buf, segs);
+    driver_write_batch(segs.data(), (int)segs.size());
+
+    device->sync();
+    device->close();
+    const myfs_io_stats dev = device->stats();
+    retired_stats.read_cnt += dev.read_cnt;
+    retired_stats.write_cnt += dev.write_cnt;
+    retired_stats.seek_cnt += dev.seek_cnt;
+    device.reset();
     super.is_mounted = false;
     
-    delete[] super.map_inode;
-    delete[] super.map_data;
-}
-
-void FileSystem::clear_bit(uint8_t* map, int index) {
-    int byte_idx = index / 8;
-    int bit_idx = index % 8;
-    map[byte_idx] &= ~(1 << bit_idx);
+    if (!meta_in_place) {
+        delete[] super.map_inode;
+        delete[] super.map_data;
+        delete[] super.map_dedup;
+    }
+    super.map_inode = super.map_data = super.map_dedup = nullptr;
+    dedup_index.clear();
+    group_alloc.reset();
+    groups.clear();
+    cluster_cache.reset(0);
+    meta_in_place = false;
 }
 
+// 只记入本次操作的释放列表, 位图与空闲区间在回收时才改动
 void FileSystem::free_data_block(int blk_no) {
     // 检查块号是否合法
-    if (blk_no < super.data_start || blk_no >= super.total_blocks) return;
-    
-    int data_idx = blk_no - super.data_start;
-    
-    // 清除位图
-    clear_bit(super.map_data, data_idx);
-    driver_write(super.dbmap_start * MYFS_BLK_SIZE, super.map_data, MYFS_BLK_SIZE);
+    if (blk_no < 0 || !is_data_block((uint32_t)blk_no)) return;
+    // 去重共用的块只去掉一个引用
+    if (dedup_on() && dedup_release((uint32_t)blk_no)) return;
+    // 仍被未发出的 read_buf 回复引用的块先搁置
+    if (!splice_pins.empty() && splice_pins.count((uint32_t)blk_no)) {
+        splice_parked.push_back((uint32_t)blk_no);
+        return;
+    }
+    tx_frees.push_back((uint32_t)blk_no);
+}
+
+// 回收队列攒够这么多块时唤醒回收线程
+static const size_t MYFS_RECLAIM_BATCH = 256;
+
+// 本次操作的元数据已写出, 去重表的改动随后写回, 释放的块移入回收队列
+void FileSystem::commit_frees() {
+    flush_dedup();
+    queue_frees(tx_frees);
+}
+
+void FileSystem::queue_frees(std::vector<uint32_t>& blks) {
+    if (blks.empty()) return;
+    bool kick;
+    {
+        std::lock_guard<std::mutex> guard(reclaim.lock);
+        reclaim.queue.insert(reclaim.queue.end(), blks.begin(), blks.end());
+        kick = reclaim.queue.size() >= MYFS_RECLAIM_BATCH;
+    }
+    blks.clear();
+    if (kick) reclaim.wake.notify_one();
+}
+
+bool FileSystem::reclaim_blocks() {
+    std::lock_guard<std::mutex> apply(reclaim.apply_lock);
+    std::vector<uint32_t> blks;
+    {
+        std::lock_guard<std::mutex> guard(reclaim.lock);
+        blks.swap(reclaim.queue);
+    }
+    if (blks.empty()) return false;
+
+    device->sync();
+    apply_frees(blks);
+    return true;
+}
+
+void FileSystem::reclaim_loop() {
+    std::unique_lock<std::mutex> guard(reclaim.lock);
+    while (true) {
+        reclaim.wake.wait(guard, [&] { return reclaim.stop || reclaim.queue.size() >= MYFS_RECLAIM_BATCH; });
+        if (reclaim.stop) return;
+        guard.unlock();
+        reclaim_blocks();
+        guard.lock();
+    }
+}
+
+// 按块号排序后逐组处理: 清位图 (已空闲的块不重复归还, 以免空闲区间重叠), 每组的位图块只写回一次,
+// 相邻的块合并成区间归还
+void FileSystem::apply_frees(std::vector<uint32_t>& blks) {
+    std::sort(blks.begin(), blks.end());
+    size_t i = 0;
+    while (i < blks.size()) {
+        uint32_t g = (uint32_t)data_group(blks[i]);
+        myfs_group_d& gd = groups[g];
+        AtomicBitmap map(dbmap(g), gd.data_blks);
+        std::vector<std::pair<uint32_t, uint32_t>> runs;
+        uint32_t freed = 0;
+        for (; i < blks.size() && data_group(blks[i]) == (int)g; i++) {
+            if (!map.release(blks[i] - gd.data_start)) continue;
+            if (!runs.empty() && runs.back().first + runs.back().second == blks[i]) runs.back().second++;
+            else runs.push_back({ blks[i], 1 });
+            freed++;
+        }
+        if (freed == 0) continue;
+
+        flush_map(g, dbmap(g), gd.dbmap_blk);
+        __atomic_fetch_add(&gd.free_blocks, freed, __ATOMIC_RELAXED);
+        std::lock_guard<std::mutex> guard(group_alloc[g].lock);
+        for (const auto& run : runs) group_alloc[g].data_free.free(run.first, run.second);
+    }
+}
+
+// =================================================================
+// read_buf 的 fd 缓冲区引用的块
+// =================================================================
+
+struct FileSystem::SpliceHeld {
+    FileSystem* fs = nullptr;
+    uint64_t gen = 0;
+    std::vector<uint32_t> blks;
+    ~SpliceHeld() {
+        if (fs && !blks.empty()) fs->splice_orphan(gen, blks);
+    }
+};
+
+FileSystem::SpliceHeld& FileSystem::splice_held() {
+    thread_local SpliceHeld held;
+    return held;
+}
+
+void FileSystem::splice_pin(const std::vector<uint32_t>& blks) {
+    SpliceHeld& held = splice_held();
+    held.fs = this;
+    held.gen = mount_gen;
+    for (uint32_t b : blks) {
+        splice_pins[b]++;
+        held.blks.push_back(b);
+    }
+}
+
+// 在最外层 OpScope 中调用: 本线程上一个回复已发出
+void FileSystem::splice_release() {
+    SpliceHeld& held = splice_held();
+    if (!held.blks.empty()) {
+        if (held.gen == mount_gen) splice_unpin(held.blks);
+        held.blks.clear();
+    }
+    if (splice_orphaned.load(std::memory_order_acquire)) {
+        std::vector<uint32_t> orphans;
+        {
+            std::lock_guard<std::mutex> guard(splice_orphan_lock);
+            orphans.swap(splice_orphans);
+            splice_orphaned.store(false, std::memory_order_relaxed);
+        }
+        splice_unpin(orphans);
+    }
+}
+
+void FileSystem::splice_orphan(uint64_t gen, const std::vector<uint32_t>& blks) {
+    std::lock_guard<std::mutex> guard(splice_orphan_lock);
+    if (gen != mount_gen) return;
+    splice_orphans.insert(splice_orphans.end(), blks.begin(), blks.end());
+    splice_orphaned.store(true, std::memory_order_release);
+}
+
+// 不再被引用的搁置块移入回收队列; 释放它们的操作早已写出元数据
+void FileSystem::splice_unpin(const std::vector<uint32_t>& blks) {
+    for (uint32_t b : blks) {
+        auto it = splice_pins.find(b);
+        if (it != splice_pins.end() && --it->second == 0) splice_pins.erase(it);
+    }
+    if (splice_parked.empty()) return;
+    std::vector<uint32_t> still, freed;
+    for (uint32_t b : splice_parked) (splice_pins.count(b) ? still : freed).push_back(b);
+    splice_parked.swap(still);
+    queue_frees(freed);
 }
 
 void FileSystem::release_inode(myfs_inode* inode) {
     if (!inode) return;
 
     //释放该 inode 占用的所有数据块
+    if (MYFS_IS_DIR(inode) && is_indexed(inode)) dx_free(inode);
     for (int i = 0; i < MYFS_DIRECT_BLOCKS; i++) {
-        if (inode->block[i] != 0) {
-            free_data_block(inode->block[i]);
-            inode->block[i] = 0;
-        }
+        if (inode->block[i] != 0 && inode->block[i] != MYFS_BLK_COMPRESSED) free_data_block(inode->block[i]);
+        inode->block[i] = 0;
     }
+    for (int c = 0; c < MYFS_DIRECT_BLOCKS / MYFS_CLUSTER_BLOCKS; c++) cluster_cache.erase(inode->ino, c);
 
     //释放 inode 位图
-    clear_bit(super.map_inode, inode->ino);
-    driver_write(super.ibmap_start * MYFS_BLK_SIZE, super.map_inode, MYFS_BLK_SIZE);
+    uint32_t g = ino_group(inode->ino);
+    AtomicBitmap(ibmap(g), super.inodes_per_group).release(inode->ino % super.inodes_per_group);
+    flush_map(g, ibmap(g), groups[g].ibmap_blk);
+    __atomic_fetch_add(&groups[g].free_inodes, 1, __ATOMIC_RELAXED);
+    if (MYFS_IS_DIR(inode)) __atomic_fetch_sub(&groups[g].dirs, 1, __ATOMIC_RELAXED);
 
     //释放内存对象
-    delete inode; 
+    free_inode(inode);
+}
+
+// 同一 inode 可能由多个目录项指向 (硬链接): 只去掉本 dentry 的引用并减少链接数, 最后一个链接
+// 与最后一个引用都去掉后才释放数据块和 inode; 否则写回新的链接数. 目录只有一个链接
+void FileSystem::drop_link(myfs_dentry* dentry) {
+    myfs_inode* inode = dentry->inode;
+    if (!inode) return;
+    detach_inode(dentry);
+    if (!MYFS_IS_DIR(inode) && inode->link_count > 0) inode->link_count--;
+    if ((MYFS_IS_DIR(inode) || inode->link_count == 0) && inode->dentry_refs == 0) {
+        release_inode(inode);
+        return;
+    }
+    inode->ctime = time(NULL);
+    write_inode(inode);
 }
 
 int FileSystem::delete_dentry(myfs_inode* parent, myfs_dentry* child) {
     if (!parent || !child) return -1;
-    
-    myfs_dentry *curr = parent->first_child;
-    myfs_dentry *prev = nullptr;
-    
-    while (curr) {
-        if (curr == child) {
-            // 从链表中移除
-            if (prev) {
-                prev->brother = curr->brother;
-            } else {
-                parent->first_child = curr->brother;
-            }
-            
-            // 更新父目录大小（逻辑大小）
-            // 物理数据块的整理在 sync_inode 中会重新根据链表生成，所以这里只需减小 size
-            if (parent->size >= sizeof(struct myfs_dentry_d))
-                parent->size -= sizeof(struct myfs_dentry_d);
-            
-            delete curr; // 释放 dentry 内存
-            return 0;
-        }
-        prev = curr;
-        curr = curr->brother;
+    if (!detach_child(parent, child)) return -1;
+
+    if (is_indexed(parent)) {
+        // 索引目录直接清除磁盘上的槽位
+        dx_remove(parent, child->fname);
+    } else if (parent->size >= sizeof(struct myfs_dentry_d)) {
+        // 更新父目录大小（逻辑大小）
+        // 物理数据块的整理在 sync_inode 中会重新根据链表生成，所以这里只需减小 size
+        parent->size -= sizeof(struct myfs_dentry_d);
     }
-    return -1;
+
+    free_dentry(child); // 释放 dentry 内存
+    return 0;
+}
+
+// 从父目录的子项链表与按名索引中摘下, 不改动磁盘与目录大小; 不在链表中时返回 false
+bool FileSystem::detach_child(myfs_inode* dir, myfs_dentry* child) {
+    myfs_dentry** link = &dir->first_child;
+    while (*link && *link != child) link = &(*link)->brother;
+    if (!*link) return false;
+
+    *link = child->brother;
+    dir->dir_entries--;
+    dir->child_by_name.erase(child->fname);
+    if (dir->rd_resume == child) dir->rd_resume = nullptr;
+    return true;
+}
+
+// child 顶替 old_child 在链表中的位置, 沿用其名字, cookie 与槽位: 对 readdir 而言这个名字一直在原处,
+// 不会因为覆盖而重复返回或漏掉. old_child 须在链表中
+void FileSystem::replace_child(myfs_inode* dir, myfs_dentry* old_child, myfs_dentry* child) {
+    myfs_dentry** link = &dir->first_child;
+    while (*link != old_child) link = &(*link)->brother;
+
+    *link = child;
+    child->brother = old_child->brother;
+    child->parent = dir->dentry;
+    child->cookie = old_child->cookie;
+    child->slot = old_child->slot;
+    child->fname = old_child->fname;
+    dir->child_by_name[child->fname] = child;
+    if (dir->rd_resume == old_child) dir->rd_resume = child;
 }
 // =================================================================
 // FUSE 接口 
 // =================================================================
 
 int FileSystem::fuse_mkdir(const char* path, mode_t mode) {
+    OpScope scope(*this);
     bool is_find, is_root;
     std::string s_path(path);
     myfs_dentry* existing = lookup(s_path, &is_find, &is_root);
@@ -586,11 +1473,20 @@ int FileSystem::fuse_mkdir(const char* path, mode_t mode) {
     if (!parent_dentry || !parent_dentry->inode) return -MYFS_ERROR_NOTFOUND;
 
     myfs_dentry *new_d = new_dentry(base_name, FileType::DIR);
-    myfs_inode *new_in = alloc_inode(new_d, MYFS_ISDIR); 
-    if (!new_in) return -MYFS_ERROR_NOSPACE;
+    myfs_inode *new_in = alloc_inode(new_d, MYFS_ISDIR, parent_dentry->inode);
+    if (!new_in) {
+        free_dentry(new_d);
+        return -MYFS_ERROR_NOSPACE;
+    }
 
-    alloc_dentry(parent_dentry->inode, new_d);
+    int ret = alloc_dentry(parent_dentry->inode, new_d);
+    if (ret != 0) {
+        release_inode(new_in);
+        free_dentry(new_d);
+        return ret;
+    }
     
+    parent_dentry->inode->link_count++;     // 子目录的 ".."
     parent_dentry->inode->mtime = time(NULL);
     
     sync_inode(new_in);
@@ -599,6 +1495,7 @@ int FileSystem::fuse_mkdir(const char* path, mode_t mode) {
 }
 
 int FileSystem::fuse_mknod(const char* path, mode_t mode, dev_t dev) {
+    OpScope scope(*this);
     bool is_find, is_root;
     std::string s_path(path);
     myfs_dentry* existing = lookup(s_path, &is_find, &is_root);
@@ -621,10 +1518,18 @@ int FileSystem::fuse_mknod(const char* path, mode_t mode, dev_t dev) {
     if (!parent_dentry || !parent_dentry->inode) return -MYFS_ERROR_NOTFOUND;
 
     myfs_dentry *new_d = new_dentry(base_name, FileType::REG_FILE);
-    myfs_inode *new_in = alloc_inode(new_d, MYFS_ISREG);
-    if (!new_in) return -MYFS_ERROR_NOSPACE;
+    myfs_inode *new_in = alloc_inode(new_d, MYFS_ISREG, parent_dentry->inode);
+    if (!new_in) {
+        free_dentry(new_d);
+        return -MYFS_ERROR_NOSPACE;
+    }
 
-    alloc_dentry(parent_dentry->inode, new_d);
+    int ret = alloc_dentry(parent_dentry->inode, new_d);
+    if (ret != 0) {
+        release_inode(new_in);
+        free_dentry(new_d);
+        return ret;
+    }
 
     parent_dentry->inode->mtime = time(NULL);
 
@@ -633,43 +1538,104 @@ int FileSystem::fuse_mknod(const char* path, mode_t mode, dev_t dev) {
     return 0;
 }
 
-int FileSystem::fuse_write(const char* path, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi) { 
-    bool is_find, is_root;
-    std::string s_path(path);
-    myfs_dentry *dentry = lookup(s_path, &is_find, &is_root);
-    if (!is_find || !dentry || !dentry->inode) return -MYFS_ERROR_NOTFOUND;
+int FileSystem::map_file_range(myfs_inode* inode, off_t offset, size_t size, bool create,
+                               std::vector<FileRun>& runs) {
+    return with_geometry(super.block_size, [&](auto geo) {
+        return map_file_range<decltype(geo)>(inode, offset, size, create, runs);
+    });
+}
 
-    myfs_inode *inode = dentry->inode;
-    
-    int start_blk_idx = (int)(offset / MYFS_BLK_SIZE);
-    int end_blk_idx = (int)((offset + size - 1) / MYFS_BLK_SIZE);
-    
-    if (end_blk_idx >= MYFS_DIRECT_BLOCKS) return -MYFS_ERROR_NOSPACE;
+// 文件区间映射为设备上物理连续的段; create 时先分配缺失的块, 否则缺失的块记为空洞
+template <class G>
+int FileSystem::map_file_range(myfs_inode* inode, off_t offset, size_t size, bool create,
+                               std::vector<FileRun>& runs) {
+    runs.clear();
+    if (size == 0) return MYFS_ERROR_NONE;
+    if (offset < 0 || (uint64_t)offset + size > G::max_file_size) return -MYFS_ERROR_NOSPACE;
+
+    int start_blk_idx = (int)G::index(offset);
+    int end_blk_idx = (int)G::index(offset + size - 1);
+
+    if (create) {
+        // 连续缺失的逻辑块一次申请整段, 分配器给不出整段时分几次
+        for (int i = start_blk_idx; i <= end_blk_idx; ) {
+            if (inode->block[i] != 0) {
+                i++;
+                continue;
+            }
+            int missing = 1;
+            while (i + missing <= end_blk_idx && inode->block[i + missing] == 0) missing++;
 
-    size_t wrote = 0;
-    for (int i = start_blk_idx; i <= end_blk_idx; i++) {
-        if (inode->block[i] == 0) {
-            int blk = alloc_data_block();
+            uint32_t got;
+            int blk = alloc_data_blocks(data_goal(inode, i), missing, &got);
             if (blk == -1) return -MYFS_ERROR_NOSPACE;
-            inode->block[i] = blk;
+            for (uint32_t k = 0; k < got; k++) inode->block[i + k] = blk + k;
+            i += got;
         }
-        
-        size_t blk_offset = (i == start_blk_idx) ? (offset % MYFS_BLK_SIZE) : 0;
-        size_t len = MYFS_BLK_SIZE - blk_offset;
-        if (len > (size - wrote)) len = size - wrote;
-        
-        driver_write(inode->block[i] * MYFS_BLK_SIZE + blk_offset, (uint8_t*)(buf + wrote), len);
-        wrote += len;
     }
 
+    size_t done = 0;
+    for (int i = start_blk_idx; i <= end_blk_idx; ) {
+        uint32_t blk = inode->block[i];
+        int run = 1;
+        while (blk != 0 && i + run <= end_blk_idx && inode->block[i + run] == blk + run) run++;
+
+        size_t blk_offset = (i == start_blk_idx) ? G::within(offset) : 0;
+        size_t len = ((size_t)run << G::bits) - blk_offset;
+        if (len > size - done) len = size - done;
+
+        off_t dev_off = blk == 0 ? -1 : G::offset(blk) + (off_t)blk_offset;
+        runs.push_back({ dev_off, done, len });
+        done += len;
+        i += run;
+    }
+    return MYFS_ERROR_NONE;
+}
+
+// 写入完成后更新大小与时间并落盘 inode, 重写压缩簇时换下的块随后进入回收队列
+void FileSystem::finish_write(myfs_inode* inode, off_t offset, size_t size) {
     if (offset + size > inode->size) inode->size = (uint32_t)(offset + size);
     inode->mtime = time(NULL);
-    
     sync_inode(inode);
+    commit_frees();
+}
+
+int FileSystem::fuse_write(const char* path, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi) { 
+    OpScope scope(*this);
+    bool is_find, is_root;
+    std::string s_path(path);
+    myfs_dentry *dentry = lookup(s_path, &is_find, &is_root);
+    if (!is_find || !dentry || !dentry->inode) return -MYFS_ERROR_NOTFOUND;
+
+    myfs_inode *inode = dentry->inode;
+    if (clustered(inode)) {
+        int ret = cluster_write(inode, buf, size, offset);
+        if (ret != MYFS_ERROR_NONE) return ret;
+        finish_write(inode, offset, size);
+        return size;
+    }
+    if (dedup_on()) {
+        int ret = dedup_write(inode, buf, size, offset);
+        if (ret != MYFS_ERROR_NONE) return ret;
+        finish_write(inode, offset, size);
+        return size;
+    }
+
+    std::vector<FileRun> runs;
+    int ret = map_file_range(inode, offset, size, true, runs);
+    if (ret != MYFS_ERROR_NONE) return ret;
+
+    // 不连续的各段一起提交
+    std::vector<IoSeg> segs;
+    for (const FileRun& r : runs) segs.push_back({ r.dev_off, (void*)(buf + r.req_off), r.len });
+    if (driver_write_batch(segs.data(), (int)segs.size()) != MYFS_ERROR_NONE) return -MYFS_ERROR_IO;
+
+    finish_write(inode, offset, size);
     return size; 
 }
 
 int FileSystem::fuse_read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) { 
+    OpScope scope(*this);
     bool is_find, is_root;
     std::string s_path(path);
     struct myfs_dentry *dentry = lookup(s_path, &is_find, &is_root);
@@ -677,28 +1643,223 @@ int FileSystem::fuse_read(const char* path, char* buf, size_t size, off_t offset
     
     if (offset >= dentry->inode->size) return 0;
     if (offset + size > dentry->inode->size) size = dentry->inode->size - offset;
+    if (clustered(dentry->inode)) return cluster_read(dentry->inode, buf, size, offset);
 
-    int start_blk_idx = (int)(offset / MYFS_BLK_SIZE);
-    int end_blk_idx = (int)((offset + size - 1) / MYFS_BLK_SIZE);
-    
-    size_t read_len = 0;
-    for (int i = start_blk_idx; i <= end_blk_idx; i++) {
-        int blk = dentry->inode->block[i];
-        size_t blk_offset = (i == start_blk_idx) ? (offset % MYFS_BLK_SIZE) : 0;
-        size_t len = MYFS_BLK_SIZE - blk_offset;
-        if (len > (size - read_len)) len = size - read_len;
+    std::vector<FileRun> runs;
+    map_file_range(dentry->inode, offset, size, false, runs);
 
-        if (blk == 0) {
-            std::memset(buf + read_len, 0, len);
+    std::vector<IoSeg> segs;
+    for (const FileRun& r : runs) {
+        if (r.dev_off < 0) {
+            std::memset(buf + r.req_off, 0, r.len);
+        } else if (uint8_t* src = in_place(r.dev_off)) {
+            std::memcpy(buf + r.req_off, src, r.len);   // mmap 后端: 直接从映射拷入 FUSE 缓冲区
         } else {
-            driver_read(blk * MYFS_BLK_SIZE + blk_offset, (uint8_t*)(buf + read_len), len);
+            segs.push_back({ r.dev_off, buf + r.req_off, r.len });
+        }
+    }
+    if (driver_read_batch(segs.data(), (int)segs.size()) != MYFS_ERROR_NONE) return -MYFS_ERROR_IO;
+    return size; 
+}
+
+// 设备可被 splice 时, 每个数据段返回指向镜像文件偏移的 fd 缓冲区, 由 libfuse 直接
+// splice 到 /dev/fuse; 空洞为零填充的内存缓冲区. 否则 (含有压缩簇时也是) 退化为一次 fuse_read
+int FileSystem::fuse_read_buf(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset,
+                              struct fuse_file_info* fi) {
+    OpScope scope(*this);
+    bool is_find, is_root;
+    std::string s_path(path);
+    struct myfs_dentry *dentry = lookup(s_path, &is_find, &is_root);
+    if (!is_find || !dentry || !dentry->inode) return -MYFS_ERROR_NOTFOUND;
+
+    if (offset >= dentry->inode->size) size = 0;
+    else if (offset + size > dentry->inode->size) size = dentry->inode->size - offset;
+
+    int fd = device->splice_fd();
+    std::vector<FileRun> runs;
+    if (fd >= 0 && !has_compressed(dentry->inode)) map_file_range(dentry->inode, offset, size, false, runs);
+
+    size_t count = runs.empty() ? 1 : runs.size();
+    struct fuse_bufvec* bv = (struct fuse_bufvec*)malloc(sizeof(struct fuse_bufvec) +
+                                                        (count - 1) * sizeof(struct fuse_buf));
+    if (!bv) return -MYFS_ERROR_NOMEM;
+    bv->count = count;
+    bv->idx = 0;
+    bv->off = 0;
+    bv->buf[0] = {};
+    bv->buf[0].size = size;
+    bv->buf[0].fd = -1;
+
+    if (runs.empty()) {
+        bv->buf[0].mem = malloc(size ? size : 1);
+        int ret = bv->buf[0].mem ? fuse_read(path, (char*)bv->buf[0].mem, size, offset, fi) : -MYFS_ERROR_NOMEM;
+        if (ret < 0) {
+            free(bv->buf[0].mem);
+            free(bv);
+            return ret;
+        }
+        bv->buf[0].size = ret;
+        *bufp = bv;
+        return 0;
+    }
+
+    uint64_t reads = 0;
+    std::vector<uint32_t> pinned;
+    for (size_t i = 0; i < runs.size(); i++) {
+        struct fuse_buf& b = bv->buf[i];
+        b = {};
+        b.size = runs[i].len;
+        b.fd = -1;
+        if (runs[i].dev_off < 0) {
+            b.mem = calloc(1, runs[i].len);
+            if (!b.mem) {
+                for (size_t j = 0; j < i; j++) free(bv->buf[j].mem);
+                free(bv);
+                return -MYFS_ERROR_NOMEM;
+            }
+        } else {
+            b.flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+            b.fd = fd;
+            b.pos = runs[i].dev_off;
+            reads++;
+            uint32_t last = (uint32_t)((runs[i].dev_off + runs[i].len - 1) >> super.blk_bits);
+            for (uint32_t blk = (uint32_t)(runs[i].dev_off >> super.blk_bits); blk <= last; blk++) {
+                pinned.push_back(blk);
+            }
+        }
+    }
+    // libfuse 在核心锁放开后才从这些偏移 splice, 回复发出前块不得回收
+    splice_pin(pinned);
+    device->account_external(reads, 0);
+    *bufp = bv;
+    return 0;
+}
+
+// 设备可被 splice 时, 目标为指向镜像文件偏移的 fd 缓冲区, 由 fuse_buf_copy 直接从
+// FUSE 管道 splice 到镜像; 否则内存缓冲区原样交给 driver_write_batch, 只有管道来源才拷贝一次
+int FileSystem::fuse_write_buf(const char* path, struct fuse_bufvec* buf, off_t offset, struct fuse_file_info* fi) {
+    OpScope scope(*this);
+    bool is_find, is_root;
+    std::string s_path(path);
+    myfs_dentry *dentry = lookup(s_path, &is_find, &is_root);
+    if (!is_find || !dentry || !dentry->inode) return -MYFS_ERROR_NOTFOUND;
+
+    myfs_inode *inode = dentry->inode;
+    size_t size = fuse_buf_size(buf);
+    bool packed = clustered(inode);     // 按簇压缩写入时数据须经内存
+    bool dedup = !packed && dedup_on(); // 去重写入要先看内容, 同样经内存
+    std::vector<FileRun> runs;
+    int ret = packed || dedup ? MYFS_ERROR_NONE : map_file_range(inode, offset, size, true, runs);
+    if (ret != MYFS_ERROR_NONE) return ret;
+    if (size == 0) return 0;
+
+    int fd = device->splice_fd();
+    if (fd >= 0 && !packed && !dedup) {
+        struct fuse_bufvec* dst = (struct fuse_bufvec*)malloc(sizeof(struct fuse_bufvec) +
+                                                             (runs.size() - 1) * sizeof(struct fuse_buf));
+        if (!dst) return -MYFS_ERROR_NOMEM;
+        dst->count = runs.size();
+        dst->idx = 0;
+        dst->off = 0;
+        for (size_t i = 0; i < runs.size(); i++) {
+            dst->buf[i] = {};
+            dst->buf[i].size = runs[i].len;
+            dst->buf[i].flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+            dst->buf[i].fd = fd;
+            dst->buf[i].pos = runs[i].dev_off;
+        }
+        ssize_t n = fuse_buf_copy(dst, buf, (enum fuse_buf_copy_flags)0);
+        free(dst);
+        if (n != (ssize_t)size) return -MYFS_ERROR_IO;
+        device->account_external(0, runs.size());
+    } else {
+        std::vector<uint8_t> copy;
+        const uint8_t* src;
+        if (buf->count == 1 && !(buf->buf[0].flags & FUSE_BUF_IS_FD)) {
+            src = (const uint8_t*)buf->buf[0].mem + buf->off;
+        } else {
+            copy.resize(size);
+            struct fuse_bufvec mem = {};
+            mem.count = 1;
+            mem.buf[0].size = size;
+            mem.buf[0].mem = copy.data();
+            mem.buf[0].fd = -1;
+            if (fuse_buf_copy(&mem, buf, (enum fuse_buf_copy_flags)0) != (ssize_t)size) return -MYFS_ERROR_IO;
+            src = copy.data();
+        }
+        if (packed || dedup) {
+            ret = packed ? cluster_write(inode, (const char*)src, size, offset) :
+                           dedup_write(inode, (const char*)src, size, offset);
+            if (ret != MYFS_ERROR_NONE) return ret;
+            finish_write(inode, offset, size);
+            return size;
+        }
+        std::vector<IoSeg> segs;
+        for (const FileRun& r : runs) segs.push_back({ r.dev_off, (void*)(src + r.req_off), r.len });
+        if (driver_write_batch(segs.data(), (int)segs.size()) != MYFS_ERROR_NONE) return -MYFS_ERROR_IO;
+    }
+
+    finish_write(inode, offset, size);
+    return size;
+}
+
+// 服务端拷贝 (copy_file_range): 整段数据在进程内搬运, 不经内核往返. 去重镜像中两端偏移都按块
+// 对齐时, 整块部分直接共用源文件的块; 其余部分读出后按普通写入写到目标
+ssize_t FileSystem::fuse_copy_file_range(const char* from, off_t off_in, const char* to, off_t off_out, size_t size) {
+    OpScope scope(*this);
+    bool is_find, is_root;
+    myfs_dentry* src = lookup(std::string(from), &is_find, &is_root);
+    if (!is_find || !src) return -MYFS_ERROR_NOTFOUND;
+    if (!src->inode) load_inode(src);
+    myfs_dentry* dst = lookup(std::string(to), &is_find, &is_root);
+    if (!is_find || !dst) return -MYFS_ERROR_NOTFOUND;
+    if (!dst->inode) load_inode(dst);
+    if (!src->inode || !dst->inode) return -MYFS_ERROR_NOTFOUND;
+    myfs_inode* in = src->inode;
+    myfs_inode* out = dst->inode;
+    if (!MYFS_IS_REG(in) || !MYFS_IS_REG(out)) return -MYFS_ERROR_ISDIR;
+    if (off_in < 0 || off_out < 0) return -MYFS_ERROR_INVAL;
+
+    if (off_in >= (off_t)in->size) return 0;
+    size = (size_t)std::min<uint64_t>(size, in->size - off_in);
+
+    // 同一文件内的拷贝可能重叠, 总是整段读出再写
+    size_t shared = 0;
+    const uint32_t mask = super.block_size - 1;
+    if (dedup_on() && in != out && !clustered(in) && !clustered(out) && !(off_in & mask) && !(off_out & mask)) {
+        int n = (int)(size >> super.blk_bits);
+        int first_in = (int)(off_in >> super.blk_bits);
+        int first_out = (int)(off_out >> super.blk_bits);
+        if (n > 0 && first_out + n <= MYFS_DIRECT_BLOCKS) {
+            dedup_clone(in, first_in, out, first_out, n);
+            flush_dedup();
+            shared = (size_t)n << super.blk_bits;
+            finish_write(out, off_out, shared);
         }
-        read_len += len;
     }
-    return read_len; 
+    if (shared == size) return size;
+
+    std::vector<char> buf(size - shared);
+    int n = fuse_read(from, buf.data(), buf.size(), off_in + shared, nullptr);
+    if (n < 0) return shared ? (ssize_t)shared : n;
+    int ret = fuse_write(to, buf.data(), n, off_out + shared, nullptr);
+    if (ret < 0) return shared ? (ssize_t)shared : ret;
+    return shared + ret;
+}
+
+int FileSystem::fuse_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+    OpScope scope(*this);
+    bool is_find, is_root;
+    std::string s_path(path);
+    myfs_dentry* dentry = lookup(s_path, &is_find, &is_root);
+    if (!is_find || !dentry) return -MYFS_ERROR_NOTFOUND;
+
+    // 元数据与数据均已写入设备 (或映射), 只需让设备落盘
+    return device->sync() == MYFS_ERROR_NONE ? 0 : -MYFS_ERROR_IO;
 }
 
 int FileSystem::fuse_utimens(const char* path, const struct timespec tv[2]) {
+    OpScope scope(*this);
     bool is_find, is_root;
     std::string s_path(path);
     struct myfs_dentry *dentry = lookup(s_path, &is_find, &is_root);
@@ -716,6 +1877,7 @@ int FileSystem::fuse_utimens(const char* path, const struct timespec tv[2]) {
 }
 
 int FileSystem::fuse_getattr(const char* path, struct stat * myfs_stat) {
+    OpScope scope(*this);
     bool is_find, is_root;
     std::string s_path(path);
     struct myfs_dentry *dentry = lookup(s_path, &is_find, &is_root);
@@ -725,48 +1887,142 @@ int FileSystem::fuse_getattr(const char* path, struct stat * myfs_stat) {
     }
 
     if (dentry->inode == nullptr) {
-        dentry->inode = read_inode(dentry->ino);
-        dentry->inode->dentry = dentry;
-    }
-
-    struct myfs_inode *inode = dentry->inode;
-    myfs_stat->st_mode = inode->mode;
-    myfs_stat->st_nlink = inode->link_count;
-    myfs_stat->st_uid = inode->uid;
-    myfs_stat->st_gid = inode->gid;
-    myfs_stat->st_size = inode->size;
-    myfs_stat->st_atime = inode->atime;
-    myfs_stat->st_mtime = inode->mtime;
-    myfs_stat->st_ctime = inode->ctime;
-    myfs_stat->st_blocks = (inode->size + MYFS_BLK_SIZE - 1) / MYFS_BLK_SIZE; 
-    myfs_stat->st_blksize = MYFS_BLK_SIZE;
+        load_inode(dentry);
+    }
 
+    fill_stat(dentry->inode, myfs_stat);
 	return 0;
 }
 
+void FileSystem::fill_stat(const myfs_inode* inode, struct stat* st) {
+    st->st_mode = inode->mode;
+    st->st_nlink = inode->link_count;
+    st->st_uid = inode->uid;
+    st->st_gid = inode->gid;
+    st->st_size = inode->size;
+    st->st_atime = inode->atime;
+    st->st_mtime = inode->mtime;
+    st->st_ctime = inode->ctime;
+    st->st_blocks = (inode->size + super.block_size - 1) >> super.blk_bits; 
+    if (MYFS_IS_REG(inode) && has_compressed(inode)) {
+        // 含压缩簇的文件按实际存放的块计
+        st->st_blocks = std::count_if(inode->block, inode->block + MYFS_DIRECT_BLOCKS,
+                                      [](uint32_t b) { return b != 0 && b != MYFS_BLK_COMPRESSED; });
+    }
+    st->st_blksize = super.block_size;
+}
+
+// readdir 偏移 (游标), 0 表示从头开始:
+//   线性目录: 最后返回的子项的 cookie, 续读时从链表中第一个更小的 cookie 开始
+//   索引目录: MYFS_DX_CURSOR | 哈希 << 16 | 该哈希已返回的项数, 续读时直接定位到哈希所在叶子
+// 目录在列举中途转为索引目录时, 转换前开始的列举继续按 cookie 沿子项缓存链表列举 (转换前的子项
+// 都还在链表中, 转换后新挂入的 cookie 更大, 不会返回); 其余的线性偏移 (如重新挂载后) 从头重新列举
+static const off_t MYFS_DX_CURSOR = (off_t)1 << 48;
+
 int FileSystem::fuse_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t offset,
 			    		 struct fuse_file_info * fi) {
+    OpScope scope(*this);
     bool is_find, is_root;
     std::string s_path(path);
     struct myfs_dentry *dentry = lookup(s_path, &is_find, &is_root);
     
-    if (!is_find || !dentry || !dentry->inode) return -MYFS_ERROR_NOTFOUND;
-    if (!MYFS_IS_DIR(dentry->inode)) return -MYFS_ERROR_NOTFOUND;
-    
-    struct myfs_dentry *child = dentry->inode->first_child;
+    if (!is_find || !dentry) return -MYFS_ERROR_NOTFOUND;
+    if (!dentry->inode) load_inode(dentry);
+    if (!dentry->inode || !MYFS_IS_DIR(dentry->inode)) return -MYFS_ERROR_NOTFOUND;
+    myfs_inode* dir = dentry->inode;
+    
+    bool linear_cursor = offset > 0 && !(offset & MYFS_DX_CURSOR) && offset <= (off_t)dir->dx_cookie;
+    if (is_indexed(dir) && !linear_cursor) {
+        uint32_t from = 0, skip = 0;
+        if (offset & MYFS_DX_CURSOR) {
+            from = (uint32_t)(offset >> 16);
+            skip = (uint32_t)(offset & 0xffff);
+        }
+
+        // 叶子内按 (哈希, 槽位) 排序后返回; 相同哈希只在同一叶子中, 按序号区分.
+        // 返回的项挂入子项缓存, 遇到未载入 inode 的项时向后成批预读, 随后的 getattr 不再读盘
+        std::vector<uint8_t> blk_buf;
+        std::vector<std::pair<uint32_t, uint32_t>> order;
+        std::vector<myfs_dentry*> batch;
+        std::vector<off_t> next;
+        const uint32_t per_block = super.block_size / sizeof(struct myfs_dentry_d);
+        dx_visit(dir->block[0], 0, from, [&](uint32_t blk, bool leaf) {
+            if (!leaf) return true;
+            const struct myfs_dentry_d* ents = (const struct myfs_dentry_d*)meta_read(blk, blk_buf);
+            if (!ents) return true;
+
+            order.clear();
+            for (uint32_t i = 0; i < per_block; i++) {
+                if (ents[i].fname[0] == '\0') continue;
+                uint32_t hash = myfs_dx_hash(ents[i].fname, ents[i].namelen);
+                if (hash >= from) order.push_back({ hash, i });
+            }
+            std::sort(order.begin(), order.end());
+
+            batch.clear();
+            next.clear();
+            uint32_t seq = 0;
+            for (size_t k = 0; k < order.size(); k++) {
+                uint32_t hash = order[k].first;
+                seq = (k > 0 && order[k - 1].first == hash) ? seq + 1 : 1;
+                if (hash == from && seq <= skip) continue;
+
+                myfs_dentry* child = dx_attach(dir, ents[order[k].second]);
+                if (!child->inode && (batch.empty() || batch.back()->inode)) dx_prefetch(dir, hash);
+                batch.push_back(child);
+                next.push_back(MYFS_DX_CURSOR | (off_t)hash << 16 | seq);
+            }
+
+            for (size_t k = 0; k < batch.size(); k++) {
+                struct stat st;
+                std::memset(&st, 0, sizeof(st));
+                if (batch[k]->inode) fill_stat(batch[k]->inode, &st);
+                else st.st_mode = batch[k]->ftype == FileType::DIR ? S_IFDIR : S_IFREG;
+                if (MYFS_FILL(filler, buf, batch[k]->fname.c_str(), &st, next[k])) return false;
+            }
+            return true;
+        });
+        return 0;
+    }
+
+    // 上次停下的位置仍有效时直接续读, 否则沿链表跳过 cookie 不小于偏移的子项
+    struct myfs_dentry *child = dir->first_child;
+    if (offset > 0 && !(offset & MYFS_DX_CURSOR)) {
+        if (dir->rd_resume && dir->rd_resume_after == offset) child = dir->rd_resume;
+        else while (child && child->cookie >= offset) child = child->brother;
+    }
+
+    // 余下子项的 inode 一次读入 (线性目录至多 MYFS_DIRECT_BLOCKS 块目录项)
+    std::vector<myfs_dentry*> fetch;
+    for (myfs_dentry* c = child; c; c = c->brother) {
+        if (!c->inode) fetch.push_back(c);
+    }
+    prefetch_inodes(fetch);
+
+    uint32_t last = (offset & MYFS_DX_CURSOR) ? 0 : (uint32_t)offset;
+    bool emitted = false;
     while(child) {
         struct stat st;
         std::memset(&st, 0, sizeof(st));
-        if (child->inode) st.st_mode = child->inode->mode;
+        if (child->inode) fill_stat(child->inode, &st);
         
-        if (filler(buf, child->fname.c_str(), &st, 0)) break;
+        if (MYFS_FILL(filler, buf, child->fname.c_str(), &st, child->cookie)) {
+            dir->rd_resume = child;
+            dir->rd_resume_after = last;
+            break;
+        }
+        emitted = true;
+        last = child->cookie;
         child = child->brother;
     }
+    // 列举到末尾后内核还会再来一次, 什么也不返回的这次才算列举结束, 此前目录不回收
+    dir->rd_listing = emitted || child;
 	
     return 0;
 }
 
 int FileSystem::fuse_access(const char* path, int mask) {
+    OpScope scope(*this);
     bool is_find, is_root;
     std::string s_path(path);
     myfs_dentry* dentry = lookup(s_path, &is_find, &is_root);
@@ -778,6 +2034,7 @@ int FileSystem::fuse_access(const char* path, int mask) {
 }
 
 int FileSystem::fuse_open(const char* path, struct fuse_file_info* fi) {
+    OpScope scope(*this);
     bool is_find, is_root;
     std::string s_path(path);
     myfs_dentry* dentry = lookup(s_path, &is_find, &is_root);
@@ -789,6 +2046,7 @@ int FileSystem::fuse_open(const char* path, struct fuse_file_info* fi) {
 }
 
 int FileSystem::fuse_opendir(const char* path, struct fuse_file_info* fi) {
+    OpScope scope(*this);
     bool is_find, is_root;
     std::string s_path(path);
     myfs_dentry* dentry = lookup(s_path, &is_find, &is_root);
@@ -797,7 +2055,7 @@ int FileSystem::fuse_opendir(const char* path, struct fuse_file_info* fi) {
         return -MYFS_ERROR_NOTFOUND;
     }
     if (!dentry->inode) {
-        dentry->inode = read_inode(dentry->ino);
+        load_inode(dentry);
     }
     if (!MYFS_IS_DIR(dentry->inode)) {
         return -MYFS_ERROR_INVAL; 
@@ -806,17 +2064,23 @@ int FileSystem::fuse_opendir(const char* path, struct fuse_file_info* fi) {
 }
 
 int FileSystem::fuse_truncate(const char* path, off_t size) {
+    OpScope scope(*this);
     bool is_find, is_root;
     std::string s_path(path);
     myfs_dentry* dentry = lookup(s_path, &is_find, &is_root);
     if (!is_find || !dentry || !dentry->inode) return -MYFS_ERROR_NOTFOUND;
+    if (size < 0) return -MYFS_ERROR_INVAL;
+    if (size > ((off_t)MYFS_DIRECT_BLOCKS << super.blk_bits)) return -MYFS_ERROR_NOSPACE;
     
     myfs_inode *inode = dentry->inode;
     
-    // 如果是缩小文件，需要释放多余的块
-    if (size < inode->size) {
-        int old_end_blk = (inode->size + MYFS_BLK_SIZE - 1) / MYFS_BLK_SIZE - 1;
-        int new_end_blk = (size + MYFS_BLK_SIZE - 1) / MYFS_BLK_SIZE - 1;
+    if (clustered(inode)) {
+        int ret = cluster_truncate(inode, size);
+        if (ret != MYFS_ERROR_NONE) return ret;
+    } else if (size < inode->size) {
+        // 如果是缩小文件，需要释放多余的块
+        int old_end_blk = (int)((inode->size + super.block_size - 1) >> super.blk_bits) - 1;
+        int new_end_blk = (int)((size + super.block_size - 1) >> super.blk_bits) - 1;
         
         // 从后往前释放不再需要的块
         for (int i = old_end_blk; i > new_end_blk; i--) {
@@ -825,15 +2089,26 @@ int FileSystem::fuse_truncate(const char* path, off_t size) {
                 inode->block[i] = 0;
             }
         }
+
+        // 末块中新大小之后的部分清零, 以后再扩大文件时读到的是零而不是旧数据
+        size_t tail = (size_t)size & (super.block_size - 1);
+        if (tail != 0 && inode->block[new_end_blk] != 0) {
+            int ret = own_block(inode, new_end_blk);    // 与其他文件共用时先复制一份
+            if (ret != MYFS_ERROR_NONE) return ret;
+            std::vector<uint8_t> zero(super.block_size - tail, 0);
+            driver_write(blk_ofs(inode->block[new_end_blk]) + tail, zero.data(), zero.size());
+        }
     }
     
     inode->size = size;
     inode->mtime = time(NULL);
     sync_inode(inode);
+    commit_frees();
     return 0;
 }
 
 int FileSystem::fuse_unlink(const char* path) {
+    OpScope scope(*this);
     bool is_find, is_root;
     std::string s_path(path);
     myfs_dentry* dentry = lookup(s_path, &is_find, &is_root);
@@ -844,21 +2119,22 @@ int FileSystem::fuse_unlink(const char* path) {
     myfs_dentry* parent = dentry->parent;
     if (!parent || !parent->inode) return -MYFS_ERROR_IO;
     
-    //释放 Inode 及其数据块
-    release_inode(dentry->inode);
-    dentry->inode = nullptr; //避免悬空
+    //去掉该目录项对 Inode 的链接, 最后一个链接时释放 Inode 及其数据块
+    drop_link(dentry);
     
     //从父目录中移除 dentry
     delete_dentry(parent->inode, dentry);
     
-    //同步父目录 (写入磁盘)
+    //同步父目录 (写入磁盘), 之后被删文件的块才进入回收队列
     parent->inode->mtime = time(NULL);
     sync_inode(parent->inode);
+    commit_frees();
     
     return 0;
 }
 
 int FileSystem::fuse_rmdir(const char* path) {
+    OpScope scope(*this);
     bool is_find, is_root;
     std::string s_path(path);
     myfs_dentry* dentry = lookup(s_path, &is_find, &is_root);
@@ -866,8 +2142,8 @@ int FileSystem::fuse_rmdir(const char* path) {
     if (!is_find || !dentry || !dentry->inode) return -MYFS_ERROR_NOTFOUND;
     if (!MYFS_IS_DIR(dentry->inode)) return -MYFS_ERROR_INVAL; 
     
-    //检查目录是否为空 (如果有子项，first_child 不为空)
-    if (dentry->inode->first_child != nullptr) {
+    //检查目录是否为空 (索引目录的 first_child 只是缓存, 以目录项计数为准)
+    if (dentry->inode->dir_entries != 0) {
         return -MYFS_ERROR_ACCESS; // Directory not empty
     }
     
@@ -875,62 +2151,121 @@ int FileSystem::fuse_rmdir(const char* path) {
     if (!parent || !parent->inode) return -MYFS_ERROR_IO;
 
     //释放 Inode
-    release_inode(dentry->inode);
-    dentry->inode = nullptr;
+    drop_link(dentry);
 
     //移除 Dentry
     delete_dentry(parent->inode, dentry);
 
     //同步父目录
+    drop_dir_link(parent->inode);
     parent->inode->mtime = time(NULL);
     sync_inode(parent->inode);
+    commit_frees();
     
     return 0;
 }
 
+// 原地改名: 源 dentry 从源父目录摘下, 改名后挂入目标父目录, dentry 对象连同其 inode 与子树不变.
+// 目标已存在时源 dentry 顶替目标在目录中的槽位 (索引目录只改写叶子中的一项), 目标名字始终指向
+// 新旧 inode 之一, 随后去掉被覆盖 inode 的链接. 只写回两个父目录 (同一目录时一个), 不递归同步子项;
+// 线性目录只改写变动的槽位所在的目录块, 至多两块
 int FileSystem::fuse_rename(const char* from, const char* to) {
+    OpScope scope(*this);
     bool is_find, is_root;
-    std::string s_from(from);
-    
-    //检查源文件是否存在
-    myfs_dentry* from_dentry = lookup(s_from, &is_find, &is_root);
-    if (!is_find || !from_dentry || !from_dentry->inode) return -MYFS_ERROR_NOTFOUND;
-    
-    //类型一致
-    mode_t mode = MYFS_IS_DIR(from_dentry->inode) ? (S_IFDIR | 0755) : (S_IFREG | 0644);
-    
-    // 在目标位置创建新节点 (借用 fuse_mkdir / fuse_mknod)
+    myfs_dentry* src = lookup(from, &is_find, &is_root);
+    if (!is_find || !src) return -MYFS_ERROR_NOTFOUND;
+    if (is_root) return -MYFS_ERROR_INVAL;
+    if (!src->inode) load_inode(src);
+    if (!src->inode) return -MYFS_ERROR_IO;
+    myfs_dentry* src_parent = src->parent;
+    if (!src_parent || !src_parent->inode) return -MYFS_ERROR_IO;
+
+    std::string s_to(to);
+    size_t last_slash = s_to.find_last_of('/');
+    std::string dir_name = last_slash == 0 ? "/" : s_to.substr(0, last_slash);
+    std::string base_name = s_to.substr(last_slash + 1);
+    if (base_name.empty()) return -MYFS_ERROR_INVAL;
+
+    myfs_dentry* dst_parent = lookup(dir_name, &is_find, &is_root);
+    if (!is_find || !dst_parent) return -MYFS_ERROR_NOTFOUND;
+    if (!dst_parent->inode) load_inode(dst_parent);
+    if (!dst_parent->inode) return -MYFS_ERROR_IO;
+    if (!MYFS_IS_DIR(dst_parent->inode)) return -MYFS_ERROR_NOTDIR;
+
+    // 目录不能移入自己的子树
+    bool src_dir = MYFS_IS_DIR(src->inode);
+    if (src_dir) {
+        for (myfs_dentry* d = dst_parent; d; d = d->parent) {
+            if (d == src) return -MYFS_ERROR_INVAL;
+        }
+    }
+
+    myfs_dentry* victim = lookup(s_to, &is_find, &is_root);
+    if (!is_find) victim = nullptr;
+    if (victim == src) return 0;
+    if (victim) {
+        if (!victim->inode) load_inode(victim);
+        if (!victim->inode) return -MYFS_ERROR_IO;
+        bool victim_dir = MYFS_IS_DIR(victim->inode);
+        if (src_dir && !victim_dir) return -MYFS_ERROR_NOTDIR;
+        if (!src_dir && victim_dir) return -MYFS_ERROR_ISDIR;
+        if (victim_dir && victim->inode->dir_entries != 0) return -MYFS_ERROR_NOTEMPTY;
+    }
+
+    myfs_inode* sdir = src_parent->inode;
+    myfs_inode* ddir = dst_parent->inode;
+    std::string old_name = src->fname;
+    int old_slot = src->slot;
+    bool src_indexed = is_indexed(sdir);
+    detach_child(sdir, src);
+
+    // 先挂入目标目录 (索引目录此时写入叶子), 失败时挂回源目录, 磁盘未动
     int ret;
-    if (S_ISDIR(mode)) {
-        ret = fuse_mkdir(to, mode);
+    if (victim) {
+        replace_child(ddir, victim, src);
+        ret = is_indexed(ddir) ? dx_replace(ddir, src->fname, src->ino, src_dir) : MYFS_ERROR_NONE;
+        if (ret != MYFS_ERROR_NONE) replace_child(ddir, src, victim);
     } else {
-        ret = fuse_mknod(to, mode, 0);
+        // 源项已摘下, 同一目录内改名时可能落回原槽位, 只改写一块
+        int slot = is_indexed(ddir) ? -1 : dir_free_slot(ddir);
+        src->fname = base_name;
+        ret = alloc_dentry(ddir, src);
+        if (ret == MYFS_ERROR_NONE) src->slot = slot;
+    }
+    if (ret != MYFS_ERROR_NONE) {
+        src->fname = old_name;
+        src->slot = old_slot;
+        link_child(sdir, src);
+        sdir->dir_entries++;
+        return ret;
     }
-    
-    if (ret != 0) return ret;
 
-    //获取刚刚创建的目标 dentry
-    bool to_find, to_root;
-    myfs_dentry* to_dentry = lookup(to, &to_find, &to_root);
-    if (!to_find || !to_dentry || !to_dentry->inode) return -MYFS_ERROR_IO;
+    // 再去掉源目录中的旧目录项. 线性目录在下面写回时重新生成旧槽位所在的块; 源目录若刚在上面转为
+    // 索引目录, 转换时旧项已不在链表中
+    if (src_indexed) dx_remove(sdir, old_name);
 
-    //mknod 刚刚分配了一个新 inode，这个新 inode 是多余的
-    release_inode(to_dentry->inode); // 释放那个临时的空 inode
-    
-    // 将目标 dentry 指向源 inode
-    to_dentry->inode = from_dentry->inode;
-    to_dentry->ino = from_dentry->inode->ino;
-    
-    //更新 inode 的反向指针
-    from_dentry->inode->dentry = to_dentry; 
-    
-    //从旧的父目录中移除源 dentry
-    myfs_dentry* from_parent = from_dentry->parent;
-    delete_dentry(from_parent->inode, from_dentry);
-    
-    //同步受影响的父目录
-    sync_inode(from_parent->inode);       // 源父目录
-    sync_inode(to_dentry->parent->inode); // 目标父目录
-    
+    if (victim) {
+        drop_link(victim);
+        free_dentry(victim);
+    }
+
+    // 目录换了父目录: 源父目录少一个子目录, 目标父目录多一个 (覆盖的空目录不再计入)
+    if (src_dir) {
+        drop_dir_link(sdir);
+        ddir->link_count++;
+        if (victim) drop_dir_link(ddir);
+    }
+
+    time_t now = time(NULL);
+    sdir->mtime = now;
+    ddir->mtime = now;
+    int slots[2] = { src->slot, old_slot };
+    if (sdir == ddir) {
+        write_dir_slots(ddir, slots, 2);
+    } else {
+        write_dir_slots(ddir, &slots[0], 1);
+        write_dir_slots(sdir, &slots[1], 1);
+    }
+    commit_frees();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,1305 @@
+/*
+ * myfs_bench: 不经过 FUSE 挂载, 直接调用 FileSystem::fuse_* 的基准测试.
+ * 设备为本地镜像文件: 默认经 ddriver_file.cpp 模拟的 ddriver 访问,
+ * --backend=image 时直接 pread/pwrite, --backend=uring 时批量经 io_uring 提交.
+ * 结果以 JSON 输出.
+ *
+ * 用法: myfs_bench [--image=PATH] [--json=FILE] [--quick] [--keep-image] [--only=NAME,...] [--key=value ...]
+ */
+#include "utils.h"
+#include "latency.h"
+#include "atomic_bitmap.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/******************************************************************************
+* SECTION: 配置
+*******************************************************************************/
+struct BenchConfig {
+    std::string image = "/tmp/myfs_bench.img";
+    std::string backend = "ddriver";       // ddriver (本地替身) / image / direct / mmap / uring
+    int queue_depth = 0;                   // uring 队列深度, 0 为默认
+    int pool_buffers = 0;                  // direct 缓冲池槽位数, 0 为默认
+    long long dev_size = 4 << 20;          // 新建镜像大小
+    int block_size = MYFS_DEF_BLK_SIZE;    // 格式化块大小: 1024 / 4096 / 16384
+    int compress = 0;                      // 非 0 时各负载都以 --compress 挂载
+    int dedup = 0;                         // 非 0 时各负载的镜像都带 --dedup 格式化
+    int cache_kb = 0;                      // 非 0 时各负载都以 --cache-kb 挂载
+    std::string json_path;                 // 为空则输出到 stdout
+    bool keep_image = false;               // 结束后保留镜像, 供 myfs-fsck 检查
+    std::string only;                      // 逗号分隔的负载名, 为空则全部运行
+
+    int depth = 2;                         // mdtest 目录树深度
+    int width = 4;                         // 每层子目录数
+    int files_per_dir = 16;                // 每个叶子目录的文件数
+
+    int rw_files = 32;                     // 顺序/随机读写的文件数
+    int rw_chunk = 1024;                   // 顺序读写单次大小
+    int rand_chunk = 512;                  // 随机读写单次大小
+    int rand_ops = 4000;
+
+    int list_entries = 40;                 // 大目录条目数
+    int list_iters = 2000;
+
+    int bigdir_entries = 600;              // 索引目录条目数, 远超线性目录的 6 块容量
+
+    int remount_iters = 50;
+
+    int walk_cache_kb = 16;                // 遍历目录树时的 inode 缓存上限
+
+    int rename_iters = 2000;               // 写临时文件 + rename 覆盖目标的次数
+
+    int alloc_bits = 65536;                // 并发位图分配: 位图大小 (1KB 块下 8 个组的 inode 数)
+    int alloc_ops = 200000;                // 每线程认领次数
+    int alloc_threads = 32;                // 线程数从 1 翻倍到此值
+
+    int getattr_iters = 50000;             // getattr 循环: 计时开销检查
+    int getattr_rounds = 61;               // 轮数多而每轮短, 中位数更稳
+    double max_overhead_pct = 5.0;
+};
+
+static bool parse_args(int argc, char** argv, BenchConfig& cfg) {
+    std::map<std::string, int*> int_opts = {
+        {"depth", &cfg.depth}, {"width", &cfg.width}, {"files-per-dir", &cfg.files_per_dir},
+        {"rw-files", &cfg.rw_files}, {"rw-chunk", &cfg.rw_chunk},
+        {"rand-chunk", &cfg.rand_chunk}, {"rand-ops", &cfg.rand_ops},
+        {"list-entries", &cfg.list_entries}, {"list-iters", &cfg.list_iters},
+        {"bigdir-entries", &cfg.bigdir_entries},
+        {"remount-iters", &cfg.remount_iters}, {"rename-iters", &cfg.rename_iters}, {"queue-depth", &cfg.queue_depth},
+        {"pool-buffers", &cfg.pool_buffers}, {"block-size", &cfg.block_size}, {"compress", &cfg.compress},
+        {"dedup", &cfg.dedup}, {"cache-kb", &cfg.cache_kb}, {"walk-cache-kb", &cfg.walk_cache_kb},
+        {"getattr-iters", &cfg.getattr_iters}, {"getattr-rounds", &cfg.getattr_rounds},
+        {"alloc-bits", &cfg.alloc_bits}, {"alloc-ops", &cfg.alloc_ops}, {"alloc-threads", &cfg.alloc_threads},
+    };
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--quick") {
+            cfg.files_per_dir = 8;
+            cfg.rw_files = 8;
+            cfg.rand_ops = 500;
+            cfg.list_iters = 200;
+            cfg.bigdir_entries = 300;
+            cfg.remount_iters = 5;
+            cfg.rename_iters = 200;
+            cfg.getattr_iters = 10000;
+            cfg.alloc_ops = 20000;
+            continue;
+        }
+        if (arg == "--keep-image") {
+            cfg.keep_image = true;
+            continue;
+        }
+        if (arg.compare(0, 2, "--") != 0 || arg.find('=') == std::string::npos) {
+            std::fprintf(stderr, "unknown argument: %s\n", argv[i]);
+            return false;
+        }
+        std::string key = arg.substr(2, arg.find('=') - 2);
+        std::string val = arg.substr(arg.find('=') + 1);
+
+        if (key == "image") cfg.image = val;
+        else if (key == "backend") cfg.backend = val;
+        else if (key == "dev-size") cfg.dev_size = std::stoll(val);
+        else if (key == "json") cfg.json_path = val;
+        else if (key == "only") cfg.only = val;
+        else if (key == "max-overhead-pct") cfg.max_overhead_pct = std::stod(val);
+        else if (int_opts.count(key)) *int_opts[key] = std::stoi(val);
+        else {
+            std::fprintf(stderr, "unknown option: --%s\n", key.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+/******************************************************************************
+* SECTION: 计时与结果
+*******************************************************************************/
+struct BenchResult {
+    std::string name;
+    uint64_t ops = 0;
+    uint64_t errors = 0;
+    bool must_succeed = true;      // errors 非 0 时退出码为 1
+    double seconds = 0;
+    double p50_us = 0, p90_us = 0, p99_us = 0, max_us = 0;
+    double dev_reads_per_op = 0;
+    double dev_writes_per_op = 0;
+    std::map<std::string, double> extra;
+};
+
+static std::vector<BenchResult> results;
+
+// 一个测量阶段: 逐次记录延迟, 结束时换算设备 IO / op.
+// expect 为每次操作应有的返回值 (如 -MYFS_ERROR_NOTFOUND); 为 0 时负数返回计为错误, 否则不等于它的计为错误
+class Phase {
+public:
+    explicit Phase(const char* name, int expect = 0) : name(name), expect(expect) {
+        io_start = FileSystem::Instance().io_stats();
+        start_ns = latency_now_ns();
+    }
+
+    int op(const std::function<int()>& fn) {
+        uint64_t t0 = latency_now_ns();
+        int ret = fn();
+        hist.record(latency_now_ns() - t0);
+        ops++;
+        if (expect ? ret != expect : ret < 0) errors++;
+        return ret;
+    }
+
+    BenchResult& finish() {
+        uint64_t elapsed = latency_now_ns() - start_ns;
+        const myfs_io_stats& io = FileSystem::Instance().io_stats();
+
+        BenchResult r;
+        r.name = name;
+        r.ops = ops;
+        r.errors = errors;
+        r.seconds = elapsed / 1e9;
+        r.p50_us = hist.percentile(0.50) / 1e3;
+        r.p90_us = hist.percentile(0.90) / 1e3;
+        r.p99_us = hist.percentile(0.99) / 1e3;
+        r.max_us = hist.max() / 1e3;
+        if (ops) {
+            r.dev_reads_per_op = (double)(io.read_cnt - io_start.read_cnt) / ops;
+            r.dev_writes_per_op = (double)(io.write_cnt - io_start.write_cnt) / ops;
+        }
+        results.push_back(r);
+        return results.back();
+    }
+
+private:
+    std::string name;
+    int expect;
+    LatencyHistogram hist;
+    uint64_t ops = 0;
+    uint64_t errors = 0;
+    uint64_t start_ns;
+    myfs_io_stats io_start;
+};
+
+static FileSystem& fs() {
+    return FileSystem::Instance();
+}
+
+static void mount_image(const BenchConfig& cfg) {
+    CustomOptions opts = {};
+    opts.device = cfg.image.c_str();
+    opts.backend = cfg.backend.c_str();
+    opts.queue_depth = (unsigned)cfg.queue_depth;
+    opts.pool_buffers = (unsigned)cfg.pool_buffers;
+    opts.block_size = (unsigned)cfg.block_size;
+    opts.compress = cfg.compress;
+    opts.dedup = cfg.dedup;
+    opts.cache_kb = (unsigned)cfg.cache_kb;
+    if (fs().mount(opts) != 0) {
+        std::fprintf(stderr, "mount %s (%s) failed\n", cfg.image.c_str(), cfg.backend.c_str());
+        exit(1);
+    }
+}
+
+// 每个负载使用全新 (全零) 镜像, mount 时自动格式化
+static void fresh_mount(const BenchConfig& cfg) {
+    unlink(cfg.image.c_str());
+    FILE* f = std::fopen(cfg.image.c_str(), "w");
+    if (!f || truncate(cfg.image.c_str(), cfg.dev_size) != 0) {
+        std::perror(cfg.image.c_str());
+        exit(1);
+    }
+    std::fclose(f);
+    mount_image(cfg);
+}
+
+static int fill_count(void* buf, const char* name, const struct stat* st, off_t off) {
+    (*(size_t*)buf)++;
+    return 0;
+}
+
+// 模拟内核的定长 readdir 缓冲区: 每次调用最多接收 page 项, 下次从最后接收项的偏移续读
+struct PagedList {
+    size_t page;
+    size_t taken = 0;
+    size_t total = 0;
+    off_t next = 0;
+    std::vector<std::string>* names = nullptr;     // 非空时收集返回的文件名
+};
+
+static int fill_paged(void* buf, const char* name, const struct stat* st, off_t off) {
+    PagedList* list = (PagedList*)buf;
+    if (list->taken == list->page) return 1;
+    list->taken++;
+    list->total++;
+    list->next = off;
+    if (list->names) list->names->push_back(name);
+    return 0;
+}
+
+// 分页列举整个目录, 返回项数; 每次 readdir 计为 phase 的一次操作
+static size_t list_paged(const char* path, size_t page, Phase& phase,
+                         std::vector<std::string>* names = nullptr) {
+    PagedList list;
+    list.page = page;
+    list.names = names;
+    do {
+        list.taken = 0;
+        phase.op([&] { return fs().fuse_readdir(path, &list, fill_paged, list.next, nullptr); });
+    } while (list.taken == page && list.next != 0);
+    return list.total;
+}
+
+/******************************************************************************
+* SECTION: mdtest 风格元数据负载
+*******************************************************************************/
+static void build_tree(const std::string& dir, int level, const BenchConfig& cfg,
+                       std::vector<std::string>& leaves, Phase* phase) {
+    if (level == cfg.depth) {
+        leaves.push_back(dir);
+        return;
+    }
+    for (int i = 0; i < cfg.width; i++) {
+        std::string child = (dir == "/" ? "" : dir) + "/d" + std::to_string(i);
+        if (phase) phase->op([&] { return fs().fuse_mkdir(child.c_str(), S_IFDIR | 0755); });
+        else fs().fuse_mkdir(child.c_str(), S_IFDIR | 0755);
+        build_tree(child, level + 1, cfg, leaves, phase);
+    }
+}
+
+static std::vector<std::string> tree_files(const std::vector<std::string>& leaves, const BenchConfig& cfg) {
+    std::vector<std::string> files;
+    for (const auto& leaf : leaves) {
+        for (int i = 0; i < cfg.files_per_dir; i++) {
+            files.push_back(leaf + "/f" + std::to_string(i));
+        }
+    }
+    return files;
+}
+
+static void bench_mdtest(const BenchConfig& cfg) {
+    fresh_mount(cfg);
+
+    std::vector<std::string> leaves;
+    {
+        Phase p("mdtest_mkdir");
+        build_tree("/", 0, cfg, leaves, &p);
+        p.finish();
+    }
+    std::vector<std::string> files = tree_files(leaves, cfg);
+
+    Phase create("mdtest_create");
+    for (const auto& f : files) {
+        create.op([&] { return fs().fuse_mknod(f.c_str(), S_IFREG | 0644, 0); });
+    }
+    create.finish();
+
+    Phase stat_phase("mdtest_stat");
+    for (const auto& f : files) {
+        struct stat st;
+        stat_phase.op([&] { return fs().fuse_getattr(f.c_str(), &st); });
+    }
+    stat_phase.finish();
+
+    Phase unlink_phase("mdtest_unlink");
+    for (const auto& f : files) {
+        unlink_phase.op([&] { return fs().fuse_unlink(f.c_str()); });
+    }
+    unlink_phase.finish();
+
+    // 删除后的负查找: 每次都应返回 ENOENT
+    Phase missing("mdtest_stat_missing", -MYFS_ERROR_NOTFOUND);
+    for (const auto& f : files) {
+        struct stat st;
+        missing.op([&] { return fs().fuse_getattr(f.c_str(), &st); });
+    }
+    missing.finish();
+
+    fs().umount();
+}
+
+/******************************************************************************
+* SECTION: 数据读写负载
+*******************************************************************************/
+static void bench_rw(const BenchConfig& cfg) {
+    fresh_mount(cfg);
+
+    const int file_size = MYFS_DIRECT_BLOCKS * cfg.block_size;
+    std::vector<std::string> files;
+    for (int i = 0; i < cfg.rw_files; i++) {
+        files.push_back("/rw" + std::to_string(i));
+        fs().fuse_mknod(files.back().c_str(), S_IFREG | 0644, 0);
+    }
+
+    std::vector<char> buf(std::max(cfg.rw_chunk, cfg.rand_chunk), 'x');
+
+    Phase seq_write("seq_write");
+    for (const auto& f : files) {
+        for (int off = 0; off + cfg.rw_chunk <= file_size; off += cfg.rw_chunk) {
+            seq_write.op([&] { return fs().fuse_write(f.c_str(), buf.data(), cfg.rw_chunk, off, nullptr); });
+        }
+    }
+    seq_write.finish().extra["MBps"] =
+        (double)files.size() * file_size / (1 << 20) / results.back().seconds;
+
+    Phase seq_read("seq_read");
+    for (const auto& f : files) {
+        for (int off = 0; off + cfg.rw_chunk <= file_size; off += cfg.rw_chunk) {
+            seq_read.op([&] { return fs().fuse_read(f.c_str(), buf.data(), cfg.rw_chunk, off, nullptr); });
+        }
+    }
+    seq_read.finish().extra["MBps"] =
+        (double)files.size() * file_size / (1 << 20) / results.back().seconds;
+
+    // read_buf/write_buf: 读出的 fd 缓冲区按 libfuse 不能 splice 时的方式拷入内存
+    struct fuse_bufvec mem = {};
+    mem.count = 1;
+    mem.buf[0].size = cfg.rw_chunk;
+    mem.buf[0].mem = buf.data();
+    mem.buf[0].fd = -1;
+
+    Phase seq_write_buf("seq_write_buf");
+    for (const auto& f : files) {
+        for (int off = 0; off + cfg.rw_chunk <= file_size; off += cfg.rw_chunk) {
+            seq_write_buf.op([&] {
+                struct fuse_bufvec src = mem;
+                return fs().fuse_write_buf(f.c_str(), &src, off, nullptr);
+            });
+        }
+    }
+    seq_write_buf.finish().extra["MBps"] =
+        (double)files.size() * file_size / (1 << 20) / results.back().seconds;
+
+    Phase seq_read_buf("seq_read_buf");
+    for (const auto& f : files) {
+        for (int off = 0; off + cfg.rw_chunk <= file_size; off += cfg.rw_chunk) {
+            seq_read_buf.op([&] {
+                struct fuse_bufvec* bv = nullptr;
+                int ret = fs().fuse_read_buf(f.c_str(), &bv, cfg.rw_chunk, off, nullptr);
+                if (ret != 0) return ret;
+                struct fuse_bufvec dst = mem;
+                ssize_t n = fuse_buf_copy(&dst, bv, (enum fuse_buf_copy_flags)0);
+                for (size_t i = 0; i < bv->count; i++) free(bv->buf[i].mem);
+                free(bv);
+                return (int)n;
+            });
+        }
+    }
+    seq_read_buf.finish().extra["MBps"] =
+        (double)files.size() * file_size / (1 << 20) / results.back().seconds;
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> pick_file(0, (int)files.size() - 1);
+    std::uniform_int_distribution<int> pick_off(0, file_size - cfg.rand_chunk);
+
+    Phase rand_write("rand_write");
+    for (int i = 0; i < cfg.rand_ops; i++) {
+        const std::string& f = files[pick_file(rng)];
+        int off = pick_off(rng);
+        rand_write.op([&] { return fs().fuse_write(f.c_str(), buf.data(), cfg.rand_chunk, off, nullptr); });
+    }
+    rand_write.finish();
+
+    Phase rand_read("rand_read");
+    for (int i = 0; i < cfg.rand_ops; i++) {
+        const std::string& f = files[pick_file(rng)];
+        int off = pick_off(rng);
+        rand_read.op([&] { return fs().fuse_read(f.c_str(), buf.data(), cfg.rand_chunk, off, nullptr); });
+    }
+    rand_read.finish();
+
+    // 整文件复制: 用户态读出再写入 (FUSE 2 的 cp) 与 copy_file_range 一次交给核心 (FUSE 3)
+    std::vector<char> whole(file_size);
+    for (size_t i = 0; i < files.size(); i++) {
+        fs().fuse_mknod(("/cp_rw" + std::to_string(i)).c_str(), S_IFREG | 0644, 0);
+        fs().fuse_mknod(("/cp_range" + std::to_string(i)).c_str(), S_IFREG | 0644, 0);
+    }
+    Phase copy_rw("copy_rw");
+    for (size_t i = 0; i < files.size(); i++) {
+        std::string to = "/cp_rw" + std::to_string(i);
+        copy_rw.op([&] {
+            int n = fs().fuse_read(files[i].c_str(), whole.data(), file_size, 0, nullptr);
+            return n < 0 ? n : fs().fuse_write(to.c_str(), whole.data(), n, 0, nullptr);
+        });
+    }
+    copy_rw.finish().extra["MBps"] =
+        (double)files.size() * file_size / (1 << 20) / results.back().seconds;
+
+    Phase copy_range("copy_range");
+    for (size_t i = 0; i < files.size(); i++) {
+        std::string to = "/cp_range" + std::to_string(i);
+        copy_range.op([&] { return (int)fs().fuse_copy_file_range(files[i].c_str(), 0, to.c_str(), 0, file_size); });
+    }
+    copy_range.finish().extra["MBps"] =
+        (double)files.size() * file_size / (1 << 20) / results.back().seconds;
+
+    fs().umount();
+}
+
+// 按簇压缩: 写满日志样式 (JSON 行) 的文件, 重新挂载后整文件读取 (读盘并解压), 再读一遍 (簇缓存命中)
+static void bench_compress(const BenchConfig& cfg) {
+    BenchConfig ccfg = cfg;
+    ccfg.compress = 1;
+    fresh_mount(ccfg);
+
+    const int file_size = MYFS_DIRECT_BLOCKS * cfg.block_size;
+    std::string text;
+    for (int i = 0; (int)text.size() < file_size; i++) {
+        text += "{\"ts\": " + std::to_string(1700000000 + i * 7) + ", \"level\": \"" + (i % 5 ? "info" : "warn") +
+                "\", \"req\": " + std::to_string(i * 7919 % 100000) + ", \"msg\": \"request served\"}\n";
+    }
+    std::vector<std::string> files;
+    for (int i = 0; i < cfg.rw_files; i++) {
+        files.push_back("/log" + std::to_string(i));
+        fs().fuse_mknod(files.back().c_str(), S_IFREG | 0644, 0);
+    }
+
+    Phase write("compress_write");
+    for (const auto& f : files) {
+        write.op([&] { return fs().fuse_write(f.c_str(), text.data(), file_size, 0, nullptr); });
+    }
+    BenchResult& w = write.finish();
+    w.extra["MBps"] = (double)files.size() * file_size / (1 << 20) / w.seconds;
+    // 逻辑块数 / 实际存放的块数
+    struct stat st;
+    uint64_t stored = 0;
+    for (const auto& f : files) {
+        fs().fuse_getattr(f.c_str(), &st);
+        stored += st.st_blocks;
+    }
+    w.extra["ratio"] = stored ? (double)files.size() * MYFS_DIRECT_BLOCKS / stored : 0;
+
+    fs().umount();
+    mount_image(ccfg);
+    for (const auto& f : files) fs().fuse_getattr(f.c_str(), &st);
+
+    std::vector<char> buf(file_size);
+    for (const char* name : { "compress_read", "compress_read_cached" }) {
+        Phase read(name);
+        for (const auto& f : files) {
+            read.op([&] {
+                int n = fs().fuse_read(f.c_str(), buf.data(), file_size, 0, nullptr);
+                return n == file_size && std::memcmp(buf.data(), text.data(), file_size) == 0 ? n : -MYFS_ERROR_IO;
+            });
+        }
+        BenchResult& r = read.finish();
+        r.extra["MBps"] = (double)files.size() * file_size / (1 << 20) / r.seconds;
+    }
+
+    fs().umount();
+}
+
+// 块级去重: 若干源文件各复制 4 份 (如整棵依赖树的多份副本), 副本的每块都命中已有的块, 只写 inode
+// 与去重表; 重新挂载后读回全部副本校验内容
+static void bench_dedup(const BenchConfig& cfg) {
+    BenchConfig dcfg = cfg;
+    dcfg.dedup = 1;
+    fresh_mount(dcfg);
+
+    const int file_size = MYFS_DIRECT_BLOCKS * cfg.block_size;
+    const int sources = std::max(1, cfg.rw_files / 4);
+    std::vector<std::string> texts(sources, std::string(file_size, 0));
+    uint32_t x = 2463534242u;
+    for (auto& t : texts) {
+        for (auto& c : t) {
+            x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+            c = (char)x;
+        }
+    }
+    for (int i = 0; i < sources; i++) {
+        std::string f = "/src" + std::to_string(i);
+        fs().fuse_mknod(f.c_str(), S_IFREG | 0644, 0);
+        fs().fuse_write(f.c_str(), texts[i].data(), file_size, 0, nullptr);
+    }
+
+    std::vector<std::pair<std::string, int>> copies;
+    for (int k = 0; k < 4; k++) {
+        for (int i = 0; i < sources; i++) {
+            copies.push_back({ "/copy" + std::to_string(k) + "_" + std::to_string(i), i });
+            fs().fuse_mknod(copies.back().first.c_str(), S_IFREG | 0644, 0);
+        }
+    }
+    Phase copy("dedup_copy");
+    for (const auto& c : copies) {
+        copy.op([&] { return fs().fuse_write(c.first.c_str(), texts[c.second].data(), file_size, 0, nullptr); });
+    }
+    BenchResult& w = copy.finish();
+    w.extra["MBps"] = (double)copies.size() * file_size / (1 << 20) / w.seconds;
+
+    fs().umount();
+    mount_image(dcfg);
+    struct stat st;
+    for (const auto& c : copies) fs().fuse_getattr(c.first.c_str(), &st);
+
+    std::vector<char> buf(file_size);
+    Phase read("dedup_read");
+    for (const auto& c : copies) {
+        read.op([&] {
+            int n = fs().fuse_read(c.first.c_str(), buf.data(), file_size, 0, nullptr);
+            return n == file_size && std::memcmp(buf.data(), texts[c.second].data(), file_size) == 0 ? n : -MYFS_ERROR_IO;
+        });
+    }
+    BenchResult& r = read.finish();
+    r.extra["MBps"] = (double)copies.size() * file_size / (1 << 20) / r.seconds;
+
+    // copy_file_range 按块对齐时直接共用源文件的块, 不读也不写数据
+    for (int i = 0; i < sources; i++) {
+        std::string src = "/src" + std::to_string(i), to = "/clone" + std::to_string(i);
+        fs().fuse_mknod(to.c_str(), S_IFREG | 0644, 0);
+        fs().fuse_getattr(src.c_str(), &st);
+        fs().fuse_getattr(to.c_str(), &st);
+    }
+    Phase clone("dedup_clone");
+    for (int i = 0; i < sources; i++) {
+        std::string src = "/src" + std::to_string(i), to = "/clone" + std::to_string(i);
+        clone.op([&] { return (int)fs().fuse_copy_file_range(src.c_str(), 0, to.c_str(), 0, file_size); });
+    }
+    BenchResult& c = clone.finish();
+    c.extra["MBps"] = (double)sources * file_size / (1 << 20) / c.seconds;
+    for (int i = 0; i < sources; i++) {
+        std::string to = "/clone" + std::to_string(i);
+        if (fs().fuse_read(to.c_str(), buf.data(), file_size, 0, nullptr) != file_size ||
+            std::memcmp(buf.data(), texts[i].data(), file_size) != 0) {
+            std::fprintf(stderr, "dedup_clone: %s differs from its source\n", to.c_str());
+            fs().umount();
+            exit(1);
+        }
+    }
+
+    fs().umount();
+}
+
+// 交错追加两个文件, 使每个文件的数据块在物理上两两不相邻; 整文件读取时各块为独立的段
+static void bench_frag(const BenchConfig& cfg) {
+    fresh_mount(cfg);
+
+    const int file_size = MYFS_DIRECT_BLOCKS * cfg.block_size;
+    std::vector<std::string> files;
+    for (int i = 0; i < cfg.rw_files * 2; i++) {
+        files.push_back("/frag" + std::to_string(i));
+        fs().fuse_mknod(files.back().c_str(), S_IFREG | 0644, 0);
+    }
+
+    std::vector<char> buf(file_size, 'y');
+    for (size_t pair = 0; pair + 1 < files.size(); pair += 2) {
+        for (int blk = 0; blk < MYFS_DIRECT_BLOCKS; blk++) {
+            for (size_t k = pair; k < pair + 2; k++) {
+                fs().fuse_write(files[k].c_str(), buf.data(), cfg.block_size, blk * cfg.block_size, nullptr);
+            }
+        }
+    }
+
+    Phase frag_read("frag_read");
+    for (int i = 0; i < cfg.rand_ops; i++) {
+        const std::string& f = files[i % files.size()];
+        frag_read.op([&] { return fs().fuse_read(f.c_str(), buf.data(), file_size, 0, nullptr); });
+    }
+    frag_read.finish();
+
+    fs().umount();
+}
+
+/******************************************************************************
+* SECTION: 大目录列举
+*******************************************************************************/
+static void bench_list(const BenchConfig& cfg) {
+    fresh_mount(cfg);
+
+    fs().fuse_mkdir("/big", S_IFDIR | 0755);
+    int created = 0;
+    for (int i = 0; i < cfg.list_entries; i++) {
+        std::string f = "/big/entry_" + std::to_string(i);
+        if (fs().fuse_mknod(f.c_str(), S_IFREG | 0644, 0) == 0) created++;
+    }
+
+    size_t listed = 0;
+    Phase list("readdir_large");
+    for (int i = 0; i < cfg.list_iters; i++) {
+        list.op([&] { return fs().fuse_readdir("/big", &listed, fill_count, 0, nullptr); });
+    }
+    BenchResult& r = list.finish();
+    r.extra["entries"] = created;
+    r.extra["entries_per_sec"] = listed / r.seconds;
+
+    listed = 0;
+    Phase paged("readdir_paged");
+    for (int i = 0; i < cfg.list_iters; i++) {
+        listed += list_paged("/big", 8, paged);
+    }
+    BenchResult& rp = paged.finish();
+    rp.extra["entries_per_sec"] = listed / rp.seconds;
+
+    fs().umount();
+}
+
+/******************************************************************************
+* SECTION: 索引目录
+* 条目数超过线性目录容量后目录转为哈希索引; 重新挂载后随机顺序逐个 stat,
+* 每次查找只读根到叶子一条路径, dev_reads_per_op 不随条目数增长
+*******************************************************************************/
+static void bench_bigdir(const BenchConfig& cfg) {
+    fresh_mount(cfg);
+
+    fs().fuse_mkdir("/big", S_IFDIR | 0755);
+    std::vector<std::string> names;
+    for (int i = 0; i < cfg.bigdir_entries; i++) {
+        std::string f = "/big/file_" + std::to_string(i);
+        if (fs().fuse_mknod(f.c_str(), S_IFREG | 0644, 0) != 0) break;    // 小镜像 inode 用尽
+        names.push_back(f);
+    }
+
+    fs().umount();
+    mount_image(cfg);
+
+    std::mt19937 rng(7);
+    std::shuffle(names.begin(), names.end(), rng);
+    struct stat st;
+    Phase stat_phase("bigdir_stat");
+    for (const auto& f : names) {
+        stat_phase.op([&] { return fs().fuse_getattr(f.c_str(), &st); });
+    }
+    stat_phase.finish().extra["entries"] = names.size();
+
+    // ls -l: 冷缓存下分页列举, 每次 readdir 从游标所在叶子续读并批量读入子项 inode;
+    // 随后逐个 stat 应全部命中缓存
+    fs().umount();
+    mount_image(cfg);
+    std::vector<std::string> listed;
+    Phase list("bigdir_readdir");
+    list_paged("/big", 32, list, &listed);
+    list.finish().extra["entries"] = listed.size();
+    if (listed.size() != names.size()) {
+        std::fprintf(stderr, "bigdir_readdir: listed %zu of %zu entries\n", listed.size(), names.size());
+        exit(1);
+    }
+
+    Phase ls_stat("bigdir_ls_stat");
+    for (const auto& n : listed) {
+        std::string f = "/big/" + n;
+        ls_stat.op([&] { return fs().fuse_getattr(f.c_str(), &st); });
+    }
+    ls_stat.finish();
+
+    fs().umount();
+}
+
+/******************************************************************************
+* SECTION: rename - 原子保存 (写临时文件后 rename 覆盖目标) 与整目录改名
+*******************************************************************************/
+static void bench_rename(const BenchConfig& cfg) {
+    fresh_mount(cfg);
+    fs().fuse_mkdir("/save", S_IFDIR | 0755);
+    std::string chunk(cfg.rw_chunk, 's');
+    for (int i = 0; i < cfg.rw_files; i++) {
+        std::string f = "/save/f" + std::to_string(i);
+        fs().fuse_mknod(f.c_str(), S_IFREG | 0644, 0);
+        fs().fuse_write(f.c_str(), chunk.data(), chunk.size(), 0, nullptr);
+    }
+
+    // 延迟与设备 IO 只计 rename 本身, 不含临时文件的创建与写入
+    Phase save("rename_save");
+    myfs_io_stats rename_io = {};
+    for (int i = 0; i < cfg.rename_iters; i++) {
+        std::string target = "/save/f" + std::to_string(i % cfg.rw_files);
+        fs().fuse_mknod("/save/.tmp", S_IFREG | 0644, 0);
+        fs().fuse_write("/save/.tmp", chunk.data(), chunk.size(), 0, nullptr);
+        myfs_io_stats before = fs().io_stats();
+        save.op([&] { return fs().fuse_rename("/save/.tmp", target.c_str()); });
+        myfs_io_stats after = fs().io_stats();
+        rename_io.read_cnt += after.read_cnt - before.read_cnt;
+        rename_io.write_cnt += after.write_cnt - before.write_cnt;
+    }
+    BenchResult& r = save.finish();
+    r.dev_reads_per_op = (double)rename_io.read_cnt / cfg.rename_iters;
+    r.dev_writes_per_op = (double)rename_io.write_cnt / cfg.rename_iters;
+
+    // 目录改名的开销与其中的项数无关
+    for (int i = 0; i < cfg.list_entries; i++) {
+        fs().fuse_mknod(("/save/g" + std::to_string(i)).c_str(), S_IFREG | 0644, 0);
+    }
+    Phase dir("rename_dir");
+    for (int i = 0; i < cfg.rename_iters; i++) {
+        dir.op([&] { return i % 2 ? fs().fuse_rename("/moved", "/save") : fs().fuse_rename("/save", "/moved"); });
+    }
+    dir.finish().extra["entries"] = cfg.rw_files + cfg.list_entries;
+
+    fs().umount();
+}
+
+/******************************************************************************
+* SECTION: read_buf 与并发释放 - 回复发出前, fd 缓冲区指向的块不能被回收、重新分配
+* 读出 fd 缓冲区后先不拷贝 (libfuse 在核心锁放开后才 splice); 另一线程把文件截断为 0, 再写满镜像,
+* 分配时当场回收. 随后拷出的须仍是截断前的内容; 本线程再次进入核心后引用解除, 搁置的块可再分配
+*******************************************************************************/
+// 每块内容不同, 去重镜像中也各占一块
+static void fill_pattern(std::vector<char>& buf, int seed, int block_size) {
+    for (size_t k = 0; k < buf.size(); k++) buf[k] = (char)(seed * 131 + k / block_size * 17 + k);
+}
+
+static void bench_splice(const BenchConfig& cfg) {
+    BenchConfig scfg = cfg;
+    if (scfg.backend != "mmap" && scfg.backend != "uring") scfg.backend = "image";     // 其余后端不返回 fd 缓冲区
+    const int file_size = MYFS_DIRECT_BLOCKS * cfg.block_size;
+    scfg.dev_size = std::min(cfg.dev_size, 1000LL * file_size);                        // 写满所需的文件数有限
+    fresh_mount(scfg);
+    std::vector<char> data(file_size), got(file_size);
+    fill_pattern(data, 0, cfg.block_size);
+    fs().fuse_mknod("/victim", S_IFREG | 0644, 0);
+    fs().fuse_write("/victim", data.data(), file_size, 0, nullptr);
+
+    struct fuse_bufvec* bv = nullptr;
+    if (fs().fuse_read_buf("/victim", &bv, file_size, 0, nullptr) != 0) {
+        std::fprintf(stderr, "read_buf_race: read_buf failed\n");
+        exit(1);
+    }
+    int fd_bufs = 0;
+    for (size_t i = 0; i < bv->count; i++) fd_bufs += (bv->buf[i].flags & FUSE_BUF_IS_FD) != 0;
+
+    int filled = 0;
+    std::thread other([&] {
+        fs().fuse_truncate("/victim", 0);
+        std::vector<char> junk(file_size);
+        for (;; filled++) {
+            std::string f = "/fill" + std::to_string(filled);
+            fill_pattern(junk, filled + 1, cfg.block_size);
+            if (fs().fuse_mknod(f.c_str(), S_IFREG | 0644, 0) != 0) break;
+            if (fs().fuse_write(f.c_str(), junk.data(), file_size, 0, nullptr) != file_size) break;
+        }
+    });
+    other.join();
+
+    Phase race("read_buf_race");
+    race.op([&] {
+        struct fuse_bufvec dst = {};
+        dst.count = 1;
+        dst.buf[0].size = file_size;
+        dst.buf[0].mem = got.data();
+        dst.buf[0].fd = -1;
+        ssize_t n = fuse_buf_copy(&dst, bv, (enum fuse_buf_copy_flags)0);
+        for (size_t i = 0; i < bv->count; i++) free(bv->buf[i].mem);
+        free(bv);
+        return n == file_size && got == data ? (int)n : -MYFS_ERROR_IO;
+    });
+    // 再次进入核心: 引用解除, 截断释放的块可重新分配
+    race.op([&] { return fs().fuse_write("/victim", data.data(), file_size, 0, nullptr); });
+    BenchResult& r = race.finish();
+    r.extra["fd_bufs"] = fd_bufs;
+    r.extra["fill_files"] = filled;
+    fs().umount();
+}
+
+/******************************************************************************
+* SECTION: rename 核对 - 线性目录与索引目录内、跨两者的改名 (含覆盖已有名字与整目录移动).
+* 重新挂载后逐个核对: 新名字读出的是改名前那个文件的内容, 旧名字已不存在, 各目录的项与预期相同
+*******************************************************************************/
+// 文件内容为创建时的路径, 改名后据此判断新名字指向哪个 inode
+static bool tag_file(const std::string& path) {
+    if (fs().fuse_mknod(path.c_str(), S_IFREG | 0644, 0) != 0) return false;
+    return fs().fuse_write(path.c_str(), path.data(), path.size(), 0, nullptr) == (int)path.size();
+}
+
+static std::set<std::string> list_names(const char* dir) {
+    std::vector<std::string> names;
+    PagedList list;
+    list.page = SIZE_MAX;
+    list.names = &names;
+    fs().fuse_readdir(dir, &list, fill_paged, 0, nullptr);
+    return std::set<std::string>(names.begin(), names.end());
+}
+
+static void bench_rename_check(const BenchConfig& cfg) {
+    fresh_mount(cfg);
+    const int lin_files = 8;
+    std::map<std::string, std::string> expect;     // 文件路径 -> 内容
+    fs().fuse_mkdir("/lin", S_IFDIR | 0755);
+    fs().fuse_mkdir("/idx", S_IFDIR | 0755);
+    fs().fuse_mkdir("/lin/sub", S_IFDIR | 0755);
+    for (int i = 0; i < lin_files; i++) {
+        std::string f = "/lin/a" + std::to_string(i);
+        if (tag_file(f)) expect[f] = f;
+    }
+    for (int i = 0; i < 4; i++) {
+        std::string f = "/lin/sub/s" + std::to_string(i);
+        if (tag_file(f)) expect[f] = f;
+    }
+    // 1KB 块时远超线性目录的容量, 目录转为索引; 小镜像 inode 用尽时到此为止
+    int idx_files = 0;
+    while (idx_files < cfg.bigdir_entries / 2) {
+        std::string f = "/idx/e" + std::to_string(idx_files);
+        if (!tag_file(f)) break;
+        expect[f] = f;
+        idx_files++;
+    }
+
+    auto idx = [](int i) { return "/idx/e" + std::to_string(i); };
+    std::vector<std::pair<std::string, std::string>> moves;
+    for (int i = 0; i < lin_files / 2; i++) {                     // 线性目录内
+        moves.push_back({ "/lin/a" + std::to_string(i), "/lin/b" + std::to_string(i) });
+    }
+    for (int i = 0; i < idx_files; i += 5) {                      // 索引目录内
+        moves.push_back({ idx(i), "/idx/r" + std::to_string(i) });
+    }
+    for (int i = 1; i + 1 < idx_files; i += 10) {                 // 索引目录内, 覆盖已有的名字
+        moves.push_back({ idx(i), idx(i + 1) });
+    }
+    for (int i = lin_files / 2; i < lin_files; i++) {             // 线性 -> 索引
+        moves.push_back({ "/lin/a" + std::to_string(i), "/idx/l" + std::to_string(i) });
+    }
+    for (int i = 3; i < idx_files; i += 10) {                     // 索引 -> 线性
+        moves.push_back({ idx(i), "/lin/i" + std::to_string(i) });
+    }
+    if (idx_files > 4) moves.push_back({ idx(4), "/lin/b0" });    // 索引 -> 线性, 覆盖已有的名字
+    moves.push_back({ "/lin/sub", "/idx/sub" });                  // 整目录移入索引目录
+
+    std::set<std::string> gone;
+    Phase phase("rename_mixed");
+    for (const auto& m : moves) {
+        phase.op([&] { return fs().fuse_rename(m.first.c_str(), m.second.c_str()); });
+        std::map<std::string, std::string> moved;
+        for (auto it = expect.begin(); it != expect.end();) {
+            if (it->first == m.first || it->first.compare(0, m.first.size() + 1, m.first + "/") == 0) {
+                moved[m.second + it->first.substr(m.first.size())] = it->second;
+                gone.insert(it->first);
+                it = expect.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        for (auto& kv : moved) expect[kv.first] = kv.second;
+    }
+    phase.finish().extra["entries"] = idx_files;
+    fs().umount();
+
+    mount_image(cfg);
+    size_t bad = 0;
+    std::map<std::string, std::set<std::string>> children = { { "/lin", {} }, { "/idx", { "sub" } }, { "/idx/sub", {} } };
+    for (const auto& e : expect) {
+        std::vector<char> buf(e.second.size() + 16);
+        int n = fs().fuse_read(e.first.c_str(), buf.data(), buf.size(), 0, nullptr);
+        if (n != (int)e.second.size() || std::memcmp(buf.data(), e.second.data(), n) != 0) {
+            std::fprintf(stderr, "rename_mixed: %s does not hold %s\n", e.first.c_str(), e.second.c_str());
+            bad++;
+        }
+        size_t slash = e.first.find_last_of('/');
+        children[e.first.substr(0, slash)].insert(e.first.substr(slash + 1));
+    }
+    for (const auto& g : gone) {
+        if (expect.count(g)) continue;
+        struct stat st;
+        if (fs().fuse_getattr(g.c_str(), &st) != -MYFS_ERROR_NOTFOUND) {
+            std::fprintf(stderr, "rename_mixed: %s still resolves\n", g.c_str());
+            bad++;
+        }
+    }
+    for (const auto& c : children) {
+        if (list_names(c.first.c_str()) != c.second) {
+            std::fprintf(stderr, "rename_mixed: %s does not list the expected %zu entries\n",
+                         c.first.c_str(), c.second.size());
+            bad++;
+        }
+    }
+    fs().umount();
+    if (bad) exit(1);
+}
+
+/******************************************************************************
+* SECTION: unlink - 删除写满的文件, 块的释放攒批后由回收线程完成
+*******************************************************************************/
+static void bench_unlink(const BenchConfig& cfg) {
+    fresh_mount(cfg);
+    fs().fuse_mkdir("/del", S_IFDIR | 0755);
+    const int file_size = MYFS_DIRECT_BLOCKS * cfg.block_size;
+    std::vector<char> buf(file_size, 'd');
+    std::vector<std::string> files;
+    for (int i = 0; i < cfg.rw_files; i++) {
+        files.push_back("/del/f" + std::to_string(i));
+        fs().fuse_mknod(files.back().c_str(), S_IFREG | 0644, 0);
+        fs().fuse_write(files.back().c_str(), buf.data(), buf.size(), 0, nullptr);
+    }
+
+    Phase full("unlink_full");
+    for (const auto& f : files) {
+        full.op([&] { return fs().fuse_unlink(f.c_str()); });
+    }
+    full.finish().extra["blocks_per_file"] = MYFS_DIRECT_BLOCKS;
+
+    fs().umount();
+}
+
+/******************************************************************************
+* SECTION: 重新挂载
+*******************************************************************************/
+static void bench_remount(const BenchConfig& cfg) {
+    fresh_mount(cfg);
+
+    std::vector<std::string> leaves;
+    build_tree("/", 0, cfg, leaves, nullptr);
+    for (const auto& f : tree_files(leaves, cfg)) {
+        fs().fuse_mknod(f.c_str(), S_IFREG | 0644, 0);
+    }
+
+    Phase remount("remount");
+    for (int i = 0; i < cfg.remount_iters; i++) {
+        remount.op([&] {
+            fs().umount();
+            mount_image(cfg);
+            return 0;
+        });
+    }
+    remount.finish();
+
+    fs().umount();
+}
+
+/******************************************************************************
+* SECTION: 卸载写回
+* mdtest 目录树建好后 umount: sync_inode 递归写回每个目录的目录块与每个 inode 的记录, 先入写请求
+* 队列, 按设备偏移排序合并后一次扫过设备. transfers 为合并后实际下发的传输数, 远少于 queued
+*******************************************************************************/
+static void bench_flush(const BenchConfig& cfg) {
+    fresh_mount(cfg);
+    std::vector<std::string> leaves;
+    build_tree("/", 0, cfg, leaves, nullptr);
+    std::vector<std::string> files = tree_files(leaves, cfg);
+    for (const auto& f : files) {
+        fs().fuse_mknod(f.c_str(), S_IFREG | 0644, 0);
+    }
+    size_t dirs = 1;
+    for (int level = 1, n = 1; level <= cfg.depth; level++) dirs += (n *= cfg.width);
+
+    myfs_io_stats io_before = fs().io_stats();
+    myfs_sched_stats before = fs().sched_stats();
+    Phase flush("umount_flush");
+    flush.op([&] {
+        fs().umount();
+        return 0;
+    });
+    BenchResult& r = flush.finish();
+    myfs_io_stats io_after = fs().io_stats();
+    myfs_sched_stats after = fs().sched_stats();
+    r.extra["inodes"] = dirs + files.size();
+    r.extra["dev_seeks"] = io_after.seek_cnt - io_before.seek_cnt;
+    r.extra["queued"] = after.queued - before.queued;
+    r.extra["requests"] = after.requests - before.requests;
+    r.extra["transfers"] = after.transfers - before.transfers;
+
+    // 合并下发的内容与逐个写回的相同: 重新挂载后每个文件都在
+    mount_image(cfg);
+    size_t missing = 0;
+    struct stat st;
+    for (const auto& f : files) {
+        if (fs().fuse_getattr(f.c_str(), &st) != 0) missing++;
+    }
+    fs().umount();
+    if (missing) {
+        std::fprintf(stderr, "umount_flush: %zu of %zu files missing after remount\n", missing, files.size());
+        exit(1);
+    }
+}
+
+/******************************************************************************
+* SECTION: inode 缓存上限
+* 重新挂载后在很小的 --cache-kb 下遍历整棵树 (像 find -ls: 每个目录分页 readdir 到返回空为止,
+* 再逐项 getattr), 每次操作后缓存的估算大小不应超过上限; 第二遍重新载入被回收的 inode
+*******************************************************************************/
+struct TreeWalk {
+    Phase& phase;
+    uint64_t budget;
+    uint64_t peak = 0;
+    uint64_t over = 0;                     // 操作结束后仍超出上限的次数
+    size_t entries = 0;
+};
+
+static void walk_op(TreeWalk& w, const std::function<int()>& fn) {
+    w.phase.op(fn);
+    uint64_t bytes = fs().cache_stats().bytes;
+    w.peak = std::max(w.peak, bytes);
+    if (w.budget && bytes > w.budget) w.over++;
+}
+
+static void walk_tree(const std::string& dir, size_t page, TreeWalk& w) {
+    std::vector<std::string> names;
+    PagedList list;
+    list.page = page;
+    list.names = &names;
+    do {
+        list.taken = 0;
+        walk_op(w, [&] { return fs().fuse_readdir(dir.c_str(), &list, fill_paged, list.next, nullptr); });
+    } while (list.taken > 0);
+
+    for (const auto& n : names) {
+        std::string path = (dir == "/" ? "" : dir) + "/" + n;
+        struct stat st;
+        std::memset(&st, 0, sizeof(st));
+        walk_op(w, [&] { return fs().fuse_getattr(path.c_str(), &st); });
+        w.entries++;
+        if (S_ISDIR(st.st_mode)) walk_tree(path, page, w);
+    }
+}
+
+static void bench_cache(const BenchConfig& cfg) {
+    fresh_mount(cfg);
+    std::vector<std::string> leaves;
+    build_tree("/", 0, cfg, leaves, nullptr);
+    std::vector<std::string> files = tree_files(leaves, cfg);
+    for (const auto& f : files) {
+        fs().fuse_mknod(f.c_str(), S_IFREG | 0644, 0);
+    }
+    size_t dirs = 0;
+    for (int level = 1, n = 1; level <= cfg.depth; level++) dirs += (n *= cfg.width);
+    fs().umount();
+
+    BenchConfig ccfg = cfg;
+    ccfg.cache_kb = cfg.walk_cache_kb;
+    mount_image(ccfg);
+    for (const char* name : { "cache_walk", "cache_rewalk" }) {
+        myfs_cache_stats before = fs().cache_stats();
+        Phase phase(name);
+        TreeWalk w{ phase, (uint64_t)ccfg.cache_kb << 10 };
+        walk_tree("/", 8, w);
+        BenchResult& r = phase.finish();
+        myfs_cache_stats after = fs().cache_stats();
+        r.extra["entries"] = w.entries;
+        r.extra["budget_kb"] = ccfg.cache_kb;
+        r.extra["peak_kb"] = w.peak / 1024.0;
+        r.extra["evictions"] = after.evictions - before.evictions;
+        r.extra["reloads"] = after.reloads - before.reloads;
+        if (w.entries != dirs + files.size() || w.over) {
+            fs().umount();
+            std::fprintf(stderr, "%s: walked %zu of %zu entries, %llu ops over the %d KB cache budget\n", name,
+                         w.entries, dirs + files.size(), (unsigned long long)w.over, ccfg.cache_kb);
+            exit(1);
+        }
+    }
+    fs().umount();
+}
+
+/******************************************************************************
+* SECTION: 并发位图分配
+* FileSystem 的目录树不支持并发修改, 这里直接在内存位图上驱动分配器: 每个线程从
+* 自己的游标起认领空闲位, 持有的位超过份额 (位图的一半 / 线程数) 时释放最早的一个,
+* 占用率保持在一半左右. 对照组用同样的游标, 但每次认领/释放都持有一把全局锁
+*******************************************************************************/
+static double alloc_loop(const BenchConfig& cfg, int threads, bool locked, uint64_t* claims) {
+    std::vector<uint64_t> words((cfg.alloc_bits + 63) / 64);
+    AtomicBitmap map((uint8_t*)words.data(), (uint32_t)cfg.alloc_bits);
+    std::mutex lock;
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<uint64_t> total{0};
+    const size_t share = std::max(1, cfg.alloc_bits / 2 / threads);
+
+    auto worker = [&](int t) {
+        uint32_t cursor = (uint32_t)((uint64_t)cfg.alloc_bits * t / threads) & ~63u;
+        std::vector<uint32_t> held(share);
+        size_t head = 0, count = 0;
+        uint64_t ok = 0;
+        auto step = [&] {
+            if (count == share) {
+                if (locked) {
+                    std::lock_guard<std::mutex> guard(lock);
+                    map.release(held[head]);
+                } else {
+                    map.release(held[head]);
+                }
+                head = (head + 1) % share;
+                count--;
+            }
+            int64_t bit;
+            if (locked) {
+                std::lock_guard<std::mutex> guard(lock);
+                bit = map.claim(cursor);
+            } else {
+                bit = map.claim(cursor);
+            }
+            if (bit < 0) return;
+            cursor = (uint32_t)bit + 1;
+            held[(head + count) % share] = (uint32_t)bit;
+            count++;
+            ok++;
+        };
+        while (count < share) step();   // 先填到份额再开始计时
+        ok = 0;
+        ready++;
+        while (!go.load()) std::this_thread::yield();
+        for (int i = 0; i < cfg.alloc_ops; i++) step();
+        total += ok;
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) pool.emplace_back(worker, t);
+    while (ready.load() < threads) std::this_thread::yield();
+    uint64_t t0 = latency_now_ns();
+    go = true;
+    for (auto& th : pool) th.join();
+    *claims = total.load();
+    return (latency_now_ns() - t0) / 1e9;
+}
+
+static void bench_alloc(const BenchConfig& cfg) {
+    for (int threads = 1; threads <= cfg.alloc_threads; threads *= 2) {
+        for (bool locked : { false, true }) {
+            BenchResult r;
+            r.name = std::string(locked ? "alloc_locked_t" : "alloc_atomic_t") + std::to_string(threads);
+            r.seconds = alloc_loop(cfg, threads, locked, &r.ops);
+            r.errors = (uint64_t)cfg.alloc_ops * threads - r.ops;
+            r.must_succeed = false;     // 认领不到空闲位不是文件系统错误
+            r.extra["threads"] = threads;
+            results.push_back(r);
+        }
+    }
+}
+
+/******************************************************************************
+* SECTION: getattr 循环 - 验证 OpTimer 计时开销
+*******************************************************************************/
+static double getattr_loop_ns(const char* path, int iters, bool timed) {
+    struct stat st;
+    uint64_t t0 = latency_now_ns();
+    for (int i = 0; i < iters; i++) {
+        if (timed) {
+            OpTimer timer(FuseOp::GETATTR, path);
+            fs().fuse_getattr(path, &st);
+        } else {
+            fs().fuse_getattr(path, &st);
+        }
+    }
+    return (double)(latency_now_ns() - t0) / iters;
+}
+
+static double bench_getattr_overhead(const BenchConfig& cfg) {
+    fresh_mount(cfg);
+    fs().fuse_mkdir("/d0", S_IFDIR | 0755);
+    fs().fuse_mkdir("/d0/d1", S_IFDIR | 0755);
+    fs().fuse_mknod("/d0/d1/file", S_IFREG | 0644, 0);
+
+    const char* path = "/d0/d1/file";
+    getattr_loop_ns(path, cfg.getattr_iters / 10, true);   // 预热
+
+    // 每轮有/无计时各跑一遍, 先后次序逐轮交替以抵消漂移; 开销取各轮比值的中位数, 单轮受干扰不影响判定
+    double raw = 1e18, timed = 1e18;
+    std::vector<double> ratios;
+    for (int r = 0; r < cfg.getattr_rounds; r++) {
+        bool timed_first = r & 1;
+        double first = getattr_loop_ns(path, cfg.getattr_iters, timed_first);
+        double second = getattr_loop_ns(path, cfg.getattr_iters, !timed_first);
+        double t = timed_first ? first : second, u = timed_first ? second : first;
+        raw = std::min(raw, u);
+        timed = std::min(timed, t);
+        ratios.push_back(t / u);
+    }
+    std::nth_element(ratios.begin(), ratios.begin() + ratios.size() / 2, ratios.end());
+    double overhead = (ratios[ratios.size() / 2] - 1.0) * 100.0;
+
+    BenchResult r;
+    r.name = "getattr_overhead";
+    r.ops = (uint64_t)cfg.getattr_iters * cfg.getattr_rounds * 2;
+    r.extra["raw_ns_per_op"] = raw;
+    r.extra["timed_ns_per_op"] = timed;
+    r.extra["overhead_pct"] = overhead;
+    results.push_back(r);
+
+    fs().umount();
+    return overhead;
+}
+
+/******************************************************************************
+* SECTION: JSON 输出
+*******************************************************************************/
+static void write_json(FILE* out, const BenchConfig& cfg) {
+    std::fprintf(out, "{\n  \"config\": {\"backend\": \"%s\", \"queue_depth\": %d, \"depth\": %d, \"width\": %d, \"files_per_dir\": %d, "
+                 "\"rw_files\": %d, \"rw_chunk\": %d, \"rand_chunk\": %d, \"block_size\": %d},\n",
+                 cfg.backend.c_str(), cfg.queue_depth, cfg.depth, cfg.width, cfg.files_per_dir, cfg.rw_files, cfg.rw_chunk,
+                 cfg.rand_chunk, cfg.block_size);
+    std::fprintf(out, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        std::fprintf(out, "    {\"name\": \"%s\", \"ops\": %llu, \"errors\": %llu, "
+                     "\"ops_per_sec\": %.1f, "
+                     "\"latency_us\": {\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f}, "
+                     "\"dev_reads_per_op\": %.2f, \"dev_writes_per_op\": %.2f",
+                     r.name.c_str(), (unsigned long long)r.ops, (unsigned long long)r.errors,
+                     r.seconds > 0 ? r.ops / r.seconds : 0.0,
+                     r.p50_us, r.p90_us, r.p99_us, r.max_us,
+                     r.dev_reads_per_op, r.dev_writes_per_op);
+        for (const auto& kv : r.extra) {
+            std::fprintf(out, ", \"%s\": %.2f", kv.first.c_str(), kv.second);
+        }
+        std::fprintf(out, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(out, "  ]\n}\n");
+}
+
+// 负载按此顺序运行; --only 按名字挑选
+static const struct {
+    const char* name;
+    void (*run)(const BenchConfig&);
+} workloads[] = {
+    { "mdtest", bench_mdtest },
+    { "rw", bench_rw },
+    { "splice", bench_splice },
+    { "compress", bench_compress },
+    { "dedup", bench_dedup },
+    { "frag", bench_frag },
+    { "list", bench_list },
+    { "bigdir", bench_bigdir },
+    { "rename", bench_rename },
+    { "rename", bench_rename_check },
+    { "unlink", bench_unlink },
+    { "remount", bench_remount },
+    { "flush", bench_flush },
+    { "cache", bench_cache },
+    { "alloc", bench_alloc },
+};
+
+static bool selected(const BenchConfig& cfg, const char* name) {
+    return cfg.only.empty() || ("," + cfg.only + ",").find("," + std::string(name) + ",") != std::string::npos;
+}
+
+int main(int argc, char** argv) {
+    BenchConfig cfg;
+    if (!parse_args(argc, argv, cfg)) return 2;
+
+    for (const auto& w : workloads) {
+        if (selected(cfg, w.name)) w.run(cfg);
+    }
+    double overhead = selected(cfg, "getattr") ? bench_getattr_overhead(cfg) : 0;
+
+    FILE* out = stdout;
+    if (!cfg.json_path.empty()) {
+        out = std::fopen(cfg.json_path.c_str(), "w");
+        if (!out) {
+            std::perror(cfg.json_path.c_str());
+            return 1;
+        }
+    }
+    write_json(out, cfg);
+    if (out != stdout) std::fclose(out);
+
+    if (!cfg.keep_image) unlink(cfg.image.c_str());
+
+    bool failed = false;
+    for (const BenchResult& r : results) {
+        if (!r.must_succeed || r.errors == 0) continue;
+        std::fprintf(stderr, "%s: %llu of %llu ops failed\n", r.name.c_str(),
+                     (unsigned long long)r.errors, (unsigned long long)r.ops);
+        failed = true;
+    }
+    if (failed) return 1;
+
+    if (overhead > cfg.max_overhead_pct) {
+        std::fprintf(stderr, "getattr timing overhead %.2f%% exceeds %.2f%%\n",
+                     overhead, cfg.max_overhead_pct);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * ddriver 的本地文件替身: 以普通镜像文件模拟 ddriver 设备,
+ * 供 myfs_bench 在无内核模块/无 FUSE 挂载的环境下直接驱动 FileSystem.
+ * 接口与语义同 include/ddriver.h, 每次调用同样计入 ddriver_state.
+ */
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+extern "C" {
+    #include "ddriver.h"
+}
+
+#define DDRIVER_FILE_IO_SZ      512
+#define DDRIVER_FILE_DEF_SIZE   (4 * 1024 * 1024)   // 与 ddriver 默认介质大小一致
+
+static struct ddriver_state file_state;
+
+int ddriver_open(char *path) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return -1;
+
+    // 空镜像按 ddriver 默认介质大小扩展
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size == 0) {
+        if (ftruncate(fd, DDRIVER_FILE_DEF_SIZE) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+int ddriver_seek(int fd, off_t offset, int whence) {
+    file_state.seek_cnt++;
+    return lseek(fd, offset, whence) < 0 ? -1 : 0;
+}
+
+int ddriver_write(int fd, char *buf, size_t size) {
+    file_state.write_cnt++;
+    return write(fd, buf, size) == (ssize_t)size ? (int)size : -1;
+}
+
+int ddriver_read(int fd, char *buf, size_t size) {
+    file_state.read_cnt++;
+    return read(fd, buf, size) == (ssize_t)size ? (int)size : -1;
+}
+
+int ddriver_ioctl(int fd, unsigned long cmd, void *ret) {
+    struct stat st;
+    switch (cmd) {
+    case IOC_REQ_DEVICE_SIZE:
+        if (fstat(fd, &st) != 0) return -1;
+        *(int *)ret = (int)st.st_size;
+        return 0;
+    case IOC_REQ_DEVICE_STATE:
+        std::memcpy(ret, &file_state, sizeof(file_state));
+        return 0;
+    case IOC_REQ_DEVICE_RESET:
+        std::memset(&file_state, 0, sizeof(file_state));
+        return 0;
+    case IOC_REQ_DEVICE_IO_SZ:
+        *(int *)ret = DDRIVER_FILE_IO_SZ;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+int ddriver_close(int fd) {
+    return close(fd);
+}
@@ -0,0 +1,49 @@
+#!/bin/bash
+# 挂载后对比两个 FUSE 入口: myfs (FUSE 2) 与 myfs3 (FUSE 3, 需 -DMYFS_FUSE3=ON 构建)
+# 用法: ./fuse_compare.sh [构建目录, 默认 ../../build] [文件数, 默认 200]
+# 每个入口在全新的 (1KB 块, 文件上限 6KB) 镜像上依次跑同一组命令, 输出各步耗时 (ms)
+
+WORK_DIR=$(cd `dirname $0`; pwd)
+BUILD_DIR=$(cd ${1:-$WORK_DIR/../../build}; pwd)
+FILES=${2:-200}
+TMP=$(mktemp -d)
+MNTPOINT=$TMP/mnt
+IMAGE=$TMP/myfs.img
+mkdir -p $MNTPOINT
+
+function now_ms() {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# 计时一步: step 名称 命令...
+function step() {
+    NAME=$1
+    shift
+    START=$(now_ms)
+    bash -c "$*" > /dev/null 2>&1 || echo "  ($NAME failed)"
+    printf "  %-12s %8d\n" $NAME $(( $(now_ms) - START ))
+}
+
+function run() {
+    BIN=$1
+    if [ ! -x $BUILD_DIR/$BIN ]; then
+        echo "$BIN: not built, skipped"
+        return
+    fi
+    rm -f $IMAGE && truncate -s 32M $IMAGE
+    $BUILD_DIR/$BIN --backend=image --device=$IMAGE $MNTPOINT || { echo "$BIN: mount failed"; return; }
+
+    echo "$BIN"
+    step write   "for i in \$(seq $FILES); do head -c 3072 /dev/urandom > $MNTPOINT/f\$i; done"
+    step append  "for i in \$(seq $FILES); do for k in 1 2 3; do head -c 1024 /dev/zero >> $MNTPOINT/f\$i; done; done"
+    step ls_l    "ls -l $MNTPOINT"
+    step cat     "cat $MNTPOINT/f* > /dev/null"
+    step cp      "mkdir $MNTPOINT/cp && for i in \$(seq $FILES); do cp $MNTPOINT/f\$i $MNTPOINT/cp/; done"
+    step rm      "rm -r $MNTPOINT/cp $MNTPOINT/f*"
+
+    fusermount3 -u $MNTPOINT 2>/dev/null || fusermount -u $MNTPOINT
+}
+
+run myfs
+run myfs3
+rm -rf $TMP
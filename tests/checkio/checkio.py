@@ -0,0 +1,95 @@
+import argparse
+import os
+import sys
+import json
+
+""" Error Code """
+ERR_OK = 0
+BUDGET_EXCEEDED = 1
+SNAPSHOT_ERR = 2
+RULES_ERR = 3
+
+""" Messages """
+ERROR = "错误: "
+
+""" Counters """
+COUNTERS = [ "reads", "writes", "seeks" ]
+SNAPSHOT_KEYS = { "read": "reads", "write": "writes", "seek": "seeks" }
+
+root = os.path.split(os.path.realpath(__file__))[0]
+
+parser = argparse.ArgumentParser()
+parser.add_argument("-r", "--rules", help="absolute path of golden budget json file")
+parser.add_argument("-s", "--stage", help="stage name in the budget file")
+parser.add_argument("-b", "--before", help="counter line read from .myfs_stats before the stage")
+parser.add_argument("-a", "--after", help="counter line read from .myfs_stats after the stage")
+parser.add_argument("-u", "--update", action="store_true", help="write the measured cost back as the stage budget")
+args = parser.parse_args()
+
+golden = args.rules if args.rules != None else root + "/golden.json"
+
+if args.stage == None or args.before == None or args.after == None:
+    sys.stderr.write("需指定阶段名与前后两次计数\n")
+    exit(RULES_ERR)
+
+""" 解析 'ddriver read R write W seek S' (或 'device ...') 一行 """
+def parse_snapshot(line: str):
+    words = line.split()
+    counters = {}
+    for i in range(len(words) - 1):
+        if words[i] in SNAPSHOT_KEYS and words[i + 1].isdigit():
+            counters[SNAPSHOT_KEYS[words[i]]] = int(words[i + 1])
+    if len(counters) != len(COUNTERS):
+        return None
+    return counters
+
+before = parse_snapshot(args.before)
+after = parse_snapshot(args.after)
+if before == None or after == None:
+    sys.stderr.write(ERROR + "无法解析设备计数: '%s' / '%s'\n" % (args.before, args.after))
+    exit(SNAPSHOT_ERR)
+
+cost = {}
+for c in COUNTERS:
+    cost[c] = after[c] - before[c]
+    if cost[c] < 0:
+        sys.stderr.write(ERROR + "%s 计数在阶段中变小, 设备可能被重置\n" % c)
+        exit(SNAPSHOT_ERR)
+
+try:
+    with open(golden, "r") as f:
+        rules = json.load(f)
+except (OSError, ValueError) as e:
+    sys.stderr.write(ERROR + "读取 %s 失败: %s\n" % (golden, e))
+    exit(RULES_ERR)
+
+stages = rules.setdefault("stages", {})
+
+if args.update:
+    stages[args.stage] = cost
+    with open(golden, "w") as f:
+        json.dump(rules, f, indent=4)
+        f.write("\n")
+    print("%s: 预算更新为 %s" % (args.stage, " ".join("%s %d" % (c, cost[c]) for c in COUNTERS)))
+    exit(ERR_OK)
+
+if args.stage not in stages:
+    sys.stderr.write(ERROR + "%s 中没有阶段 %s\n" % (golden, args.stage))
+    exit(RULES_ERR)
+
+""" 上限 = 预算 × (1 + tolerance_pct%) + slack, slack 吸收回收线程等带来的时序抖动 """
+tolerance = rules.get("tolerance_pct", 25) / 100.0
+slack = rules.get("slack", 8)
+budget = stages[args.stage]
+
+ret = ERR_OK
+for c in COUNTERS:
+    if c not in budget:
+        continue
+    limit = int(budget[c] * (1 + tolerance) + slack)
+    verdict = "ok"
+    if cost[c] > limit:
+        verdict = "超出预算"
+        ret = BUDGET_EXCEEDED
+    print("%s %-6s %6d (预算 %d, 上限 %d) %s" % (args.stage, c, cost[c], budget[c], limit, verdict))
+exit(ret)
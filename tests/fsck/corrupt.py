@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+# 在镜像副本上制造两处损坏, 检查 myfs-fsck 的发现与修复:
+#   1. 第 0 组数据位图中置上一个空闲块的位 (块泄漏)
+#   2. 根目录第一个目录块的空槽中写入指向未分配 inode 的目录项 (悬空目录项)
+# 随后依次期望: 检查返回 4, --repair 返回 1, 再检查返回 0
+#
+# 用法: corrupt.py --fsck=PATH --image=SRC --out=DST
+import argparse
+import shutil
+import struct
+import subprocess
+import sys
+
+SUPER_FMT = '<16I'          # myfs_super_d 的前 16 个字段
+GROUP_FMT = '<8I'           # myfs_group_d
+INODE_SIZE = 128
+DENTRY_FMT = '<IHBB128s'    # myfs_dentry_d
+DX_INDEXED = 0x1
+
+
+def first_clear_bit(bitmap, nbits):
+    for i in range(nbits):
+        if not bitmap[i // 8] & (1 << (i % 8)):
+            return i
+    return -1
+
+
+def corrupt(path):
+    with open(path, 'r+b') as f:
+        sb = struct.unpack(SUPER_FMT, f.read(struct.calcsize(SUPER_FMT)))
+        bs, inodes_per_group, root_ino = sb[1], sb[10], sb[13]
+        gdt_start = sb[5]
+
+        def read_blk(blk):
+            f.seek(blk * bs)
+            return bytearray(f.read(bs))
+
+        def write_blk(blk, data):
+            f.seek(blk * bs)
+            f.write(data)
+
+        g0 = struct.unpack_from(GROUP_FMT, read_blk(gdt_start))
+        ibmap_blk, dbmap_blk, inode_start, data_start, data_blks = g0[:5]
+
+        # 块泄漏
+        dbmap = read_blk(dbmap_blk)
+        bit = first_clear_bit(dbmap, data_blks)
+        if bit < 0:
+            sys.exit('no free data block in group 0')
+        dbmap[bit // 8] |= 1 << (bit % 8)
+        write_blk(dbmap_blk, dbmap)
+
+        # 悬空目录项: 目标取第 0 组第一个未分配的 inode
+        ino = first_clear_bit(read_blk(ibmap_blk), inodes_per_group)
+        if ino < 0:
+            sys.exit('no free inode in group 0')
+        f.seek(inode_start * bs + (root_ino % inodes_per_group) * INODE_SIZE)
+        root = f.read(INODE_SIZE)
+        blk0 = struct.unpack_from('<I', root, 32)[0]    # block[0]
+        flags = struct.unpack_from('<I', root, 56)[0]
+        if flags & DX_INDEXED or blk0 == 0:
+            sys.exit('root directory is not a linear directory with blocks')
+
+        dir_blk = read_blk(blk0)
+        size = struct.calcsize(DENTRY_FMT)
+        for off in range(0, bs - size + 1, size):
+            if dir_blk[off + 8] == 0:   # fname[0]
+                name = b'dangling'
+                struct.pack_into(DENTRY_FMT, dir_blk, off, ino, size, len(name), 0, name)
+                write_blk(blk0, dir_blk)
+                return
+        sys.exit('root directory block has no free slot')
+
+
+def run(fsck, image, repair, expect):
+    cmd = [fsck, '--backend=image', '--image=' + image] + (['--repair'] if repair else [])
+    ret = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    print('$ ' + ' '.join(cmd) + '  -> exit %d' % ret.returncode)
+    print(ret.stdout.rstrip())
+    if ret.returncode != expect:
+        sys.exit('expected exit %d, got %d' % (expect, ret.returncode))
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument('--fsck', required=True)
+    ap.add_argument('--image', required=True)
+    ap.add_argument('--out', required=True)
+    args = ap.parse_args()
+
+    shutil.copyfile(args.image, args.out)
+    corrupt(args.out)
+    run(args.fsck, args.out, False, 4)
+    run(args.fsck, args.out, True, 1)
+    run(args.fsck, args.out, False, 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,742 @@
+/*
+ * myfs-fsck: myfs 镜像的离线一致性检查与修复.
+ *
+ * 1. 校验超级块与组描述符表的布局
+ * 2. 多线程分片顺序读各组 inode 表, 逐槽校验记录
+ * 3. 从 root_ino 按层并行遍历目录树, 校验目录项并统计可达的 inode
+ * 4. 由可达 inode 的块指针统计块引用, 与各组位图交叉核对 (重复引用 / 泄漏 / 缺失), 核对组计数;
+ *    带去重的镜像中普通文件可以共用块, 共用次数与去重表核对
+ * 5. --repair 时清除坏目录项与坏块指针, 改正 link_count, 按可达集合重建位图、组计数与去重表
+ *
+ * 用法: myfs-fsck --image=PATH [--backend=image|ddriver|direct] [--jobs=N] [--repair] [--verbose]
+ * 退出码 (同 e2fsck): 0 无错误, 1 错误已修复, 4 存在未修复的错误, 8 运行错误
+ */
+#include "block_device.h"
+#include "block_geometry.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+#define FSCK_OK             0
+#define FSCK_FIXED          1
+#define FSCK_UNCORRECTED    4
+#define FSCK_ERROR          8
+
+#define FSCK_CHUNK_BLKS     256     // inode 表每个分片的块数 (一次顺序读 256KB)
+#define FSCK_MAX_REPORT     20      // 每类问题默认只打印前若干条
+
+struct FsckConfig {
+    std::string image;
+    std::string backend = "image";
+    unsigned jobs = 0;
+    bool repair = false;
+    bool verbose = false;
+};
+
+/******************************************************************************
+* SECTION: 设备访问
+* BlockDevice 要求按 io_unit 对齐, 这里负责扩展与读改写
+*******************************************************************************/
+static std::unique_ptr<BlockDevice> device;
+static std::mutex device_lock;      // ddriver 的 seek + read 不是线程安全的
+static bool serialize_io = false;
+
+static bool read_range(off_t offset, void* buf, size_t size) {
+    const off_t unit = device->io_unit();
+    off_t down = MYFS_ROUND_DOWN(offset, unit);
+    off_t up = MYFS_ROUND_UP(offset + (off_t)size, unit);
+
+    std::unique_lock<std::mutex> guard(device_lock, std::defer_lock);
+    if (serialize_io) guard.lock();
+
+    if (down == offset && up == offset + (off_t)size) {
+        return device->read(offset, buf, size) == MYFS_ERROR_NONE;
+    }
+    std::vector<uint8_t> tmp(up - down);
+    if (device->read(down, tmp.data(), tmp.size()) != MYFS_ERROR_NONE) return false;
+    std::memcpy(buf, tmp.data() + (offset - down), size);
+    return true;
+}
+
+static bool write_range(off_t offset, const void* buf, size_t size) {
+    const off_t unit = device->io_unit();
+    off_t down = MYFS_ROUND_DOWN(offset, unit);
+    off_t up = MYFS_ROUND_UP(offset + (off_t)size, unit);
+
+    std::lock_guard<std::mutex> guard(device_lock);
+    if (down == offset && up == offset + (off_t)size) {
+        return device->write(offset, buf, size) == MYFS_ERROR_NONE;
+    }
+    std::vector<uint8_t> tmp(up - down);
+    if (device->read(down, tmp.data(), tmp.size()) != MYFS_ERROR_NONE) return false;
+    std::memcpy(tmp.data() + (offset - down), buf, size);
+    return device->write(down, tmp.data(), tmp.size()) == MYFS_ERROR_NONE;
+}
+
+// 把 [0, count) 按 step 切片, 由 jobs 个线程各自领取
+static void parallel_for(unsigned jobs, uint64_t count, uint64_t step,
+                         const std::function<void(uint64_t, uint64_t)>& fn) {
+    std::atomic<uint64_t> next{0};
+    auto worker = [&] {
+        for (;;) {
+            uint64_t begin = next.fetch_add(step);
+            if (begin >= count) return;
+            fn(begin, std::min(count, begin + step));
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < jobs; i++) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+}
+
+/******************************************************************************
+* SECTION: 问题记录
+*******************************************************************************/
+enum class Problem {
+    BAD_INODE,          // inode 记录本身非法 (类型、大小、ino 字段)
+    BAD_BLOCK_PTR,      // 块指针越出数据区
+    DUP_BLOCK,          // 同一数据块被多个 inode 引用
+    BAD_DENTRY,         // 目录项非法 (ino 越界、空名、类型不符、重名)
+    DANGLING_DENTRY,    // 目录项指向未分配的 inode
+    MULTI_LINK,         // 同一 inode 出现在多个目录项中
+    INODE_LEAK,         // 位图已分配但不可达
+    INODE_MISSING,      // 可达但位图未分配
+    BLOCK_LEAK,         // 位图已分配但无引用
+    BLOCK_MISSING,      // 被引用但位图未分配
+    DEDUP_ENTRY,        // 去重表项与实际引用不符 (共用次数、空闲或目录块上的哈希)
+    BAD_INDEX,          // 目录索引损坏 (幻数、层数、哈希顺序、块共享), 不自动修复
+    DIR_SUMMARY,        // 索引目录记录的目录项数或大小与实际不符
+    LINK_COUNT,         // link_count 与实际不符 (目录为 2 + 子目录数, 文件为 1)
+    GROUP_SUMMARY,      // 组描述符的空闲 inode / 空闲块 / 目录数与实际不符
+    COUNT
+};
+
+static const char* problem_names[(int)Problem::COUNT] = {
+    "bad inode", "bad block pointer", "duplicate block", "bad dentry", "dangling dentry",
+    "multiply-linked inode", "leaked inode", "unmarked inode", "leaked block", "unmarked block", "bad dedup entry",
+    "bad directory index", "bad directory summary", "bad link count", "bad group summary",
+};
+
+static std::mutex report_lock;
+static uint64_t problem_count[(int)Problem::COUNT] = {};
+static bool verbose = false;
+
+static void report(Problem p, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+static void report(Problem p, const char* fmt, ...) {
+    std::lock_guard<std::mutex> guard(report_lock);
+    uint64_t n = ++problem_count[(int)p];
+    if (!verbose && n > FSCK_MAX_REPORT) return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    std::printf("  %s: ", problem_names[(int)p]);
+    std::vprintf(fmt, ap);
+    std::printf("\n");
+    va_end(ap);
+}
+
+/******************************************************************************
+* SECTION: 镜像状态
+*******************************************************************************/
+struct DentryRef {
+    uint32_t parent;        // 所在目录的 ino
+    uint32_t blk;           // 所在目录块号
+    uint32_t slot;          // 块内槽位
+    uint32_t ino;
+    uint8_t file_type;
+    std::string name;
+};
+
+static struct myfs_super_d super;
+static uint32_t block_size;                 // 取自超级块
+static std::vector<myfs_group_d> groups;
+static std::vector<uint8_t> map_inode, map_data;    // 各组位图依次相接, 每组一块
+static std::vector<myfs_dedup_entry> dedup;         // 各组去重表依次相接, 每组 dedup_per_group 项
+static uint64_t dedup_per_group;
+static std::vector<myfs_inode_d> inodes;
+static std::vector<uint8_t> inode_bad;       // 记录非法的 inode 不参与后续检查
+static std::vector<uint8_t> reachable;
+
+static bool test_bit(const std::vector<uint8_t>& map, uint64_t i) {
+    return map[i / 8] & (1 << (i % 8));
+}
+
+static void assign_bit(std::vector<uint8_t>& map, uint64_t i, bool v) {
+    if (v) map[i / 8] |= (1 << (i % 8));
+    else map[i / 8] &= ~(1 << (i % 8));
+}
+
+// inode 与数据块在各组位图拼接后的位序号
+static uint64_t inode_bit(uint64_t ino) {
+    return ino / super.inodes_per_group * block_size * 8 + ino % super.inodes_per_group;
+}
+
+static int data_group(uint32_t blk) {
+    if (blk < super.group_start) return -1;
+    uint32_t g = (blk - super.group_start) / super.blocks_per_group;
+    if (g >= super.group_count) return -1;
+    return blk >= groups[g].data_start && blk - groups[g].data_start < groups[g].data_blks ? (int)g : -1;
+}
+
+static bool block_in_data(uint32_t blk) {
+    return data_group(blk) >= 0;
+}
+
+// 普通文件压缩簇中的标记槽位: 簇的首槽位为块, 自 i 起到簇尾都是标记
+static bool is_cluster_mark(const myfs_inode_d& d, int i) {
+    if (!S_ISREG(d.mode) || d.block[i] != MYFS_BLK_COMPRESSED) return false;
+    int first = i - i % MYFS_CLUSTER_BLOCKS;
+    if (i == first || d.block[first] == 0 || d.block[first] == MYFS_BLK_COMPRESSED) return false;
+    for (int j = i; j < first + MYFS_CLUSTER_BLOCKS; j++) {
+        if (d.block[j] != MYFS_BLK_COMPRESSED) return false;
+    }
+    return true;
+}
+
+static uint64_t block_bit(uint32_t blk) {
+    uint32_t g = (uint32_t)data_group(blk);
+    return (uint64_t)g * block_size * 8 + (blk - groups[g].data_start);
+}
+
+static myfs_dedup_entry& dedup_entry(uint32_t blk) {
+    uint32_t g = (uint32_t)data_group(blk);
+    return dedup[g * dedup_per_group + (blk - groups[g].data_start)];
+}
+
+static off_t inode_offset(uint64_t ino) {
+    const myfs_group_d& gd = groups[ino / super.inodes_per_group];
+    return (off_t)gd.inode_start * block_size + (off_t)(ino % super.inodes_per_group) * MYFS_INODE_DISK_SIZE;
+}
+
+static bool load_super() {
+    if (!read_range(MYFS_SUPER_OFS, &super, sizeof(super))) return false;
+    if (super.magic_num != MYFS_MAGIC_NUM) {
+        std::fprintf(stderr, "bad magic 0x%08x: not a myfs image\n", super.magic_num);
+        return false;
+    }
+    if (const char* why = myfs_check_super(super, device->size())) {
+        std::fprintf(stderr, "superblock: %s; refusing to continue\n", why);
+        return false;
+    }
+    block_size = super.block_size;
+    return true;
+}
+
+// 描述符的位置须与超级块推出的一致, 否则无从定位各组; 计数在阶段 3 核对
+static bool load_groups() {
+    std::vector<uint8_t> buf((size_t)super.gdt_blks * block_size);
+    if (!read_range((off_t)super.gdt_start * block_size, buf.data(), buf.size())) return false;
+    groups.resize(super.group_count);
+    std::memcpy(groups.data(), buf.data(), groups.size() * sizeof(myfs_group_d));
+    for (uint32_t g = 0; g < super.group_count; g++) {
+        if (const char* why = myfs_check_group(super, groups[g], g)) {
+            std::fprintf(stderr, "group %u: %s; refusing to continue\n", g, why);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool load_bitmaps() {
+    map_inode.resize((size_t)super.group_count * block_size);
+    map_data.resize((size_t)super.group_count * block_size);
+    for (uint32_t g = 0; g < super.group_count; g++) {
+        if (!read_range((off_t)groups[g].ibmap_blk * block_size, &map_inode[(size_t)g * block_size], block_size) ||
+            !read_range((off_t)groups[g].dbmap_blk * block_size, &map_data[(size_t)g * block_size], block_size)) {
+            return false;
+        }
+    }
+    if (!(super.features & MYFS_FEATURE_DEDUP)) return true;
+
+    const size_t table_size = (size_t)super.dedup_blks_per_group * block_size;
+    dedup_per_group = table_size / sizeof(myfs_dedup_entry);
+    dedup.resize(super.group_count * dedup_per_group);
+    for (uint32_t g = 0; g < super.group_count; g++) {
+        off_t start = (off_t)(groups[g].data_start - super.dedup_blks_per_group) * block_size;
+        if (!read_range(start, &dedup[g * dedup_per_group], table_size)) return false;
+    }
+    return true;
+}
+
+/******************************************************************************
+* SECTION: 阶段 1 - 并行扫描 inode 表
+*******************************************************************************/
+static bool scan_inode_table(unsigned jobs) {
+    // 分片不跨组: 第 k 片为第 k / chunks 组内的第 k % chunks 片
+    const uint64_t group_blks = super.inode_blks_per_group;
+    const uint64_t chunks = (group_blks + FSCK_CHUNK_BLKS - 1) / FSCK_CHUNK_BLKS;
+    inodes.assign(super.inode_count, myfs_inode_d{});
+    inode_bad.assign(super.inode_count, 0);
+    std::atomic<bool> io_ok{true};
+
+    parallel_for(jobs, super.group_count * chunks, 1, [&](uint64_t k, uint64_t) {
+        uint64_t g = k / chunks;
+        uint64_t begin = k % chunks * FSCK_CHUNK_BLKS;
+        uint64_t end = std::min(group_blks, begin + FSCK_CHUNK_BLKS);
+        std::vector<uint8_t> buf((end - begin) * block_size);
+        if (!read_range((off_t)(groups[g].inode_start + begin) * block_size, buf.data(), buf.size())) {
+            io_ok = false;
+            return;
+        }
+        const myfs_inode_d* recs = (const myfs_inode_d*)buf.data();
+        uint64_t first = g * super.inodes_per_group + begin * super.inode_per_block;
+        uint64_t last = g * super.inodes_per_group + end * super.inode_per_block;
+        for (uint64_t ino = first; ino < last; ino++) {
+            inodes[ino] = recs[ino - first];
+            if (!test_bit(map_inode, inode_bit(ino))) continue;     // 未分配的槽位不校验
+
+            const myfs_inode_d& d = inodes[ino];
+            if (d.ino != ino) {
+                report(Problem::BAD_INODE, "inode %llu: ino field is %u", (unsigned long long)ino, d.ino);
+                inode_bad[ino] = 1;
+            } else if (!S_ISDIR(d.mode) && !S_ISREG(d.mode)) {
+                report(Problem::BAD_INODE, "inode %llu: unsupported mode 0%o", (unsigned long long)ino, d.mode);
+                inode_bad[ino] = 1;
+            } else if ((d.flags & MYFS_INODE_DIR_INDEXED) && !S_ISDIR(d.mode)) {
+                report(Problem::BAD_INODE, "inode %llu: index flag on a non-directory", (unsigned long long)ino);
+                inode_bad[ino] = 1;
+            } else if (!(d.flags & MYFS_INODE_DIR_INDEXED) && d.size > MYFS_DIRECT_BLOCKS * block_size) {
+                report(Problem::BAD_INODE, "inode %llu: size %u exceeds %d", (unsigned long long)ino, d.size,
+                       MYFS_DIRECT_BLOCKS * block_size);
+                inode_bad[ino] = 1;
+            }
+            for (int i = 0; i < MYFS_DIRECT_BLOCKS && !inode_bad[ino]; i++) {
+                if (is_cluster_mark(d, i)) continue;
+                if (d.block[i] != 0 && !block_in_data(d.block[i])) {
+                    report(Problem::BAD_BLOCK_PTR, "inode %llu: block[%d] = %u outside data area",
+                           (unsigned long long)ino, i, d.block[i]);
+                }
+            }
+        }
+    });
+    return io_ok;
+}
+
+/******************************************************************************
+* SECTION: 阶段 2 - 按层并行遍历目录树
+* inode 可达时立即认领其数据块, 先到者为属主; 目录只读取自己认领到的块,
+* 以免两个目录共享同一块时把对方的目录项当作自己的来修复
+*******************************************************************************/
+struct BlockFix {
+    uint32_t ino;
+    int idx;
+};
+static std::vector<DentryRef> bad_dentries;     // 修复时需要清除的目录项
+static std::vector<BlockFix> bad_block_ptrs;    // 修复时清零的块指针
+static std::vector<uint32_t> owner;             // 数据块 -> 属主 ino
+static std::vector<uint32_t> shares;            // 去重: 数据块在属主之外被普通文件引用的次数
+static std::vector<uint32_t> bad_summary;       // 修复时按实际目录项数与块数重写的索引目录
+static std::vector<uint32_t> bad_links;         // 修复时按实际重写 link_count 的 inode
+
+static void claim_blocks(uint32_t ino) {
+    myfs_inode_d& d = inodes[ino];
+    for (int i = 0; i < MYFS_DIRECT_BLOCKS; i++) {
+        uint32_t blk = d.block[i];
+        if (blk == 0 || is_cluster_mark(d, i)) continue;
+        if (block_in_data(blk)) {
+            uint32_t& o = owner[blk];
+            if (o == UINT32_MAX) {
+                o = ino;
+                continue;
+            }
+            if ((super.features & MYFS_FEATURE_DEDUP) && S_ISREG(d.mode) && S_ISREG(inodes[o].mode)) {
+                shares[blk]++;
+                continue;
+            }
+            report(Problem::DUP_BLOCK, "block %u: owned by inode %u, also referenced by inode %u", blk, o, ino);
+        }
+        // 越界指针已在阶段 1 报告; 内存副本中清零, 修复时写回
+        bad_block_ptrs.push_back({ ino, i });
+        d.block[i] = 0;
+    }
+}
+
+// 一个目录的扫描结果, 在工作线程中填充, 合并阶段按目录顺序处理
+struct DirScan {
+    std::vector<DentryRef> entries;
+    std::vector<uint32_t> tree_blks;        // 索引目录: 根块以外的索引块与叶子
+    std::vector<std::string> index_errors;
+};
+
+static bool read_dentry_block(uint32_t dir, uint32_t blk, std::vector<uint8_t>& buf, DirScan& out) {
+    if (!read_range((off_t)blk * block_size, buf.data(), block_size)) return false;
+    const myfs_dentry_d* ents = (const myfs_dentry_d*)buf.data();
+    for (uint32_t s = 0; s < block_size / sizeof(myfs_dentry_d); s++) {
+        if (ents[s].fname[0] == '\0') continue;
+        size_t len = strnlen(ents[s].fname, MYFS_MAX_FILE_NAME);
+        out.entries.push_back({ dir, blk, s, ents[s].ino, ents[s].file_type, std::string(ents[s].fname, len) });
+    }
+    return true;
+}
+
+// 校验以 blk 为根、覆盖哈希区间 [lo, hi) 的索引子树并读入叶子中的目录项.
+// level 必须逐层递减, 环与过深的树因此都会被发现
+static bool scan_index(uint32_t dir, uint32_t blk, int level, uint32_t lo, uint64_t hi, DirScan& out) {
+    char why[128];
+    std::vector<uint8_t> buf(block_size);
+    if (!read_range((off_t)blk * block_size, buf.data(), block_size)) return false;
+
+    const myfs_dx_head* head = (const myfs_dx_head*)buf.data();
+    const myfs_dx_entry* ents = (const myfs_dx_entry*)(head + 1);
+    const uint32_t limit = (block_size - sizeof(myfs_dx_head)) / sizeof(myfs_dx_entry);
+    if (head->magic != MYFS_DX_MAGIC) {
+        std::snprintf(why, sizeof(why), "index block %u: bad magic 0x%08x", blk, head->magic);
+    } else if (head->count == 0 || head->count > limit) {
+        std::snprintf(why, sizeof(why), "index block %u: entry count %u", blk, head->count);
+    } else if (level < 0 ? head->level > MYFS_DX_MAX_LEVEL : head->level != level) {
+        std::snprintf(why, sizeof(why), "index block %u: level %u", blk, head->level);
+    } else if (level >= 0 && ents[0].hash != lo) {
+        std::snprintf(why, sizeof(why), "index block %u: first hash 0x%08x, parent expects 0x%08x",
+                      blk, ents[0].hash, lo);
+    } else {
+        why[0] = '\0';
+        for (uint32_t i = 1; i < head->count && !why[0]; i++) {
+            if (ents[i].hash <= ents[i - 1].hash || ents[i].hash >= hi) {
+                std::snprintf(why, sizeof(why), "index block %u: hash order broken at entry %u", blk, i);
+            }
+        }
+        for (uint32_t i = 0; i < head->count && !why[0]; i++) {
+            if (!block_in_data(ents[i].blk)) {
+                std::snprintf(why, sizeof(why), "index block %u: entry %u points to block %u", blk, i, ents[i].blk);
+            }
+        }
+    }
+    if (why[0]) {
+        out.index_errors.push_back(why);
+        return true;
+    }
+
+    const int child_level = head->level - 1;
+    std::vector<myfs_dx_entry> copy(ents, ents + head->count);
+    for (size_t i = 0; i < copy.size(); i++) {
+        uint32_t child_lo = i == 0 ? lo : copy[i].hash;
+        uint64_t child_hi = i + 1 < copy.size() ? copy[i + 1].hash : hi;
+        out.tree_blks.push_back(copy[i].blk);
+        if (child_level >= 0) {
+            if (!scan_index(dir, copy[i].blk, child_level, child_lo, child_hi, out)) return false;
+            continue;
+        }
+        size_t first = out.entries.size();
+        if (!read_dentry_block(dir, copy[i].blk, buf, out)) return false;
+        for (size_t k = first; k < out.entries.size(); k++) {
+            const DentryRef& e = out.entries[k];
+            uint32_t h = myfs_dx_hash(e.name.data(), e.name.size());
+            if (h < child_lo || h >= child_hi) {
+                std::snprintf(why, sizeof(why), "leaf %u slot %u '%.40s': hash 0x%08x outside leaf range",
+                              e.blk, e.slot, e.name.c_str(), h);
+                out.index_errors.push_back(why);
+            }
+        }
+    }
+    return true;
+}
+
+static bool walk_tree(unsigned jobs) {
+    reachable.assign(super.inode_count, 0);
+    if (!test_bit(map_inode, inode_bit(super.root_ino)) || inode_bad[super.root_ino] ||
+        !S_ISDIR(inodes[super.root_ino].mode)) {
+        std::fprintf(stderr, "root inode %u is missing or not a directory\n", super.root_ino);
+        return false;
+    }
+    owner.assign(super.total_blocks, UINT32_MAX);
+    shares.assign(super.total_blocks, 0);
+    reachable[super.root_ino] = 1;
+    claim_blocks(super.root_ino);
+
+    std::vector<uint32_t> frontier = { super.root_ino };
+    std::atomic<bool> io_ok{true};
+
+    while (!frontier.empty()) {
+        // 每个目录的目录项先各自收集, 再在单线程中合并, 保证判重结果与线程数无关
+        std::vector<DirScan> found(frontier.size());
+        parallel_for(jobs, frontier.size(), 1, [&](uint64_t begin, uint64_t end) {
+            std::vector<uint8_t> buf(block_size);
+            for (uint64_t k = begin; k < end; k++) {
+                const myfs_inode_d& dir = inodes[frontier[k]];
+                bool ok = true;
+                if (dir.flags & MYFS_INODE_DIR_INDEXED) {
+                    if (dir.block[0] != 0) ok = scan_index(frontier[k], dir.block[0], -1, 0, UINT64_C(1) << 32, found[k]);
+                    else found[k].index_errors.push_back("indexed directory without a root block");
+                } else {
+                    for (int b = 0; b < MYFS_DIRECT_BLOCKS && ok; b++) {
+                        if (dir.block[b] != 0) ok = read_dentry_block(frontier[k], dir.block[b], buf, found[k]);
+                    }
+                }
+                if (!ok) {
+                    io_ok = false;
+                    return;
+                }
+            }
+        });
+        if (!io_ok) return false;
+
+        std::vector<uint32_t> next;
+        for (size_t k = 0; k < frontier.size(); k++) {
+            const uint32_t dir = frontier[k];
+            DirScan& scan = found[k];
+            for (const std::string& why : scan.index_errors) report(Problem::BAD_INDEX, "dir %u: %s", dir, why.c_str());
+            for (uint32_t blk : scan.tree_blks) {
+                uint32_t& o = owner[blk];
+                if (o == UINT32_MAX) o = dir;
+                else report(Problem::BAD_INDEX, "dir %u: index block %u is also owned by inode %u", dir, blk, o);
+            }
+
+            std::map<std::string, int> names;
+            uint32_t live = 0, subdirs = 0;
+            for (DentryRef& e : scan.entries) {
+                const char* why = nullptr;
+                Problem kind = Problem::BAD_DENTRY;
+                if (e.name.size() >= (size_t)MYFS_MAX_FILE_NAME) why = "name is not terminated";
+                else if (e.ino >= super.inode_count) why = "ino out of range";
+                else if (names[e.name]++) why = "duplicate name";
+                else if (!test_bit(map_inode, inode_bit(e.ino))) {
+                    kind = Problem::DANGLING_DENTRY;
+                    why = "inode is not allocated";
+                } else if (inode_bad[e.ino]) why = "target inode is invalid";
+                else if ((e.file_type == 1) != S_ISDIR(inodes[e.ino].mode)) why = "file type mismatch";
+                else if (reachable[e.ino]) {
+                    kind = Problem::MULTI_LINK;
+                    why = "inode already linked elsewhere";
+                }
+
+                if (why) {
+                    report(kind, "dir %u block %u slot %u '%s' -> %u: %s",
+                           e.parent, e.blk, e.slot, e.name.c_str(), e.ino, why);
+                    bad_dentries.push_back(e);
+                    continue;
+                }
+                live++;
+                reachable[e.ino] = 1;
+                claim_blocks(e.ino);
+                if (S_ISDIR(inodes[e.ino].mode)) {
+                    next.push_back(e.ino);
+                    subdirs++;
+                } else if (inodes[e.ino].link_count != 1) {
+                    report(Problem::LINK_COUNT, "inode %u: link count %u, 1 found", e.ino, inodes[e.ino].link_count);
+                    inodes[e.ino].link_count = 1;
+                    bad_links.push_back(e.ino);
+                }
+            }
+
+            myfs_inode_d& d = inodes[dir];
+            if (scan.index_errors.empty() && d.link_count != 2 + subdirs) {
+                report(Problem::LINK_COUNT, "dir %u: link count %u, %u found", dir, d.link_count, 2 + subdirs);
+                d.link_count = (uint16_t)(2 + subdirs);
+                bad_links.push_back(dir);
+            }
+
+            // 索引目录不整体载入, 挂载后 rmdir 依赖磁盘上的目录项数
+            if ((d.flags & MYFS_INODE_DIR_INDEXED) && scan.index_errors.empty()) {
+                uint32_t size = (uint32_t)(scan.tree_blks.size() + 1) * block_size;
+                if (d.dir_entries != live || d.size != size) {
+                    report(Problem::DIR_SUMMARY, "dir %u: %u entries / %u bytes recorded, %u / %u found",
+                           dir, d.dir_entries, d.size, live, size);
+                    d.dir_entries = live;
+                    d.size = size;
+                    bad_summary.push_back(dir);
+                }
+            }
+        }
+        frontier.swap(next);
+    }
+    return true;
+}
+
+/******************************************************************************
+* SECTION: 阶段 3 - 位图交叉核对
+*******************************************************************************/
+static void check_bitmaps(unsigned jobs) {
+    parallel_for(jobs, super.inode_count, 1 << 16, [&](uint64_t begin, uint64_t end) {
+        for (uint64_t ino = begin; ino < end; ino++) {
+            bool marked = test_bit(map_inode, inode_bit(ino));
+            if (marked && !reachable[ino]) report(Problem::INODE_LEAK, "inode %llu", (unsigned long long)ino);
+            if (!marked && reachable[ino]) report(Problem::INODE_MISSING, "inode %llu", (unsigned long long)ino);
+        }
+    });
+    parallel_for(jobs, super.group_count, 1, [&](uint64_t g, uint64_t) {
+        const myfs_group_d& gd = groups[g];
+        for (uint32_t blk = gd.data_start; blk < gd.data_start + gd.data_blks; blk++) {
+            bool marked = test_bit(map_data, block_bit(blk));
+            bool used = owner[blk] != UINT32_MAX;
+            if (marked && !used) report(Problem::BLOCK_LEAK, "block %u", blk);
+            if (!marked && used) report(Problem::BLOCK_MISSING, "block %u (inode %u)", blk, owner[blk]);
+        }
+    });
+
+    // 去重表: 共用次数须与实际相符; 空闲块的项为全 0, 目录块不在索引中
+    if (super.features & MYFS_FEATURE_DEDUP) {
+        for (const myfs_group_d& gd : groups) {
+            for (uint32_t blk = gd.data_start; blk < gd.data_start + gd.data_blks; blk++) {
+                myfs_dedup_entry& e = dedup_entry(blk);
+                bool used = owner[blk] != UINT32_MAX;
+                if (e.shares != shares[blk]) {
+                    report(Problem::DEDUP_ENTRY, "block %u: %u shares recorded, %u found", blk, e.shares, shares[blk]);
+                    e.shares = shares[blk];
+                }
+                if (e.hash != 0 && (!used || !S_ISREG(inodes[owner[blk]].mode))) {
+                    report(Problem::DEDUP_ENTRY, "block %u: hashed but %s", blk, used ? "owned by a directory" : "free");
+                    e.hash = 0;
+                }
+            }
+        }
+    }
+
+    // 重建位图备用: 可达 inode 与被认领的块
+    for (uint64_t ino = 0; ino < super.inode_count; ino++) assign_bit(map_inode, inode_bit(ino), reachable[ino]);
+    for (const myfs_group_d& gd : groups) {
+        for (uint32_t blk = gd.data_start; blk < gd.data_start + gd.data_blks; blk++) {
+            assign_bit(map_data, block_bit(blk), owner[blk] != UINT32_MAX);
+        }
+    }
+
+    // 按重建后的状态核对各组计数
+    for (uint32_t g = 0; g < super.group_count; g++) {
+        myfs_group_d& gd = groups[g];
+        uint32_t free_inodes = 0, free_blocks = 0, dirs = 0;
+        for (uint64_t ino = (uint64_t)g * super.inodes_per_group; ino < (uint64_t)(g + 1) * super.inodes_per_group; ino++) {
+            if (!reachable[ino]) free_inodes++;
+            else if (S_ISDIR(inodes[ino].mode)) dirs++;
+        }
+        for (uint32_t blk = gd.data_start; blk < gd.data_start + gd.data_blks; blk++) {
+            if (owner[blk] == UINT32_MAX) free_blocks++;
+        }
+        if (gd.free_inodes != free_inodes || gd.free_blocks != free_blocks || gd.dirs != dirs) {
+            report(Problem::GROUP_SUMMARY, "group %u: %u free inodes / %u free blocks / %u dirs recorded, "
+                   "%u / %u / %u found", g, gd.free_inodes, gd.free_blocks, gd.dirs, free_inodes, free_blocks, dirs);
+        }
+        gd.free_inodes = free_inodes;
+        gd.free_blocks = free_blocks;
+        gd.dirs = dirs;
+    }
+}
+
+/******************************************************************************
+* SECTION: 修复
+*******************************************************************************/
+static bool repair() {
+    // 清除坏目录项: 同一目录块内的多个槽位合并为一次读改写
+    std::map<uint32_t, std::vector<uint32_t>> slots_by_blk;
+    for (const DentryRef& e : bad_dentries) slots_by_blk[e.blk].push_back(e.slot);
+    for (auto& kv : slots_by_blk) {
+        std::vector<uint8_t> buf(block_size);
+        if (!read_range((off_t)kv.first * block_size, buf.data(), block_size)) return false;
+        for (uint32_t s : kv.second) std::memset(buf.data() + s * sizeof(myfs_dentry_d), 0, sizeof(myfs_dentry_d));
+        if (!write_range((off_t)kv.first * block_size, buf.data(), block_size)) return false;
+    }
+
+    // 清零坏块指针并写回 inode 记录
+    std::vector<uint32_t> dirty(bad_summary);
+    dirty.insert(dirty.end(), bad_links.begin(), bad_links.end());
+    for (const BlockFix& f : bad_block_ptrs) dirty.push_back(f.ino);
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+    for (uint32_t ino : dirty) {
+        if (!write_range(inode_offset(ino), &inodes[ino], sizeof(myfs_inode_d))) return false;
+    }
+
+    // 按可达集合重建的位图与组计数
+    for (uint32_t g = 0; g < super.group_count; g++) {
+        if (!write_range((off_t)groups[g].ibmap_blk * block_size, &map_inode[(size_t)g * block_size], block_size) ||
+            !write_range((off_t)groups[g].dbmap_blk * block_size, &map_data[(size_t)g * block_size], block_size)) {
+            return false;
+        }
+    }
+    const size_t table_size = (size_t)super.dedup_blks_per_group * block_size;
+    for (uint32_t g = 0; table_size && g < super.group_count; g++) {
+        off_t start = (off_t)(groups[g].data_start - super.dedup_blks_per_group) * block_size;
+        if (!write_range(start, &dedup[g * dedup_per_group], table_size)) return false;
+    }
+    std::vector<uint8_t> gdt((size_t)super.gdt_blks * block_size);
+    std::memcpy(gdt.data(), groups.data(), groups.size() * sizeof(myfs_group_d));
+    if (!write_range((off_t)super.gdt_start * block_size, gdt.data(), gdt.size())) return false;
+    return device->sync() == MYFS_ERROR_NONE;
+}
+
+/******************************************************************************
+* SECTION: main
+*******************************************************************************/
+static bool parse_args(int argc, char** argv, FsckConfig& cfg) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--repair") cfg.repair = true;
+        else if (arg == "--verbose" || arg == "-v") cfg.verbose = true;
+        else if (arg.compare(0, 8, "--image=") == 0) cfg.image = arg.substr(8);
+        else if (arg.compare(0, 10, "--backend=") == 0) cfg.backend = arg.substr(10);
+        else if (arg.compare(0, 7, "--jobs=") == 0) cfg.jobs = (unsigned)std::stoul(arg.substr(7));
+        else {
+            std::fprintf(stderr, "unknown argument: %s\n", argv[i]);
+            return false;
+        }
+    }
+    if (cfg.image.empty()) {
+        std::fprintf(stderr, "usage: myfs-fsck --image=PATH [--backend=image|ddriver|direct] "
+                             "[--jobs=N] [--repair] [--verbose]\n");
+        return false;
+    }
+    if (cfg.jobs == 0) cfg.jobs = std::max(1u, std::thread::hardware_concurrency());
+    return true;
+}
+
+int main(int argc, char** argv) {
+    FsckConfig cfg;
+    if (!parse_args(argc, argv, cfg)) return FSCK_ERROR;
+    verbose = cfg.verbose;
+
+    CustomOptions opts = {};
+    opts.device = cfg.image.c_str();
+    opts.backend = cfg.backend.c_str();
+    device = make_block_device(opts);
+    if (!device || device->open(cfg.image.c_str()) != MYFS_ERROR_NONE) {
+        std::fprintf(stderr, "cannot open %s (%s)\n", cfg.image.c_str(), cfg.backend.c_str());
+        return FSCK_ERROR;
+    }
+    serialize_io = cfg.backend == "ddriver";
+
+    if (!load_super() || !load_groups() || !load_bitmaps()) return FSCK_ERROR;
+    std::printf("myfs-fsck: %s, %u blocks, %u inodes, %u groups, %u jobs\n",
+                cfg.image.c_str(), super.total_blocks, super.inode_count, super.group_count, cfg.jobs);
+
+    std::printf("pass 1: inode table\n");
+    if (!scan_inode_table(cfg.jobs)) return FSCK_ERROR;
+    std::printf("pass 2: directory tree\n");
+    if (!walk_tree(cfg.jobs)) return FSCK_UNCORRECTED;
+    std::printf("pass 3: bitmaps and group counters\n");
+    check_bitmaps(cfg.jobs);
+
+    uint64_t total = 0;
+    for (int i = 0; i < (int)Problem::COUNT; i++) {
+        if (problem_count[i] == 0) continue;
+        std::printf("%-24s %llu\n", problem_names[i], (unsigned long long)problem_count[i]);
+        total += problem_count[i];
+    }
+
+    uint64_t used_inodes = std::count(reachable.begin(), reachable.end(), 1);
+    std::printf("%llu inodes in use, %llu problems\n", (unsigned long long)used_inodes, (unsigned long long)total);
+    if (total == 0) return FSCK_OK;
+    if (!cfg.repair) return FSCK_UNCORRECTED;
+
+    // 索引损坏时可达集合不完整, 按它重建位图会释放仍在使用的 inode 与块
+    if (problem_count[(int)Problem::BAD_INDEX]) {
+        std::printf("directory index damaged; not repairing\n");
+        return FSCK_UNCORRECTED;
+    }
+    // BAD_INODE 只能通过清除指向它的目录项解决, 已包含在 bad_dentries 中
+    if (!repair()) {
+        std::fprintf(stderr, "repair failed: device IO error\n");
+        return FSCK_ERROR;
+    }
+    device->close();
+    std::printf("repaired\n");
+    return FSCK_FIXED;
+}
@@ -128,6 +128,41 @@ function clean_mount() {
     done
 }
 
+# 设备 IO 预算: 阶段前后各读一次 .myfs_stats 中 ddriver 的计数 (IOC_REQ_DEVICE_STATE),
+# 由 checkio.py 与 checkio/golden.json 比对. IO_CHECK=0 跳过, IO_CHECK=update 以本次结果重写预算
+IO_CHECK=${IO_CHECK:-1}
+IO_FAILS=0
+
+function io_snapshot() {
+    grep -m1 '^ddriver ' "${MNTPOINT}"/.myfs_stats 2>/dev/null || grep -m1 '^device ' "${MNTPOINT}"/.myfs_stats 2>/dev/null
+}
+
+function io_begin() {
+    IO_BEFORE=$(io_snapshot)
+}
+
+function io_check() {
+    STAGE=$1
+    if [[ "${IO_CHECK}" == "0" ]]; then
+        return 0
+    fi
+    IO_AFTER=$(io_snapshot)
+    UPDATE=""
+    if [[ "${IO_CHECK}" == "update" ]]; then
+        UPDATE="-u"
+    fi
+    if ! OUTPUT=$(python3 "$ROOT_PATH"/checkio/checkio.py -r "$ROOT_PATH"/checkio/golden.json -s "$STAGE" -b "$IO_BEFORE" -a "$IO_AFTER" $UPDATE 2>&1); then
+        echo "$OUTPUT"
+        fail "io budget - $STAGE: 设备 IO 超出 checkio/golden.json 中的预算, 请检查本阶段的读写是否变多"
+        IO_FAILS=$((IO_FAILS + 1))
+        return 1
+    fi
+    if [[ -n "${UPDATE}" ]]; then
+        echo "$OUTPUT"
+    fi
+    return 0
+}
+
 function mkdir_and_check () {
     DIR=$1
     if [ ! -d "$DIR" ]; then
@@ -193,7 +228,10 @@ function test_start() {
 }
 
 function test_end() {
-    if [ $POINTS -eq $TOTAL_POINTS ]; then
+    if (( IO_FAILS > 0 )); then
+        fail "设备 IO 预算: ${IO_FAILS} 个阶段超出"
+    fi
+    if [ $POINTS -eq $TOTAL_POINTS ] && (( IO_FAILS == 0 )); then
         echo " "
         echo "Score: $POINTS/$TOTAL_POINTS"
         pass "恭喜你，通过所有测试 ($TOTAL_POINTS/$TOTAL_POINTS)"
@@ -0,0 +1,310 @@
+/*
+ * myfs3-ops: 不经挂载直接调用 myfs3 的回调表 (src/myfs3.cpp, 以 MYFS3_NO_MAIN 编译), 设备同基准测试.
+ * init 协商的能力与内核下发请求时一致地核对; 随后多个线程同时在各自目录与同一共享目录中
+ * 建文件、经 write_buf / read_buf 读写、rename, 另一线程反复读统计文件, 模拟多线程 FUSE 会话.
+ * destroy 后再次 init (重新挂载), 核对内容与目录项都已落盘. 镜像留给 fsck 检查.
+ *
+ * 用法: myfs3-ops [--image=PATH] [--threads=N] [--files=N] [--cache-kb=N]
+ */
+#include "utils.h"
+#include "latency.h"
+#include <cstdio>
+#include <atomic>
+#include <cstring>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE    (1 << 0)
+#endif
+
+// src/myfs3.cpp
+const struct fuse_operations* myfs3_operations();
+extern struct CustomOptions myfs_options;
+
+/******************************************************************************
+* SECTION: 配置与工具
+*******************************************************************************/
+struct Ops3Config {
+    std::string image = "/tmp/myfs3_ops.img";
+    long long dev_size = 16 << 20;
+    int threads = 4;
+    int files = 40;                        // 每个线程在自己目录与共享目录中各建的文件数
+    int cache_kb = 0;                      // 小的缓存上限使回收与其他线程的操作交错
+};
+
+static const struct fuse_operations* ops;
+static std::atomic<int> failures{0};
+
+#define CHECK(cond, ...) do {                                   \
+    if (!(cond)) {                                              \
+        std::fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+        std::fprintf(stderr, __VA_ARGS__);                      \
+        std::fprintf(stderr, "\n");                             \
+        failures++;                                             \
+    }                                                           \
+} while (0)
+
+// 文件内容: 由文件编号决定的长度与图样
+static size_t file_size(int id) {
+    return 1 + (size_t)id * 523 % 6000;
+}
+
+static std::vector<char> file_data(int id) {
+    std::vector<char> data(file_size(id));
+    for (size_t i = 0; i < data.size(); i++) data[i] = (char)(id * 31 + i * 7);
+    return data;
+}
+
+static int file_id(int thread, int i) {
+    return thread * 1000 + i;
+}
+
+static int write_file(const char* path, const std::vector<char>& data) {
+    struct fuse_bufvec bv = {};
+    bv.count = 1;
+    bv.buf[0].size = data.size();
+    bv.buf[0].mem = (void*)data.data();
+    bv.buf[0].fd = -1;
+    struct fuse_file_info fi = {};
+    return ops->write_buf(path, &bv, 0, &fi);
+}
+
+// read_buf 返回的 fd 段按内核 splice 的方式从镜像偏移读出
+static int read_file(const char* path, size_t size, std::vector<char>& out) {
+    struct fuse_bufvec* bv = nullptr;
+    struct fuse_file_info fi = {};
+    int ret = ops->read_buf(path, &bv, size, 0, &fi);
+    if (ret < 0) return ret;
+    out.clear();
+    for (size_t i = 0; i < bv->count; i++) {
+        struct fuse_buf& b = bv->buf[i];
+        size_t at = out.size();
+        out.resize(at + b.size);
+        if (b.flags & FUSE_BUF_IS_FD) {
+            if (pread(b.fd, out.data() + at, b.size, b.pos) != (ssize_t)b.size) ret = -EIO;
+        } else {
+            memcpy(out.data() + at, b.mem, b.size);
+            free(b.mem);
+        }
+    }
+    free(bv);
+    return ret;
+}
+
+static int fill_names(void* buf, const char* name, const struct stat* st, off_t off,
+                      enum fuse_fill_dir_flags flags) {
+    ((std::set<std::string>*)buf)->insert(name);
+    return 0;
+}
+
+static std::set<std::string> list_dir(const char* path) {
+    std::set<std::string> names;
+    struct fuse_file_info fi = {};
+    int ret = ops->readdir(path, &names, fill_names, 0, &fi, FUSE_READDIR_PLUS);
+    CHECK(ret == 0, "readdir %s: %d", path, ret);
+    names.erase(".");
+    names.erase("..");
+    return names;
+}
+
+static void check_file(const std::string& path, int id) {
+    std::vector<char> want = file_data(id), got;
+    struct stat st;
+    int ret = ops->getattr(path.c_str(), &st, nullptr);
+    CHECK(ret == 0 && (size_t)st.st_size == want.size(), "getattr %s: %d size %lld want %zu",
+          path.c_str(), ret, (long long)st.st_size, want.size());
+    ret = read_file(path.c_str(), want.size() + 100, got);
+    CHECK(ret == 0 && got == want, "read %s: %d, %zu bytes", path.c_str(), ret, got.size());
+}
+
+/******************************************************************************
+* SECTION: 挂载
+*******************************************************************************/
+static bool init_fs(const Ops3Config& cfg) {
+    myfs_options = {};
+    myfs_options.device = cfg.image.c_str();
+    myfs_options.backend = "image";
+    myfs_options.cache_kb = (unsigned)cfg.cache_kb;
+
+    struct fuse_conn_info conn = {};
+    struct fuse_config fcfg = {};
+    conn.capable = ~0u;
+    ops->init(&conn, &fcfg);
+    struct stat st;
+    if (ops->getattr("/", &st, nullptr) != 0) {
+        std::fprintf(stderr, "mount %s failed\n", cfg.image.c_str());
+        return false;
+    }
+    // 核心串行执行, 并行目录操作无从受益; 其余能力照常协商
+    CHECK(!(conn.want & FUSE_CAP_PARALLEL_DIROPS), "PARALLEL_DIROPS negotiated");
+    CHECK(conn.want & FUSE_CAP_SPLICE_READ, "SPLICE_READ not negotiated");
+    CHECK(conn.want & FUSE_CAP_READDIRPLUS, "READDIRPLUS not negotiated");
+    CHECK(fcfg.kernel_cache == 1, "kernel_cache not set");
+    return true;
+}
+
+/******************************************************************************
+* SECTION: 负载
+*******************************************************************************/
+// 每个线程: 私有目录中建、写、读、rename; 共享目录中建与写; 各步结果须与单线程时相同
+static void worker(const Ops3Config& cfg, int t) {
+    std::string dir = "/t" + std::to_string(t);
+    int ret = ops->mkdir(dir.c_str(), S_IFDIR | 0755);
+    CHECK(ret == 0, "mkdir %s: %d", dir.c_str(), ret);
+
+    for (int i = 0; i < cfg.files; i++) {
+        int id = file_id(t, i);
+        std::string f = dir + "/f" + std::to_string(i);
+        std::string g = dir + "/g" + std::to_string(i);
+        std::string s = "/shared/s" + std::to_string(id);
+
+        ret = ops->mknod(f.c_str(), S_IFREG | 0644, 0);
+        CHECK(ret == 0, "mknod %s: %d", f.c_str(), ret);
+        ret = write_file(f.c_str(), file_data(id));
+        CHECK(ret == (int)file_size(id), "write %s: %d", f.c_str(), ret);
+        check_file(f, id);
+
+        ret = ops->mknod(s.c_str(), S_IFREG | 0644, 0);
+        CHECK(ret == 0, "mknod %s: %d", s.c_str(), ret);
+        ret = write_file(s.c_str(), file_data(id));
+        CHECK(ret == (int)file_size(id), "write %s: %d", s.c_str(), ret);
+
+        ret = ops->rename(f.c_str(), g.c_str(), 0);
+        CHECK(ret == 0, "rename %s: %d", f.c_str(), ret);
+        if (i > 0) {
+            std::string prev = dir + "/g" + std::to_string(i - 1);
+            ret = ops->rename(g.c_str(), prev.c_str(), RENAME_NOREPLACE);
+            CHECK(ret == -MYFS_ERROR_EXISTS, "rename noreplace %s: %d", g.c_str(), ret);
+        }
+    }
+}
+
+// 统计文件与核心计数快照: 与工作线程并发读取
+static void stats_reader(std::atomic<bool>* stop) {
+    while (!stop->load()) {
+        struct stat st;
+        CHECK(ops->getattr(MYFS_STATS_PATH, &st, nullptr) == 0, "getattr stats");
+        std::vector<char> text;
+        CHECK(read_file(MYFS_STATS_PATH, 1 << 16, text) == 0, "read stats");
+        CHECK(std::string(text.begin(), text.end()).find("inode_cache") != std::string::npos,
+              "stats text incomplete");
+    }
+}
+
+static void run_concurrent(const Ops3Config& cfg) {
+    int ret = ops->mkdir("/shared", S_IFDIR | 0755);
+    CHECK(ret == 0, "mkdir /shared: %d", ret);
+
+    std::atomic<bool> stop{false};
+    std::thread reader(stats_reader, &stop);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < cfg.threads; t++) workers.emplace_back(worker, std::cref(cfg), t);
+    for (auto& w : workers) w.join();
+    stop = true;
+    reader.join();
+}
+
+// 单线程收尾: copy_file_range、truncate、unlink 与非空目录的 rmdir
+static void run_tail(const Ops3Config& cfg) {
+    int id = file_id(0, 0);
+    std::string src = "/shared/s" + std::to_string(id);
+    int ret = ops->mknod("/copy", S_IFREG | 0644, 0);
+    CHECK(ret == 0, "mknod /copy: %d", ret);
+    ssize_t n = ops->copy_file_range(src.c_str(), nullptr, 0, "/copy", nullptr, 0, file_size(id), 0);
+    CHECK(n == (ssize_t)file_size(id), "copy_file_range: %zd", n);
+    check_file("/copy", id);
+
+    ret = ops->truncate("/copy", 0, nullptr);
+    CHECK(ret == 0, "truncate /copy: %d", ret);
+    ret = ops->unlink("/copy");
+    CHECK(ret == 0, "unlink /copy: %d", ret);
+
+    ret = ops->rmdir("/shared");
+    CHECK(ret < 0, "rmdir /shared: %d", ret);
+    // 每个线程的最后一个文件删除, 重新挂载后应不存在
+    for (int t = 0; t < cfg.threads; t++) {
+        std::string s = "/shared/s" + std::to_string(file_id(t, cfg.files - 1));
+        ret = ops->unlink(s.c_str());
+        CHECK(ret == 0, "unlink %s: %d", s.c_str(), ret);
+    }
+}
+
+static void verify(const Ops3Config& cfg) {
+    std::set<std::string> shared = list_dir("/shared");
+    CHECK((int)shared.size() == cfg.threads * (cfg.files - 1), "/shared has %zu entries", shared.size());
+    for (int t = 0; t < cfg.threads; t++) {
+        std::string dir = "/t" + std::to_string(t);
+        std::set<std::string> names = list_dir(dir.c_str());
+        CHECK((int)names.size() == cfg.files, "%s has %zu entries", dir.c_str(), names.size());
+        for (int i = 0; i < cfg.files; i++) {
+            int id = file_id(t, i);
+            CHECK(!names.count("f" + std::to_string(i)), "%s/f%d still listed", dir.c_str(), i);
+            check_file(dir + "/g" + std::to_string(i), id);
+            if (i < cfg.files - 1) check_file("/shared/s" + std::to_string(id), id);
+            else CHECK(!shared.count("s" + std::to_string(id)), "s%d still listed", id);
+        }
+    }
+    struct stat st;
+    CHECK(ops->getattr("/copy", &st, nullptr) == -MYFS_ERROR_NOTFOUND, "/copy still exists");
+}
+
+/******************************************************************************
+* SECTION: 入口
+*******************************************************************************/
+static bool parse_args(int argc, char** argv, Ops3Config& cfg) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 2, "--") != 0 || arg.find('=') == std::string::npos) {
+            std::fprintf(stderr, "unknown argument: %s\n", argv[i]);
+            return false;
+        }
+        std::string key = arg.substr(2, arg.find('=') - 2);
+        std::string val = arg.substr(arg.find('=') + 1);
+        if (key == "image") cfg.image = val;
+        else if (key == "threads") cfg.threads = std::stoi(val);
+        else if (key == "files") cfg.files = std::stoi(val);
+        else if (key == "cache-kb") cfg.cache_kb = std::stoi(val);
+        else {
+            std::fprintf(stderr, "unknown option: --%s\n", key.c_str());
+            return false;
+        }
+    }
+    return cfg.threads > 0 && cfg.files > 1;
+}
+
+int main(int argc, char** argv) {
+    Ops3Config cfg;
+    if (!parse_args(argc, argv, cfg)) return 2;
+    ops = myfs3_operations();
+
+    // 全零镜像, 首次 init 时格式化
+    unlink(cfg.image.c_str());
+    FILE* f = std::fopen(cfg.image.c_str(), "w");
+    if (!f || truncate(cfg.image.c_str(), cfg.dev_size) != 0) {
+        std::perror(cfg.image.c_str());
+        return 1;
+    }
+    std::fclose(f);
+
+    if (!init_fs(cfg)) return 1;
+    run_concurrent(cfg);
+    run_tail(cfg);
+    verify(cfg);
+    ops->destroy(nullptr);
+
+    if (!init_fs(cfg)) return 1;
+    verify(cfg);
+    ops->destroy(nullptr);
+
+    if (failures) {
+        std::fprintf(stderr, "%d checks failed\n", failures.load());
+        return 1;
+    }
+    std::printf("myfs3 ops: %d threads x %d files ok\n", cfg.threads, cfg.files);
+    return 0;
+}
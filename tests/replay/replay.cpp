@@ -0,0 +1,345 @@
+/*
+ * myfs-replay: 在本地镜像上重放 --trace 记录的操作序列, 直接调用 FileSystem::fuse_*.
+ * 设备与 myfs_bench 相同 (默认经 ddriver_file.cpp 模拟的 ddriver), 无需 FUSE 挂载.
+ * 操作按 trace 中的顺序单线程执行: 尽快执行, 或按记录的时间间隔 (--timing=original) 执行.
+ * 写入的数据为固定图样; readdir 每次至多接收记录中返回的项数, 与当时内核缓冲区的分页一致.
+ * 结果以 JSON 输出: 吞吐、各操作的延迟分布 (与 trace 中记录的对照)、设备 IO 与结果不符的次数.
+ *
+ * 用法: myfs-replay --trace=FILE [--image=PATH] [--fresh] [--timing=fast|original] [--speed=X]
+ *                   [--strict] [--json=FILE] [--key=value ...]
+ */
+#include "utils.h"
+#include "latency.h"
+#include "trace.h"
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE    (1 << 0)
+#endif
+
+#define REPLAY_MAX_REPORT   10      // 结果不符的操作只打印前若干条
+
+/******************************************************************************
+* SECTION: 配置
+*******************************************************************************/
+struct ReplayConfig {
+    std::string trace;
+    std::string image = "/tmp/myfs_replay.img";
+    std::string backend = "ddriver";
+    long long dev_size = 4 << 20;          // 新建镜像大小
+    bool fresh = false;                    // 重新建立全零镜像, 挂载时格式化
+    bool original = false;                 // 按记录的时间间隔执行
+    double speed = 1.0;                    // --timing=original 时的加速倍数
+    bool strict = false;                   // 有结果不符时退出码为 1
+    std::string json_path;
+
+    int queue_depth = 0;
+    int pool_buffers = 0;
+    int block_size = 0;
+    int compress = 0;
+    int dedup = 0;
+    int cache_kb = 0;
+};
+
+static bool parse_args(int argc, char** argv, ReplayConfig& cfg) {
+    std::map<std::string, int*> int_opts = {
+        {"queue-depth", &cfg.queue_depth}, {"pool-buffers", &cfg.pool_buffers},
+        {"block-size", &cfg.block_size}, {"compress", &cfg.compress}, {"dedup", &cfg.dedup},
+        {"cache-kb", &cfg.cache_kb},
+    };
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--fresh") {
+            cfg.fresh = true;
+            continue;
+        }
+        if (arg == "--strict") {
+            cfg.strict = true;
+            continue;
+        }
+        if (arg.compare(0, 2, "--") != 0 || arg.find('=') == std::string::npos) {
+            std::fprintf(stderr, "unknown argument: %s\n", argv[i]);
+            return false;
+        }
+        std::string key = arg.substr(2, arg.find('=') - 2);
+        std::string val = arg.substr(arg.find('=') + 1);
+
+        if (key == "trace") cfg.trace = val;
+        else if (key == "image") cfg.image = val;
+        else if (key == "backend") cfg.backend = val;
+        else if (key == "dev-size") cfg.dev_size = std::stoll(val);
+        else if (key == "json") cfg.json_path = val;
+        else if (key == "speed") cfg.speed = std::stod(val);
+        else if (key == "timing" && (val == "fast" || val == "original")) cfg.original = val == "original";
+        else if (int_opts.count(key)) *int_opts[key] = std::stoi(val);
+        else {
+            std::fprintf(stderr, "unknown option: --%s\n", key.c_str());
+            return false;
+        }
+    }
+    if (cfg.trace.empty()) {
+        std::fprintf(stderr, "--trace=FILE is required\n");
+        return false;
+    }
+    if (cfg.speed <= 0) cfg.speed = 1.0;
+    return true;
+}
+
+static FileSystem& fs() {
+    return FileSystem::Instance();
+}
+
+static bool mount_image(const ReplayConfig& cfg) {
+    struct stat st;
+    if (cfg.fresh || stat(cfg.image.c_str(), &st) != 0) {
+        unlink(cfg.image.c_str());
+        FILE* f = std::fopen(cfg.image.c_str(), "w");
+        if (!f || truncate(cfg.image.c_str(), cfg.dev_size) != 0) {
+            std::perror(cfg.image.c_str());
+            if (f) std::fclose(f);
+            return false;
+        }
+        std::fclose(f);
+    }
+
+    CustomOptions opts = {};
+    opts.device = cfg.image.c_str();
+    opts.backend = cfg.backend.c_str();
+    opts.queue_depth = (unsigned)cfg.queue_depth;
+    opts.pool_buffers = (unsigned)cfg.pool_buffers;
+    opts.block_size = (unsigned)cfg.block_size;
+    opts.compress = cfg.compress;
+    opts.dedup = cfg.dedup;
+    opts.cache_kb = (unsigned)cfg.cache_kb;
+    if (fs().mount(opts) != 0) {
+        std::fprintf(stderr, "mount %s (%s) failed\n", cfg.image.c_str(), cfg.backend.c_str());
+        return false;
+    }
+    return true;
+}
+
+/******************************************************************************
+* SECTION: 重放
+*******************************************************************************/
+
+// 模拟当时的内核 readdir 缓冲区: 接收满记录中的项数后返回已满
+struct ReplayFill {
+    uint64_t room;
+    uint64_t taken = 0;
+};
+
+static int replay_fill(void* buf, const char* name, const struct stat* st, off_t off) {
+    ReplayFill* fill = (ReplayFill*)buf;
+    if (fill->taken == fill->room) return 1;
+    fill->taken++;
+    return 0;
+}
+
+// 执行一条记录, 返回与记录中 result 同义的结果; readdir 另以 *listed 返回接收的项数
+static int64_t replay_one(const TraceEvent& ev, std::vector<char>& buf, uint64_t* listed) {
+    const char* path = ev.path.c_str();
+    if ((ev.op == FuseOp::READ || ev.op == FuseOp::WRITE) && buf.size() < ev.size) buf.resize(ev.size, 'r');
+
+    switch (ev.op) {
+    case FuseOp::GETATTR: {
+        struct stat st;
+        return fs().fuse_getattr(path, &st);
+    }
+    case FuseOp::READDIR: {
+        ReplayFill fill;
+        fill.room = ev.size;
+        int ret = fs().fuse_readdir(path, &fill, replay_fill, (off_t)ev.offset, nullptr);
+        *listed = fill.taken;
+        return ret;
+    }
+    case FuseOp::MKDIR:
+        return fs().fuse_mkdir(path, (mode_t)ev.aux);
+    case FuseOp::MKNOD:
+        return fs().fuse_mknod(path, (mode_t)ev.aux, 0);
+    case FuseOp::WRITE:
+        return fs().fuse_write(path, buf.data(), ev.size, (off_t)ev.offset, nullptr);
+    case FuseOp::READ:
+        return fs().fuse_read(path, buf.data(), ev.size, (off_t)ev.offset, nullptr);
+    case FuseOp::UTIMENS:
+        return fs().fuse_utimens(path, nullptr);
+    case FuseOp::ACCESS:
+        return fs().fuse_access(path, (int)ev.aux);
+    case FuseOp::OPEN: {
+        struct fuse_file_info fi;
+        std::memset(&fi, 0, sizeof(fi));
+        return fs().fuse_open(path, &fi);
+    }
+    case FuseOp::OPENDIR: {
+        struct fuse_file_info fi;
+        std::memset(&fi, 0, sizeof(fi));
+        return fs().fuse_opendir(path, &fi);
+    }
+    case FuseOp::TRUNCATE:
+        return fs().fuse_truncate(path, (off_t)ev.offset);
+    case FuseOp::UNLINK:
+        return fs().fuse_unlink(path);
+    case FuseOp::RMDIR:
+        return fs().fuse_rmdir(path);
+    case FuseOp::RENAME: {
+        if (ev.aux & ~(uint64_t)RENAME_NOREPLACE) return -MYFS_ERROR_INVAL;
+        struct stat st;
+        if ((ev.aux & RENAME_NOREPLACE) && fs().fuse_getattr(ev.path2.c_str(), &st) == 0) return -MYFS_ERROR_EXISTS;
+        return fs().fuse_rename(path, ev.path2.c_str());
+    }
+    case FuseOp::FSYNC:
+        return fs().fuse_fsync(path, (int)ev.aux, nullptr);
+    case FuseOp::COPY_RANGE:
+        return fs().fuse_copy_file_range(path, (off_t)ev.offset, ev.path2.c_str(), (off_t)ev.aux, ev.size);
+    default:
+        return -MYFS_ERROR_INVAL;
+    }
+}
+
+static void sleep_until_ns(uint64_t deadline) {
+    uint64_t now = latency_now_ns();
+    if (deadline <= now) return;
+    struct timespec ts;
+    ts.tv_sec = (time_t)((deadline - now) / 1000000000ull);
+    ts.tv_nsec = (long)((deadline - now) % 1000000000ull);
+    nanosleep(&ts, nullptr);
+}
+
+struct OpResult {
+    LatencyHistogram replayed;
+    LatencyHistogram recorded;
+    uint64_t errors = 0;
+    uint64_t mismatches = 0;
+};
+
+struct ReplayReport {
+    OpResult ops[(int)FuseOp::OP_COUNT];
+    uint64_t total = 0;
+    uint64_t mismatches = 0;
+    double seconds = 0;
+    double trace_seconds = 0;              // trace 中首末两条记录的时间跨度
+    myfs_io_stats io = {};
+};
+
+static void replay(const ReplayConfig& cfg, TraceReader& reader, ReplayReport& rep) {
+    std::vector<char> buf;
+    TraceEvent ev;
+    uint64_t first_ns = 0;
+    uint64_t last_ns = 0;
+    myfs_io_stats io_start = fs().io_stats();
+    uint64_t start = latency_now_ns();
+
+    while (reader.next(ev)) {
+        if (rep.total == 0) first_ns = ev.start_ns;
+        last_ns = ev.start_ns;
+        if (cfg.original) sleep_until_ns(start + (uint64_t)((ev.start_ns - first_ns) / cfg.speed));
+
+        uint64_t listed = 0;
+        uint64_t t0 = latency_now_ns();
+        int64_t ret = replay_one(ev, buf, &listed);
+        uint64_t ns = latency_now_ns() - t0;
+
+        OpResult& r = rep.ops[(int)ev.op];
+        r.replayed.record(ns);
+        r.recorded.record(ev.dur_ns);
+        if (ret < 0) r.errors++;
+        bool same = ret == ev.result && (ev.op != FuseOp::READDIR || listed == ev.size);
+        if (!same) {
+            if (rep.mismatches < REPLAY_MAX_REPORT) {
+                std::fprintf(stderr, "#%llu %s %s%s%s: recorded %d",
+                             (unsigned long long)rep.total, fuse_op_name(ev.op), ev.path.c_str(),
+                             ev.path2.empty() ? "" : " -> ", ev.path2.c_str(), ev.result);
+                if (ev.op == FuseOp::READDIR) std::fprintf(stderr, " (%llu entries)", (unsigned long long)ev.size);
+                std::fprintf(stderr, ", replayed %lld", (long long)ret);
+                if (ev.op == FuseOp::READDIR) std::fprintf(stderr, " (%llu entries)", (unsigned long long)listed);
+                std::fprintf(stderr, "\n");
+            }
+            r.mismatches++;
+            rep.mismatches++;
+        }
+        rep.total++;
+    }
+
+    rep.seconds = (latency_now_ns() - start) / 1e9;
+    rep.trace_seconds = (last_ns - first_ns) / 1e9;
+    myfs_io_stats io = fs().io_stats();
+    rep.io.read_cnt = io.read_cnt - io_start.read_cnt;
+    rep.io.write_cnt = io.write_cnt - io_start.write_cnt;
+    rep.io.seek_cnt = io.seek_cnt - io_start.seek_cnt;
+}
+
+/******************************************************************************
+* SECTION: JSON 输出
+*******************************************************************************/
+static void write_json(FILE* out, const ReplayConfig& cfg, const ReplayReport& rep) {
+    std::fprintf(out, "{\n  \"config\": {\"trace\": \"%s\", \"backend\": \"%s\", \"timing\": \"%s\", \"speed\": %.2f},\n",
+                 cfg.trace.c_str(), cfg.backend.c_str(), cfg.original ? "original" : "fast", cfg.speed);
+    std::fprintf(out, "  \"ops\": %llu, \"seconds\": %.6f, \"trace_seconds\": %.6f, \"ops_per_sec\": %.1f, "
+                 "\"mismatches\": %llu,\n",
+                 (unsigned long long)rep.total, rep.seconds, rep.trace_seconds,
+                 rep.seconds > 0 ? rep.total / rep.seconds : 0.0, (unsigned long long)rep.mismatches);
+    std::fprintf(out, "  \"device\": {\"reads\": %llu, \"writes\": %llu, \"seeks\": %llu, "
+                 "\"reads_per_op\": %.2f, \"writes_per_op\": %.2f},\n",
+                 (unsigned long long)rep.io.read_cnt, (unsigned long long)rep.io.write_cnt,
+                 (unsigned long long)rep.io.seek_cnt,
+                 rep.total ? (double)rep.io.read_cnt / rep.total : 0.0,
+                 rep.total ? (double)rep.io.write_cnt / rep.total : 0.0);
+    std::fprintf(out, "  \"by_op\": [\n");
+    bool first = true;
+    for (int i = 0; i < (int)FuseOp::OP_COUNT; i++) {
+        const OpResult& r = rep.ops[i];
+        if (r.replayed.count() == 0) continue;
+        std::fprintf(out, "%s    {\"op\": \"%s\", \"count\": %llu, \"errors\": %llu, \"mismatches\": %llu, "
+                     "\"latency_us\": {\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f}, "
+                     "\"recorded_us\": {\"p50\": %.2f, \"p99\": %.2f}}",
+                     first ? "" : ",\n", fuse_op_name((FuseOp)i), (unsigned long long)r.replayed.count(),
+                     (unsigned long long)r.errors, (unsigned long long)r.mismatches,
+                     r.replayed.percentile(0.50) / 1e3, r.replayed.percentile(0.90) / 1e3,
+                     r.replayed.percentile(0.99) / 1e3, r.replayed.max() / 1e3,
+                     r.recorded.percentile(0.50) / 1e3, r.recorded.percentile(0.99) / 1e3);
+        first = false;
+    }
+    std::fprintf(out, "\n  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+    ReplayConfig cfg;
+    if (!parse_args(argc, argv, cfg)) return 2;
+
+    TraceReader reader;
+    std::string err;
+    if (!reader.open(cfg.trace.c_str(), &err)) {
+        std::fprintf(stderr, "%s\n", err.c_str());
+        return 2;
+    }
+    if (!mount_image(cfg)) return 1;
+
+    ReplayReport rep;
+    replay(cfg, reader, rep);
+    fs().umount();
+
+    FILE* out = stdout;
+    if (!cfg.json_path.empty()) {
+        out = std::fopen(cfg.json_path.c_str(), "w");
+        if (!out) {
+            std::perror(cfg.json_path.c_str());
+            return 1;
+        }
+    }
+    write_json(out, cfg, rep);
+    if (out != stdout) std::fclose(out);
+
+    if (cfg.strict && rep.mismatches) {
+        std::fprintf(stderr, "%llu of %llu ops differ from the trace\n",
+                     (unsigned long long)rep.mismatches, (unsigned long long)rep.total);
+        return 1;
+    }
+    return 0;
+}
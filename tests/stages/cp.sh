@@ -65,9 +65,12 @@ function check_copy () {
 
 
 try_mount_or_fail
+io_begin
 
 TEST_CASE="case 7.1 - prepare content of ${MNTPOINT}/file9"
 core_tester echo "$TEST_CASE" check_prepare "$TEST_CASE"
 
 TEST_CASE="case 7.2 - copy ${MNTPOINT}/file9 to ${MNTPOINT}/file10"
 core_tester echo "$TEST_CASE" check_copy "$TEST_CASE"
+
+io_check cp
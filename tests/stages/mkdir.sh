@@ -13,6 +13,7 @@ function check_mkdir () {
 }
 
 try_mount_or_fail
+io_begin
 
 TEST_CASE="case 2.1 - mkdir ${MNTPOINT}/dir0"
 core_tester mkdir "${MNTPOINT}"/dir0 check_mkdir "$TEST_CASE"
@@ -26,3 +27,4 @@ core_tester mkdir "${MNTPOINT}"/dir0/dir0/dir0 check_mkdir "$TEST_CASE"
 TEST_CASE="case 2.4 - mkdir ${MNTPOINT}/dir1"
 core_tester mkdir "${MNTPOINT}"/dir1 check_mkdir "$TEST_CASE"
 
+io_check mkdir
@@ -99,10 +99,12 @@ core_tester ls "${MNTPOINT}" check_umount "$TEST_CASE" 1
 sleep 1
 
 try_mount_or_fail
+io_begin
 
 
 TEST_CASE="case 5.2 - remount ${MNTPOINT}"
 core_tester ls "${MNTPOINT}"/dir0/dir1/dir2 check_ls_remount "$TEST_CASE" 3
+io_check remount
 
 clean_mount
 clean_ddriver
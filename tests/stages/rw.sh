@@ -33,10 +33,13 @@ function check_read () {
 
 
 try_mount_or_fail
+io_begin
 
 TEST_CASE="case 6.1 - write ${MNTPOINT}/file0"
 touch_and_check "${MNTPOINT}"/file0
 core_tester echo "$GOLDEN" check_write "$TEST_CASE"
 
 TEST_CASE="case 6.2 - read ${MNTPOINT}/file0"
-core_tester echo "$GOLDEN" check_read "$TEST_CASE"
\ No newline at end of file
+core_tester echo "$GOLDEN" check_read "$TEST_CASE"
+
+io_check rw
@@ -14,6 +14,7 @@ function check_touch () {
 }
 
 try_mount_or_fail
+io_begin
 
 TEST_CASE="case 3.1 - touch ${MNTPOINT}/file0"
 core_tester touch "${MNTPOINT}"/file0 check_touch "$TEST_CASE"
@@ -32,3 +33,4 @@ TEST_CASE="case 3.5 - touch ${MNTPOINT}/dir1/file3"
 mkdir_and_check "${MNTPOINT}"/dir1
 core_tester touch "${MNTPOINT}"/dir1/file3 check_touch "$TEST_CASE"
 
+io_check touch